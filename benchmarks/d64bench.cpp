@@ -0,0 +1,734 @@
+// Written by Paul Baxter
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <array>
+#include <memory>
+#include <memory_resource>
+#include <fstream>
+#include <filesystem>
+
+#include "d64.h"
+#include "d64_shared.h"
+#include "d64_loader.h"
+#include "d64_archive.h"
+
+namespace d64lib_bench
+{
+    static const std::vector<uint8_t>& programData(size_t size)
+    {
+        static std::vector<uint8_t> data;
+        if (data.size() != size) {
+            data.resize(size);
+            for (size_t i = 0; i < size; ++i) {
+                data[i] = static_cast<uint8_t>(i * 7 + 1);
+            }
+        }
+        return data;
+    }
+
+    // fill a disk with files of blocks sectors each until it is full
+    static d64 fullDisk(diskType type, int blocks)
+    {
+        d64 disk(type);
+        disk.setErrorLog(nullptr);
+        auto& prog = programData(blocks * 254);
+        for (auto file = 0; disk.getFreeSectorCount() > blocks + 1; ++file) {
+            disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, prog);
+        }
+        return disk;
+    }
+
+    // fixtures are built once and copied when a benchmark changes them
+    static const d64& emptyDisk()
+    {
+        static d64 disk;
+        return disk;
+    }
+
+    static const d64& full35Disk()
+    {
+        static d64 disk = fullDisk(diskType::thirty_five_track, 8);
+        return disk;
+    }
+
+    static const d64& full40Disk()
+    {
+        static d64 disk = fullDisk(diskType::forty_track, 8);
+        return disk;
+    }
+
+    // a full 1541 directory, 18 sectors of 8 entries
+    static const d64& dir144Disk()
+    {
+        static d64 disk = []
+            {
+                d64 disk;
+                disk.setErrorLog(nullptr);
+                auto& prog = programData(200);
+                for (auto file = 0; file < 144; ++file) {
+                    disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, prog);
+                }
+                return disk;
+            }();
+        return disk;
+    }
+
+    static const d64& fixture(int64_t id)
+    {
+        switch (id) {
+            case 0: return emptyDisk();
+            case 1: return full35Disk();
+            case 2: return full40Disk();
+            default: return dir144Disk();
+        }
+    }
+
+    static const char* fixtureName(int64_t id)
+    {
+        switch (id) {
+            case 0: return "empty";
+            case 1: return "full35";
+            case 2: return "full40";
+            default: return "dir144";
+        }
+    }
+
+    static void setImageRate(benchmark::State& state)
+    {
+        state.counters["images/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    }
+
+    static void BM_addFile_sequential(benchmark::State& state)
+    {
+        auto size = static_cast<size_t>(state.range(0));
+        auto& prog = programData(size);
+        for (auto _ : state) {
+            state.PauseTiming();
+            d64 disk(emptyDisk());
+            state.ResumeTiming();
+
+            benchmark::DoNotOptimize(disk.addFile("SEQFILE", d64FileTypes::SEQ, prog));
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_addFile_sequential)->Arg(254)->Arg(254 * 40)->Arg(254 * 600);
+
+    static void BM_addFile_rel(benchmark::State& state)
+    {
+        constexpr int RECORD_SIZE = 64;
+        auto size = static_cast<size_t>(state.range(0)) * RECORD_SIZE;
+        auto& rel = programData(size);
+        for (auto _ : state) {
+            state.PauseTiming();
+            d64 disk(emptyDisk());
+            state.ResumeTiming();
+
+            benchmark::DoNotOptimize(disk.addFile("RELFILE", d64FileTypes::REL, rel, RECORD_SIZE));
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_addFile_rel)->Arg(100)->Arg(1500);
+
+    static void BM_readFile(benchmark::State& state)
+    {
+        d64 disk(fixture(state.range(0)));
+        auto names = disk.directory();
+        int64_t bytes = 0;
+        for (auto _ : state) {
+            for (auto& entry : names) {
+                auto file = disk.readFile(d64::Trim(entry.fileName));
+                bytes += static_cast<int64_t>(file->size());
+                benchmark::DoNotOptimize(file);
+            }
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        state.SetBytesProcessed(bytes);
+        setImageRate(state);
+    }
+    BENCHMARK(BM_readFile)->Arg(1)->Arg(2)->Arg(3);
+
+    static void BM_readFileChain(benchmark::State& state)
+    {
+        d64 disk(fixture(state.range(0)));
+        auto names = disk.directory();
+        int64_t bytes = 0;
+        for (auto _ : state) {
+            for (auto& entry : names) {
+                for (auto sector : disk.fileChain(entry)) {
+                    bytes += static_cast<int64_t>(sector.size());
+                    benchmark::DoNotOptimize(sector.data());
+                }
+            }
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        state.SetBytesProcessed(bytes);
+        setImageRate(state);
+    }
+    BENCHMARK(BM_readFileChain)->Arg(1)->Arg(2)->Arg(3);
+
+    static void BM_readCorrupt(benchmark::State& state)
+    {
+        // a chain that links off the disk, exceptions against diskResult
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.addFile("BROKEN", d64FileTypes::PRG, programData(2000));
+        auto start = disk.fileChain("BROKEN").begin().location();
+        disk.writeByte(start.track, start.sector, 0, 99);
+        for (auto _ : state) {
+            if (state.range(0) == 0) {
+                try {
+                    benchmark::DoNotOptimize(disk.readFile("BROKEN"));
+                }
+                catch (const std::exception& e) {
+                    benchmark::DoNotOptimize(e.what());
+                }
+            }
+            else {
+                benchmark::DoNotOptimize(disk.tryReadFile("BROKEN"));
+            }
+        }
+        state.SetLabel(state.range(0) == 0 ? "throw" : "result");
+        setImageRate(state);
+    }
+    BENCHMARK(BM_readCorrupt)->Arg(0)->Arg(1);
+
+    static void BM_readRecord(benchmark::State& state)
+    {
+        // one record from the middle of a large REL file, whole file against side sectors
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.addFile("RELFILE", d64FileTypes::REL, programData(64 * 1000), 64);
+        for (auto _ : state) {
+            if (state.range(0) == 0) {
+                auto file = disk.readFile("RELFILE").value();
+                benchmark::DoNotOptimize(std::vector<uint8_t>(file.begin() + 500 * 64, file.begin() + 501 * 64));
+            }
+            else {
+                benchmark::DoNotOptimize(disk.readRecord("RELFILE", 500));
+            }
+        }
+        state.SetLabel(state.range(0) == 0 ? "readFile" : "readRecord");
+    }
+    BENCHMARK(BM_readRecord)->Arg(0)->Arg(1);
+
+    static void BM_imageFingerprint(benchmark::State& state)
+    {
+        // whole image digest, every sector hashed against only the written one
+        d64 disk(fixture(state.range(0)));
+        for (auto _ : state) {
+            if (state.range(1) == 0) {
+                state.PauseTiming();
+                d64 cold(disk);
+                state.ResumeTiming();
+                benchmark::DoNotOptimize(cold.imageFingerprint());
+            }
+            else {
+                disk.writeByte(18, 1, 100, 0);
+                benchmark::DoNotOptimize(disk.imageFingerprint());
+            }
+        }
+        state.SetLabel(std::string(fixtureName(state.range(0))) + (state.range(1) == 0 ? " cold" : " after write"));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_imageFingerprint)->Args({ 1, 0 })->Args({ 1, 1 })->Args({ 3, 0 })->Args({ 3, 1 });
+
+    static void BM_generateImage(benchmark::State& state)
+    {
+        // build a small image and read it back, the image on the heap, from an arena or in a reused buffer
+        auto& prog = programData(2000);
+        std::vector<uint8_t> arenaBytes(64 * D64_DISK35_SZ);
+        std::pmr::monotonic_buffer_resource arena(arenaBytes.data(), arenaBytes.size());
+        std::vector<uint8_t> buffer(D64_DISK35_SZ);
+        std::array<uint8_t, SECTOR_SIZE> sector = {};
+        auto count = 0;
+        for (auto _ : state) {
+            auto build = [&](d64& disk)
+                {
+                    disk.addFile("PROG", d64FileTypes::PRG, prog);
+                    disk.writeSector(1, 0, sector);
+                    disk.readSectorInto(DIRECTORY_TRACK, DIRECTORY_SECTOR, sector);
+                    benchmark::DoNotOptimize(sector);
+                };
+            switch (state.range(0)) {
+                case 0: {
+                    d64 disk;
+                    build(disk);
+                    break;
+                }
+                case 1: {
+                    if (++count % 64 == 0) arena.release();
+                    d64 disk(diskType::thirty_five_track, &arena);
+                    build(disk);
+                    break;
+                }
+                default: {
+                    d64 disk{ std::span<uint8_t>(buffer) };
+                    disk.formatDisk("NEW DISK");
+                    build(disk);
+                    break;
+                }
+            }
+        }
+        static const char* labels[] = { "heap", "arena", "caller buffer" };
+        state.SetLabel(labels[state.range(0)]);
+        setImageRate(state);
+    }
+    BENCHMARK(BM_generateImage)->Arg(0)->Arg(1)->Arg(2);
+
+    static void BM_findFile(benchmark::State& state)
+    {
+        d64 disk(fixture(state.range(0)));
+        std::vector<std::string> names;
+        for (auto& entry : disk.directory()) {
+            names.push_back(d64::Trim(entry.fileName));
+        }
+        for (auto _ : state) {
+            for (auto& name : names) {
+                benchmark::DoNotOptimize(disk.findFile(name));
+            }
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * names.size()));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_findFile)->Arg(1)->Arg(3);
+
+    static void BM_directory(benchmark::State& state)
+    {
+        d64 disk(fixture(state.range(0)));
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(disk.directory());
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_directory)->Arg(0)->Arg(1)->Arg(3);
+
+    static void BM_directoryView(benchmark::State& state)
+    {
+        d64 disk(fixture(state.range(0)));
+        for (auto _ : state) {
+            auto view = disk.entries();
+            benchmark::DoNotOptimize(std::distance(view.begin(), view.end()));
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_directoryView)->Arg(0)->Arg(1)->Arg(3);
+
+    static void BM_reorderOrdered(benchmark::State& state)
+    {
+        // the order check is all the work when nothing moves
+        d64 disk(fixture(state.range(0)));
+        auto files = disk.directory();
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(disk.reorderDirectory(files));
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_reorderOrdered)->Arg(1)->Arg(3);
+
+    static void BM_reorderByName(benchmark::State& state)
+    {
+        // flip between the name order and its reverse so every pass moves every entry
+        d64 disk(dir144Disk());
+        std::vector<std::string> forward;
+        for (auto& entry : disk.entries()) {
+            forward.push_back(d64::Trim(entry.fileName));
+        }
+        std::vector<std::string> backward(forward.rbegin(), forward.rend());
+        auto flip = false;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(disk.reorderDirectory(flip ? forward : backward));
+            flip = !flip;
+        }
+        setImageRate(state);
+    }
+    BENCHMARK(BM_reorderByName);
+
+    static void BM_movefileFirst(benchmark::State& state)
+    {
+        d64 disk(dir144Disk());
+        auto flip = false;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(disk.movefileFirst(flip ? "FILE0" : "FILE143"));
+            flip = !flip;
+        }
+        setImageRate(state);
+    }
+    BENCHMARK(BM_movefileFirst);
+
+    static void BM_compactDirectory(benchmark::State& state)
+    {
+        // remove every other file so there is something to compact
+        d64 holes(dir144Disk());
+        holes.setErrorLog(nullptr);
+        for (auto file = 0; file < 144; file += 2) {
+            holes.removeFile("FILE" + std::to_string(file));
+        }
+
+        for (auto _ : state) {
+            state.PauseTiming();
+            d64 disk(holes);
+            state.ResumeTiming();
+
+            benchmark::DoNotOptimize(disk.compactDirectory());
+        }
+        setImageRate(state);
+    }
+    BENCHMARK(BM_compactDirectory);
+
+    static void BM_verifyBAMIntegrity(benchmark::State& state)
+    {
+        d64 disk(fixture(state.range(0)));
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(disk.verifyBAMIntegrity(false, ""));
+        }
+        state.SetLabel(fixtureName(state.range(0)));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_verifyBAMIntegrity)->Arg(0)->Arg(1)->Arg(2)->Arg(3);
+
+    static void BM_verifyReport(benchmark::State& state)
+    {
+        // structured verify walked by one or more threads
+        d64 disk(fixture(state.range(0)));
+        auto threads = static_cast<unsigned>(state.range(1));
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(disk.verify(threads));
+        }
+        state.SetLabel(std::string(fixtureName(state.range(0))) + " threads " + std::to_string(threads));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_verifyReport)->Args({ 1, 1 })->Args({ 1, 4 })->Args({ 3, 1 })->Args({ 3, 4 });
+
+    static void BM_relayout(benchmark::State& state)
+    {
+        // relayout a disk fragmented by removing every other file and adding bigger ones
+        d64 fragmented(fixture(1));
+        for (auto file = 0; file < 40; file += 2) {
+            fragmented.removeFile("FILE" + std::to_string(file));
+        }
+        for (auto file = 0; file < 8; ++file) {
+            fragmented.addFile("BIG" + std::to_string(file), d64FileTypes::PRG, programData(4000));
+        }
+        relayoutReport report;
+        for (auto _ : state) {
+            state.PauseTiming();
+            d64 disk(fragmented);
+            state.ResumeTiming();
+            report = disk.relayout(static_cast<int>(state.range(0)));
+        }
+        state.counters["load_s_before"] = report.loadMsBefore / 1000;
+        state.counters["load_s_after"] = report.loadMsAfter / 1000;
+        state.SetLabel("interleave " + std::to_string(state.range(0)));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_relayout)->Arg(10)->Arg(5);
+
+    static void BM_loaderPolicy(benchmark::State& state)
+    {
+        // add a file laid out for a loader and simulate loading it, against the stock interleave
+        static const std::array<std::pair<const char*, loadModel>, 3> loaders = { {
+            { "kernal", loadModel::kernal() }, { "jiffydos", loadModel::jiffyDos() }, { "fastloader", loadModel::fastloader() }
+        } };
+        auto& [name, model] = loaders[state.range(0)];
+        auto& prog = programData(254 * 60);
+        allocationPolicy policy{ d64::fastestInterleave(model) };
+        loadEstimate tuned, stock;
+        for (auto _ : state) {
+            d64 disk;
+            disk.addFile("TUNED", d64FileTypes::PRG, prog, policy);
+            tuned = disk.profileLoad(*disk.findFile("TUNED").value(), model);
+        }
+        d64 disk;
+        disk.addFile("STOCK", d64FileTypes::PRG, prog);
+        stock = disk.profileLoad(*disk.findFile("STOCK").value(), model);
+        state.counters["load_s_tuned"] = tuned.totalMs / 1000;
+        state.counters["load_s_stock"] = stock.totalMs / 1000;
+        state.SetLabel(std::string(name) + " interleave " + std::to_string(policy.interleave));
+    }
+    BENCHMARK(BM_loaderPolicy)->DenseRange(0, 2);
+
+    static void BM_fillStrategy(benchmark::State& state)
+    {
+        // fill a 40 track disk with mostly small and some large files, remove a third and fill again
+        auto strategy = static_cast<allocationStrategy>(state.range(0));
+        static const char* names[] = { "near directory", "first fit", "best fit", "banded", "extended first" };
+        size_t trackChanges = 0;
+        for (auto _ : state) {
+            d64 disk(diskType::forty_track);
+            disk.setErrorLog(nullptr);
+            disk.setAllocationPolicy(allocationPolicy{ 10, strategy });
+            uint32_t seed = 5;
+            auto random = [&] { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+            auto files = 0;
+            for (auto round = 0; round < 4; ++round) {
+                while (true) {
+                    auto blocks = random() % 4 == 0 ? 20 + random() % 60 : 1 + random() % 8;
+                    if (disk.getFreeSectorCount() < blocks + 1) break;
+                    disk.addFile("F" + std::to_string(files++), d64FileTypes::PRG, programData(blocks * 254));
+                }
+                for (auto file = static_cast<int>(random() % 3); file < files; file += 3) {
+                    disk.removeFile("F" + std::to_string(file));
+                }
+            }
+            state.PauseTiming();
+            trackChanges = 0;
+            for (auto& entry : disk.entries()) {
+                trackChanges += disk.profileLoad(entry).trackChanges;
+            }
+            state.ResumeTiming();
+        }
+        state.counters["track_changes"] = static_cast<double>(trackChanges);
+        state.SetLabel(names[state.range(0)]);
+    }
+    BENCHMARK(BM_fillStrategy)->DenseRange(0, 4);
+
+    static void BM_sharedReadFile(benchmark::State& state)
+    {
+        // many threads reading files of one image through the reader lock, no copy per thread
+        static std::unique_ptr<sharedDisk> shared;
+        if (state.thread_index() == 0) {
+            shared = std::make_unique<sharedDisk>(d64(fixture(1)));
+        }
+        auto file = state.thread_index();
+        size_t bytes = 0;
+        for (auto _ : state) {
+            auto data = shared->readFile("FILE" + std::to_string(file));
+            bytes += data->size();
+            file = (file + 1) % 40;
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(bytes));
+        if (state.thread_index() == 0) {
+            shared.reset();
+        }
+    }
+    BENCHMARK(BM_sharedReadFile)->Threads(1)->Threads(4)->Threads(8)->UseRealTime();
+
+    static void BM_verifyAfterChange(benchmark::State& state)
+    {
+        // verify after every mutation, full scan against incremental
+        d64 disk(fixture(1));
+        auto& prog = programData(1000);
+        disk.removeFile("FILE1");
+        disk.verifyBAMIntegrity(false, "");
+        for (auto _ : state) {
+            disk.addFile("VARIANT", d64FileTypes::PRG, prog);
+            benchmark::DoNotOptimize(state.range(0) == 0 ? disk.verifyBAMIntegrity(false, "") : disk.verifyBAMIncremental(false, ""));
+            disk.removeFile("VARIANT");
+            benchmark::DoNotOptimize(state.range(0) == 0 ? disk.verifyBAMIntegrity(false, "") : disk.verifyBAMIncremental(false, ""));
+        }
+        state.SetLabel(state.range(0) == 0 ? "full" : "incremental");
+        setImageRate(state);
+    }
+    BENCHMARK(BM_verifyAfterChange)->Arg(0)->Arg(1);
+
+    static void BM_loadSave(benchmark::State& state)
+    {
+        auto name = std::string("d64bench_") + fixtureName(state.range(0)) + ".d64";
+        d64 disk(fixture(state.range(0)));
+        int64_t bytes = 0;
+        for (auto _ : state) {
+            disk.save(name);
+            if (!disk.load(name)) {
+                state.SkipWithError("load failed");
+                break;
+            }
+            bytes += 2 * static_cast<int64_t>(disk.TRACKS == TRACKS_35 ? D64_DISK35_SZ : D64_DISK40_SZ);
+        }
+        std::remove(name.c_str());
+        state.SetLabel(fixtureName(state.range(0)));
+        state.SetBytesProcessed(bytes);
+        setImageRate(state);
+    }
+    BENCHMARK(BM_loadSave)->Arg(0)->Arg(1)->Arg(2);
+
+    static void BM_saveAfterEdit(benchmark::State& state)
+    {
+        // rename one file then save, whole image against changed sectors
+        auto name = std::string("d64bench_edit.d64");
+        d64 disk(fixture(1));
+        disk.save(name);
+        auto flip = false;
+        for (auto _ : state) {
+            disk.renameFile(flip ? "EDITED" : "FILE0", flip ? "FILE0" : "EDITED");
+            flip = !flip;
+            auto mode = state.range(0) < 2 ? saveMode::save_in_place : saveMode::save_journaled;
+            benchmark::DoNotOptimize(state.range(0) % 2 == 0 ? disk.save(name, mode) : disk.saveIncremental(name, mode));
+        }
+        std::remove(name.c_str());
+        static const char* labels[] = { "full", "incremental", "journaled full", "journaled incremental" };
+        state.SetLabel(labels[state.range(0)]);
+        setImageRate(state);
+    }
+    BENCHMARK(BM_saveAfterEdit)->Arg(0)->Arg(1)->Arg(2)->Arg(3);
+
+    static void BM_loadMapped(benchmark::State& state)
+    {
+        auto name = std::string("d64bench_mapped_") + fixtureName(state.range(0)) + ".d64";
+        d64(fixture(state.range(0))).save(name);
+        int64_t bytes = 0;
+        for (auto _ : state) {
+            d64 disk(name, mapMode::map_read_only);
+            benchmark::DoNotOptimize(disk.diskname());
+            bytes += static_cast<int64_t>(disk.TRACKS == TRACKS_35 ? D64_DISK35_SZ : D64_DISK40_SZ);
+        }
+        std::remove(name.c_str());
+        state.SetLabel(fixtureName(state.range(0)));
+        state.SetBytesProcessed(bytes);
+        setImageRate(state);
+    }
+    BENCHMARK(BM_loadMapped)->Arg(0)->Arg(1)->Arg(2);
+
+    static void BM_loadImages(benchmark::State& state)
+    {
+        // load a collection of images one at a time against the loader with its reads in flight together
+        static const char* names[] = { "sequential", "io_uring", "thread pool" };
+        std::vector<std::string> paths;
+        for (auto image = 0; image < 64; ++image) {
+            paths.push_back("d64bench_collection_" + std::to_string(image) + ".d64");
+            d64(fixture(1 + image % 2)).save(paths.back());
+        }
+        auto backend = state.range(0) == 1 ? loadBackend::load_io_uring : loadBackend::load_thread_pool;
+        d64loader loader(16, backend);
+        if (state.range(0) == 1 && loader.backend() != loadBackend::load_io_uring) {
+            state.SkipWithError("io_uring not available");
+        }
+        for (auto _ : state) {
+            size_t loaded = 0;
+            if (state.range(0) == 0) {
+                for (auto& path : paths) {
+                    d64 disk;
+                    loaded += disk.load(path);
+                }
+            }
+            else {
+                loader.load(paths, [&](loadedImage& image) { loaded += image.ok(); });
+            }
+            if (loaded != paths.size()) {
+                state.SkipWithError("load failed");
+                break;
+            }
+        }
+        for (auto& path : paths) {
+            std::remove(path.c_str());
+        }
+        state.SetLabel(names[state.range(0)]);
+        state.counters["images/s"] = benchmark::Counter(static_cast<double>(state.iterations() * paths.size()), benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(BM_loadImages)->DenseRange(0, 2)->UseRealTime();
+
+    static void BM_archiveOpen(benchmark::State& state)
+    {
+        // open every image of a collection and list it, one file per image against one archive
+        static const char* names[] = { "files", "concatenated", "deduplicated" };
+        std::vector<std::string> paths;
+        for (auto image = 0; image < 64; ++image) {
+            d64 disk(fixture(1));
+            disk.rename_disk("IMAGE" + std::to_string(image));
+            paths.push_back("d64bench_collection_" + std::to_string(image) + ".d64");
+            disk.save(paths.back());
+        }
+        auto archiveName = std::string("d64bench_collection.d64a");
+        if (state.range(0) > 0) {
+            d64archiveWriter writer(archiveName, state.range(0) == 1 ? archiveLayout::archive_concatenated : archiveLayout::archive_deduplicated);
+            for (auto& path : paths) {
+                std::ifstream in(path, std::ios::binary);
+                writer.add(path, in);
+            }
+            writer.finish();
+        }
+        for (auto _ : state) {
+            size_t entries = 0;
+            if (state.range(0) == 0) {
+                for (auto& path : paths) {
+                    d64 disk(path, mapMode::map_read_only);
+                    entries += disk.directory().size();
+                }
+            }
+            else {
+                d64archive archive(archiveName);
+                for (auto& path : paths) {
+                    entries += archive.open(path)->directory().size();
+                }
+            }
+            benchmark::DoNotOptimize(entries);
+        }
+        std::error_code ec;
+        state.counters["bytes_on_disk"] = static_cast<double>(state.range(0) == 0 ? paths.size() * D64_DISK35_SZ : std::filesystem::file_size(archiveName, ec));
+        for (auto& path : paths) {
+            std::remove(path.c_str());
+        }
+        std::remove(archiveName.c_str());
+        state.SetLabel(names[state.range(0)]);
+        state.counters["images/s"] = benchmark::Counter(static_cast<double>(state.iterations() * paths.size()), benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(BM_archiveOpen)->DenseRange(0, 2);
+
+    static void BM_extractAll(benchmark::State& state)
+    {
+        // every file of a disk with a full directory, extractFile one name at a time against extractAll writing or finding it all up to date
+        static const char* names[] = { "extractFile", "extractAll", "up to date" };
+        auto& disk = fixture(3);
+        auto dir = std::filesystem::path("d64bench_extract");
+        std::filesystem::create_directories(dir);
+        // extractFile writes to the working directory under the name it looks up
+        std::vector<std::string> files;
+        for (auto& entry : disk.entries()) {
+            files.push_back(d64::Trim(entry.fileName));
+        }
+        extractOptions options;
+        options.skipUpToDate = state.range(0) == 2;
+        disk.extractAll(dir.string(), options);
+        for (auto _ : state) {
+            if (state.range(0) == 0) {
+                for (auto& file : files) {
+                    benchmark::DoNotOptimize(disk.extractFile(file));
+                }
+            }
+            else {
+                benchmark::DoNotOptimize(disk.extractAll(dir.string(), options));
+            }
+        }
+        std::filesystem::remove_all(dir);
+        if (state.range(0) == 0) {
+            for (auto& file : files) {
+                std::remove((file + ".prg").c_str());
+            }
+        }
+        state.SetLabel(names[state.range(0)]);
+        state.counters["files/s"] = benchmark::Counter(static_cast<double>(state.iterations() * files.size()), benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(BM_extractAll)->DenseRange(0, 2);
+
+    static void BM_clone(benchmark::State& state)
+    {
+        // a copy against a copy on write fork that adds one program
+        d64 disk(fixture(state.range(0)));
+        disk.removeFile("FILE1");
+        auto& prog = programData(1000);
+        for (auto _ : state) {
+            if (state.range(1) == 0) {
+                d64 variant(disk);
+                variant.addFile("VARIANT", d64FileTypes::PRG, prog);
+                benchmark::DoNotOptimize(variant.getFreeSectorCount());
+            }
+            else {
+                auto variant = disk.clone();
+                variant.addFile("VARIANT", d64FileTypes::PRG, prog);
+                benchmark::DoNotOptimize(variant.getFreeSectorCount());
+            }
+        }
+        state.SetLabel(std::string(fixtureName(state.range(0))) + (state.range(1) == 0 ? "/copy" : "/clone"));
+        setImageRate(state);
+    }
+    BENCHMARK(BM_clone)->Args({ 1, 0 })->Args({ 1, 1 })->Args({ 3, 0 })->Args({ 3, 1 });
+}
+
+BENCHMARK_MAIN();
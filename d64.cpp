@@ -8,10 +8,17 @@
 #include <iomanip>
 #include <optional>
 #include <algorithm>
+#include <numeric>
 #include <stdexcept>
 #include <map>
 #include <sstream>
 #include <bitset>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <unordered_set>
+#include <unordered_map>
+#include <cmath>
 
 #include "d64.h"
 
@@ -36,6 +43,18 @@ d64::d64(diskType type)
     init_disk();
 }
 
+/// <summary>
+/// constructor with disktype and memory resource
+/// the image is allocated from resource, which must outlive the disk
+/// </summary>
+/// <param name="type">disktype</param>
+/// <param name="resource">where the image bytes come from, such as an arena</param>
+d64::d64(diskType type, std::pmr::memory_resource* resource)
+{
+    disktype = type;
+    init_disk(resource);
+}
+
 /// <summary>
 /// constructor with a file name
 /// load the disk from an existing d64 file
@@ -50,35 +69,259 @@ d64::d64(std::string name)
 }
 
 /// <summary>
-/// Initialize 35 or 40 track
+/// constructor with a file name and map mode
+/// map the disk from an existing d64 file without copying it
 /// </summary>
-void d64::init_disk()
+/// <param name="name">name of file to map</param>
+/// <param name="mode">how to map the file</param>
+/// <param name="log">where diagnostics go, nullptr discards them</param>
+d64::d64(std::string name, mapMode mode, std::ostream* log) : errorStream(log)
 {
-    int sz = 0;
-    switch (disktype) {
-        case diskType::thirty_five_track:
-            TRACKS = TRACKS_35;
-            sz = D64_DISK35_SZ;
-            break;
-        case diskType::forty_track:
-            TRACKS = TRACKS_40;
-            sz = D64_DISK40_SZ;
-            break;
-        default:
-            throw std::runtime_error("Invalid Disk type");
+    // map the disk
+    if (!load(name, mode)) {
+        throw std::invalid_argument("Unable to map disk");
+    }
+}
+
+/// <summary>
+/// constructor with an already filled image
+/// the disk type is taken from the size of the image
+/// </summary>
+/// <param name="image">storage holding the image</param>
+d64::d64(std::unique_ptr<diskStorage> image)
+{
+    attachStorage(std::move(image));
+}
+
+/// <summary>
+/// constructor over a buffer owned by the caller
+/// the bytes are used as the image as they are, formatDisk blanks them
+/// the buffer must outlive the disk
+/// </summary>
+/// <param name="image">D64_DISK35_SZ or D64_DISK40_SZ bytes</param>
+d64::d64(std::span<uint8_t> image)
+{
+    attachStorage(std::make_unique<spanStorage>(image));
+}
+
+/// <summary>
+/// copy constructor
+/// the copy always owns its own heap image
+/// </summary>
+/// <param name="other">disk to copy</param>
+d64::d64(const d64& other)
+{
+    attachStorage(other.storage->clone());
+    copyState(other);
+}
+
+/// <summary>
+/// copy assignment
+/// </summary>
+/// <param name="other">disk to copy</param>
+/// <returns>this disk</returns>
+d64& d64::operator=(const d64& other)
+{
+    if (this != &other) {
+        attachStorage(other.storage->clone());
+        copyState(other);
     }
-    data.resize(sz, 0x01);
+    return *this;
+}
+
+/// <summary>
+/// copy what a disk knows about its image to a disk with the same image
+/// </summary>
+/// <param name="other">disk to copy from</param>
+void d64::copyState(const d64& other)
+{
+    lastSectorUsed = other.lastSectorUsed;
+    allocation = other.allocation;
+    errorStream = other.errorStream;
+    errorInfo = other.errorInfo;
+    traceCallback = other.traceCallback;
+    verifyState = other.verifyState;
+    dirtySectors = other.dirtySectors;
+    dirtyBamTracks = other.dirtyBamTracks;
+    unsavedBits = other.unsavedBits;
+    dataHashes = other.dataHashes;
+    hashedSectors = other.hashedSectors;
+}
+
+/// <summary>
+/// move assignment
+/// the image buffer does not move so the BAM pointers stay valid
+/// </summary>
+/// <param name="other">disk to move</param>
+/// <returns>this disk</returns>
+d64& d64::operator=(d64&& other) noexcept
+{
+    if (this != &other) {
+        TRACKS = other.TRACKS;
+        lastSectorUsed = other.lastSectorUsed;
+        allocation = other.allocation;
+        diskBamPtr = other.diskBamPtr;
+        bamTrackPtr = other.bamTrackPtr;
+        bamExtraTrackPtr = other.bamExtraTrackPtr;
+        disktype = other.disktype;
+        storage = std::move(other.storage);
+        imageBytes = other.imageBytes;
+        nameIndex = std::move(other.nameIndex);
+        nameIndexValid = other.nameIndexValid;
+        nameIndexDuplicates = other.nameIndexDuplicates;
+        freeMap = other.freeMap;
+        freeTracks = other.freeTracks;
+        freeMapValid = other.freeMapValid;
+        errorStream = other.errorStream;
+        errorInfo = std::move(other.errorInfo);
+        stats = other.stats;
+        traceCallback = std::move(other.traceCallback);
+        verifyState = std::move(other.verifyState);
+        dirtySectors = other.dirtySectors;
+        dirtyBamTracks = other.dirtyBamTracks;
+        unsavedBits = other.unsavedBits;
+        dataHashes = other.dataHashes;
+        hashedSectors = other.hashedSectors;
+    }
+    return *this;
+}
+
+/// <summary>
+/// Initialize 35 or 40 track
+/// </summary>
+/// <param name="resource">where the image bytes come from</param>
+void d64::init_disk(std::pmr::memory_resource* resource)
+{
+    auto& format = diskFormat::of(disktype);
+    TRACKS = format.tracks;
+    storage = std::make_unique<vectorStorage>(format.imageSize, resource);
+    imageBytes = storage->data();
     std::fill_n(lastSectorUsed.begin(), TRACKS_40, 1);
     formatDisk("NEW DISK");
 }
 
+/// <summary>
+/// Use an already filled image as the disk
+/// the disk type is taken from the size of the image
+/// </summary>
+/// <param name="image">storage holding the image</param>
+void d64::attachStorage(std::unique_ptr<diskStorage> image)
+{
+    auto hasErrors = false;
+    auto& format = openedFormat(image->size(), &hasErrors);
+
+    // error bytes after the image go to their own table so every sector stays where the geometry puts it
+    std::vector<uint8_t> codes;
+    if (hasErrors) {
+        if (image->data() == nullptr) {
+            throw std::invalid_argument("Invalid disk size");
+        }
+        codes.assign(image->data() + format.imageSize, image->data() + format.fileSize(true));
+        if (!image->truncate(format.imageSize)) {
+            throw std::invalid_argument("Invalid disk size");
+        }
+    }
+    disktype = format.type.value();
+    TRACKS = format.tracks;
+    errorInfo = std::move(codes);
+    storage = std::move(image);
+    imageBytes = storage->data();
+    std::fill_n(lastSectorUsed.begin(), TRACKS_40, 1);
+    invalidateNameIndex();
+    freeMapValid = false;
+    verifyState.valid = false;
+    unsavedBits.fill(0);
+    hashedSectors.fill(0);
+    initBAMPtr();
+}
+
+/// <summary>
+/// format of an image file that d64 can open
+/// </summary>
+/// <param name="size">bytes in the file</param>
+/// <param name="errorInfo">out true if the image is followed by error bytes, may be nullptr</param>
+/// <returns>the format, throws std::invalid_argument if the size is not one d64 opens</returns>
+const diskFormat& d64::openedFormat(size_t size, bool* errorInfo)
+{
+    auto format = diskFormat::fromFileSize(size, errorInfo);
+    if (format == nullptr) {
+        throw std::invalid_argument("Invalid disk size");
+    }
+    if (!format->type.has_value()) {
+        throw std::invalid_argument("Error: Unsupported format, " + std::string(format->name) + " images are not supported");
+    }
+    return *format;
+}
+
+/// <summary>
+/// Clone the disk
+/// the clone shares every sector with this disk and a sector is only copied
+/// the first time either disk changes it, so cloning costs O(changed sectors)
+/// pointers from findFile and the sector accessors are invalid after a clone
+/// </summary>
+/// <returns>writable disk with the same contents</returns>
+d64 d64::clone()
+{
+    auto paged = dynamic_cast<pagedStorage*>(storage.get());
+    if (paged == nullptr) {
+        if (dynamic_cast<mappedStorage*>(storage.get()) != nullptr) {
+            // the mapped file can change under the clone, it shares a heap copy instead
+            d64 copy(std::make_unique<pagedStorage>(std::shared_ptr<const diskStorage>(storage->clone()), true));
+            copy.copyState(*this);
+            return copy;
+        }
+
+        // the current image becomes the base shared by this disk and its clones
+        auto canWrite = storage->writable();
+        std::shared_ptr<const diskStorage> base(std::move(storage));
+        storage = std::make_unique<pagedStorage>(std::move(base), canWrite);
+        paged = static_cast<pagedStorage*>(storage.get());
+        imageBytes = nullptr;
+    }
+
+    d64 copy(paged->fork());
+    copy.copyState(*this);
+
+    // the BAM pointers of both disks must point at their own copy of the BAM sector
+    initBAMPtr();
+    return copy;
+}
+
+/// <summary>
+/// Get the stream diagnostics are written to
+/// </summary>
+/// <returns>error log stream</returns>
+std::ostream& d64::errorLog() const
+{
+    if (errorStream != nullptr) {
+        return *errorStream;
+    }
+
+    // a stream without a buffer discards everything
+    // one per thread so disks on different threads never share its state
+    thread_local std::ostream discard(nullptr);
+    return discard;
+}
+
+/// <summary>
+/// Throw if the image can not be modified
+/// </summary>
+void d64::checkWritable() const
+{
+    if (!storage->writable()) {
+        throw std::runtime_error("Error: Disk image is read only");
+    }
+}
+
 // NOTE: track starts at 1. returns offset int datafor track and sector
 int d64::calcOffset(int track, int sector) const
 {
-    if (!isValidTrackSector(track, sector)) {
+    D64_COUNT(calcOffsetCalls, 1);
+    auto index = linkIndex(track, sector);
+    if (index < 0) {
         throw std::runtime_error("Invalid Track and Sector TRACK:" + std::to_string(track) + " SECTOR:" + std::to_string(sector));
     }
-    return TRACK_OFFSETS[track - 1] + sector * SECTOR_SIZE;
+    return index * SECTOR_SIZE;
 }
 
 /// <summary>
@@ -99,18 +342,16 @@ void d64::initBAM(std::string_view name)
     for (auto t = 0; t < TRACKS; ++t) {
         auto bam = bamtrack(t);
         bam->free = SECTORS_PER_TRACK[t];
-        bam->clear();
-        for (auto b = 0; b < SECTORS_PER_TRACK[t]; b++) {
-            bam->set(b);
-        }
+        bam->setMask((1u << SECTORS_PER_TRACK[t]) - 1);
     }
+    rebuildFreeMap();
 
     // Initialize the directory structure
-    auto index = calcOffset(DIRECTORY_TRACK, DIRECTORY_SECTOR);
-    std::fill_n(data.begin() + index, SECTOR_SIZE, 0);
+    auto dir = sectorForWrite(sectorIndex(DIRECTORY_TRACK, DIRECTORY_SECTOR));
+    std::fill_n(dir, SECTOR_SIZE, 0);
 
     // mark as the last directory sector
-    data[index + 1] = 0xFF;
+    dir[1] = 0xFF;
 
     // allocate the BAM sector
     allocateSector(DIRECTORY_TRACK, BAM_SECTOR);
@@ -123,8 +364,10 @@ void d64::initBAM(std::string_view name)
 /// Rename the disk
 /// </summary>
 /// <param name="name">new name for disk</param>
-bool d64::rename_disk(std::string_view name) const
+bool d64::rename_disk(std::string_view name)
 {
+    checkWritable();
+    markWritten(sectorIndex(DIRECTORY_TRACK, BAM_SECTOR));
     auto len = std::min(name.size(), static_cast<size_t>(DISK_NAME_SZ));
     std::copy_n(name.begin(), len, diskBamPtr->diskName);
     std::fill(diskBamPtr->diskName + len, diskBamPtr->diskName + DISK_NAME_SZ, static_cast<char>(A0_VALUE));
@@ -137,8 +380,15 @@ bool d64::rename_disk(std::string_view name) const
 /// <param name="name">new name for disk</param>
 void d64::formatDisk(std::string_view name)
 {
+    checkWritable();
+    invalidateNameIndex();
+    verifyState.valid = false;
+
     // format with 1's
-    std::fill(data.begin(), data.end(), 0x01);
+    auto sectors = static_cast<int>(storage->size() / SECTOR_SIZE);
+    for (auto i = 0; i < sectors; ++i) {
+        std::fill_n(sectorForWrite(i), SECTOR_SIZE, 0x01);
+    }
 
     // intialize BAM
     initBAM(name);
@@ -151,7 +401,7 @@ void d64::formatDisk(std::string_view name)
 /// <param name="sector">sector number</param>
 /// <param name="bytes">arrray of SECTOR_SIZE bytes</param>
 /// <returns>true on success</returns>
-bool d64::writeSector(int track, int sector, std::vector<uint8_t> bytes)
+bool d64::writeSector(int track, int sector, std::span<const uint8_t> bytes)
 {
     try {
         if (!isValidTrackSector(track, sector) || bytes.size() != SECTOR_SIZE) {
@@ -160,7 +410,7 @@ bool d64::writeSector(int track, int sector, std::vector<uint8_t> bytes)
         return writeData(track, sector, bytes, 0);
     }
     catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        errorLog() << "Error: " << e.what() << std::endl;
         throw; // Rethrow the exception
     }
     return false;
@@ -177,7 +427,7 @@ bool d64::writeSector(int track, int sector, std::vector<uint8_t> bytes)
 bool d64::writeByte(int track, int sector, int byteoffset, uint8_t value)
 {
     if (!isValidTrackSector(track, sector) || byteoffset < 0 || byteoffset >= SECTOR_SIZE) return false;
-    return writeData(track, sector, { value }, byteoffset);
+    return writeData(track, sector, std::span<const uint8_t>(&value, 1), byteoffset);
 }
 
 /// <summary>
@@ -187,14 +437,10 @@ bool d64::writeByte(int track, int sector, int byteoffset, uint8_t value)
 /// <param name="sector">sector number</param>
 /// <param name="offset">byte of sector</param>
 /// <returns>optional data read</returns>
-std::optional<uint8_t> d64::readByte(int track, int sector, int byteoffset)
+std::optional<uint8_t> d64::readByte(int track, int sector, int byteoffset) const
 {
     if (!isValidTrackSector(track, sector) || byteoffset < 0 || byteoffset >= SECTOR_SIZE) return std::nullopt;
-    auto offset = calcOffset(track, sector) + byteoffset;
-    if (offset >= 0 && offset < static_cast<int>(data.size())) {
-        return data[offset];
-    }
-    return std::nullopt;
+    return sectorForRead(sectorIndex(track, sector))[byteoffset];
 }
 
 /// <summary>
@@ -203,45 +449,61 @@ std::optional<uint8_t> d64::readByte(int track, int sector, int byteoffset)
 /// <param name="track">track number</param>
 /// <param name="sector">sector number</param>
 /// <returns>optional vector of data read</returns>
-std::optional<std::vector<uint8_t>> d64::readSector(int track, int sector)
+std::optional<std::vector<uint8_t>> d64::readSector(int track, int sector) const
 {
     if (!isValidTrackSector(track, sector)) return std::nullopt;
-    std::vector<uint8_t> bytes(SECTOR_SIZE);
-    auto index = calcOffset(track, sector);
-    if (index >= 0 && index + SECTOR_SIZE <= static_cast<int>(data.size())) {
-        std::copy_n(data.begin() + index, SECTOR_SIZE, bytes.begin());
-        return bytes;
-    }
-    return std::nullopt;
+    auto bytes = sectorForRead(sectorIndex(track, sector));
+    return std::vector<uint8_t>(bytes, bytes + SECTOR_SIZE);
+}
+
+/// <summary>
+/// Read a sector into a buffer supplied by the caller
+/// </summary>
+/// <param name="track">track number</param>
+/// <param name="sector">sector number</param>
+/// <param name="buffer">at least SECTOR_SIZE bytes</param>
+/// <returns>true on success</returns>
+bool d64::readSectorInto(int track, int sector, std::span<uint8_t> buffer) const
+{
+    if (!isValidTrackSector(track, sector) || buffer.size() < SECTOR_SIZE) return false;
+    std::copy_n(sectorForRead(sectorIndex(track, sector)), SECTOR_SIZE, buffer.begin());
+    return true;
 }
 
 /// <summary>
 /// Find an empty slot in the directory
 /// This will create a new directory sector if needed
 /// </summary>
+/// <param name="slot">out location of the free slot</param>
 /// <returns>optional Directory_EntryPtr to free slot</returns>
-std::optional<directoryEntryPtr> d64::findEmptyDirectorySlot()
+std::optional<directoryEntryPtr> d64::findEmptyDirectorySlot(directorySlot& slot)
 {
-    auto dir_track = DIRECTORY_TRACK;
-    auto dir_sector = DIRECTORY_SECTOR;
-
-    while (dir_track != 0) {
-        directorySectorPtr dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-        for (auto& fileEntry : dirSectorPtr->fileEntry) {
-            if (!fileEntry.file_type.closed) {
-                return &fileEntry;
+    // the walk is bounded, a directory that loops has no end to grow from
+    auto chain = directoryChain();
+    for (auto& ts : chain) {
+        // only the sector with the free slot is about to change
+        auto dirSectorPtr = std::as_const(*this).getDirectory_SectorPtr(ts.track, ts.sector);
+        for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+            D64_COUNT(directoryEntriesScanned, 1);
+            if (!dirSectorPtr->fileEntry[i].file_type.closed) {
+                slot = directorySlot(ts.track, ts.sector, i);
+                return getDirectoryEntryPtr(slot);
             }
         }
-        dir_track = dirSectorPtr->next.track;
-        dir_sector = dirSectorPtr->next.sector;
+    }
+    if (chain.size() >= storage->size() / SECTOR_SIZE) {
+        throw std::runtime_error("Error: Directory chain loops");
+    }
 
-        if (dir_track == 0 || dir_track > TRACKS || dir_sector < 0 || dir_sector > SECTORS_PER_TRACK[dir_track - 1]) {
-            if (!allocateNewDirectorySector(dir_track, dir_sector, dirSectorPtr)) {
-                throw std::runtime_error("Disk full. Unable to find directory slot");
-            }
-        }
+    // grow the directory after its last sector
+    auto lastSectorPtr = getDirectory_SectorPtr(chain.back().track, chain.back().sector);
+    int dir_track = lastSectorPtr->next.track;
+    int dir_sector = lastSectorPtr->next.sector;
+    if (!allocateNewDirectorySector(dir_track, dir_sector, lastSectorPtr)) {
+        throw std::runtime_error("Disk full. Unable to find directory slot");
     }
-    return std::nullopt;
+    slot = directorySlot(dir_track, dir_sector, 0);
+    return getDirectoryEntryPtr(slot);
 }
 
 bool d64::allocateNewDirectorySector(int& dir_track, int& dir_sector, directorySectorPtr& dirSectorPtr)
@@ -296,7 +558,7 @@ bool d64::allocateDataSector(int& track, int& sector, sectorPtr& sectorPtr)
 /// <param name="fileData">data to write</param>
 /// <param name="offset">offset of data</param>
 /// <param name="bytesLeft">number of bytes left to write</param>
-void d64::writeDataToSector(sectorPtr sectorPtr, const std::vector<uint8_t>& fileData, int& offset, int& bytesLeft)
+void d64::writeDataToSector(sectorPtr sectorPtr, std::span<const uint8_t> fileData, int& offset, int& bytesLeft)
 {
     if (!sectorPtr) {
         throw std::invalid_argument("Invalid null sector pointer");
@@ -334,14 +596,32 @@ void d64::writeDataToSector(sectorPtr sectorPtr, const std::vector<uint8_t>& fil
 /// <param name="fileData">data to the file</param>
 /// <returns>true if successful</returns>
 /// <summary>
-bool d64::addFile(std::string_view filename, c64FileType type, const std::vector<uint8_t>& fileData, int recordSize)
+bool d64::addFile(std::string_view filename, c64FileType type, std::span<const uint8_t> fileData, int recordSize)
 {
+    D64_TRACE(traceOperation::trace_add_file);
     // Validate inputs
     if (filename.empty() || fileData.empty()) {
         throw std::runtime_error("Error: Filename or file data cannot be empty");
     }
+    checkWritable();
+
+    // fail before touching the disk if the file does not fit, so nothing is left allocated
+    auto dataSectors = static_cast<int>((fileData.size() + DATA_BYTES - 1) / DATA_BYTES);
+    auto needed = dataSectors;
+    if (type.type == d64FileTypes::REL) {
+        auto sides = (dataSectors + SIDE_SECTOR_CHAIN_SZ - 1) / SIDE_SECTOR_CHAIN_SZ;
+        if (sides > SIDE_SECTOR_ENTRY_SIZE) return false;
+        needed += sides;
+    }
+    if (freeDirectorySlots() == 0) {
+        ++needed;
+    }
+    if (needed > availableSectors()) {
+        throw std::runtime_error("Disk full. Unable to add file data");
+    }
 
     // Find and allocate the first sector for the file
+    beginFileAllocation(dataSectors);
     int start_track, start_sector;
     if (!findAndAllocateFirstSector(start_track, start_sector)) {
         return false;
@@ -358,6 +638,151 @@ bool d64::addFile(std::string_view filename, c64FileType type, const std::vector
     return true;
 }
 
+/// <summary>
+/// Add a file to the disk, placing its sectors with a policy of its own
+/// </summary>
+/// <param name="filename">name of the file</param>
+/// <param name="type">file type</param>
+/// <param name="fileData">bytes of the file</param>
+/// <param name="policy">placement for this file only, for example the interleave that loads fastest with the target loader</param>
+/// <param name="recordSize">record size of a .REL file</param>
+/// <returns>true if successful</returns>
+bool d64::addFile(std::string_view filename, c64FileType type, std::span<const uint8_t> fileData, const allocationPolicy& policy, int recordSize)
+{
+    return withAllocation(policy, [&] { return addFile(filename, type, fileData, recordSize); });
+}
+
+/// <summary>
+/// Add several files to the disk
+/// The space for all of the files is checked before anything is written
+/// so either every file is added or the disk is left unchanged
+/// </summary>
+/// <param name="files">files to add</param>
+/// <returns>true if successful, false if the files do not fit</returns>
+bool d64::addFiles(std::span<const fileSpec> files)
+{
+    // Validate inputs
+    for (auto& file : files) {
+        if (file.filename.empty() || file.data.empty()) {
+            throw std::runtime_error("Error: Filename or file data cannot be empty");
+        }
+    }
+    checkWritable();
+    if (files.empty()) return true;
+
+    // **Step 1: Count the sectors needed for all files**
+    std::vector<int> dataSectors;
+    dataSectors.reserve(files.size());
+    int needed = 0;
+
+    for (auto& file : files) {
+        auto count = static_cast<int>((file.data.size() + DATA_BYTES - 1) / DATA_BYTES);
+        dataSectors.push_back(count);
+        needed += count;
+
+        if (file.type.type == d64FileTypes::REL) {
+            auto sides = (count + SIDE_SECTOR_CHAIN_SZ - 1) / SIDE_SECTOR_CHAIN_SZ;
+            if (sides > SIDE_SECTOR_ENTRY_SIZE) return false;
+            needed += sides;
+        }
+    }
+
+    // **Step 2: Count the directory slots free in the existing chain**
+    auto chain = directoryChain();
+    auto loops = endAtLoop(chain);
+    auto newSlots = std::max(0, static_cast<int>(files.size()) - freeDirectorySlots());
+    if (newSlots > 0 && loops) {
+        // a directory that loops has no last sector to grow from
+        throw std::runtime_error("Error: Directory chain loops");
+    }
+    needed += (newSlots + FILES_PER_SECTOR - 1) / FILES_PER_SECTOR;
+
+    // **Step 3: Fail before touching the disk if the files do not fit**
+    if (needed > availableSectors()) return false;
+
+    // **Step 4: Lay out and write each file**
+    // sectors are taken in allocation order so each chain follows the interleave
+    // and each file starts where the previous one ended
+    std::vector<std::vector<trackSector>> chains(files.size());
+    for (size_t f = 0; f < files.size(); ++f) {
+        auto& chain = chains[f];
+        chain.reserve(dataSectors[f]);
+        beginFileAllocation(dataSectors[f]);
+        for (auto i = 0; i < dataSectors[f]; ++i) {
+            int track, sector;
+            if (!findAndAllocateFreeSector(track, sector)) {
+                throw std::runtime_error("Disk full. Unable to add file data");
+            }
+            chain.emplace_back(track, sector);
+        }
+        writeFileDataToSectors(chain, files[f].data);
+    }
+
+    // **Step 5: Write the directory entries in one pass**
+    size_t f = 0;
+    auto place = [&](int dir_track, int dir_sector, int slot)
+        {
+            auto& file = files[f];
+            auto writeSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
+            writeDirectoryEntry(writeSectorPtr->fileEntry[slot], directorySlot(dir_track, dir_sector, slot), file.filename, file.type,
+                chains[f].front().track, chains[f].front().sector, chains[f], static_cast<uint8_t>(file.recordSize));
+            ++f;
+        };
+
+    // directory sectors are only written where an entry goes
+    for (auto& ts : chain) {
+        auto dirSectorPtr = std::as_const(*this).getDirectory_SectorPtr(ts.track, ts.sector);
+        for (auto slot = 0; slot < FILES_PER_SECTOR && f < files.size(); ++slot) {
+            if (!dirSectorPtr->fileEntry[slot].file_type.closed) {
+                place(ts.track, ts.sector, slot);
+            }
+        }
+    }
+
+    // the rest go in new sectors after the last one
+    int dir_track = chain.back().track;
+    int dir_sector = chain.back().sector;
+    while (f < files.size()) {
+        auto lastSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
+        if (!allocateNewDirectorySector(dir_track, dir_sector, lastSectorPtr)) {
+            throw std::runtime_error("Disk full. Unable to find directory slot");
+        }
+        for (auto slot = 0; slot < FILES_PER_SECTOR && f < files.size(); ++slot) {
+            place(dir_track, dir_sector, slot);
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Count the free slots in the directory chain as it is, without the sectors it could grow into
+/// </summary>
+/// <returns>number of free directory entries</returns>
+int d64::freeDirectorySlots() const
+{
+    int freeSlots = 0;
+    auto chain = directoryChain();
+    endAtLoop(chain);
+    for (auto& ts : chain) {
+        for (auto& fileEntry : getDirectory_SectorPtr(ts.track, ts.sector)->fileEntry) {
+            if (!fileEntry.file_type.closed) ++freeSlots;
+        }
+    }
+    return freeSlots;
+}
+
+/// <summary>
+/// Add several files to the disk, placing their sectors with a policy of their own
+/// </summary>
+/// <param name="files">files to add</param>
+/// <param name="policy">placement for these files only</param>
+/// <returns>true if successful, false if the files do not fit</returns>
+bool d64::addFiles(std::span<const fileSpec> files, const allocationPolicy& policy)
+{
+    return withAllocation(policy, [&] { return addFiles(files); });
+}
+
 /// <summary>
 /// Find and allocate the first sector for a file
 /// </summary>
@@ -380,7 +805,7 @@ bool d64::findAndAllocateFirstSector(int& start_track, int& start_sector)
 /// <param name="start_sector">starting sector></param>
 /// <param name="fileData">data to write</param>
 /// <returns>vector of allocated sectors</returns>
-std::vector<trackSector> d64::writeFileDataToSectors(int start_track, int start_sector, const std::vector<uint8_t>& fileData)
+std::vector<trackSector> d64::writeFileDataToSectors(int start_track, int start_sector, std::span<const uint8_t> fileData)
 {
     std::vector<trackSector> allocatedSectors;
     int next_track = start_track;
@@ -413,6 +838,27 @@ std::vector<trackSector> d64::writeFileDataToSectors(int start_track, int start_
     return allocatedSectors;
 }
 
+/// <summary>
+/// Write file data to sectors that are already allocated
+/// </summary>
+/// <param name="chain">sectors of the file in order</param>
+/// <param name="fileData">data to write</param>
+void d64::writeFileDataToSectors(const std::vector<trackSector>& chain, std::span<const uint8_t> fileData)
+{
+    int offset = 0;
+    int bytesLeft = static_cast<int>(fileData.size());
+
+    for (size_t i = 0; i < chain.size(); ++i) {
+        auto sectorPtr = getSectorPtr(chain[i].track, chain[i].sector);
+        if (i + 1 < chain.size()) {
+            sectorPtr->next = chain[i + 1];
+        }
+
+        // the last sector gets its length from writeDataToSector
+        writeDataToSector(sectorPtr, fileData, offset, bytesLeft);
+    }
+}
+
 /// <summary>
 /// Create a side sector list
 /// </summary>
@@ -421,45 +867,43 @@ std::vector<trackSector> d64::writeFileDataToSectors(int start_track, int start_
 /// <returns>list of side sectors</returns>
 std::optional<std::vector<sideSectorPtr>> d64::createSideSectors(const std::vector<trackSector>& allocatedSectors, uint8_t record_size)
 {
-    int ssecTrack, ssecSector;
-    sideSectorPtr sideSector{};
-
-    std::vector<sideSectorPtr> sideSectorList;
-    int block = 0;
-    int sideCount = 0;
-    int chainCount = 0;
-
-    if (!allocateSideSector(ssecTrack, ssecSector, sideSector)) return std::nullopt;
-
-    sideSectorList.push_back(sideSector);
-    sideSector->recordsize = record_size;
-    sideSector->next = { 0, 16 };
-    sideSector->block = block++;
-    sideSectorPtr first = sideSector;
-    first->sideSectors[sideCount++] = { ssecTrack, ssecSector };
+    auto count = std::max<size_t>(1, (allocatedSectors.size() + SIDE_SECTOR_CHAIN_SZ - 1) / SIDE_SECTOR_CHAIN_SZ);
+    if (count > SIDE_SECTOR_ENTRY_SIZE) {
+        throw std::runtime_error("Exceeded maximum number of side sectors (6)");
+    }
 
-    for (const auto& ts : allocatedSectors) {
-        if (chainCount < SIDE_SECTOR_CHAIN_SZ) {
-            sideSector->chain[chainCount++] = ts;
-            sideSector->next.sector += 2;
-        }
-        else {
-            if (sideSectorList.size() >= SIDE_SECTOR_ENTRY_SIZE) {
-                throw std::runtime_error("Exceeded maximum number of side sectors (6)");
-            }
-            if (!allocateSideSector(ssecTrack, ssecSector, sideSector)) return std::nullopt;
-            first->sideSectors[sideCount++] = { ssecTrack, ssecSector };
-            sideSectorList.back()->next = { ssecTrack, ssecSector };
-            sideSector->block = block++;
-            sideSector->recordsize = record_size;
-            chainCount = 0;
-            sideSector->chain[chainCount++] = ts;
-            sideSector->next = { 0, 16 + 2 };
-        }
+    std::vector<trackSector> sides;
+    for (size_t i = 0; i < count; ++i) {
+        int ssecTrack, ssecSector;
+        if (!findAndAllocateFreeSector(ssecTrack, ssecSector)) return std::nullopt;
+        sides.emplace_back(ssecTrack, ssecSector);
     }
+    return writeSideSectors(allocatedSectors, sides, record_size);
+}
 
-    for (auto& sideSectors : sideSectorList) {
-        std::copy_n(first->sideSectors, sideCount, sideSectors->sideSectors);
+/// <summary>
+/// Fill in the side sectors of a .REL file
+/// </summary>
+/// <param name="allocatedSectors">list of file sectors</param>
+/// <param name="sides">allocated side sectors, one for each SIDE_SECTOR_CHAIN_SZ file sectors</param>
+/// <param name="record_size">size of each record</param>
+/// <returns>list of side sectors</returns>
+std::vector<sideSectorPtr> d64::writeSideSectors(const std::vector<trackSector>& allocatedSectors, const std::vector<trackSector>& sides, uint8_t record_size)
+{
+    std::vector<sideSectorPtr> sideSectorList;
+    for (size_t block = 0; block < sides.size(); ++block) {
+        auto sideSector = getSideSectorPtr(sides[block].track, sides[block].sector);
+        std::fill_n(reinterpret_cast<uint8_t*>(sideSector), SECTOR_SIZE, 0);
+        sideSector->block = static_cast<uint8_t>(block);
+        sideSector->recordsize = record_size;
+        std::copy(sides.begin(), sides.end(), sideSector->sideSectors);
+
+        // each side sector lists its run of the file sectors
+        auto first = block * SIDE_SECTOR_CHAIN_SZ;
+        auto chainCount = std::min<size_t>(SIDE_SECTOR_CHAIN_SZ, allocatedSectors.size() - std::min(first, allocatedSectors.size()));
+        std::copy_n(allocatedSectors.begin() + first, chainCount, sideSector->chain);
+        sideSector->next = block + 1 < sides.size() ? sides[block + 1] : trackSector(0, static_cast<int>(16 + 2 * chainCount));
+        sideSectorList.push_back(sideSector);
     }
     return sideSectorList;
 }
@@ -475,18 +919,38 @@ std::optional<std::vector<sideSectorPtr>> d64::createSideSectors(const std::vect
 /// <returns>true on success</returns>
 bool d64::createDirectoryEntry(std::string_view filename, c64FileType type, int start_track, int start_sector, const std::vector<trackSector>& allocatedSectors, uint8_t record_size)
 {
-    auto fileEntry = findEmptyDirectorySlot();
+    directorySlot slot;
+    auto fileEntry = findEmptyDirectorySlot(slot);
     if (!fileEntry.has_value()) {
         return false;
     }
 
-    fileEntry.value()->file_type = type;
-    fileEntry.value()->start.track = start_track;
-    fileEntry.value()->start.sector = start_sector;
+    writeDirectoryEntry(*fileEntry.value(), slot, filename, type, start_track, start_sector, allocatedSectors, record_size);
+    return true;
+}
+
+/// <summary>
+/// Fill in a free directory entry
+/// side sectors are created for .REL files
+/// </summary>
+/// <param name="fileEntry">entry to fill</param>
+/// <param name="slot">location of the entry</param>
+/// <param name="filename">name of file</param>
+/// <param name="type">type of file</param>
+/// <param name="start_track">first track</param>
+/// <param name="start_sector">first sector</param>
+/// <param name="allocated_sectors">data sectors of the file</param>
+/// <param name="record_size">record size of .REL file</param>
+void d64::writeDirectoryEntry(directoryEntry& fileEntry, const directorySlot& slot, std::string_view filename, c64FileType type, int start_track, int start_sector, const std::vector<trackSector>& allocatedSectors, uint8_t record_size)
+{
+    fileEntry.file_type = type;
+    fileEntry.start.track = start_track;
+    fileEntry.start.sector = start_sector;
 
     auto len = std::min(filename.size(), static_cast<size_t>(FILE_NAME_SZ));
-    std::copy_n(filename.begin(), len, fileEntry.value()->fileName);
-    std::fill(fileEntry.value()->fileName + len, fileEntry.value()->fileName + FILE_NAME_SZ, static_cast<char>(A0_VALUE));
+    std::copy_n(filename.begin(), len, fileEntry.fileName);
+    std::fill(fileEntry.fileName + len, fileEntry.fileName + FILE_NAME_SZ, static_cast<char>(A0_VALUE));
+    indexName(fileEntry, slot);
 
     // create side sectors for .REL files
     if (type.type == d64FileTypes::REL) {
@@ -494,168 +958,576 @@ bool d64::createDirectoryEntry(std::string_view filename, c64FileType type, int
         if (!sideSectorList.has_value() || sideSectorList.value().size() < 1) {
             throw std::runtime_error("Error: Unable to create side sector list");
         }
-        fileEntry.value()->recordLength = record_size;
-        fileEntry.value()->side.track = sideSectorList.value()[0]->sideSectors[0].track;
-        fileEntry.value()->side.sector = sideSectorList.value()[0]->sideSectors[0].sector;
+        fileEntry.recordLength = record_size;
+        fileEntry.side.track = sideSectorList.value()[0]->sideSectors[0].track;
+        fileEntry.side.sector = sideSectorList.value()[0]->sideSectors[0].sector;
     }
     else {
-        fileEntry.value()->recordLength = 0;
-        fileEntry.value()->side.track = 0;
-        fileEntry.value()->side.sector = 0;
+        fileEntry.recordLength = 0;
+        fileEntry.side.track = 0;
+        fileEntry.side.sector = 0;
     }
 
-    fileEntry.value()->replace.track = fileEntry.value()->start.track;
-    fileEntry.value()->replace.sector = fileEntry.value()->start.sector;
-    fileEntry.value()->fileSize[0] = allocatedSectors.size() & 0xFF;
-    fileEntry.value()->fileSize[1] = (allocatedSectors.size() & 0xFF00) >> 8;
-
-    return true;
+    fileEntry.replace.track = fileEntry.start.track;
+    fileEntry.replace.sector = fileEntry.start.sector;
+    fileEntry.fileSize[0] = allocatedSectors.size() & 0xFF;
+    fileEntry.fileSize[1] = (allocatedSectors.size() & 0xFF00) >> 8;
 }
 
 /// <summary>
 /// verify the BAM integrity
+/// every directory entry and file chain is walked
 /// </summary>
 /// <param name="fix">true to auto fix</param>
-/// <param name="logFile">logfile name or "" for std::cerr</param>
+/// <param name="logFile">logfile name or "" for the error log</param>
 /// <returns>true on success</returns>
 bool d64::verifyBAMIntegrity(bool fix, const std::string& logFile)
 {
+    D64_TRACE(traceOperation::trace_verify_bam);
+    if (fix) {
+        checkWritable();
+    }
+
     // Open log file if specified
     std::ofstream logStream;
-    std::ostream* logOutput = &std::cerr;
+    auto logOutput = openVerifyLog(logFile, logStream);
 
-    if (!logFile.empty()) {
-        logStream.open(logFile, std::ios::out);
-        if (logStream.is_open()) {
-            logOutput = &logStream;
-        }
-        else {
-            std::cerr << "WARNING: Failed to open log file. Logging to std::cerr instead.\n";
+    // **Step 1: Find the users of every sector**
+    rebuildVerifyCache();
+
+    // **Step 2: Compare BAM against actual usage**
+    auto errorsFound = false;
+    for (auto track = 1; track <= TRACKS; ++track) {
+        if (!verifyTrack(track, fix, *logOutput)) {
+            errorsFound = true;
         }
     }
 
-    // Temp map to count sector usage
-    std::array<std::array<bool, 21>, TRACKS_40> sectorUsage = {}; // Max sectors per track
-
-    // **Step 1: Mark BAM itself as used**
-    sectorUsage[DIRECTORY_TRACK - 1][BAM_SECTOR] = true;
-
-    // **Step 2: Scan directory for used sectors**
-    auto dir_track = DIRECTORY_TRACK;
-    auto dir_sector = DIRECTORY_SECTOR;
-    directorySectorPtr dirSectorPtr;
-
-    while (dir_track != 0) {
-        dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-
-        // Mark directory sector as used
-        sectorUsage[dir_track - 1][dir_sector] = true;
-
-        for (auto& entry : dirSectorPtr->fileEntry) {
+    dirtySectors.fill(0);
+    dirtyBamTracks = 0;
+    return !errorsFound; // Return true if BAM is valid
+}
 
-            if ((entry.file_type.closed) == 0) continue; // Skip deleted files
+/// <summary>
+/// verify the BAM integrity from what changed since the last verify
+/// only the chains of files with a written sector or directory entry are walked again
+/// and only the tracks they or the BAM changes touch are compared
+/// falls back to verifyBAMIntegrity when there is nothing to start from
+/// or a sector is used by more than one file
+/// changes made through pointers kept from before the last verify are not seen
+/// </summary>
+/// <param name="fix">true to auto fix</param>
+/// <param name="logFile">logfile name or "" for the error log</param>
+/// <returns>true on success</returns>
+bool d64::verifyBAMIncremental(bool fix, const std::string& logFile)
+{
+    if (!verifyState.valid || verifyState.crossLinked) {
+        return verifyBAMIntegrity(fix, logFile);
+    }
+    if (fix) {
+        checkWritable();
+    }
 
-            int track = entry.start.track;
-            int sector = entry.start.sector;
-            sectorUsage[track - 1][sector] = true;
+    // tracks already wrong are compared again
+    uint64_t touched = dirtyBamTracks | verifyState.badTracks;
+    if (isDirty(sectorIndex(DIRECTORY_TRACK, BAM_SECTOR))) {
+        touched = ~uint64_t(0);
+    }
 
-            if (entry.file_type.type == d64FileTypes::REL) {
-                // get the first location of a side sector
-                trackSector sidePosition = entry.side;
-
-                // load the side sector 
-                sideSectorPtr side = getSideSectorPtr(sidePosition.track, sidePosition.sector);
-                for (auto side_sectors : side->sideSectors) {
-                    if (side_sectors.track == 0)
-                        break;
-
-                    side = getSideSectorPtr(side_sectors.track, side_sectors.sector);
-                    sectorUsage[side_sectors.track - 1][side_sectors.sector] = true;
-
-                    for (auto chainEntry : side->chain) {
-                        if (chainEntry.track == 0) {
-                            break;
-                        }
-                        sectorUsage[chainEntry.track - 1][chainEntry.sector] = true;
-                    }
-                }
+    // **Step 1: Follow the directory chain again**
+    auto chain = directoryChain();
+    auto& oldChain = verifyState.directoryChain;
+    std::vector<directorySlot> changed;
+    for (auto& ts : oldChain) {
+        if (std::find(chain.begin(), chain.end(), ts) == chain.end()) {
+            // the entries of a sector that left the chain are gone
+            releaseSector(ts, DIRECTORY_OWNER, touched);
+            for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+                dropSlot(slotId(directorySlot(ts.track, ts.sector, i)), touched);
+            }
+        }
+    }
+    for (auto& ts : chain) {
+        auto added = std::find(oldChain.begin(), oldChain.end(), ts) == oldChain.end();
+        if (added) {
+            useSector(ts, DIRECTORY_OWNER, touched);
+        }
+        if (added || isDirty(sectorIndex(ts.track, ts.sector))) {
+            for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+                changed.emplace_back(ts.track, ts.sector, i);
             }
-            else {
-                while (track != 0) {
-                    sectorUsage[track - 1][sector] = true;
-                    auto next = getTrackSectorPtr(track, sector);
+        }
+    }
+    oldChain = std::move(chain);
 
-                    track = next->track;
-                    sector = next->sector;
-                }
+    // **Step 2: Find the files with a written sector**
+    for (size_t word = 0; word < dirtySectors.size(); ++word) {
+        for (auto bits = dirtySectors[word]; bits != 0; bits &= bits - 1) {
+            auto index = static_cast<int>(word * 64 + std::countr_zero(bits));
+            if (index >= static_cast<int>(verifyState.owner.size())) break;
+            auto owner = verifyState.owner[index];
+            if (owner >= 0) {
+                changed.push_back(verifyState.files.at(owner).slot);
             }
         }
+    }
 
-        dir_track = dirSectorPtr->next.track;
-        dir_sector = dirSectorPtr->next.sector;
+    // **Step 3: Walk the chains of those files again**
+    std::sort(changed.begin(), changed.end(), [&](auto& a, auto& b) { return slotId(a) < slotId(b); });
+    changed.erase(std::unique(changed.begin(), changed.end(), [&](auto& a, auto& b) { return slotId(a) == slotId(b); }), changed.end());
+    for (auto& slot : changed) {
+        reconcileSlot(slot, touched);
     }
 
-    // **Step 3: Compare BAM against actual usage**
-    auto errorsFound = false;
+    // a sector with two users can not be followed by its owner alone
+    if (verifyState.crossLinked) {
+        return verifyBAMIntegrity(fix, logFile);
+    }
 
-    for (auto track = 1; track <= TRACKS; ++track) {
-        auto correctFreeCount = 0;
+    // **Step 4: Compare BAM against actual usage on the touched tracks**
+    std::ofstream logStream;
+    auto logOutput = openVerifyLog(logFile, logStream);
+
+    auto errorsFound = false;
+    for (auto track = 1; track <= TRACKS; ++track) {
+        if (((touched >> (track - 1)) & 1) && !verifyTrack(track, fix, *logOutput)) {
+            errorsFound = true;
+        }
+    }
 
-        for (auto sector = 0; sector < SECTORS_PER_TRACK[track - 1]; ++sector) {
-            auto isFreeInBAM = bamtrack(track - 1)->test(sector);
-            auto isUsedInDirectory = sectorUsage[track - 1][sector];
+    dirtySectors.fill(0);
+    dirtyBamTracks = 0;
+    return !errorsFound;
+}
 
-            // Error: Sector incorrectly marked as used
-            if (!isUsedInDirectory && !isFreeInBAM) {
-                *logOutput << "ERROR: Sector " << sector << " on Track " << track
-                    << " is incorrectly marked as used in BAM.\n";
-                errorsFound = true;
+/// <summary>
+/// Check the BAM against the sectors the directory and its files use
+/// nothing is written or logged, every problem found is in the report
+/// the chains of the files can be walked by several threads, each marking its own
+/// sector bitmap, the bitmaps are then merged and a sector marked twice is cross linked
+/// </summary>
+/// <param name="threads">threads walking the files, 0 for one per hardware thread</param>
+/// <returns>what was found wrong</returns>
+verifyReport d64::verify(unsigned threads) const
+{
+    verifyReport report;
+    sectorBits used = {};
+    sectorBits crossed = {};
+    auto mark = [&](trackSector ts)
+        {
+            auto index = uncheckedIndex(ts.track, ts.sector);
+            auto bit = uint64_t(1) << (index & 63);
+            crossed[index >> 6] |= used[index >> 6] & bit;
+            used[index >> 6] |= bit;
+        };
+
+    // the BAM and the directory chain belong to the directory
+    mark(trackSector(DIRECTORY_TRACK, BAM_SECTOR));
+    std::vector<directorySlot> slots;
+    auto directory = walkChain(trackSector(DIRECTORY_TRACK, DIRECTORY_SECTOR), [&](trackSector location, const struct sector&)
+        {
+            mark(location);
+            for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+                slots.emplace_back(location.track, location.sector, i);
+            }
+        });
+    if (!directory) {
+        report.chainFaults.push_back({ directorySlot(), directory.error() });
+    }
+    std::erase_if(slots, [&](auto& slot) { return !getDirectoryEntryPtr(slot)->file_type.closed; });
+    report.files = slots.size();
 
-                if (fix) {
-                    *logOutput << "FIXING: Freeing sector " << sector << " on Track " << track << ".\n";
-                    bamtrack(track - 1)->set(sector);
+    // walk the files, each worker over its own run of slots
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::clamp<size_t>(threads, 1, std::max<size_t>(slots.size(), 1)));
+    std::vector<sectorBits> workerUsed(threads, sectorBits{});
+    std::vector<sectorBits> workerCrossed(threads, sectorBits{});
+    std::vector<std::vector<verifyReport::chainFault>> workerFaults(threads);
+    auto work = [&](unsigned w)
+        {
+            for (auto i = slots.size() * w / threads; i < slots.size() * (w + 1) / threads; ++i) {
+                auto fault = markEntrySectors(*getDirectoryEntryPtr(slots[i]), workerUsed[w], workerCrossed[w]);
+                if (fault.has_value()) {
+                    workerFaults[w].push_back({ slots[i], fault.value() });
                 }
             }
+        };
+    if (threads == 1) {
+        work(0);
+    }
+    else {
+        std::vector<std::thread> workers;
+        for (auto w = 1u; w < threads; ++w) {
+            workers.emplace_back(work, w);
+        }
+        work(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
 
-            // Error: Sector incorrectly marked as free
-            else if (isUsedInDirectory && isFreeInBAM) {
-                *logOutput << "ERROR: Sector " << sector << " on Track " << track
-                    << " is incorrectly marked as free in BAM.\n";
-                errorsFound = true;
+    // merge the bitmaps, a sector in two of them is cross linked too
+    auto anyCrossed = uint64_t(0);
+    for (auto w = 0u; w < threads; ++w) {
+        for (size_t i = 0; i < used.size(); ++i) {
+            crossed[i] |= workerCrossed[w][i] | (used[i] & workerUsed[w][i]);
+            used[i] |= workerUsed[w][i];
+        }
+        report.chainFaults.insert(report.chainFaults.end(), workerFaults[w].begin(), workerFaults[w].end());
+    }
+    for (auto bits : crossed) {
+        anyCrossed |= bits;
+    }
 
-                if (fix) {
-                    *logOutput << "FIXING: Marking sector " << sector << " on Track " << track << " as used.\n";
-                    bamtrack(track - 1)->reset(sector);
+    // only when something is cross linked are the users of each sector needed
+    if (anyCrossed != 0) {
+        std::vector<int> firstUser(storage->size() / SECTOR_SIZE, -1);
+        auto owner = [&](int user, trackSector location)
+            {
+                auto index = uncheckedIndex(location.track, location.sector);
+                if (((crossed[index >> 6] >> (index & 63)) & 1) == 0) return;
+                if (firstUser[index] < 0) {
+                    firstUser[index] = user;
+                    return;
                 }
+                auto first = firstUser[index] == 0 ? directorySlot() : slots[firstUser[index] - 1];
+                auto second = user == 0 ? directorySlot() : slots[user - 1];
+                report.crossLinks.push_back({ location, first, second });
+            };
+        owner(0, trackSector(DIRECTORY_TRACK, BAM_SECTOR));
+        walkChain(trackSector(DIRECTORY_TRACK, DIRECTORY_SECTOR), [&](trackSector location, const struct sector&) { owner(0, location); });
+        for (size_t i = 0; i < slots.size(); ++i) {
+            auto& entry = *getDirectoryEntryPtr(slots[i]);
+            auto user = static_cast<int>(i + 1);
+            walkChain(entry.start, [&](trackSector location, const struct sector&) { owner(user, location); });
+            if (entry.file_type.type == d64FileTypes::REL) {
+                walkChain(entry.side, [&](trackSector location, const struct sector&) { owner(user, location); });
             }
+        }
+    }
 
-            if (!isUsedInDirectory) {
-                correctFreeCount++;
+    // compare the BAM of each track against the sectors used
+    for (auto track = 1; track <= TRACKS; ++track) {
+        auto count = SECTORS_PER_TRACK[track - 1];
+        auto first = uncheckedIndex(track, 0);
+        uint32_t unused = 0;
+        for (auto sector = 0; sector < count; ++sector) {
+            auto index = first + sector;
+            if (((used[index >> 6] >> (index & 63)) & 1) == 0) {
+                unused |= 1u << sector;
             }
         }
 
-        // Error: Incorrect free sector count
-        int free = bamtrack(track - 1)->free;
+        auto bam = bamtrack(track - 1);
+        auto all = (1u << count) - 1;
+        for (auto wrong = (bam->mask() & all) ^ unused; wrong != 0; wrong &= wrong - 1) {
+            auto sector = std::countr_zero(wrong);
+            report.mismatches.push_back({ trackSector(track, sector), ((unused >> sector) & 1) == 0 });
+        }
+        auto expected = std::popcount(unused);
+        if (bam->free != expected) {
+            report.freeCounts.push_back({ static_cast<uint8_t>(track), bam->free, static_cast<uint8_t>(expected) });
+        }
+    }
+    return report;
+}
+
+/// <summary>
+/// Mark the sectors of a file as used
+/// the walk of each chain is checked and bounded by walkChain
+/// </summary>
+/// <param name="entry">directory entry of the file</param>
+/// <param name="used">bit set for each sector used</param>
+/// <param name="crossed">bit set for each sector found already used</param>
+/// <returns>the first bad link found</returns>
+std::optional<diskError> d64::markEntrySectors(const directoryEntry& entry, sectorBits& used, sectorBits& crossed) const
+{
+    auto mark = [&](trackSector location, const struct sector&)
+        {
+            auto index = uncheckedIndex(location.track, location.sector);
+            auto bit = uint64_t(1) << (index & 63);
+            crossed[index >> 6] |= used[index >> 6] & bit;
+            used[index >> 6] |= bit;
+        };
+
+    std::optional<diskError> fault;
+    auto data = walkChain(entry.start, mark);
+    if (!data) {
+        fault = data.error();
+    }
+
+    // the side sectors of a REL file are linked like a chain
+    if (entry.file_type.type == d64FileTypes::REL) {
+        auto sides = walkChain(entry.side, mark);
+        if (!sides && !fault.has_value()) {
+            fault = sides.error();
+        }
+    }
+    return fault;
+}
+
+/// <summary>
+/// Open the log of a BAM verify
+/// </summary>
+/// <param name="logFile">logfile name or "" for the error log</param>
+/// <param name="logStream">stream to open the log file in</param>
+/// <returns>stream to log to</returns>
+std::ostream* d64::openVerifyLog(const std::string& logFile, std::ofstream& logStream)
+{
+    if (!logFile.empty()) {
+        logStream.open(logFile, std::ios::out);
+        if (logStream.is_open()) {
+            return &logStream;
+        }
+        errorLog() << "WARNING: Failed to open log file. Logging to the error log instead.\n";
+    }
+    return &errorLog();
+}
+
+/// <summary>
+/// Get the sectors of the directory chain
+/// </summary>
+/// <returns>directory sectors in chain order</returns>
+std::vector<trackSector> d64::directoryChain() const
+{
+    std::vector<trackSector> chain;
+    auto limit = storage->size() / SECTOR_SIZE;
+    int dir_track = DIRECTORY_TRACK;
+    int dir_sector = DIRECTORY_SECTOR;
+
+    // a chain longer than the disk loops
+    for (auto index = linkIndex(dir_track, dir_sector); index >= 0 && chain.size() < limit; index = linkIndex(dir_track, dir_sector)) {
+        chain.emplace_back(dir_track, dir_sector);
+        auto dirSectorPtr = sectorAt<directorySector>(index);
+        dir_track = dirSectorPtr->next.track;
+        dir_sector = dirSectorPtr->next.sector;
+    }
+    return chain;
+}
+
+/// <summary>
+/// End a directory chain before the first sector it has already been through
+/// </summary>
+/// <param name="chain">chain from directoryChain</param>
+/// <returns>true if the chain looped</returns>
+bool d64::endAtLoop(std::vector<trackSector>& chain) const
+{
+    sectorBits seen = {};
+    for (size_t i = 0; i < chain.size(); ++i) {
+        auto index = uncheckedIndex(chain[i].track, chain[i].sector);
+        auto bit = uint64_t(1) << (index & 63);
+        if (seen[index >> 6] & bit) {
+            chain.resize(i);
+            return true;
+        }
+        seen[index >> 6] |= bit;
+    }
+    return false;
+}
+
+/// <summary>
+/// Get the sectors used by a file
+/// a REL file also uses the chain of its side sectors
+/// </summary>
+/// <param name="entry">directory entry of the file</param>
+/// <returns>each sector of the file once</returns>
+std::vector<trackSector> d64::entrySectors(const directoryEntry& entry) const
+{
+    // the sectors up to a bad link or a loop, the same ones verify counts
+    std::vector<trackSector> sectors;
+    auto add = [&](trackSector location, const struct sector&) { sectors.push_back(location); };
+    walkChain(entry.start, add);
+
+    // the data sectors the side sectors list are the data chain, a damaged list is not trusted over it
+    if (entry.file_type.type == d64FileTypes::REL) {
+        walkChain(entry.side, add);
+    }
+
+    std::sort(sectors.begin(), sectors.end(), [&](auto& a, auto& b) { return sectorIndex(a.track, a.sector) < sectorIndex(b.track, b.sector); });
+    sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+    return sectors;
+}
+
+/// <summary>
+/// Find the users of every sector from the directory
+/// </summary>
+void d64::rebuildVerifyCache()
+{
+    auto sectors = storage->size() / SECTOR_SIZE;
+    verifyState = verifyCache();
+    verifyState.users.assign(sectors, 0);
+    verifyState.owner.assign(sectors, NO_OWNER);
+
+    uint64_t touched = 0;
+
+    // the BAM itself is used
+    useSector(trackSector(DIRECTORY_TRACK, BAM_SECTOR), DIRECTORY_OWNER, touched);
+
+    // the directory and every file in it
+    verifyState.directoryChain = directoryChain();
+    for (auto& ts : verifyState.directoryChain) {
+        useSector(ts, DIRECTORY_OWNER, touched);
+    }
+    for (auto& ts : verifyState.directoryChain) {
+        for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+            reconcileSlot(directorySlot(ts.track, ts.sector, i), touched);
+        }
+    }
+    verifyState.valid = true;
+}
+
+/// <summary>
+/// Bring the sectors used by a directory slot up to date
+/// </summary>
+/// <param name="slot">slot to check</param>
+/// <param name="touched">tracks whose usage changed are added here</param>
+void d64::reconcileSlot(const directorySlot& slot, uint64_t& touched)
+{
+    auto& entry = *std::as_const(*this).getDirectoryEntryPtr(slot);
+    std::vector<trackSector> sectors;
+    if (entry.file_type.closed) {
+        sectors = entrySectors(entry);
+    }
+
+    auto id = slotId(slot);
+    auto it = verifyState.files.find(id);
+    if (it != verifyState.files.end() && it->second.sectors == sectors) {
+        return;
+    }
+    dropSlot(id, touched);
+
+    if (!sectors.empty()) {
+        for (auto& ts : sectors) {
+            useSector(ts, static_cast<int16_t>(id), touched);
+        }
+        verifyState.files.emplace(id, fileUse{ slot, std::move(sectors) });
+    }
+}
+
+/// <summary>
+/// Forget the sectors used by a directory slot
+/// </summary>
+/// <param name="id">slot id</param>
+/// <param name="touched">tracks whose usage changed are added here</param>
+void d64::dropSlot(int id, uint64_t& touched)
+{
+    auto it = verifyState.files.find(id);
+    if (it == verifyState.files.end()) return;
+    for (auto& ts : it->second.sectors) {
+        releaseSector(ts, static_cast<int16_t>(id), touched);
+    }
+    verifyState.files.erase(it);
+}
+
+/// <summary>
+/// Count a user of a sector
+/// </summary>
+/// <param name="ts">sector used</param>
+/// <param name="owner">slot id of the file or DIRECTORY_OWNER</param>
+/// <param name="touched">the track of the sector is added here</param>
+void d64::useSector(const trackSector& ts, int16_t owner, uint64_t& touched)
+{
+    auto index = sectorIndex(ts.track, ts.sector);
+    if (verifyState.users[index]++ > 0) {
+        verifyState.crossLinked = true;
+    }
+    if (verifyState.owner[index] == NO_OWNER) {
+        verifyState.owner[index] = owner;
+    }
+    touched |= uint64_t(1) << (ts.track - 1);
+}
+
+/// <summary>
+/// Remove a user of a sector
+/// </summary>
+/// <param name="ts">sector no longer used</param>
+/// <param name="owner">slot id of the file or DIRECTORY_OWNER</param>
+/// <param name="touched">the track of the sector is added here</param>
+void d64::releaseSector(const trackSector& ts, int16_t owner, uint64_t& touched)
+{
+    auto index = sectorIndex(ts.track, ts.sector);
+    --verifyState.users[index];
+    if (verifyState.owner[index] == owner) {
+        verifyState.owner[index] = NO_OWNER;
+    }
+    touched |= uint64_t(1) << (ts.track - 1);
+}
+
+/// <summary>
+/// Compare the BAM of a track against the sector users
+/// </summary>
+/// <param name="track">track to compare</param>
+/// <param name="fix">true to auto fix</param>
+/// <param name="log">stream to log to</param>
+/// <returns>true if the BAM of the track was right</returns>
+bool d64::verifyTrack(int track, bool fix, std::ostream& log)
+{
+    auto errorsFound = false;
+    auto correctFreeCount = 0;
+
+    for (auto sector = 0; sector < SECTORS_PER_TRACK[track - 1]; ++sector) {
+        auto isFreeInBAM = std::as_const(*this).bamtrack(track - 1)->test(sector);
+        auto isUsedInDirectory = verifyState.users[sectorIndex(track, sector)] > 0;
+
+        // Error: Sector incorrectly marked as used
+        if (!isUsedInDirectory && !isFreeInBAM) {
+            log << "ERROR: Sector " << sector << " on Track " << track
+                << " is incorrectly marked as used in BAM.\n";
+            errorsFound = true;
+
+            if (fix) {
+                log << "FIXING: Freeing sector " << sector << " on Track " << track << ".\n";
+                bamtrack(track - 1)->set(sector);
+            }
+        }
 
-        if (free != correctFreeCount) {
-            *logOutput << "WARNING: BAM free sector count mismatch on Track " << track
-                << " (BAM: " << free
-                << ", Expected: " << correctFreeCount << ")\n";
+        // Error: Sector incorrectly marked as free
+        else if (isUsedInDirectory && isFreeInBAM) {
+            log << "ERROR: Sector " << sector << " on Track " << track
+                << " is incorrectly marked as free in BAM.\n";
             errorsFound = true;
 
             if (fix) {
-                *logOutput << "FIXING: Correcting free sector count for Track " << track << ".\n";
-                bamtrack(track - 1)->free = correctFreeCount;
+                log << "FIXING: Marking sector " << sector << " on Track " << track << " as used.\n";
+                bamtrack(track - 1)->reset(sector);
             }
         }
+
+        if (!isUsedInDirectory) {
+            correctFreeCount++;
+        }
+    }
+
+    // Error: Incorrect free sector count
+    int free = std::as_const(*this).bamtrack(track - 1)->free;
+
+    if (free != correctFreeCount) {
+        log << "WARNING: BAM free sector count mismatch on Track " << track
+            << " (BAM: " << free
+            << ", Expected: " << correctFreeCount << ")\n";
+        errorsFound = true;
+
+        if (fix) {
+            log << "FIXING: Correcting free sector count for Track " << track << ".\n";
+            bamtrack(track - 1)->free = correctFreeCount;
+        }
     }
 
-    // Close log file if used
-    if (logStream.is_open()) {
-        logStream.close();
+    if (fix) {
+        refreshFreeMap(track);
     }
 
-    return !errorsFound; // Return true if BAM is valid
+    // a fixed track is right from now on
+    auto bit = uint64_t(1) << (track - 1);
+    if (errorsFound && !fix) {
+        verifyState.badTracks |= bit;
+    }
+    else {
+        verifyState.badTracks &= ~bit;
+    }
+    return !errorsFound;
 }
 
 /// <summary>
@@ -665,31 +1537,41 @@ bool d64::verifyBAMIntegrity(bool fix, const std::string& logFile)
 /// <returns>true on success</returns>
 bool d64::reorderDirectory(const std::vector<std::string>& fileOrder)
 {
-    std::vector<directoryEntry> files = directory();
-    std::vector<directoryEntry> reorderedFiles;
+    checkWritable();
+
+    std::vector<directorySlot> slots;
+    std::unordered_map<int, size_t> position;
+    auto view = entries();
+    for (auto it = view.begin(); it != view.end(); ++it) {
+        position.emplace(slotId(it.slot()), slots.size());
+        slots.push_back(it.slot());
+    }
 
     // **Step 1: Add files in the specified order**
+    // names are looked up once each through the name index
+    std::vector<size_t> order;
+    std::vector<bool> placed(slots.size(), false);
+    order.reserve(slots.size());
     for (const auto& filename : fileOrder) {
-        auto it = std::find_if(files.begin(), files.end(), [&](const directoryEntry& entry)
-            {
-                return Trim(entry.fileName) == filename;
-            });
+        auto slot = findSlot(filename);
+        if (!slot.has_value()) continue;
 
-        if (it != files.end()) {
-            reorderedFiles.push_back(*it);
-            files.erase(it);
+        auto it = position.find(slotId(slot.value()));
+        if (it != position.end() && !placed[it->second]) {
+            placed[it->second] = true;
+            order.push_back(it->second);
         }
     }
 
     // **Step 2: Append any remaining files that were not explicitly ordered**
-    reorderedFiles.insert(reorderedFiles.end(), files.begin(), files.end());
-
-    // **Step 3: Avoid unnecessary writes**
-    if (directory() == reorderedFiles)
-        return false; // No change needed
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (!placed[i]) {
+            order.push_back(i);
+        }
+    }
 
-    // **Step 4: Write new order to directory**
-    return reorderDirectory(reorderedFiles);
+    // **Step 3: Move the entries that changed place**
+    return permuteDirectory(slots, order);
 }
 
 /// <summary>
@@ -698,75 +1580,72 @@ bool d64::reorderDirectory(const std::vector<std::string>& fileOrder)
 /// <returns>true on success</returns>
 bool d64::compactDirectory()
 {
-    std::vector<directoryEntry> files;
+    D64_TRACE(traceOperation::trace_compact_directory);
+    checkWritable();
 
-    int dir_track = DIRECTORY_TRACK;
-    int dir_sector = DIRECTORY_SECTOR;
-    directorySectorPtr dirSectorPtr;
+    // the directory sectors in chain order, a link back into the chain ends it
+    auto chain = directoryChain();
+    endAtLoop(chain);
 
     // **Step 1: Collect all valid directory entries**
-    while (dir_track != 0) {
-        dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-
-        for (auto &entry : dirSectorPtr->fileEntry) {
+    std::vector<directoryEntry> files;
+    for (auto& ts : chain) {
+        for (auto& entry : std::as_const(*this).getDirectory_SectorPtr(ts.track, ts.sector)->fileEntry) {
             if ((entry.file_type.closed) == 0)
                 continue; // Skip deleted files
 
-            files.push_back(entry);
+            files.push_back(readEntry(entry));
         }
-
-        dir_track = dirSectorPtr->next.track;
-        dir_sector = dirSectorPtr->next.sector;
     }
 
     if (files.empty()) return false; // No valid files
 
     // **Step 2: Rewrite the directory with compacted entries**
-    dir_track = DIRECTORY_TRACK;
-    dir_sector = DIRECTORY_SECTOR;
-    dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-
     size_t index = 0;
     bool freedSector = false;
 
-    while (dir_track != 0) {
+    // every entry is about to move, index them where they land
+    nameIndex.clear();
+    nameIndexDuplicates = false;
+    nameIndexValid = true;
+
+    for (size_t position = 0; position < chain.size(); ++position) {
+        int dir_track = chain[position].track;
+        int dir_sector = chain[position].sector;
+        auto dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
+
+        // clearing the sector would lose the link to the next one
+        auto next = dirSectorPtr->next;
         std::fill_n(reinterpret_cast<uint8_t*>(dirSectorPtr), SECTOR_SIZE, 0); // Clear sector
+        dirSectorPtr->next = next;
 
         for (auto i = 0; i < FILES_PER_SECTOR && index < files.size(); ++i, ++index) {
-            dirSectorPtr->fileEntry[i] = files[index];
+            writeEntry(dirSectorPtr->fileEntry[i], files[index]);
+            indexName(files[index], directorySlot(dir_track, dir_sector, i));
         }
 
         // **Step 3: If no more files, free remaining sectors**
         if (index >= files.size()) {
-            // Mark remaining directory sectors as free in BAM
-            while (dir_track != 0) {
-                int next_track = dirSectorPtr->next.track;
-                int next_sector = dirSectorPtr->next.sector;
+            // this sector now ends the directory
+            dirSectorPtr->next.track = 0;
+            dirSectorPtr->next.sector = 0xFF;
 
+            // Mark remaining directory sectors as free in BAM
+            for (auto rest = position + 1; rest < chain.size(); ++rest) {
                 // never mark track 18 as free
-                if (dir_track != DIRECTORY_TRACK || dir_sector != DIRECTORY_SECTOR) {
+                if (chain[rest].track != DIRECTORY_TRACK || chain[rest].sector != DIRECTORY_SECTOR) {
 
                     // Free the sector in BAM
-                    freeSector(dir_track, dir_sector);
+                    freeSector(chain[rest].track, chain[rest].sector);
                     freedSector = true;
                 }
-
-                if (next_track == 0) break; // No more directory sectors
-
-                dir_track = next_track;
-                dir_sector = next_sector;
-                dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
             }
             break;
         }
-
-        dir_track = dirSectorPtr->next.track;
-        dir_sector = dirSectorPtr->next.sector;
-        if (dir_track != 0) dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
     }
 
     if (freedSector) {
-        std::cerr << "FIXED: Freed unused directory sectors and updated BAM.\n";
+        errorLog() << "FIXED: Freed unused directory sectors and updated BAM.\n";
     }
 
     return true;
@@ -779,34 +1658,43 @@ bool d64::compactDirectory()
 /// <returns>optional pointer to the fiels directory entry</returns>
 std::optional<directoryEntryPtr> d64::findFile(std::string_view filename)
 {
+    auto slot = findSlot(filename);
+    if (!slot.has_value()) {
+        return std::nullopt;
+    }
+    return getDirectoryEntryPtr(slot.value());
+}
+
+/// <summary>
+/// find the directory slot of a file
+/// the directory is only read
+/// </summary>
+/// <param name="filename">file to find</param>
+/// <returns>optional location of the files directory entry</returns>
+std::optional<directorySlot> d64::findSlot(std::string_view filename) const
+{
+    D64_COUNT(fileLookups, 1);
     try {
-        auto dir_track = DIRECTORY_TRACK;
-        auto dir_sector = DIRECTORY_SECTOR;
-
-        while (dir_track != 0) {
-            auto dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-            for (auto& fileEntry : dirSectorPtr->fileEntry) {
-                if (fileEntry.file_type.closed == 0) {
-                    continue;
-                }
-                std::string entryName(fileEntry.fileName, FILE_NAME_SZ);
-                entryName.erase(std::find_if(entryName.begin(), entryName.end(), [](char c) { return c == static_cast<char>(A0_VALUE); }), entryName.end());
-                if (entryName == filename) {
-                    return &fileEntry;
-                }
-            }
-            dir_track = dirSectorPtr->next.track;
-            dir_sector = dirSectorPtr->next.sector;
+        // names that can not be stored in a directory entry are never found
+        auto key = makeNameKey(filename);
+        if (!key.has_value()) {
+            return std::nullopt;
+        }
+
+        requireNameIndex();
+        auto it = nameIndex.find(key.value());
+        if (it != nameIndex.end()) {
+            return it->second;
         }
     }
     catch (const std::out_of_range& e) {
-        std::cerr << "Out of range error: " << e.what() << std::endl;
+        errorLog() << "Out of range error: " << e.what() << std::endl;
     }
     catch (const std::runtime_error& e) {
-        std::cerr << "Runtime error: " << e.what() << std::endl;
+        errorLog() << "Runtime error: " << e.what() << std::endl;
     }
     catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        errorLog() << "Error: " << e.what() << std::endl;
     }
     return std::nullopt;
 }
@@ -819,30 +1707,38 @@ std::optional<directoryEntryPtr> d64::findFile(std::string_view filename)
 bool d64::removeFile(std::string_view filename)
 {
     try {
+        checkWritable();
         auto fileEntry = findFile(filename);
         if (!fileEntry.has_value()) {
             throw std::runtime_error("File not found: " + std::string(filename));
         }
-        int track = fileEntry.value()->start.track;
-        int sector = fileEntry.value()->start.sector;
+        // nothing is freed unless the whole chain is good
+        std::vector<trackSector> chain;
+        walkFileChain(*fileEntry.value(), [&](trackSector location, const struct sector&) { chain.push_back(location); });
+        for (auto& ts : chain) {
+            freeSector(ts.track, ts.sector);
+        }
 
-        while (track != 0) {
-            auto sectorPtr = getTrackSectorPtr(track, sector);
-            auto next_track = sectorPtr->track;
-            auto next_sector = sectorPtr->sector;
-            freeSector(track, sector);
-            track = next_track;
-            sector = next_sector;
+        // a REL file also owns the side sectors listed in its first side sector
+        auto side = fileEntry.value()->side;
+        if (fileEntry.value()->file_type.type == d64FileTypes::REL && isValidTrackSector(side.track, side.sector)) {
+            auto sideSectorPtr = std::as_const(*this).getSideSectorPtr(side.track, side.sector);
+            for (auto sides : sideSectorPtr->sideSectors) {
+                if (!isValidTrackSector(sides.track, sides.sector))
+                    break;
+                freeSector(sides.track, sides.sector);
+            }
         }
 
-        memset(fileEntry.value(), 0, sizeof(directoryEntry));
+        unindexName(*fileEntry.value());
+        memset(fileEntry.value(), 0, DIR_ENTRY_SZ);
         return true;
     }
     catch (const std::runtime_error& e) {
-        std::cerr << "Runtime error: " << e.what() << std::endl;
+        errorLog() << "Runtime error: " << e.what() << std::endl;
     }
     catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        errorLog() << "Error: " << e.what() << std::endl;
     }
     return false;
 }
@@ -855,13 +1751,20 @@ bool d64::removeFile(std::string_view filename)
 /// <returns>true if successful</returns>
 bool d64::renameFile(std::string_view oldfilename, std::string_view newfilename)
 {
+    checkWritable();
     auto fileEntry = findFile(oldfilename);
     if (!fileEntry.has_value()) {
         throw std::runtime_error("File not found: " + std::string(oldfilename));
     }
+
+    // findFile left the index valid
+    auto slot = nameIndex.at(makeNameKey(*fileEntry.value()));
+    unindexName(*fileEntry.value());
+
     auto len = std::min(newfilename.size(), static_cast<size_t>(FILE_NAME_SZ));
     std::copy_n(newfilename.begin(), len, fileEntry.value()->fileName);
     std::fill(fileEntry.value()->fileName + len, fileEntry.value()->fileName + FILE_NAME_SZ, static_cast<char>(A0_VALUE));
+    indexName(*fileEntry.value(), slot);
     return true;
 }
 
@@ -870,37 +1773,36 @@ bool d64::renameFile(std::string_view oldfilename, std::string_view newfilename)
 /// </summary>
 /// <param name="filename">file to extrack</param>
 /// <returns>true if successful</returns>
-bool d64::extractFile(std::string filename)
+bool d64::extractFile(std::string filename) const
 {
-    auto fileEntry = findFile(filename);
-    if (!fileEntry.has_value()) {
+    auto slot = findSlot(filename);
+    if (!slot.has_value()) {
         throw std::runtime_error("File not found: " + std::string(filename));
     }
 
-    static const std::map<d64FileTypes, std::string> extMap = {
-        { d64FileTypes::PRG, ".prg" },
-        { d64FileTypes::SEQ, ".seq" },
-        { d64FileTypes::USR, ".usr" },
-        { d64FileTypes::REL, ".rel" },
-    };
-    auto it = extMap.find(fileEntry.value()->file_type.type);
-    if (it == extMap.end()) {
-        throw std::runtime_error("Unknown file type: " + std::to_string(static_cast<uint8_t>(fileEntry.value()->file_type)));
-    }
-
-    auto fileData = readFile(filename);
-    if (!fileData.has_value()) {
-        throw std::runtime_error("Unable to read file " + filename);
+    auto fileEntry = std::as_const(*this).getDirectoryEntryPtr(slot.value());
+    auto ext = std::string(extension(fileEntry->file_type.type));
+    if (ext.empty()) {
+        throw std::runtime_error("Unknown file type: " + std::to_string(static_cast<uint8_t>(fileEntry->file_type)));
     }
 
-    auto ext = extMap.at(fileEntry.value()->file_type.type);
     try {
+        // the chain is checked before the output is opened, a bad chain leaves nothing on the host
+        auto length = tryChainLength(fileEntry->start);
+        if (!length) {
+            throw std::runtime_error(std::string(readErrorText(length.error().code)));
+        }
+
         std::ofstream outFile((filename + ext).c_str(), std::ios::binary);
         if (!outFile.is_open()) {
             throw std::runtime_error("Failed to open output file: " + filename + ext);
         }
         
-        outFile.write(reinterpret_cast<char*>(fileData->data()), fileData->size());
+        // write straight from the image one sector at a time
+        walkFileChain(*fileEntry, [&](trackSector, const struct sector& current)
+            {
+                outFile.write(reinterpret_cast<const char*>(current.data.data()), chainBytes(current));
+            });
         if (outFile.fail()) {
             throw std::runtime_error("Failed to write to file: " + filename + ext);
         }
@@ -911,7 +1813,7 @@ bool d64::extractFile(std::string filename)
         }
     }
     catch (const std::exception& e) {
-        std::cerr << "Error extracting file: " << e.what() << std::endl;
+        errorLog() << "Error extracting file: " << e.what() << std::endl;
         return false;
     }
 
@@ -919,85 +1821,1033 @@ bool d64::extractFile(std::string filename)
 }
 
 /// <summary>
-/// get file data from the disk
+/// extract every file of the disk into a directory
+/// each chain is written straight from the image, host names are the trimmed file names made legal
+/// a name that two files would share gets a ~2, ~3 ... before its extension
 /// </summary>
-/// <param name="filename">file to read</param>
-/// <returns>true if successful</returns>
-std::optional<std::vector<uint8_t>> d64::readFile(std::string filename)
+/// <param name="outputDir">directory to write to, created if needed</param>
+/// <param name="options">threads, skipping files already there and flushing</param>
+/// <returns>the host files written and left as they were</returns>
+extractReport d64::extractAll(const std::string& outputDir, const extractOptions& options) const
 {
-    // find the file
-    auto fileEntry = findFile(filename);
-    if (!fileEntry.has_value()) {
-        throw std::runtime_error("File not found: " + filename);
+    extractReport report;
+    std::error_code ec;
+    std::filesystem::create_directories(outputDir, ec);
+    if (ec) {
+        errorLog() << "Error: Could not create directory " << outputDir << ": " << ec.message() << "\n";
+        ++report.failed;
+        return report;
+    }
+
+    // one walk of the directory picks the files and their host names
+    struct target {
+        const directoryEntry* entry;
+        std::string path;
+        bool written = false;
+        bool upToDate = false;
+        std::string error{};
+    };
+    std::vector<target> targets;
+    std::unordered_set<std::string> names;
+    std::unordered_map<std::string, int> nextCopy;
+    // a directory that loops comes back round to slots it has been through, everything after that repeats
+    std::vector<bool> seenSlots(storage->size() / SECTOR_SIZE * FILES_PER_SECTOR);
+    for (auto it = entries().begin(); it != entries().end(); ++it) {
+        auto slot = it.slot();
+        auto seen = seenSlots.begin() + uncheckedIndex(slot.location.track, slot.location.sector) * FILES_PER_SECTOR + slot.entry;
+        if (*seen) break;
+        *seen = true;
+
+        auto& entry = *it;
+        auto ext = extension(entry.file_type.type);
+        if (ext.empty()) continue;
+
+        auto name = Trim(entry.fileName);
+        std::replace_if(name.begin(), name.end(), [](char c)
+            {
+                return static_cast<unsigned char>(c) < 0x20 || std::string_view("/\\:*?\"<>|").find(c) != std::string_view::npos;
+            }, '_');
+        if (name.empty()) {
+            name = "_";
+        }
+        // the copy number carries on from the last one given to the name
+        auto unique = name;
+        for (auto& copy = nextCopy.try_emplace(name, 2).first->second; !names.insert(unique).second; ++copy) {
+            unique = name + "~" + std::to_string(copy);
+        }
+        targets.push_back({ &entry, (std::filesystem::path(outputDir) / (unique + std::string(ext))).string() });
     }
 
-    // the file data will be stored here
-    std::vector<uint8_t> fileData;
-
-    // get the files start track and sector
-    int track = fileEntry.value()->start.track;
-    int sector = fileEntry.value()->start.sector;
-
-    // track 0 signifies end
-    while (track != 0) {
-
-        // get the next track and sector of file
-        auto sectorPtr = getSectorPtr(track, sector);
-
-        // if the track is not zero then write the whole block
-        int bytes = sectorPtr->next.track != 0 ? sizeof(sectorPtr->data) : sectorPtr->next.sector - 1;
-        // append the data at the end 
-        fileData.insert(fileData.end(), sectorPtr->data.begin(), sectorPtr->data.begin() + bytes);
+    // the disk is only read, so files can be written at once, errors are logged afterwards in directory order
+    auto extract = [&](target& file)
+        {
+            try {
+                // a chain that loops or links off the disk fails the file before anything is written
+                std::vector<std::span<const uint8_t>> parts;
+                size_t length = 0;
+                auto chain = walkChain(file.entry->start, [&](trackSector, const struct sector& current)
+                    {
+                        parts.emplace_back(current.data.data(), chainBytes(current));
+                        length += parts.back().size();
+                    });
+                if (!chain) {
+                    file.error = "Error extracting file: " + std::string(readErrorText(chain.error().code));
+                    return;
+                }
+                if (options.skipUpToDate && hostFileMatches(file.path, *file.entry, length)) {
+                    file.upToDate = true;
+                }
+                else if (diskStorage::writeFile(file.path, parts, options.flush)) {
+                    file.written = true;
+                }
+                else {
+                    file.error = "Error: Failed to write to file: " + file.path;
+                }
+            }
+            catch (const std::exception& e) {
+                file.error = std::string("Error extracting file: ") + e.what();
+            }
+        };
 
-        // set current track and sector
-        track = sectorPtr->next.track;
-        sector = sectorPtr->next.sector;
+    auto threads = options.threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : options.threads;
+    threads = static_cast<unsigned>(std::clamp<size_t>(threads, 1, std::max<size_t>(targets.size(), 1)));
+    std::atomic<size_t> next = 0;
+    auto work = [&]()
+        {
+            // take the next file rather than a fixed run, files differ a lot in length
+            for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < targets.size(); i = next.fetch_add(1, std::memory_order_relaxed)) {
+                extract(targets[i]);
+            }
+        };
+    if (threads == 1) {
+        work();
+    }
+    else {
+        std::vector<std::thread> workers;
+        for (auto w = 1u; w < threads; ++w) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (auto& worker : workers) {
+            worker.join();
+        }
     }
 
-    // exit
-    return fileData;
+    for (auto& file : targets) {
+        if (file.written) {
+            report.written.push_back(std::move(file.path));
+        }
+        else if (file.upToDate) {
+            report.upToDate.push_back(std::move(file.path));
+        }
+        else {
+            errorLog() << file.error << "\n";
+            ++report.failed;
+        }
+    }
+    return report;
 }
 
 /// <summary>
-/// Get the name of the disk
+/// tell if a host file already holds the data of a file
+/// the size is checked first, only a file of the right size is read and fingerprinted
 /// </summary>
-/// <returns>Name of the disk</returns>
-std::string d64::diskname()
+/// <param name="path">host file</param>
+/// <param name="entry">file on the disk</param>
+/// <param name="length">data bytes of the file</param>
+/// <returns>true if the host file has the same size and fingerprint</returns>
+bool d64::hostFileMatches(const std::string& path, const directoryEntry& entry, size_t length) const
 {
-    std::string name;
-    for (auto& ch : diskBamPtr->diskName) {
-        if (ch == static_cast<char>(0xA0)) return name;
-        name += ch;
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec || size != length) {
+        return false;
     }
-    return name;
+    std::ifstream in(path, std::ios::binary);
+    std::vector<uint8_t> bytes(length);
+    if (!in.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(length))) {
+        return false;
+    }
+    return dataFingerprint(bytes) == fileFingerprint(entry);
 }
 
 /// <summary>
-/// save image to disk
+/// get the host file extension for a file type
 /// </summary>
-/// <param name="filename">name of file</param>
-/// <returns>true if successful</returns>
-bool d64::save(std::string filename)
+/// <param name="type">file type</param>
+/// <returns>extension including the dot or empty if the type is not extracted</returns>
+std::string_view d64::extension(d64FileTypes type)
 {
-    // open the file
-    std::ofstream outFile(filename.c_str(), std::ios::binary);
-    if (!outFile) {
-        throw std::runtime_error("Error: Could not open file for writing");
+    switch (type) {
+        case d64FileTypes::PRG: return ".prg";
+        case d64FileTypes::SEQ: return ".seq";
+        case d64FileTypes::USR: return ".usr";
+        case d64FileTypes::REL: return ".rel";
+        default: return "";
     }
-    // write all the data
-    outFile.write(reinterpret_cast<char*>(data.data()), data.size());
-    outFile.close();
-    return true;
 }
 
 /// <summary>
-/// load a disk image
+/// get file data from the disk
 /// </summary>
-/// <param name="filename">name of .d64 file to load</param>
+/// <param name="filename">file to read</param>
+/// <returns>true if successful</returns>
+std::optional<std::vector<uint8_t>> d64::readFile(std::string filename) const
+{
+    auto& entry = requireFile(filename);
+
+    // the file data will be stored here, sized from the block count in the directory
+    std::vector<uint8_t> fileData;
+    auto blocks = std::min<size_t>(entry.fileSize[0] | (entry.fileSize[1] << 8), storage->size() / SECTOR_SIZE);
+    fileData.reserve(blocks * DATA_BYTES);
+
+    // append the data of each sector at the end, the chain is only walked once
+    walkFileChain(entry, [&](trackSector, const struct sector& current)
+        {
+            fileData.insert(fileData.end(), current.data.begin(), current.data.begin() + chainBytes(current));
+        });
+    return fileData;
+}
+
+/// <summary>
+/// read file data from the disk into a buffer
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <param name="buffer">buffer to fill</param>
+/// <returns>number of bytes read or nullopt if the buffer is too small</returns>
+std::optional<size_t> d64::readFileInto(std::string_view filename, std::span<uint8_t> buffer) const
+{
+    // measure the chain first, a buffer that is too small is left untouched
+    const auto& entry = requireFile(filename);
+    auto length = tryChainLength(entry.start);
+    if (!length) {
+        throw std::runtime_error(std::string(readErrorText(length.error().code)));
+    }
+    if (length.value() > buffer.size()) {
+        return std::nullopt;
+    }
+
+    auto out = buffer.begin();
+    walkFileChain(entry, [&](trackSector, const struct sector& current)
+        {
+            out = std::copy_n(current.data.begin(), chainBytes(current), out);
+        });
+    return length.value();
+}
+
+/// <summary>
+/// get the number of bytes in a file
+/// </summary>
+/// <param name="filename">file to measure</param>
+/// <returns>number of data bytes in the file</returns>
+size_t d64::fileLength(std::string_view filename) const
+{
+    size_t length = 0;
+    walkFileChain(requireFile(filename), [&](trackSector, const struct sector& current) { length += chainBytes(current); });
+    return length;
+}
+
+/// <summary>
+/// get the sector chain of a file
+/// </summary>
+/// <param name="filename">file to find</param>
+/// <returns>range over the data of each sector of the file</returns>
+d64::sectorChain d64::fileChain(std::string_view filename) const
+{
+    return fileChain(requireFile(filename));
+}
+
+/// <summary>
+/// find the directory entry of a file
+/// </summary>
+/// <param name="filename">file to find</param>
+/// <returns>directory entry of the file</returns>
+const directoryEntry& d64::requireFile(std::string_view filename) const
+{
+    auto slot = findSlot(filename);
+    if (!slot.has_value()) {
+        throw std::runtime_error("File not found: " + std::string(filename));
+    }
+    return *std::as_const(*this).getDirectoryEntryPtr(slot.value());
+}
+
+/// <summary>
+/// get the sector chain of a directory entry
+/// </summary>
+/// <param name="entry">directory entry of the file</param>
+/// <returns>range over the data of each sector of the file</returns>
+d64::sectorChain d64::fileChain(const directoryEntry& entry) const
+{
+    return sectorChain(this, entry.start);
+}
+
+/// <summary>
+/// Read a byte from a sector without throwing
+/// </summary>
+/// <param name="track">track number</param>
+/// <param name="sector">sector number</param>
+/// <param name="offset">byte of sector</param>
+/// <returns>byte or error</returns>
+diskResult<uint8_t> d64::tryReadByte(int track, int sector, int offset) const noexcept
+{
+    if (!isValidTrackSector(track, sector)) {
+        return diskError{ readError::read_bad_track_sector };
+    }
+    if (offset < 0 || offset >= SECTOR_SIZE) {
+        return diskError{ readError::read_bad_offset, static_cast<uint8_t>(track), static_cast<uint8_t>(sector) };
+    }
+    return sectorForRead(uncheckedIndex(track, sector))[offset];
+}
+
+/// <summary>
+/// View a sector without copying or throwing
+/// </summary>
+/// <param name="track">track number</param>
+/// <param name="sector">sector number</param>
+/// <returns>SECTOR_SIZE bytes of the sector or error</returns>
+diskResult<std::span<const uint8_t>> d64::tryReadSector(int track, int sector) const noexcept
+{
+    if (!isValidTrackSector(track, sector)) {
+        return diskError{ readError::read_bad_track_sector };
+    }
+    return std::span<const uint8_t>(sectorForRead(uncheckedIndex(track, sector)), SECTOR_SIZE);
+}
+
+/// <summary>
+/// Find a file without throwing
+/// </summary>
+/// <param name="filename">file to find</param>
+/// <returns>directory entry of the file or error</returns>
+diskResult<const directoryEntry*> d64::tryFindFile(std::string_view filename) const
+{
+    auto key = makeNameKey(filename);
+    if (!key.has_value()) {
+        return diskError{ readError::read_bad_name };
+    }
+    requireNameIndex();
+    auto it = nameIndex.find(key.value());
+    if (it == nameIndex.end()) {
+        return diskError{ readError::read_file_not_found };
+    }
+    return std::as_const(*this).getDirectoryEntryPtr(it->second);
+}
+
+/// <summary>
+/// Get the directory entries without throwing
+/// </summary>
+/// <returns>current directory entries or where the directory chain is broken</returns>
+diskResult<std::vector<directoryEntry>> d64::tryDirectory() const
+{
+    std::vector<directoryEntry> files;
+    std::bitset<D64_DISK40_SZ / SECTOR_SIZE> visited;
+
+    int dir_track = DIRECTORY_TRACK;
+    int dir_sector = DIRECTORY_SECTOR;
+    while (dir_track != 0) {
+        auto index = uncheckedIndex(dir_track, dir_sector);
+        if (visited.test(index)) {
+            return diskError{ readError::read_chain_loop, static_cast<uint8_t>(dir_track), static_cast<uint8_t>(dir_sector) };
+        }
+        visited.set(index);
+
+        auto dirSectorPtr = reinterpret_cast<const directorySector*>(sectorForRead(index));
+        for (auto& entry : dirSectorPtr->fileEntry) {
+            if (entry.file_type.closed) {
+                files.push_back(readEntry(entry));
+            }
+        }
+
+        auto next = dirSectorPtr->next;
+        if (next.track != 0 && !isValidTrackSector(next.track, next.sector)) {
+            return diskError{ readError::read_chain_broken, static_cast<uint8_t>(dir_track), static_cast<uint8_t>(dir_sector) };
+        }
+        dir_track = next.track;
+        dir_sector = next.sector;
+    }
+    return files;
+}
+
+/// <summary>
+/// Follow a sector chain without throwing
+/// every link is checked and a sector seen twice ends the walk
+/// the error holds the sector with the bad link
+/// </summary>
+/// <param name="start">first sector of the chain</param>
+/// <returns>number of data bytes in the chain or error</returns>
+diskResult<size_t> d64::tryChainLength(trackSector start) const noexcept
+{
+    size_t length = 0;
+    auto chain = walkChain(start, [&](trackSector, const struct sector& current) { length += chainBytes(current); });
+    if (!chain) {
+        return chain.error();
+    }
+    return length;
+}
+
+/// <summary>
+/// Get the sector chain of a file after checking every link
+/// iterating the chain can then not throw
+/// </summary>
+/// <param name="filename">file to find</param>
+/// <returns>range over the data of each sector of the file or error</returns>
+diskResult<d64::sectorChain> d64::tryFileChain(std::string_view filename) const
+{
+    auto entry = tryFindFile(filename);
+    if (!entry) {
+        return entry.error();
+    }
+    auto length = tryChainLength((*entry)->start);
+    if (!length) {
+        return length.error();
+    }
+    return fileChain(**entry);
+}
+
+/// <summary>
+/// Read file data into a buffer without throwing
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <param name="buffer">buffer to fill</param>
+/// <returns>number of bytes read or error</returns>
+diskResult<size_t> d64::tryReadFileInto(std::string_view filename, std::span<uint8_t> buffer) const
+{
+    auto entry = tryFindFile(filename);
+    if (!entry) {
+        return entry.error();
+    }
+    auto length = tryChainLength((*entry)->start);
+    if (!length) {
+        return length.error();
+    }
+    if (*length > buffer.size()) {
+        return diskError{ readError::read_buffer_too_small };
+    }
+
+    auto out = buffer.begin();
+    for (auto bytes : fileChain(**entry)) {
+        out = std::copy(bytes.begin(), bytes.end(), out);
+    }
+    return *length;
+}
+
+/// <summary>
+/// Read file data without throwing
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <returns>file data or error</returns>
+diskResult<std::vector<uint8_t>> d64::tryReadFile(std::string_view filename) const
+{
+    auto entry = tryFindFile(filename);
+    if (!entry) {
+        return entry.error();
+    }
+    auto length = tryChainLength((*entry)->start);
+    if (!length) {
+        return length.error();
+    }
+
+    std::vector<uint8_t> fileData;
+    fileData.reserve(*length);
+    for (auto bytes : fileChain(**entry)) {
+        fileData.insert(fileData.end(), bytes.begin(), bytes.end());
+    }
+    return fileData;
+}
+
+/// <summary>
+/// Get the name of the disk
+/// </summary>
+/// <returns>Name of the disk</returns>
+std::string d64::diskname() const
+{
+    std::string name;
+    for (auto& ch : diskBamPtr->diskName) {
+        if (ch == static_cast<char>(0xA0)) return name;
+        name += ch;
+    }
+    return name;
+}
+
+/// <summary>
+/// save image to disk
+/// a journaled save writes a new file and renames it over the old one
+/// </summary>
+/// <param name="filename">name of file</param>
+/// <param name="mode">how to write the file</param>
+/// <returns>true if successful</returns>
+bool d64::save(std::string filename, saveMode mode)
+{
+    D64_TRACE(traceOperation::trace_save);
+    // a write through mapping of the same file only needs a flush
+    if (storage->writesThrough(filename)) {
+        if (!storage->sync()) {
+            throw std::runtime_error("Error: Could not flush disk image");
+        }
+        unsavedBits.fill(0);
+        return true;
+    }
+
+    // nothing can have changed in a read only mapping of the same file
+    auto sameFile = storage->mappedFrom(filename);
+    if (sameFile && !storage->writable()) {
+        return true;
+    }
+
+    // an unfinished journal would be replayed over the new image
+    recoverJournal(filename);
+
+    if (mode == saveMode::save_journaled) {
+        // the mapped file holds the image as loaded so only the changes need the journal
+        if (sameFile) {
+            return saveIncremental(filename, mode);
+        }
+
+        auto temp = filename + ".tmp";
+        std::error_code ec;
+        std::ofstream outFile(temp, std::ios::binary | std::ios::trunc);
+        auto written = outFile && writeImage(outFile);
+        outFile.close();
+        if (!written || outFile.fail()) {
+            std::filesystem::remove(temp, ec);
+            throw std::runtime_error("Error: Could not write file " + temp);
+        }
+
+        // the new image must be on the disk before it replaces the old one
+        if (diskStorage::syncFile(temp)) {
+            std::filesystem::rename(temp, filename, ec);
+        }
+        else {
+            ec = std::make_error_code(std::errc::io_error);
+        }
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            throw std::runtime_error("Error: Could not replace file " + filename);
+        }
+        diskStorage::syncDirectory(filename);
+        unsavedBits.fill(0);
+        return true;
+    }
+
+    // open the file
+    // a file that is still mapped must not be truncated so it is overwritten in place
+    auto openMode = sameFile ? std::ios::binary | std::ios::in | std::ios::out : std::ios::binary | std::ios::out | std::ios::trunc;
+    std::fstream outFile(filename.c_str(), openMode);
+    if (!outFile) {
+        throw std::runtime_error("Error: Could not open file for writing");
+    }
+    // write all the data, a short write keeps the changes unsaved
+    auto written = writeImage(outFile);
+    outFile.close();
+    if (!written || outFile.fail()) {
+        throw std::runtime_error("Error: Could not write file " + filename);
+    }
+    unsavedBits.fill(0);
+    return true;
+}
+
+/// <summary>
+/// write the whole image to a stream, as save writes it to a file
+/// the disk still counts its changes as unsaved
+/// </summary>
+/// <param name="out">stream to write to</param>
+/// <returns>true if successful</returns>
+bool d64::save(std::ostream& out) const
+{
+    D64_TRACE(traceOperation::trace_save);
+    return writeImage(out);
+}
+
+/// <summary>
+/// write the image and its error bytes if it has them
+/// </summary>
+/// <param name="out">stream to write to</param>
+/// <returns>true if successful</returns>
+bool d64::writeImage(std::ostream& out) const
+{
+    if (!storage->write(out)) {
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(errorInfo.data()), errorInfo.size());
+    return out.good();
+}
+
+/// <summary>
+/// error code of a sector from the error bytes of the image file
+/// </summary>
+/// <param name="track">track number</param>
+/// <param name="sector">sector number</param>
+/// <returns>1541 error code, 1 (no error) if the image has no error bytes</returns>
+uint8_t d64::sectorError(int track, int sector) const
+{
+    auto index = sectorIndex(track, sector);
+    return errorInfo.empty() ? 1 : errorInfo[index];
+}
+
+/// <summary>
+/// set the error bytes saved after the image
+/// a write through mapping keeps the error bytes already in its file
+/// </summary>
+/// <param name="codes">one error code per sector, empty to save the image without them</param>
+void d64::setErrorInfo(std::span<const uint8_t> codes)
+{
+    if (!codes.empty() && codes.size() != storage->size() / SECTOR_SIZE) {
+        throw std::invalid_argument("Error: Need one error code for each of the " + std::to_string(storage->size() / SECTOR_SIZE) + " sectors");
+    }
+    errorInfo.assign(codes.begin(), codes.end());
+}
+
+/// <summary>
+/// save only the sectors changed since the image was loaded or saved
+/// filename must hold the image as it was then
+/// a journaled save writes the sectors to a journal first, load finishes a save that was cut short
+/// </summary>
+/// <param name="filename">name of the .d64 file to update</param>
+/// <param name="mode">how to write the file</param>
+/// <returns>true if sucessful</returns>
+bool d64::saveIncremental(std::string filename, saveMode mode)
+{
+    D64_TRACE(traceOperation::trace_save);
+    // a write through mapping of the same file only needs a flush
+    if (storage->writesThrough(filename)) {
+        if (!storage->sync()) {
+            throw std::runtime_error("Error: Could not flush disk image");
+        }
+        unsavedBits.fill(0);
+        return true;
+    }
+
+    // nothing can have changed in a read only mapping of the same file
+    if (storage->mappedFrom(filename) && !storage->writable()) {
+        return true;
+    }
+
+    auto runs = unsavedRuns();
+    if (runs.empty()) {
+        return true;
+    }
+
+    recoverJournal(filename);
+    auto journaled = mode == saveMode::save_journaled;
+    if (journaled) {
+        writeJournal(filename);
+    }
+
+    // a failed write leaves the journal for the next load
+    if (!storage->writeSectors(filename, runs, journaled, errorInfo.size())) {
+        throw std::runtime_error("Error: Could not update disk image " + filename);
+    }
+
+    // replaying a journal that is left behind writes the same bytes again
+    if (journaled) {
+        std::error_code ec;
+        std::filesystem::remove(journalName(filename), ec);
+    }
+    unsavedBits.fill(0);
+    return true;
+}
+
+/// <summary>
+/// 64 bit hash of a block of bytes
+/// this is XXH64, four independent lanes over 32 byte stripes
+/// </summary>
+/// <param name="bytes">bytes to hash</param>
+/// <param name="seed">starting value</param>
+/// <returns>hash of the bytes</returns>
+uint64_t d64::hash64(std::span<const uint8_t> bytes, uint64_t seed)
+{
+    constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t P3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+    auto read64 = [](const uint8_t* p) { uint64_t v; std::memcpy(&v, p, sizeof(v)); return v; };
+    auto read32 = [](const uint8_t* p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; };
+    auto round = [](uint64_t acc, uint64_t input) { return std::rotl(acc + input * P2, 31) * P1; };
+    auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * P1 + P4; };
+
+    auto p = bytes.data();
+    auto end = p + bytes.size();
+    uint64_t hash;
+
+    if (bytes.size() >= 32) {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+    }
+    else {
+        hash = seed + P5;
+    }
+    hash += bytes.size();
+
+    for (; end - p >= 8; p += 8) {
+        hash = std::rotl(hash ^ round(0, read64(p)), 27) * P1 + P4;
+    }
+    if (end - p >= 4) {
+        hash = std::rotl(hash ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash = std::rotl(hash ^ (*p * P5), 11) * P1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= P2;
+    hash ^= hash >> 29;
+    hash *= P3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/// <summary>
+/// hash of the data bytes of a sector, the bytes after the link
+/// the hash is kept until the sector is written
+/// </summary>
+/// <param name="index">sector number counted from the start of the image</param>
+/// <returns>hash of the data bytes</returns>
+uint64_t d64::dataHash(int index) const
+{
+    // readers sharing the disk may hash the same sector at once, they store the same value
+    auto bit = uint64_t(1) << (index & 63);
+    std::atomic_ref<uint64_t> hashed(hashedSectors[index >> 6]);
+    std::atomic_ref<uint64_t> hash(dataHashes[index]);
+    if (!(hashed.load(std::memory_order_acquire) & bit)) {
+        hash.store(hash64(std::span<const uint8_t>(sectorForRead(index) + sizeof(trackSector), DATA_BYTES)), std::memory_order_relaxed);
+        hashed.fetch_or(bit, std::memory_order_release);
+    }
+    return hash.load(std::memory_order_relaxed);
+}
+
+/// <summary>
+/// fingerprint of all of the bytes of a sector
+/// </summary>
+/// <param name="track">track number</param>
+/// <param name="sector">sector number</param>
+/// <returns>64 bit fingerprint</returns>
+uint64_t d64::sectorFingerprint(int track, int sector) const
+{
+    return sectorHash(sectorIndex(track, sector));
+}
+
+/// <summary>
+/// hash of a sector from its link and the hash of its data bytes
+/// </summary>
+/// <param name="index">sector number counted from the start of the image</param>
+/// <returns>hash of the sector</returns>
+uint64_t d64::sectorHash(int index) const
+{
+    auto link = reinterpret_cast<const trackSector*>(sectorForRead(index));
+    return combineHash(dataHash(index), (link->track << 8) | link->sector);
+}
+
+/// <summary>
+/// fingerprint of the data of a file
+/// the same data gives the same fingerprint on any disk and from dataFingerprint
+/// </summary>
+/// <param name="entry">directory entry of the file</param>
+/// <returns>64 bit fingerprint</returns>
+uint64_t d64::fileFingerprint(const directoryEntry& entry) const
+{
+    uint64_t hash = 0;
+    size_t length = 0;
+    walkFileChain(entry, [&](trackSector location, const struct sector& current)
+        {
+            // a full sector uses the hash kept for it
+            auto bytes = chainBytes(current);
+            hash = combineHash(hash, bytes == DATA_BYTES ?
+                dataHash(uncheckedIndex(location.track, location.sector)) :
+                hash64(std::span<const uint8_t>(current.data.data(), bytes)));
+            length += bytes;
+        });
+    return combineHash(hash, length);
+}
+
+/// <summary>
+/// fingerprint of the data of a file
+/// </summary>
+/// <param name="filename">file to fingerprint</param>
+/// <returns>64 bit fingerprint or nullopt if the file is not found</returns>
+std::optional<uint64_t> d64::fileFingerprint(std::string_view filename) const
+{
+    auto slot = findSlot(filename);
+    if (!slot.has_value()) {
+        return std::nullopt;
+    }
+    return fileFingerprint(*std::as_const(*this).getDirectoryEntryPtr(slot.value()));
+}
+
+/// <summary>
+/// fingerprint file data that is not on a disk
+/// it matches fileFingerprint of the same data stored on any disk
+/// </summary>
+/// <param name="fileData">bytes of a file</param>
+/// <returns>64 bit fingerprint</returns>
+uint64_t d64::dataFingerprint(std::span<const uint8_t> fileData)
+{
+    uint64_t hash = 0;
+    for (size_t offset = 0; offset < fileData.size(); offset += DATA_BYTES) {
+        hash = combineHash(hash, hash64(fileData.subspan(offset, std::min(DATA_BYTES, fileData.size() - offset))));
+    }
+    return combineHash(hash, fileData.size());
+}
+
+/// <summary>
+/// fingerprint of the whole image
+/// only the sectors written since the last call are hashed again
+/// </summary>
+/// <returns>64 bit fingerprint</returns>
+uint64_t d64::imageFingerprint() const
+{
+    auto sectors = static_cast<int>(storage->size() / SECTOR_SIZE);
+    uint64_t hash = sectors;
+    for (auto index = 0; index < sectors; ++index) {
+        hash = combineHash(hash, sectorHash(index));
+    }
+    return hash;
+}
+
+/// <summary>
+/// checksum that tells a whole journal from one cut short
+/// </summary>
+/// <param name="bytes">bytes to check</param>
+/// <returns>64 bit FNV-1a hash</returns>
+uint64_t d64::journalChecksum(std::span<const uint8_t> bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (auto byte : bytes) {
+        hash = (hash ^ byte) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/// <summary>
+/// write the unsaved sectors to the journal of an image file and wait until it is on the disk
+/// the journal is the patch from exportPatch followed by its checksum
+/// </summary>
+/// <param name="filename">image file the journal is for</param>
+void d64::writeJournal(const std::string& filename)
+{
+    auto journal = exportPatch();
+    auto checksum = journalChecksum(journal);
+    for (auto i = 0; i < 8; ++i) {
+        journal.push_back(static_cast<uint8_t>(checksum >> (i * 8)));
+    }
+
+    auto name = journalName(filename);
+    std::ofstream outFile(name, std::ios::binary | std::ios::trunc);
+    outFile.write(reinterpret_cast<const char*>(journal.data()), journal.size());
+    outFile.close();
+    if (outFile.fail() || !diskStorage::syncFile(name) || !diskStorage::syncDirectory(name)) {
+        throw std::runtime_error("Error: Could not write journal " + name);
+    }
+}
+
+/// <summary>
+/// finish a journaled save that was cut short
+/// a whole journal is written into the image, one cut short is dropped as the image was not touched yet
+/// </summary>
+/// <param name="filename">image file to recover</param>
+/// <returns>true if a journal was replayed</returns>
+bool d64::recoverJournal(const std::string& filename)
+{
+    auto name = journalName(filename);
+    std::error_code ec;
+    if (!std::filesystem::exists(name, ec)) {
+        return false;
+    }
+
+    std::ifstream inFile(name, std::ios::binary);
+    std::vector<uint8_t> journal((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+    inFile.close();
+
+    auto replayed = false;
+    std::vector<std::pair<sectorRun, size_t>> runs;
+    // the journal covers the image, not the error bytes that may follow it
+    auto fileSize = std::filesystem::file_size(filename, ec);
+    auto format = ec ? nullptr : diskFormat::fromFileSize(fileSize);
+    if (format != nullptr && journal.size() > 8) {
+        auto size = format->imageSize;
+        auto patch = std::span<const uint8_t>(journal).first(journal.size() - 8);
+        uint64_t checksum = 0;
+        for (auto i = 0; i < 8; ++i) {
+            checksum |= uint64_t(journal[patch.size() + i]) << (i * 8);
+        }
+
+        if (checksum == journalChecksum(patch) && parsePatch(patch, size / SECTOR_SIZE, runs)) {
+            vectorStorage image(size);
+            for (auto& [run, offset] : runs) {
+                std::copy_n(patch.begin() + offset, run.count * SECTOR_SIZE, image.data() + run.first * SECTOR_SIZE);
+            }
+
+            std::vector<sectorRun> sectors;
+            for (auto& entry : runs) {
+                sectors.push_back(entry.first);
+            }
+            if (!image.writeSectors(filename, sectors, true, fileSize - size)) {
+                throw std::runtime_error("Error: Could not replay journal " + name);
+            }
+            replayed = true;
+        }
+    }
+
+    if (!replayed) {
+        errorLog() << "Warning: Dropped incomplete journal " << name << std::endl;
+    }
+    std::filesystem::remove(name, ec);
+    diskStorage::syncDirectory(name);
+    return replayed;
+}
+
+/// <summary>
+/// number of sectors changed since the image was loaded or saved
+/// </summary>
+size_t d64::unsavedSectors() const
+{
+    size_t count = 0;
+    for (auto bits : unsavedBits) {
+        count += std::popcount(bits);
+    }
+    return count;
+}
+
+/// <summary>
+/// get the changed sectors as runs of consecutive sectors
+/// </summary>
+/// <returns>runs in sector order</returns>
+std::vector<sectorRun> d64::unsavedRuns() const
+{
+    std::vector<sectorRun> runs;
+    auto sectors = storage->size() / SECTOR_SIZE;
+    for (size_t index = 0; index < sectors; ++index) {
+        if (!((unsavedBits[index >> 6] >> (index & 63)) & 1)) continue;
+        if (!runs.empty() && runs.back().first + runs.back().count == index) {
+            ++runs.back().count;
+        }
+        else {
+            runs.push_back({ index, 1 });
+        }
+    }
+    return runs;
+}
+
+/// <summary>
+/// Export the sectors changed since the image was loaded or saved
+/// the patch is "D64P", a version byte, the image size in sectors and the number of runs,
+/// then for each run the first sector, the sector count and the sector bytes
+/// numbers are 16 bit little endian
+/// </summary>
+/// <returns>patch for applyPatch</returns>
+std::vector<uint8_t> d64::exportPatch() const
+{
+    auto runs = unsavedRuns();
+    std::vector<uint8_t> patch = { 'D', '6', '4', 'P', PATCH_VERSION };
+    auto put16 = [&](size_t value)
+        {
+            patch.push_back(static_cast<uint8_t>(value));
+            patch.push_back(static_cast<uint8_t>(value >> 8));
+        };
+    put16(storage->size() / SECTOR_SIZE);
+    put16(runs.size());
+    for (auto& run : runs) {
+        put16(run.first);
+        put16(run.count);
+        for (auto index = run.first; index < run.first + run.count; ++index) {
+            auto bytes = sectorForRead(static_cast<int>(index));
+            patch.insert(patch.end(), bytes, bytes + SECTOR_SIZE);
+        }
+    }
+    return patch;
+}
+
+/// <summary>
+/// Check a patch from exportPatch and find its runs
+/// </summary>
+/// <param name="patch">patch to check</param>
+/// <param name="sectors">number of sectors in the image it is for</param>
+/// <param name="runs">out each run with the offset of its sector bytes in the patch</param>
+/// <returns>true if the whole patch is valid for the image</returns>
+bool d64::parsePatch(std::span<const uint8_t> patch, size_t sectors, std::vector<std::pair<sectorRun, size_t>>& runs)
+{
+    size_t pos = 5;
+    auto get16 = [&](size_t& value)
+        {
+            if (patch.size() - pos < 2) return false;
+            value = patch[pos] | (patch[pos + 1] << 8);
+            pos += 2;
+            return true;
+        };
+
+    size_t imageSectors = 0;
+    size_t count = 0;
+    if (patch.size() < pos || !std::equal(patch.begin(), patch.begin() + 4, "D64P") || patch[4] != PATCH_VERSION ||
+        !get16(imageSectors) || imageSectors != sectors || !get16(count)) {
+        return false;
+    }
+
+    runs.clear();
+    for (size_t i = 0; i < count; ++i) {
+        sectorRun run{};
+        if (!get16(run.first) || !get16(run.count) || run.first + run.count > sectors ||
+            patch.size() - pos < run.count * SECTOR_SIZE) {
+            return false;
+        }
+        runs.emplace_back(run, pos);
+        pos += run.count * SECTOR_SIZE;
+    }
+    return pos == patch.size();
+}
+
+/// <summary>
+/// Write the sectors of a patch from exportPatch into the disk
+/// nothing is written unless the whole patch is valid for this disk
+/// </summary>
+/// <param name="patch">patch to apply</param>
+/// <returns>true if sucessful</returns>
+bool d64::applyPatch(std::span<const uint8_t> patch)
+{
+    checkWritable();
+
+    // check the header and every run before changing anything
+    std::vector<std::pair<sectorRun, size_t>> runs;
+    if (!parsePatch(patch, storage->size() / SECTOR_SIZE, runs)) {
+        errorLog() << "Error: Invalid patch" << std::endl;
+        return false;
+    }
+
+    for (auto& [run, offset] : runs) {
+        for (size_t i = 0; i < run.count; ++i) {
+            auto bytes = patch.subspan(offset + i * SECTOR_SIZE, SECTOR_SIZE);
+            std::copy(bytes.begin(), bytes.end(), sectorForWrite(static_cast<int>(run.first + i)));
+        }
+    }
+
+    // the directory and BAM may have changed underneath
+    invalidateNameIndex();
+    freeMapValid = false;
+    return true;
+}
+
+/// <summary>
+/// load a disk image
+/// </summary>
+/// <param name="filename">name of .d64 file to load</param>
 /// <returns>true if sucessful</returns>
 bool d64::load(std::string filename)
 {
+    D64_TRACE(traceOperation::trace_load);
     try {
+        // finish a journaled save that was cut short
+        recoverJournal(filename);
+
         // open the file
         std::ifstream inFile(filename, std::ios::binary);
         if (!inFile) {
@@ -1007,20 +2857,23 @@ bool d64::load(std::string filename)
         auto pos = inFile.tellg();
 
         inFile.seekg(0, std::ios::beg);
-        if (pos != D64_DISK35_SZ && pos != D64_DISK40_SZ) {
-            throw std::invalid_argument("Invalid disk size");
-        }
-        disktype = (pos == D64_DISK35_SZ) ? diskType::thirty_five_track : diskType::forty_track;
+        openedFormat(static_cast<size_t>(pos));
 
-        // allocate the disk
-        init_disk();
-
-        // read the data
-        inFile.read(reinterpret_cast<char*>(data.data()), data.size());
+        // read the data straight into a new image
+        // there is no need to format it first as every byte is overwritten
+        // error bytes are read with it and split off when the image is attached
+        auto image = std::make_unique<vectorStorage>(static_cast<size_t>(pos));
+        inFile.read(reinterpret_cast<char*>(image->data()), image->size());
+        if (!inFile) {
+            throw std::ios_base::failure("Error: Could not read disk file " + filename);
+        }
 
         // close the file
         inFile.close();
 
+        // use the image as the disk
+        attachStorage(std::move(image));
+
         // validate the disk
         if (!validateD64()) {
             formatDisk("NEW DISK");
@@ -1029,16 +2882,61 @@ bool d64::load(std::string filename)
         return true;
     }
     catch (const std::ios_base::failure& e) {
-        std::cerr << "I/O error: " << e.what() << std::endl;
+        errorLog() << "I/O error: " << e.what() << std::endl;
+    }
+    catch (const std::invalid_argument& e) {
+        errorLog() << "Invalid argument: " << e.what() << std::endl;
+    }
+    catch (const std::runtime_error& e) {
+        errorLog() << "Runtime error: " << e.what() << std::endl;
+    }
+    catch (const std::exception& e) {
+        errorLog() << "Error: " << e.what() << std::endl;
+    }
+    return false;
+}
+
+/// <summary>
+/// map a disk image
+/// the image is used in place without copying or formatting
+/// </summary>
+/// <param name="filename">name of .d64 file to map</param>
+/// <param name="mode">how to map the file</param>
+/// <returns>true if sucessful</returns>
+bool d64::load(std::string filename, mapMode mode)
+{
+    D64_TRACE(traceOperation::trace_load);
+    try {
+        // finish a journaled save that was cut short
+        recoverJournal(filename);
+
+        // map the file
+        auto image = mappedStorage::open(filename, mode);
+        if (!image) {
+            throw std::ios_base::failure("Error: Could not map disk file " + filename);
+        }
+        openedFormat(image->size());
+
+        // use the mapping as the disk
+        // error bytes stay in the file past the end of the image
+        attachStorage(std::move(image));
+
+        // validate the disk
+        // throws if invalid, a mapped image is never reformatted
+        validateD64();
+        return true;
+    }
+    catch (const std::ios_base::failure& e) {
+        errorLog() << "I/O error: " << e.what() << std::endl;
     }
     catch (const std::invalid_argument& e) {
-        std::cerr << "Invalid argument: " << e.what() << std::endl;
+        errorLog() << "Invalid argument: " << e.what() << std::endl;
     }
     catch (const std::runtime_error& e) {
-        std::cerr << "Runtime error: " << e.what() << std::endl;
+        errorLog() << "Runtime error: " << e.what() << std::endl;
     }
     catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        errorLog() << "Error: " << e.what() << std::endl;
     }
     return false;
 }
@@ -1051,41 +2949,34 @@ bool d64::load(std::string filename)
 /// <returns>true if successful. If the sector is already free false</returns>
 bool d64::freeSector(const int& track, const int& sector)
 {
+    checkWritable();
+
     // validate track sector number
     if (!isValidTrackSector(track, sector)) {
         throw std::runtime_error("Invalid Tack and Sector TRACK:" + std::to_string(track) + " SECTOR:" + std::to_string(sector));
     }
     if (track == DIRECTORY_TRACK && sector == DIRECTORY_SECTOR) {
-        std::cerr << "Warning: Attempt to free directory sector ignored (Track 18, Sector 1)\n";
+        errorLog() << "Warning: Attempt to free directory sector ignored (Track 18, Sector 1)\n";
         return false;
     }
     if (track == DIRECTORY_TRACK && sector == BAM_SECTOR) {
-        std::cerr << "Warning: Attempt to free directory sector ignored (Track 18, Sector 0)\n";
+        errorLog() << "Warning: Attempt to free directory sector ignored (Track 18, Sector 0)\n";
         return false;
     }
 
     // calculate byte of BAM entry for track
     // its stored as a bitmap of 3 bytes. 1 if free and 0 if allocated    
-    if (bamtrack(track - 1)->test(sector))
+    if (std::as_const(*this).bamtrack(track - 1)->test(sector))
         return false;
     
     bamtrack(track - 1)->set(sector);   // mark track sector as free 
     bamtrack(track - 1)->free++;            // increment free
+    refreshFreeMap(track);
+    dirtyBamTracks |= uint64_t(1) << (track - 1);
 
     return true;
 }
 
-/// <summary>
-/// Check the validity of the track and sector number
-/// </summary>
-/// <param name="track">track number to check</param>
-/// <param name="sector">sector number to check</param>
-/// <returns>true if valid</returns>
-bool d64::isValidTrackSector(int track, int sector) const
-{
-    return track >= 1 && track <= TRACKS && sector >= 0 && sector < SECTORS_PER_TRACK[track - 1];
-}
-
 /// <summary>
 /// allocate a sector
 /// </summary>
@@ -1094,84 +2985,222 @@ bool d64::isValidTrackSector(int track, int sector) const
 /// <returns>true if successful. If the sector is already allocated return false</returns>
 bool d64::allocateSector(const int& track, const int& sector)
 {
+    checkWritable();
+
     // validate track sector number
     if (!isValidTrackSector(track, sector)) {
         throw std::runtime_error("Invalid Tack and Sector TRACK:" + std::to_string(track) + " SECTOR:" + std::to_string(sector));
     }
 
-    if (!bamtrack(track - 1)->test(sector))
+    if (!std::as_const(*this).bamtrack(track - 1)->test(sector))
         return false;
 
     bamtrack(track - 1)->reset(sector); // mark track sector as ALLOCATED 
     bamtrack(track - 1)->free--;        // decrement free
+    refreshFreeMap(track);
+    dirtyBamTracks |= uint64_t(1) << (track - 1);
 
     return true;
 }
 
 /// <summary>
-/// Find and allocate a sector in provided track
+/// Find and allocate a sector in provided track
+/// </summary>
+/// <param name="track">track to search for free sector</param>
+/// <param name="sector">out found sector if sucessful</param>
+/// <returns>true if successful</returns>
+bool d64::findAndAllocateFreeOnTrack(int track, int& sector)
+{
+    if (track < 1 || track > TRACKS) {
+        throw std::runtime_error("Invalid Tack TRACK:" + std::to_string(track));
+    }
+
+    // if there are no free sectors in the track go to next track
+    D64_COUNT(bamProbes, 1);
+    auto count = SECTORS_PER_TRACK[track - 1];
+    auto all = (1u << count) - 1;
+    auto freeBits = std::as_const(*this).bamtrack(track - 1)->mask() & all;
+    if (std::as_const(*this).bamtrack(track - 1)->free < 1 || freeBits == 0) {
+        D64_COUNT(bamProbeMisses, 1);
+        return false;
+    }
+
+    // rotate the free bits so the interleaved start sector is bit 0
+    // the lowest set bit is then the first free sector at or after it
+    auto start_sector = (lastSectorUsed[track - 1] + allocation.interleave) % count;
+    auto rotated = ((freeBits >> start_sector) | (freeBits << (count - start_sector))) & all;
+    auto search_sector = start_sector + std::countr_zero(rotated);
+    if (search_sector >= count)
+        search_sector -= count; // Wrap around
+
+    allocateSector(track, search_sector);
+    sector = search_sector;
+    // update the last sector used for the track
+    lastSectorUsed[track - 1] = sector;
+    return true;
+}
+
+/// <summary>
+/// Find and allocate a sector
+/// the track comes from the allocation strategy, the sector from the interleave
+/// </summary>
+/// <param name="track">out track number</param>
+/// <param name="sector">out sector number</param>
+/// <returns>true if successful</returns>
+bool d64::findAndAllocateFreeSector(int& track, int& sector)
+{
+    if (!freeMapValid) {
+        rebuildFreeMap();
+    }
+
+    auto t = chooseAllocationTrack();
+    if (t == 0 || !findAndAllocateFreeOnTrack(t, sector))
+        return false;
+
+    track = t;
+    allocationTrack = t;
+    if (allocationRemaining > 0) {
+        --allocationRemaining;
+    }
+    return true;
+}
+
+/// <summary>
+/// Pick the track for the next sector with the allocation strategy
+/// the free map must be valid
+/// </summary>
+/// <returns>track number or 0 if the disk is full</returns>
+int d64::chooseAllocationTrack() const
+{
+    auto tracks = freeTracks & ((uint64_t(1) << TRACKS) - 1);
+    if (tracks == 0)
+        return 0;
+
+    auto nearest = [&](bool outerFirst)
+        {
+            for (size_t i = 0; i < TRACK_40_SEARCH_ORDER.size(); ++i) {
+                auto t = TRACK_40_SEARCH_ORDER[outerFirst ? TRACK_40_SEARCH_ORDER.size() - 1 - i : i];
+                if (tracks & (uint64_t(1) << (t - 1)))
+                    return t;
+            }
+            return 0;
+        };
+
+    // a file stays on its track while the track has room
+    auto current = allocationTrack > 0 && (tracks & (uint64_t(1) << (allocationTrack - 1)));
+
+    switch (allocation.strategy) {
+    case allocationStrategy::allocate_first_fit:
+        return std::countr_zero(tracks) + 1;
+
+    case allocationStrategy::allocate_best_fit: {
+        if (current)
+            return allocationTrack;
+
+        // the closest fit for what is left of the file, else the emptiest track
+        auto best = 0, bestFree = 0;
+        auto fits = false;
+        for (auto t : TRACK_40_SEARCH_ORDER) {
+            if (!(tracks & (uint64_t(1) << (t - 1))))
+                continue;
+            auto free = std::popcount(freeMap[t - 1]);
+            auto fit = static_cast<size_t>(free) >= allocationRemaining;
+            if (best == 0 || (fit && (!fits || free < bestFree)) || (!fit && !fits && free > bestFree)) {
+                best = t;
+                bestFree = free;
+                fits = fit;
+            }
+        }
+        return best;
+    }
+
+    case allocationStrategy::allocate_banded:
+        if (current)
+            return allocationTrack;
+        return nearest(allocationSectors > static_cast<size_t>(allocation.bandSectors));
+
+    case allocationStrategy::allocate_extended_first:
+        if (tracks >> TRACKS_35)
+            return std::countr_zero(tracks >> TRACKS_35) + TRACKS_35 + 1;
+        return nearest(false);
+
+    default:
+        return nearest(false);
+    }
+}
+
+/// <summary>
+/// Tell the allocator a new file starts
 /// </summary>
-/// <param name="track">track to search for free sector</param>
-/// <param name="sector">out found sector if sucessful</param>
-/// <returns>true if successful</returns>
-bool d64::findAndAllocateFreeOnTrack(int track, int& sector)
+/// <param name="sectors">data sectors of the file</param>
+void d64::beginFileAllocation(size_t sectors)
 {
-    if (track < 1 || track > TRACKS) {
-        throw std::runtime_error("Invalid Tack TRACK:" + std::to_string(track));
-    }
-
-    // if there are no free sectors in the track go to next track
-    if (bamtrack(track - 1)->free < 1) 
-        return false;
-
-    auto start_sector = (lastSectorUsed[track - 1] + INTERLEAVE) % SECTORS_PER_TRACK[track - 1];
+    allocationTrack = 0;
+    allocationSectors = sectors;
+    allocationRemaining = sectors;
+}
 
-    // find the free sector
-    for (auto i = 0; i < SECTORS_PER_TRACK[track - 1]; ++i) {
-        int search_sector = (start_sector + i) % SECTORS_PER_TRACK[track - 1]; // Wrap around
+/// <summary>
+/// Set the allocation policy used for every file added from now on
+/// </summary>
+/// <param name="policy">interleave and strategy</param>
+void d64::setAllocationPolicy(const allocationPolicy& policy)
+{
+    checkAllocationPolicy(policy);
+    allocation = policy;
+}
 
-        // see if sector is free
-        if (bamtrack(track - 1)->test(search_sector)) {
-            allocateSector(track, search_sector);
-            sector = search_sector;
-            // update the last sector used for the track
-            lastSectorUsed[track - 1] = sector;
-            return true;
-        }
+/// <summary>
+/// Throw std::invalid_argument for a policy the allocator cannot use
+/// </summary>
+/// <param name="policy">policy to check</param>
+void d64::checkAllocationPolicy(const allocationPolicy& policy)
+{
+    if (policy.interleave < 1) {
+        throw std::invalid_argument("Invalid interleave");
+    }
+    if (policy.strategy > allocationStrategy::allocate_extended_first) {
+        throw std::invalid_argument("Invalid allocation strategy");
+    }
+    if (policy.bandSectors < 0) {
+        throw std::invalid_argument("Invalid band size");
     }
-    return false;
 }
 
 /// <summary>
-/// Find and allocate a sector
+/// Get the number of sectors that can still be allocated
+/// this includes the directory track
 /// </summary>
-/// <param name="track">out track number</param>
-/// <param name="sector">out sector number</param>
-/// <returns>true if successful</returns>
-bool d64::findAndAllocateFreeSector(int& track, int& sector)
+/// <returns>number of allocatable sectors</returns>
+int d64::availableSectors() const
 {
-    static const std::array<int, 40> TRACK_40_SEARCH_ORDER = {
-        18, 17, 19, 16, 20, 15, 21, 14, 22, 13, 23, 12, 24, 11, 25, 10, 26, 9,
-        27, 8, 28, 7, 29, 6, 30, 5, 31, 4, 32, 3, 33, 2, 34, 1, 35, 36, 37, 38, 39, 40
-    };
-
-    for (auto& t : TRACK_40_SEARCH_ORDER) {
-        if (disktype == diskType::thirty_five_track && t > TRACKS_35)
-            continue;
-        if (findAndAllocateFreeOnTrack(t, sector)) {
-            track = t;
-            return true;
-        }
+    int available = 0;
+    for (auto t = 1; t <= TRACKS; ++t) {
+        auto bam = bamtrack(t - 1);
+        auto all = (1u << SECTORS_PER_TRACK[t - 1]) - 1;
+        available += std::min<int>(bam->free, std::popcount(bam->mask() & all));
     }
+    return available;
+}
 
-    return false;
+/// <summary>
+/// Rebuild the free map of every track from the BAM
+/// </summary>
+void d64::rebuildFreeMap()
+{
+    freeMap.fill(0);
+    freeTracks = 0;
+    for (auto t = 1; t <= TRACKS; ++t) {
+        refreshFreeMap(t);
+    }
+    freeMapValid = true;
 }
 
 /// <summary>
 /// Get the number of free sectors
 /// </summary>
 /// <returns>number of free sectors</returns>
-uint16_t d64::getFreeSectorCount()
+uint16_t d64::getFreeSectorCount() const
 {
     // init free to 0
     uint16_t free = 0;
@@ -1184,7 +3213,7 @@ uint16_t d64::getFreeSectorCount()
             continue;
 
         // add the free bytes of each track
-        free += static_cast<uint16_t>(bamtrack(t - 1)->free);
+        free += static_cast<uint16_t>(std::as_const(*this).bamtrack(t - 1)->free);
     }
     return free;
 }
@@ -1200,6 +3229,7 @@ void d64::initializeBAMFields(std::string_view name)
     if (!diskBamPtr) {
         throw std::runtime_error("Invalid BAM pointer");
     }
+    markWritten(sectorIndex(DIRECTORY_TRACK, BAM_SECTOR));
 
     diskBamPtr->dirStart.track = DIRECTORY_TRACK;
     diskBamPtr->dirStart.sector = DIRECTORY_SECTOR;
@@ -1242,6 +3272,96 @@ std::string d64::Trim(const char filename[FILE_NAME_SZ])
     return name;
 }
 
+/// <summary>
+/// Make the directory key for a file name
+/// </summary>
+/// <param name="filename">name to convert</param>
+/// <returns>key or nullopt if no directory entry can have the name</returns>
+std::optional<fileNameKey> d64::makeNameKey(std::string_view filename)
+{
+    if (filename.size() > FILE_NAME_SZ || filename.find(static_cast<char>(A0_VALUE)) != std::string_view::npos) {
+        return std::nullopt;
+    }
+    fileNameKey key;
+    key.name.fill(static_cast<char>(A0_VALUE));
+    std::copy(filename.begin(), filename.end(), key.name.begin());
+    return key;
+}
+
+/// <summary>
+/// Make the directory key for a directory entry
+/// the name ends at the first A0
+/// </summary>
+/// <param name="entry">entry to convert</param>
+/// <returns>key</returns>
+fileNameKey d64::makeNameKey(const directoryEntry& entry)
+{
+    fileNameKey key;
+    auto end = std::find(entry.fileName, entry.fileName + FILE_NAME_SZ, static_cast<char>(A0_VALUE));
+    auto it = std::copy(entry.fileName, end, key.name.begin());
+    std::fill(it, key.name.end(), static_cast<char>(A0_VALUE));
+    return key;
+}
+
+/// <summary>
+/// Build the name index from the directory
+/// </summary>
+void d64::buildNameIndex() const
+{
+    nameIndex.clear();
+    nameIndexDuplicates = false;
+
+    // the directory chain stops at a bad link so a corrupt image can still be searched
+    for (auto& ts : directoryChain()) {
+        auto dirSectorPtr = std::as_const(*this).getDirectory_SectorPtr(ts.track, ts.sector);
+        D64_COUNT(directoryEntriesScanned, FILES_PER_SECTOR);
+        for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+            auto& entry = dirSectorPtr->fileEntry[i];
+            if (entry.file_type.closed == 0) {
+                continue;
+            }
+
+            // the first entry in the chain wins
+            if (!nameIndex.try_emplace(makeNameKey(entry), ts.track, ts.sector, i).second) {
+                nameIndexDuplicates = true;
+            }
+        }
+    }
+    std::atomic_ref<bool>(nameIndexValid).store(true, std::memory_order_release);
+}
+
+/// <summary>
+/// Add a directory entry to the name index
+/// </summary>
+/// <param name="entry">entry to add</param>
+/// <param name="slot">location of the entry</param>
+void d64::indexName(const directoryEntry& entry, const directorySlot& slot)
+{
+    if (!nameIndexValid) return;
+
+    // a second file with the same name may sit ahead of the first in the chain
+    // let the next lookup rebuild the index from the directory
+    if (!nameIndex.try_emplace(makeNameKey(entry), slot).second) {
+        invalidateNameIndex();
+    }
+}
+
+/// <summary>
+/// Remove a directory entry from the name index
+/// </summary>
+/// <param name="entry">entry to remove</param>
+void d64::unindexName(const directoryEntry& entry)
+{
+    if (!nameIndexValid) return;
+
+    // another entry with the same name would take its place
+    if (nameIndexDuplicates) {
+        invalidateNameIndex();
+        return;
+    }
+    nameIndex.erase(makeNameKey(entry));
+}
+
 /// <summary>
 /// Move a file to the top of the directory list
 /// </summary>
@@ -1249,17 +3369,20 @@ std::string d64::Trim(const char filename[FILE_NAME_SZ])
 /// <returns>true on success</returns>
 bool d64::movefileFirst(std::string file)
 {
-    std::vector<directoryEntry> files = directory();
-    auto it = std::find_if(files.begin(), files.end(), [&](const directoryEntry& entry)
-        {
-            return Trim(entry.fileName) == file;
-        });
+    checkWritable();
+
+    auto slot = findSlot(file);
+    auto view = entries();
+    auto first = view.begin();
+    if (!slot.has_value() || first == view.end())
+        return false;  // File not found
 
-    if (it == files.end() || it == files.begin())
-        return false;  // File not found or already at the top
+    auto top = first.slot();
+    if (slotId(top) == slotId(slot.value()))
+        return false;  // already at the top
 
-    std::iter_swap(files.begin(), it);
-    return reorderDirectory(files);
+    // a single swap of two entries
+    return permuteDirectory({ top, slot.value() }, { 1, 0 });
 }
 
 /// <summary>
@@ -1269,6 +3392,7 @@ bool d64::movefileFirst(std::string file)
 /// <returns>true on success</returns>
 bool d64::lockfile(std::string filename, bool lock)
 {
+    checkWritable();
     auto fileEntry = findFile(filename);
     if (!fileEntry.has_value()) {
         throw std::runtime_error("File not found " + filename);
@@ -1285,27 +3409,28 @@ bool d64::lockfile(std::string filename, bool lock)
 /// <returns>true on success</returns>
 bool d64::reorderDirectory(std::vector<directoryEntry>& files)
 {
-    std::vector<directoryEntry> currentFiles = directory();
+    checkWritable();
 
-    if (currentFiles == files)
+    auto current = entries();
+    if (std::equal(current.begin(), current.end(), files.begin(), files.end()))
         return false;  // No need to rewrite if already in the correct order
 
-    int dir_track = DIRECTORY_TRACK;
-    int dir_sector = DIRECTORY_SECTOR;
-    auto dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-    size_t index = 0;
-
-    while (dir_track != 0 && index < files.size()) {
-        std::fill_n(reinterpret_cast<uint8_t*>(dirSectorPtr), SECTOR_SIZE, 0); // Clear sector
-
-        auto len = std::min(FILES_PER_SECTOR, static_cast<int>(files.size() - index));
-        std::copy_n(files.begin() + index, len, dirSectorPtr->fileEntry);
-        index += len;
+    // every entry is about to move, index them where they land
+    nameIndex.clear();
+    nameIndexDuplicates = false;
+    nameIndexValid = true;
 
-        dir_track = dirSectorPtr->next.track;
-        dir_sector = dirSectorPtr->next.sector;
-        if (dir_track != 0) {
-            dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
+    // fill the directory slots in chain order, the slots past the new entries are emptied
+    const directoryEntry empty{};
+    size_t index = 0;
+    for (auto& ts : directoryChain()) {
+        for (auto i = 0; i < FILES_PER_SECTOR; ++i) {
+            directorySlot slot(ts.track, ts.sector, i);
+            auto& entry = index < files.size() ? files[index++] : empty;
+            placeEntry(slot, entry);
+            if (entry.file_type.closed) {
+                indexName(entry, slot);
+            }
         }
     }
     return true;
@@ -1318,40 +3443,102 @@ bool d64::reorderDirectory(std::vector<directoryEntry>& files)
 /// <returns>true on success</returns>
 bool d64::reorderDirectory(std::function<bool(const directoryEntry&, const directoryEntry&)> compare)
 {
-    // get the current directory entries
-    std::vector<directoryEntry> files = directory();
+    checkWritable();
 
-    if (files.empty())
+    // nothing to do if the directory is already in order
+    auto current = entries();
+    if (current.begin() == current.end() || std::is_sorted(current.begin(), current.end(), compare))
         return false; // No files to reorder
 
-    // Sort files based on user-defined comparison function**
-    std::sort(files.begin(), files.end(), compare);
+    std::vector<directorySlot> slots;
+    for (auto it = current.begin(); it != current.end(); ++it) {
+        slots.push_back(it.slot());
+    }
+
+    // sort the positions, the entries stay where they are until they move
+    std::vector<size_t> order(slots.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+        {
+            return compare(*std::as_const(*this).getDirectoryEntryPtr(slots[a]), *std::as_const(*this).getDirectoryEntryPtr(slots[b]));
+        });
 
     // reorder based on sorted list
-    return reorderDirectory(files);
+    return permuteDirectory(slots, order);
+}
+
+/// <summary>
+/// Move directory entries between slots
+/// the permutation is applied one cycle at a time so only one entry is held aside,
+/// and only entries that change are written
+/// </summary>
+/// <param name="slots">slots of the entries to move</param>
+/// <param name="order">for each slot, the index in slots of the entry that goes there</param>
+/// <returns>true if any entry moved</returns>
+bool d64::permuteDirectory(const std::vector<directorySlot>& slots, const std::vector<size_t>& order)
+{
+    std::vector<bool> done(slots.size(), false);
+    auto moved = false;
+
+    for (size_t start = 0; start < slots.size(); ++start) {
+        if (done[start] || order[start] == start) continue;
+
+        // slots[start] takes the entry from slots[order[start]] and so on round the cycle
+        auto held = readEntry(*std::as_const(*this).getDirectoryEntryPtr(slots[start]));
+        auto i = start;
+        while (true) {
+            done[i] = true;
+            auto from = order[i];
+            if (from == start) {
+                placeEntry(slots[i], held);
+                break;
+            }
+            placeEntry(slots[i], readEntry(*std::as_const(*this).getDirectoryEntryPtr(slots[from])));
+            i = from;
+        }
+        moved = true;
+    }
+
+    if (moved && nameIndexValid) {
+        if (nameIndexDuplicates) {
+            // which of the duplicates comes first may have changed
+            invalidateNameIndex();
+        }
+        else {
+            for (size_t i = 0; i < slots.size(); ++i) {
+                if (order[i] != i) {
+                    nameIndex[makeNameKey(*std::as_const(*this).getDirectoryEntryPtr(slots[i]))] = slots[i];
+                }
+            }
+        }
+    }
+    return moved;
+}
+
+/// <summary>
+/// Put an entry in a directory slot
+/// the sector is only written if the entry differs
+/// </summary>
+/// <param name="slot">slot to fill</param>
+/// <param name="entry">entry to put there</param>
+void d64::placeEntry(const directorySlot& slot, const directoryEntry& entry)
+{
+    if (!sameEntry(*std::as_const(*this).getDirectoryEntryPtr(slot), entry)) {
+        writeEntry(*getDirectoryEntryPtr(slot), entry);
+    }
 }
 
 /// <summary>
 /// return the current directory entries
 /// </summary >
 /// <returns>current directory entries</returns>
-std::vector<directoryEntry> d64::directory()
+std::vector<directoryEntry> d64::directory() const
 {
     std::vector<directoryEntry> files;
 
-    int dir_track = DIRECTORY_TRACK;
-    int dir_sector = DIRECTORY_SECTOR;
-
     // Read all directory entries
-    while (dir_track != 0) {
-        auto dirSectorPtr = getDirectory_SectorPtr(dir_track, dir_sector);
-
-        std::copy_if(dirSectorPtr->fileEntry,
-            dirSectorPtr->fileEntry + FILES_PER_SECTOR,
-            std::back_inserter(files), [&](auto& entry) { return entry.file_type.closed; });
-
-        dir_track = dirSectorPtr->next.track;
-        dir_sector = dirSectorPtr->next.sector;
+    for (auto& entry : entries()) {
+        files.push_back(readEntry(entry));
     }
     return files;
 }
@@ -1363,9 +3550,8 @@ std::vector<directoryEntry> d64::directory()
 bool d64::validateD64()
 {
     // Check file size
-    auto sz = disktype == diskType::thirty_five_track ? D64_DISK35_SZ : D64_DISK40_SZ;
-    if (data.size() != sz) {
-        throw std::runtime_error("Error: Invalid .d64 size (" + std::to_string(data.size()) + " bytes)");
+    if (storage->size() != diskFormat::of(disktype).imageSize) {
+        throw std::runtime_error("Error: Invalid .d64 size (" + std::to_string(storage->size()) + " bytes)");
     }
 
     // Check BAM structure
@@ -1374,8 +3560,9 @@ bool d64::validateD64()
     }
 
     // Check sector data integrity (optional deeper check)
-    auto dir = getTrackSectorPtr(DIRECTORY_TRACK, DIRECTORY_SECTOR);
-    auto valid = dir->track == DIRECTORY_TRACK || (dir->track == 0 && dir->sector == 0xFF);
+    auto dir = std::as_const(*this).getTrackSectorPtr(DIRECTORY_TRACK, DIRECTORY_SECTOR);
+    // once track 18 is full the directory continues on whatever track has room
+    auto valid = isValidTrackSector(dir->track, dir->sector) || (dir->track == 0 && dir->sector == 0xFF);
     if (!valid) {
         throw std::runtime_error("Error: Directory sector does not match expected values");
     }
@@ -1395,7 +3582,7 @@ std::vector<trackSector> d64::parseSideSectors(int sideTrack, int sideSector)
 
     // sideTrack 0 signifies end
     while (sideTrack != 0) {
-        auto sideSectorPtr = getSideSectorPtr(sideTrack, sideSector);
+        auto sideSectorPtr = std::as_const(*this).getSideSectorPtr(sideTrack, sideSector);
 
         // Get Next side-sector location
         uint8_t nextTrack = sideSectorPtr->next.track;
@@ -1416,20 +3603,486 @@ std::vector<trackSector> d64::parseSideSectors(int sideTrack, int sideSector)
     return recordMap;
 }
 
+/// <summary>
+/// Find the side sectors and size of a .REL file
+/// </summary>
+/// <param name="filename">file to open</param>
+/// <returns>where the records of the file are</returns>
+d64::relFile d64::openRelFile(std::string_view filename)
+{
+    auto slot = findSlot(filename);
+    if (!slot.has_value()) {
+        throw std::runtime_error("File not found: " + std::string(filename));
+    }
+    auto& entry = *std::as_const(*this).getDirectoryEntryPtr(slot.value());
+    if (entry.file_type.type != d64FileTypes::REL || entry.recordLength == 0) {
+        throw std::runtime_error("Not a REL file: " + std::string(filename));
+    }
+
+    relFile rel;
+    rel.slot = slot.value();
+    rel.recordLength = entry.recordLength;
+
+    // every side sector lists all of the side sectors
+    auto first = std::as_const(*this).getSideSectorPtr(entry.side.track, entry.side.sector);
+    while (rel.sideCount < SIDE_SECTOR_ENTRY_SIZE && first->sideSectors[rel.sideCount].track != 0) {
+        rel.sides[rel.sideCount] = first->sideSectors[rel.sideCount];
+        ++rel.sideCount;
+    }
+    if (rel.sideCount == 0) {
+        throw std::runtime_error("Missing side sectors: " + std::string(filename));
+    }
+
+    // only the last side sector is partly used
+    auto& lastSide = rel.sides[rel.sideCount - 1];
+    auto last = std::as_const(*this).getSideSectorPtr(lastSide.track, lastSide.sector);
+    size_t used = 0;
+    while (used < SIDE_SECTOR_CHAIN_SZ && last->chain[used].track != 0) {
+        ++used;
+    }
+    rel.sectors = (rel.sideCount - 1) * SIDE_SECTOR_CHAIN_SZ + used;
+
+    // the last data sector holds its length
+    if (rel.sectors > 0) {
+        auto ts = relDataSector(rel, rel.sectors - 1);
+        auto next = reinterpret_cast<const trackSector*>(sectorForRead(sectorIndex(ts.track, ts.sector)));
+        auto length = next->track == 0 && next->sector > 0 ? std::min<size_t>(next->sector - 1, DATA_BYTES) : DATA_BYTES;
+        rel.bytes = (rel.sectors - 1) * DATA_BYTES + length;
+    }
+    return rel;
+}
+
+/// <summary>
+/// Find a data sector of a .REL file
+/// </summary>
+/// <param name="rel">file to look in</param>
+/// <param name="index">data sector counted from the start of the file</param>
+/// <returns>track and sector of the data sector</returns>
+trackSector d64::relDataSector(const relFile& rel, size_t index) const
+{
+    auto& side = rel.sides[index / SIDE_SECTOR_CHAIN_SZ];
+    return getSideSectorPtr(side.track, side.sector)->chain[index % SIDE_SECTOR_CHAIN_SZ];
+}
+
+/// <summary>
+/// Copy a record between a buffer and the data sectors of a .REL file
+/// a record touches at most two data sectors
+/// </summary>
+/// <param name="rel">file the record is in</param>
+/// <param name="record">record number</param>
+/// <param name="bytes">record sized buffer</param>
+/// <param name="toDisk">true to write the record, false to read it</param>
+void d64::copyRecord(const relFile& rel, size_t record, std::span<uint8_t> bytes, bool toDisk)
+{
+    auto pos = record * rel.recordLength;
+    size_t done = 0;
+    while (done < bytes.size()) {
+        auto within = pos % DATA_BYTES;
+        auto len = std::min(bytes.size() - done, DATA_BYTES - within);
+        auto ts = std::as_const(*this).relDataSector(rel, pos / DATA_BYTES);
+        auto index = sectorIndex(ts.track, ts.sector);
+        if (toDisk) {
+            std::copy_n(bytes.begin() + done, len, sectorForWrite(index) + sizeof(trackSector) + within);
+        }
+        else {
+            std::copy_n(sectorForRead(index) + sizeof(trackSector) + within, len, bytes.begin() + done);
+        }
+        done += len;
+        pos += len;
+    }
+}
+
+/// <summary>
+/// Get the number of records in a .REL file
+/// </summary>
+/// <param name="filename">file to count</param>
+/// <returns>number of whole records</returns>
+size_t d64::recordCount(std::string_view filename)
+{
+    return openRelFile(filename).records();
+}
+
+/// <summary>
+/// Read one record of a .REL file
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <param name="record">record number counted from 0</param>
+/// <returns>bytes of the record or nullopt if there is no such record</returns>
+std::optional<std::vector<uint8_t>> d64::readRecord(std::string_view filename, size_t record)
+{
+    auto rel = openRelFile(filename);
+    if (record >= rel.records()) {
+        return std::nullopt;
+    }
+    std::vector<uint8_t> bytes(rel.recordLength);
+    copyRecord(rel, record, bytes, false);
+    return bytes;
+}
+
+/// <summary>
+/// Replace one record of a .REL file
+/// a short record is padded with zeros
+/// </summary>
+/// <param name="filename">file to write</param>
+/// <param name="record">record number counted from 0</param>
+/// <param name="bytes">new record, at most the record length</param>
+/// <returns>true on success, false if there is no such record or it is too long</returns>
+bool d64::writeRecord(std::string_view filename, size_t record, std::span<const uint8_t> bytes)
+{
+    checkWritable();
+    auto rel = openRelFile(filename);
+    if (record >= rel.records() || bytes.size() > rel.recordLength) {
+        return false;
+    }
+    std::vector<uint8_t> padded(rel.recordLength, 0);
+    std::copy(bytes.begin(), bytes.end(), padded.begin());
+    copyRecord(rel, record, padded, true);
+    return true;
+}
+
+/// <summary>
+/// Add a record at the end of a .REL file
+/// a short record is padded with zeros
+/// </summary>
+/// <param name="filename">file to extend</param>
+/// <param name="bytes">new record, at most the record length</param>
+/// <returns>true on success, false if the record is too long or does not fit</returns>
+bool d64::appendRecord(std::string_view filename, std::span<const uint8_t> bytes)
+{
+    checkWritable();
+    auto rel = openRelFile(filename);
+    if (bytes.size() > rel.recordLength || rel.sectors == 0) {
+        return false;
+    }
+
+    // the record goes after the last whole one
+    auto record = rel.records();
+    auto length = (record + 1) * rel.recordLength;
+
+    // a record is never longer than a sector so it needs one new data sector at most
+    auto grow = length > rel.sectors * DATA_BYTES;
+    if (grow) {
+        auto newSide = rel.sectors % SIDE_SECTOR_CHAIN_SZ == 0;
+        if (newSide && rel.sideCount == SIDE_SECTOR_ENTRY_SIZE) return false;
+        if (availableSectors() < (newSide ? 2 : 1)) return false;
+
+        int track, sector;
+        auto lastData = std::as_const(*this).relDataSector(rel, rel.sectors - 1);
+        if (!findAndAllocateFreeSector(track, sector)) return false;
+        auto dataPtr = getSectorPtr(track, sector);
+        dataPtr->next = { 0, 0 };
+        dataPtr->data.fill(0);
+        getSectorPtr(lastData.track, lastData.sector)->next = { track, sector };
+
+        if (newSide) {
+            int sideTrack, sideSector;
+            sideSectorPtr side;
+            if (!allocateSideSector(sideTrack, sideSector, side)) return false;
+            side->block = static_cast<uint8_t>(rel.sideCount);
+            side->recordsize = rel.recordLength;
+            auto& previous = rel.sides[rel.sideCount - 1];
+            getSideSectorPtr(previous.track, previous.sector)->next = { sideTrack, sideSector };
+            rel.sides[rel.sideCount++] = { sideTrack, sideSector };
+
+            // every side sector lists all of them
+            for (auto i = 0; i < rel.sideCount; ++i) {
+                std::copy_n(rel.sides.begin(), rel.sideCount, getSideSectorPtr(rel.sides[i].track, rel.sides[i].sector)->sideSectors);
+            }
+        }
+
+        auto& lastSide = rel.sides[rel.sideCount - 1];
+        auto used = static_cast<int>(rel.sectors % SIDE_SECTOR_CHAIN_SZ);
+        auto side = getSideSectorPtr(lastSide.track, lastSide.sector);
+        side->chain[used] = { track, sector };
+        side->next = { 0, 16 + 2 * (used + 1) };
+        ++rel.sectors;
+
+        auto entry = getDirectoryEntryPtr(rel.slot);
+        auto blocks = (entry->fileSize[0] | (entry->fileSize[1] << 8)) + 1;
+        entry->fileSize[0] = blocks & 0xFF;
+        entry->fileSize[1] = (blocks & 0xFF00) >> 8;
+    }
+
+    // the last data sector holds the new length
+    rel.bytes = length;
+    auto lastData = std::as_const(*this).relDataSector(rel, rel.sectors - 1);
+    getSectorPtr(lastData.track, lastData.sector)->next = { 0, static_cast<int>(length - (rel.sectors - 1) * DATA_BYTES + 1) };
+
+    std::vector<uint8_t> padded(rel.recordLength, 0);
+    std::copy(bytes.begin(), bytes.end(), padded.begin());
+    copyRecord(rel, record, padded, true);
+    return true;
+}
+
+/// <summary>
+/// Rewrite every file into runs of sectors on as few tracks as possible
+/// files are laid out one after another in directory order, taking tracks nearest the
+/// directory first, with the sectors of a track interleave apart
+/// the directory entries stay where they are, only their start and side sectors change
+/// every file is read and the space counted first so nothing changes if a chain is bad
+/// or cross linked chains need more sectors than the disk has
+/// </summary>
+/// <param name="interleave">sectors from one sector of a file to the next on a track</param>
+/// <param name="model">timing used for the load time estimates</param>
+/// <returns>what was moved and the estimated load times before and after</returns>
+relayoutReport d64::relayout(int interleave, const loadModel& model)
+{
+    checkWritable();
+    if (interleave < 1) {
+        throw std::invalid_argument("Invalid interleave");
+    }
+
+    struct movedFile {
+        directorySlot slot;
+        std::vector<uint8_t> data;
+        std::vector<trackSector> sectors;   // data and side sectors as they were
+    };
+    relayoutReport report;
+
+    // sectors of the BAM and directory are never freed, even if a chain runs through them
+    sectorBits owned = {};
+    auto has = [&](const sectorBits& bits, trackSector ts)
+        {
+            auto index = uncheckedIndex(ts.track, ts.sector);
+            return (bits[index >> 6] & (uint64_t(1) << (index & 63))) != 0;
+        };
+    auto mark = [&](sectorBits& bits, trackSector ts)
+        {
+            auto index = uncheckedIndex(ts.track, ts.sector);
+            auto first = !has(bits, ts);
+            bits[index >> 6] |= uint64_t(1) << (index & 63);
+            return first;
+        };
+    auto directory = directoryChain();
+    endAtLoop(directory);
+    mark(owned, trackSector(DIRECTORY_TRACK, BAM_SECTOR));
+    for (auto& ts : directory) {
+        mark(owned, ts);
+    }
+
+    // **Step 1: Read every file**
+    // a sector is freed once however many chains run through it, each file gets a chain of its own
+    std::vector<movedFile> files;
+    sectorBits freed = {};
+    size_t freeing = 0;
+    size_t needed = 0;
+    auto take = [&](movedFile& file, trackSector location)
+        {
+            if (has(owned, location)) {
+                return;
+            }
+            file.sectors.push_back(location);
+            if (mark(freed, location) && !std::as_const(*this).bamtrack(location.track - 1)->test(location.sector)) {
+                ++freeing;
+            }
+        };
+    for (auto it = entries().begin(); it != entries().end(); ++it) {
+        auto& entry = *it;
+        auto& file = files.emplace_back(movedFile{ it.slot(), {}, {} });
+        walkFileChain(entry, [&](trackSector location, const struct sector& current)
+            {
+                take(file, location);
+                file.data.insert(file.data.end(), current.data.begin(), current.data.begin() + chainBytes(current));
+            });
+        auto chainSectors = (std::max<size_t>(file.data.size(), 1) + DATA_BYTES - 1) / DATA_BYTES;
+        needed += chainSectors;
+        if (entry.file_type.type == d64FileTypes::REL) {
+            auto sides = walkChain(entry.side, [&](trackSector location, const struct sector&) { take(file, location); });
+            if (!sides) {
+                throw std::runtime_error(std::string(readErrorText(sides.error().code)));
+            }
+            needed += std::max<size_t>(1, (chainSectors + SIDE_SECTOR_CHAIN_SZ - 1) / SIDE_SECTOR_CHAIN_SZ);
+        }
+        report.loadMsBefore += estimateLoadTime(entry, model);
+    }
+    if (needed > static_cast<size_t>(availableSectors()) + freeing) {
+        throw std::runtime_error("Disk full. Unable to relayout files");
+    }
+
+    // **Step 2: Free the sectors of every file**
+    for (auto& file : files) {
+        for (auto& ts : file.sectors) {
+            freeSector(ts.track, ts.sector);
+        }
+    }
+
+    // **Step 3: Lay the files out track by track**
+    // where the next sector should be, as a fraction of a turn
+    // a run that goes on to the next track keeps the interleave across the step
+    size_t order = 0;
+    double target = 0;
+    auto next = [&]()
+        {
+            for (; order < TRACK_40_SEARCH_ORDER.size(); ++order) {
+                auto track = TRACK_40_SEARCH_ORDER[order];
+                if (track > TRACKS) continue;
+
+                auto count = SECTORS_PER_TRACK[track - 1];
+                auto all = (1u << count) - 1;
+                auto freeBits = std::as_const(*this).bamtrack(track - 1)->mask() & all;
+                if (freeBits == 0) continue;
+
+                // the first free sector at or after the interleaved one
+                auto start = static_cast<int>(std::ceil(target * count - 1e-9)) % count;
+                auto rotated = ((freeBits >> start) | (freeBits << (count - start))) & all;
+                auto sector = (start + std::countr_zero(rotated)) % count;
+                allocateSector(track, sector);
+                target = std::fmod(static_cast<double>(sector + interleave) / count, 1.0);
+                return trackSector(track, sector);
+            }
+            throw std::runtime_error("Disk full. Unable to relayout files");
+        };
+
+    for (auto& file : files) {
+        auto entry = getDirectoryEntryPtr(file.slot);
+        std::vector<trackSector> chain((std::max<size_t>(file.data.size(), 1) + DATA_BYTES - 1) / DATA_BYTES);
+        std::generate(chain.begin(), chain.end(), next);
+        if (file.data.empty()) {
+            auto sectorPtr = getSectorPtr(chain[0].track, chain[0].sector);
+            std::fill_n(reinterpret_cast<uint8_t*>(sectorPtr), SECTOR_SIZE, 0);
+            sectorPtr->next = trackSector(0, 1);
+        }
+        else {
+            writeFileDataToSectors(chain, file.data);
+        }
+        entry->start = chain[0];
+        entry->replace = chain[0];
+        report.sectors += chain.size();
+
+        if (entry->file_type.type == d64FileTypes::REL) {
+            std::vector<trackSector> sides(std::max<size_t>(1, (chain.size() + SIDE_SECTOR_CHAIN_SZ - 1) / SIDE_SECTOR_CHAIN_SZ));
+            std::generate(sides.begin(), sides.end(), next);
+            writeSideSectors(chain, sides, entry->recordLength);
+            entry->side = sides[0];
+            report.sectors += sides.size();
+        }
+        ++report.files;
+        report.loadMsAfter += estimateLoadTime(*entry, model);
+    }
+
+    // the allocator starts again from the new layout
+    std::fill_n(lastSectorUsed.begin(), TRACKS_40, 1);
+    return report;
+}
+
+/// <summary>
+/// Estimate how long a file takes to load, starting with the head on the directory track
+/// </summary>
+/// <param name="entry">directory entry of the file</param>
+/// <param name="model">drive and loader timing</param>
+/// <returns>estimated milliseconds</returns>
+double d64::estimateLoadTime(const directoryEntry& entry, const loadModel& model) const
+{
+    return profileLoad(entry, model).totalMs;
+}
+
+/// <summary>
+/// Simulate loading a file, starting with the head on the directory track
+/// </summary>
+/// <param name="entry">directory entry of the file</param>
+/// <param name="model">drive and loader timing</param>
+/// <returns>where the time goes</returns>
+loadEstimate d64::profileLoad(const directoryEntry& entry, const loadModel& model) const
+{
+    std::vector<trackSector> chain;
+    walkFileChain(entry, [&](trackSector location, const struct sector&) { chain.push_back(location); });
+    return profileLoad(chain, model);
+}
+
+/// <summary>
+/// Simulate reading a sector chain, starting with the head on the directory track
+/// the head steps to each track, waits for the sector to come round, reads it
+/// and then decodes and transfers it while the disk keeps turning
+/// </summary>
+/// <param name="chain">sectors in the order they are read</param>
+/// <param name="model">drive and loader timing</param>
+/// <returns>where the time goes</returns>
+loadEstimate d64::profileLoad(std::span<const trackSector> chain, const loadModel& model)
+{
+    loadEstimate estimate;
+    auto handle = model.decodeMs + model.transferMs;
+    int head = DIRECTORY_TRACK;
+    for (auto& ts : chain) {
+        if (!geometry40::isValid(ts.track, ts.sector)) {
+            throw std::invalid_argument("Invalid Tack and Sector TRACK:" + std::to_string(ts.track) + " SECTOR:" + std::to_string(ts.sector));
+        }
+        if (ts.track != head) {
+            estimate.stepMs += std::abs(ts.track - head) * model.trackStepMs;
+            estimate.totalMs += std::abs(ts.track - head) * model.trackStepMs;
+            ++estimate.trackChanges;
+            head = ts.track;
+        }
+
+        auto sectorTime = model.revolutionMs / SECTORS_PER_TRACK[ts.track - 1];
+        auto wait = std::fmod(ts.sector * sectorTime - std::fmod(estimate.totalMs, model.revolutionMs) + model.revolutionMs, model.revolutionMs);
+        estimate.rotationMs += wait;
+        estimate.readMs += sectorTime;
+        estimate.handleMs += handle;
+        estimate.totalMs += wait + sectorTime + handle;
+        if (estimate.sectors > 0) {
+            estimate.missedSectors += static_cast<size_t>(wait / sectorTime + 1e-9);
+        }
+        ++estimate.sectors;
+    }
+    return estimate;
+}
+
+/// <summary>
+/// Find the interleave that reads a track fastest with a loader
+/// each candidate lays a whole track out the way the allocator does and is timed with the model
+/// </summary>
+/// <param name="model">drive and loader timing</param>
+/// <param name="track">track whose speed zone to use, the default is next to the directory</param>
+/// <returns>interleave for allocationPolicy</returns>
+int d64::fastestInterleave(const loadModel& model, int track)
+{
+    if (track < 1 || track > TRACKS_40) {
+        throw std::invalid_argument("Invalid Tack TRACK:" + std::to_string(track));
+    }
+
+    auto count = SECTORS_PER_TRACK[track - 1];
+    auto best = 1;
+    auto bestMs = 0.0;
+    for (auto interleave = 1; interleave < count; ++interleave) {
+        std::vector<trackSector> chain;
+        uint32_t used = 0;
+        auto sector = 0;
+        for (auto i = 0; i < count; ++i) {
+            // first sector not used yet at or after the interleaved one
+            while (used & (1u << sector)) {
+                sector = (sector + 1) % count;
+            }
+            used |= 1u << sector;
+            chain.emplace_back(track, sector);
+            sector = (sector + interleave) % count;
+        }
+
+        auto ms = profileLoad(chain, model).totalMs;
+        if (interleave == 1 || ms < bestMs) {
+            best = interleave;
+            bestMs = ms;
+        }
+    }
+    return best;
+}
+
 /// <summary>
 /// Write data to disk
 /// </summary>
 /// <param name="track">tarck to write</param>
 /// <param name="sector">sector to write</param>
-/// <param name="bytes">vector of bytes to write</param>
+/// <param name="bytes">bytes to write</param>
 /// <param name="byteoffset">offset of sector write at</param>
 /// <returns></returns>
-bool d64::writeData(int track, int sector, std::vector<uint8_t> bytes, int byteoffset = 0)
+bool d64::writeData(int track, int sector, std::span<const uint8_t> bytes, int byteoffset = 0)
 {
-    if (byteoffset < 0 || byteoffset >= SECTOR_SIZE) return false;
-    auto index = calcOffset(track, sector) + byteoffset;
-    if (index >= 0 && index + bytes.size() <= data.size()) {
-        std::copy(bytes.begin(), bytes.end(), data.begin() + index);
+    if (byteoffset < 0 || byteoffset >= SECTOR_SIZE || !storage->writable()) return false;
+    if (byteoffset + bytes.size() <= SECTOR_SIZE) {
+        std::copy(bytes.begin(), bytes.end(), sectorForWrite(sectorIndex(track, sector)) + byteoffset);
+
+        // a raw write may have changed the directory or the BAM
+        invalidateNameIndex();
+        freeMapValid = false;
         return true;
     }
     return false;
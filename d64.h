@@ -7,125 +7,912 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <stdexcept>
 #include <bitset>
+#include <bit>
+#include <memory>
+#include <span>
+#include <iterator>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <cassert>
+#include <atomic>
+#include <mutex>
 
 #include "d64_types.h"
+#include "d64_geometry.h"
+#include "d64_storage.h"
+#include "d64_trace.h"
 
-#pragma pack(push, 1)
+/// <summary>
+/// A file to add with d64::addFiles
+/// </summary>
+struct fileSpec {
+    std::string_view filename;
+    c64FileType type;
+    std::span<const uint8_t> data;
+    int recordSize = 0;
+};
+
+/// <summary>
+/// Why a non throwing read failed
+/// </summary>
+enum readError : uint8_t {
+    read_bad_track_sector,      // track or sector is not on the disk
+    read_bad_offset,            // byte offset is not in the sector
+    read_bad_name,              // no directory entry can have the name
+    read_file_not_found,        // no directory entry has the name
+    read_chain_broken,          // a link points off the disk
+    read_chain_loop,            // a chain comes back to one of its own sectors
+    read_buffer_too_small       // the buffer can not hold the file
+};
+
+/// <summary>
+/// Error of a non throwing read
+/// track and sector are where it was found, 0 if no sector was involved
+/// </summary>
+struct diskError {
+    readError code;
+    uint8_t track = 0;
+    uint8_t sector = 0;
+};
+
+/// <summary>
+/// Get the text for a read error
+/// </summary>
+/// <param name="code">error</param>
+/// <returns>description</returns>
+inline std::string_view readErrorText(readError code)
+{
+    switch (code) {
+        case readError::read_bad_track_sector: return "Invalid track and sector";
+        case readError::read_bad_offset: return "Invalid byte offset";
+        case readError::read_bad_name: return "Invalid file name";
+        case readError::read_file_not_found: return "File not found";
+        case readError::read_chain_broken: return "Sector chain links off the disk";
+        case readError::read_chain_loop: return "Sector chain loops";
+        case readError::read_buffer_too_small: return "Buffer too small";
+        default: return "Unknown error";
+    }
+}
+
+/// <summary>
+/// Value or error of a non throwing read, in the manner of std::expected
+/// </summary>
+template <typename T>
+class diskResult {
+public:
+    diskResult(const T& value) : result(value) {}
+    diskResult(T&& value) : result(std::move(value)) {}
+    diskResult(const diskError& error) : result(error) {}
+
+    bool has_value() const noexcept { return result.index() == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    // value throws std::bad_variant_access if there is none, * does not check
+    T& value() & { return std::get<0>(result); }
+    const T& value() const& { return std::get<0>(result); }
+    T&& value() && { return std::get<0>(std::move(result)); }
+    T& operator*() noexcept { return *std::get_if<0>(&result); }
+    const T& operator*() const noexcept { return *std::get_if<0>(&result); }
+    T* operator->() noexcept { return std::get_if<0>(&result); }
+    const T* operator->() const noexcept { return std::get_if<0>(&result); }
+
+    const diskError& error() const { return std::get<1>(result); }
+
+private:
+    std::variant<T, diskError> result;
+};
+
+/// <summary>
+/// What d64::verify found wrong with an image
+/// a file is named by its directory slot, the default slot stands for the BAM and the directory
+/// </summary>
+struct verifyReport {
+    // a sector whose BAM bit does not match its use
+    struct bamMismatch {
+        trackSector location;
+        bool used;              // used but marked free, else marked used but not used
+    };
+
+    // a track whose free count is not the number of sectors nothing uses
+    struct freeCountMismatch {
+        uint8_t track;
+        uint8_t bamFree;        // count in the BAM
+        uint8_t expected;       // sectors nothing uses
+    };
+
+    // a sector used by two files
+    struct crossLink {
+        trackSector location;
+        directorySlot first;    // first user in directory order
+        directorySlot second;
+    };
+
+    // a chain that links off the disk or loops, the sectors before the bad link are counted as used
+    struct chainFault {
+        directorySlot slot;
+        diskError error;
+    };
+
+    std::vector<bamMismatch> mismatches;
+    std::vector<freeCountMismatch> freeCounts;
+    std::vector<crossLink> crossLinks;
+    std::vector<chainFault> chainFaults;
+    size_t files = 0;           // directory entries checked
+
+    bool valid() const { return mismatches.empty() && freeCounts.empty() && crossLinks.empty() && chainFaults.empty(); }
+};
+
+/// <summary>
+/// How d64::extractAll writes the files of a disk
+/// </summary>
+struct extractOptions {
+    unsigned threads = 1;       // files written at once, 0 for one per core
+    bool skipUpToDate = true;   // leave a host file that already has the size and fingerprint of the file
+    bool flush = false;         // wait until each file written is on the disk
+};
+
+/// <summary>
+/// What d64::extractAll did, host files are listed in directory order
+/// </summary>
+struct extractReport {
+    std::vector<std::string> written;
+    std::vector<std::string> upToDate;  // left as they were
+    size_t failed = 0;                  // files not extracted, each has a line in the error log
+
+    bool ok() const { return failed == 0; }
+};
+
+/// <summary>
+/// Timing of a drive and its loader, used to estimate how long a file takes to load
+/// sector 0 of every track is taken to pass the head at the same moment
+/// the defaults are the standard KERNAL load, the figures are typical rather than measured on one drive
+/// </summary>
+struct loadModel {
+    double revolutionMs = 200.0;    // one turn of the disk at 300 rpm
+    double trackStepMs = 6.0;       // moving the head by one track
+    double decodeMs = 4.0;          // after a sector is read, decoding its GCR and checking it in the drive
+    double transferMs = 478.0;      // then sending its 254 bytes to the computer, the next sector can only be read after
+
+    // standard KERNAL serial load, a little under 500 bytes a second at its best interleave of 10
+    static constexpr loadModel kernal() { return loadModel(); }
+
+    // JiffyDOS, the drive ROM decodes as usual and a faster serial protocol sends the bytes
+    static constexpr loadModel jiffyDos() { return loadModel{ 200.0, 6.0, 4.0, 40.0 }; }
+
+    // a typical fastloader, decoding on the fly, a two bit transfer and faster head stepping
+    static constexpr loadModel fastloader() { return loadModel{ 200.0, 3.0, 1.0, 22.0 }; }
+};
+
+/// <summary>
+/// Where the time of a simulated load goes
+/// </summary>
+struct loadEstimate {
+    double totalMs = 0;
+    double stepMs = 0;              // moving the head between tracks
+    double rotationMs = 0;          // waiting for the next sector to come round
+    double readMs = 0;              // sectors passing under the head
+    double handleMs = 0;            // decoding and transferring the sectors
+    size_t sectors = 0;
+    size_t trackChanges = 0;
+    size_t missedSectors = 0;       // sectors that passed the head while waiting for the next one of the file
+};
+
+/// <summary>
+/// Which track the allocator takes the next sector of a file from
+/// </summary>
+enum allocationStrategy : uint8_t {
+    allocate_near_directory,    // the 1541 DOS, tracks nearest the directory first
+    allocate_first_fit,         // the lowest track with a free sector
+    allocate_best_fit,          // a file starts on the track whose free sectors fit it most closely, or the emptiest if none fits
+    allocate_banded,            // small files near the directory, files over bandSectors from the outer tracks in
+    allocate_extended_first     // tracks 36 to 40 of a 40 track disk first, then nearest the directory
+};
+
+/// <summary>
+/// How d64::addFile places the sectors of a file
+/// </summary>
+struct allocationPolicy {
+    int interleave = 10;            // sectors from one sector of a file to the next on a track, 10 is the 1541 DOS
+    allocationStrategy strategy = allocationStrategy::allocate_near_directory;
+    int bandSectors = 21;           // allocate_banded, largest file kept near the directory
+};
+
+/// <summary>
+/// What d64::relayout did
+/// </summary>
+struct relayoutReport {
+    size_t files = 0;               // files rewritten
+    size_t sectors = 0;             // sectors written, side sectors included
+    double loadMsBefore = 0;        // estimated time to load every file, one at a time from the directory track
+    double loadMsAfter = 0;
+};
 
 class d64 {
 public:
 
     d64();
     d64(diskType type);
+    d64(diskType type, std::pmr::memory_resource* resource);
     d64(std::string name);
+    d64(std::string name, mapMode mode, std::ostream* log = &std::cerr);
+    explicit d64(std::unique_ptr<diskStorage> image);
+    explicit d64(std::span<uint8_t> image);
+    d64(const d64& other);
+    d64(d64&& other) noexcept = default;
+    d64& operator=(const d64& other);
+    d64& operator=(d64&& other) noexcept;
 
     void formatDisk(std::string_view name);
-    bool rename_disk(std::string_view name) const;
-    std::string diskname();
+    bool rename_disk(std::string_view name);
+    std::string diskname() const;
     std::optional<directoryEntryPtr> findFile(std::string_view filename);
-    bool addFile(std::string_view filename, c64FileType type, const std::vector<uint8_t>& fileData, int recirdSize = 0);
+    bool addFile(std::string_view filename, c64FileType type, std::span<const uint8_t> fileData, int recirdSize = 0);
+    bool addFile(std::string_view filename, c64FileType type, std::span<const uint8_t> fileData, const allocationPolicy& policy, int recordSize = 0);
+    bool addFiles(std::span<const fileSpec> files);
+    bool addFiles(std::span<const fileSpec> files, const allocationPolicy& policy);
+    void setAllocationPolicy(const allocationPolicy& policy);
+    const allocationPolicy& getAllocationPolicy() const { return allocation; }
     bool removeFile(std::string_view filename);
     bool renameFile(std::string_view oldfilename, std::string_view newfilename);
-    bool extractFile(std::string filename);
-    bool save(std::string filename);
+    bool extractFile(std::string filename) const;
+    extractReport extractAll(const std::string& outputDir, const extractOptions& options = extractOptions()) const;
+    bool save(std::string filename, saveMode mode = saveMode::save_in_place);
+    bool save(std::ostream& out) const;
+    bool saveIncremental(std::string filename, saveMode mode = saveMode::save_in_place);
+    size_t unsavedSectors() const;
+    std::vector<uint8_t> exportPatch() const;
+    bool applyPatch(std::span<const uint8_t> patch);
+
+    // 64 bit fingerprints for finding the same sectors, files and images on other disks
+    // a file fingerprint only depends on the file data, not on where it is stored
+    uint64_t sectorFingerprint(int track, int sector) const;
+    uint64_t fileFingerprint(const directoryEntry& entry) const;
+    std::optional<uint64_t> fileFingerprint(std::string_view filename) const;
+    uint64_t imageFingerprint() const;
+    static uint64_t dataFingerprint(std::span<const uint8_t> fileData);
+
     bool load(std::string filename);
+    bool load(std::string filename, mapMode mode);
+    bool validateD64();
+    bool writable() const { return storage->writable(); }
+
+    // error bytes kept from an image file that had them, one 1541 error code per sector
+    // save writes them back after the image
+    bool hasErrorInfo() const { return !errorInfo.empty(); }
+    std::span<const uint8_t> errorCodes() const { return errorInfo; }
+    uint8_t sectorError(int track, int sector) const;
+    void setErrorInfo(std::span<const uint8_t> codes);
+    d64 clone();
+    size_t sharedSectors() const { return storage->sharedSectors(); }
+    void setErrorLog(std::ostream* log) { errorStream = log; }
+
+    // what the disk has done, see d64_trace.h
+    // read the stats of a shared disk from a writer, readers may be counting
+    const d64Stats& getStats() const { return stats; }
+    void resetStats() { stats = d64Stats(); }
+    void setTraceHook(traceHook hook) { traceCallback = std::move(hook); }
+
+    std::ostream& errorLog() const;
     int calcOffset(int track, int sector) const;
     bool writeByte(int track, int sector, int offset, uint8_t value);
-    bool writeSector(int track, int sector, std::vector<uint8_t> bytes);
-    std::optional<uint8_t> readByte(int track, int sector, int offset);
-    std::optional<std::vector<uint8_t>> readSector(int track, int sector);
+    bool writeSector(int track, int sector, std::span<const uint8_t> bytes);
+    std::optional<uint8_t> readByte(int track, int sector, int offset) const;
+    std::optional<std::vector<uint8_t>> readSector(int track, int sector) const;
+    bool readSectorInto(int track, int sector, std::span<uint8_t> buffer) const;
     bool freeSector(const int& track, const int& sector);
     bool allocateSector(const int& track, const int& sector);
     bool findAndAllocateFreeSector(int& track, int& sector);
-    std::optional<std::vector<uint8_t>> readFile(std::string filename);
-    uint16_t getFreeSectorCount();
+    std::optional<std::vector<uint8_t>> readFile(std::string filename) const;
+    std::optional<size_t> readFileInto(std::string_view filename, std::span<uint8_t> buffer) const;
+    size_t fileLength(std::string_view filename) const;
+
+    // records of a .REL file, found through its side sectors
+    size_t recordCount(std::string_view filename);
+    std::optional<std::vector<uint8_t>> readRecord(std::string_view filename, size_t record);
+    bool writeRecord(std::string_view filename, size_t record, std::span<const uint8_t> bytes);
+    bool appendRecord(std::string_view filename, std::span<const uint8_t> bytes);
+    uint16_t getFreeSectorCount() const;
     bool compactDirectory();
     bool verifyBAMIntegrity(bool fix, const std::string& logFile);
+    bool verifyBAMIncremental(bool fix, const std::string& logFile);
+    verifyReport verify(unsigned threads = 1) const;
     bool reorderDirectory(std::function<bool(const directoryEntry&, const directoryEntry&)> compare);
     bool reorderDirectory(std::vector<directoryEntry>& files);
     bool reorderDirectory(const std::vector<std::string>& fileOrder);
     bool movefileFirst(std::string file);
     bool lockfile(std::string file, bool lock);
-    std::vector<directoryEntry> directory();
+    relayoutReport relayout(int interleave = INTERLEAVE, const loadModel& model = loadModel());
+    double estimateLoadTime(const directoryEntry& entry, const loadModel& model = loadModel()) const;
+    loadEstimate profileLoad(const directoryEntry& entry, const loadModel& model = loadModel()) const;
+    static loadEstimate profileLoad(std::span<const trackSector> chain, const loadModel& model = loadModel());
+    static int fastestInterleave(const loadModel& model, int track = DIRECTORY_TRACK - 1);
+    std::vector<directoryEntry> directory() const;
     static std::string Trim(const char filename[FILE_NAME_SZ]);
+    static std::string_view extension(d64FileTypes type);
 
-    int TRACKS;
+    /// <summary>
+    /// Range over the data of a file's sector chain
+    /// each element is a view of the data bytes of one sector
+    /// a chain with more sectors than the disk loops, stepping past them throws
+    /// </summary>
+    class sectorChain {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::span<const uint8_t>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = value_type;
+
+            iterator() = default;
 
-    // Constants for D64 format
-    const std::array<int, TRACKS_40> SECTORS_PER_TRACK = {
-        21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, // Tracks 1-17
-        19, 19, 19, 19, 19, 19, 19,                                         // Tracks 18-24
-        18, 18, 18, 18, 18, 18,                                             // Tracks 25-30
-        17, 17, 17, 17, 17,                                                 // Tracks 31-35
-        17, 17, 17, 17, 17                                                  // Tracks 36-40
+            value_type operator*() const
+            {
+                return value_type(current->data.data(), chainBytes(*current));
+            }
+            iterator& operator++()
+            {
+                position = current->next;
+                if (position.track != 0 && ++steps >= disk->storage->size() / SECTOR_SIZE) {
+                    throw std::runtime_error(std::string(readErrorText(readError::read_chain_loop)));
+                }
+                current = position.track != 0 ? disk->getSectorPtr(position.track, position.sector) : nullptr;
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                auto it = *this;
+                ++*this;
+                return it;
+            }
+            bool operator==(const iterator& other) const { return current == other.current; }
+
+            // track and sector of the current sector
+            trackSector location() const { return position; }
+
+        private:
+            friend class sectorChain;
+            iterator(const d64* disk, trackSector start) :
+                disk(disk),
+                current(start.track != 0 ? disk->getSectorPtr(start.track, start.sector) : nullptr),
+                position(start)
+            {
+            }
+
+            const d64* disk = nullptr;
+            const struct sector* current = nullptr;
+            trackSector position{ 0, 0 };
+            size_t steps = 0;       // links followed, no chain on the disk needs as many as it has sectors
+        };
+
+        iterator begin() const { return iterator(disk, start); }
+        iterator end() const { return iterator(); }
+
+    private:
+        friend class d64;
+        sectorChain(const d64* disk, trackSector start) : disk(disk), start(start) {}
+
+        const d64* disk;
+        trackSector start;
     };
 
-    const std::array<int, TRACKS_40> TRACK_OFFSETS = {
-        0x00000, 0x01500, 0x02A00, 0x03F00, 0x05400, 0x06900, 0x07E00, 0x09300, 0x0A800, 0x0BD00,
-        0x0D200, 0x0E700, 0x0FC00, 0x11100, 0x12600, 0x13B00, 0x15000, 0x16500, 0x17800, 0x18B00,
-        0x19E00, 0x1B100, 0x1C400, 0x1D700, 0x1EA00, 0x1FC00, 0x20E00, 0x22000, 0x23200, 0x24400,
-        0x25600, 0x26700, 0x27800, 0x28900, 0x29A00, 0x2AB00, 0x2BC00, 0x2CD00, 0x2DE00, 0x2EF00
+    sectorChain fileChain(std::string_view filename) const;
+    sectorChain fileChain(const directoryEntry& entry) const;
+
+    /// <summary>
+    /// Range over the live entries of the directory, read in place
+    /// the walk stops at a link off the disk or once it has seen as many sectors as the disk has
+    /// </summary>
+    class directoryView {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = directoryEntry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const directoryEntry*;
+            using reference = const directoryEntry&;
+
+            iterator() = default;
+
+            reference operator*() const { return current->fileEntry[entry]; }
+            pointer operator->() const { return &current->fileEntry[entry]; }
+            iterator& operator++()
+            {
+                ++entry;
+                skip();
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                auto it = *this;
+                ++*this;
+                return it;
+            }
+            bool operator==(const iterator& other) const { return current == other.current && entry == other.entry; }
+
+            // where the current entry is in the directory
+            directorySlot slot() const { return directorySlot(position.track, position.sector, entry); }
+
+        private:
+            friend class directoryView;
+            iterator(const d64* disk, bool filtered, d64FileTypes type) :
+                disk(disk),
+                current(disk->getDirectory_SectorPtr(DIRECTORY_TRACK, DIRECTORY_SECTOR)),
+                position(DIRECTORY_TRACK, DIRECTORY_SECTOR),
+                filtered(filtered),
+                type(type)
+            {
+                skip();
+            }
+
+            // move to the first wanted entry at or after the current one
+            void skip()
+            {
+                while (current != nullptr) {
+                    for (; entry < FILES_PER_SECTOR; ++entry) {
+                        auto& fileType = current->fileEntry[entry].file_type;
+                        if (fileType.closed && (!filtered || fileType.type == type)) return;
+                    }
+
+                    auto next = current->next;
+                    auto limit = disk->storage->size() / SECTOR_SIZE;
+                    auto index = disk->linkIndex(next.track, next.sector);
+                    entry = 0;
+                    if (++sectors >= limit || index < 0) {
+                        current = nullptr;
+                        return;
+                    }
+                    position = next;
+                    current = disk->sectorAt<directorySector>(index);
+                }
+            }
+
+            const d64* disk = nullptr;
+            const directorySector* current = nullptr;
+            trackSector position{ 0, 0 };
+            int entry = 0;
+            size_t sectors = 0;
+            bool filtered = false;
+            d64FileTypes type = d64FileTypes::DEL;
+        };
+
+        iterator begin() const { return iterator(disk, filtered, type); }
+        iterator end() const { return iterator(); }
+
+    private:
+        friend class d64;
+        directoryView(const d64* disk, bool filtered, d64FileTypes type) : disk(disk), filtered(filtered), type(type) {}
+
+        const d64* disk;
+        bool filtered;
+        d64FileTypes type;
     };
 
+    directoryView entries() const { return directoryView(this, false, d64FileTypes::DEL); }
+    directoryView entries(d64FileTypes type) const { return directoryView(this, true, type); }
+
+    // non throwing reads for images that may be corrupt
+    // views stay valid until the sector is written
+    diskResult<uint8_t> tryReadByte(int track, int sector, int offset) const noexcept;
+    diskResult<std::span<const uint8_t>> tryReadSector(int track, int sector) const noexcept;
+    diskResult<const directoryEntry*> tryFindFile(std::string_view filename) const;
+    diskResult<std::vector<directoryEntry>> tryDirectory() const;
+    diskResult<size_t> tryChainLength(trackSector start) const noexcept;
+    diskResult<sectorChain> tryFileChain(std::string_view filename) const;
+    diskResult<size_t> tryReadFileInto(std::string_view filename, std::span<uint8_t> buffer) const;
+    diskResult<std::vector<uint8_t>> tryReadFile(std::string_view filename) const;
+
+    int TRACKS;
+
+    // Constants for D64 format, shared by every disk
+    // a 35 track disk uses the first 35 entries
+    static constexpr const std::array<int, TRACKS_40>& SECTORS_PER_TRACK = geometry40::SECTORS_PER_TRACK;
+    static constexpr const std::array<int, TRACKS_40>& TRACK_OFFSETS = geometry40::TRACK_OFFSETS;
+
     inline bamTrackEntry* bamtrack(int t)
+    {
+        markWritten(uncheckedIndex(DIRECTORY_TRACK, BAM_SECTOR));
+        return (t < TRACKS_35) ?
+            &bamTrackPtr[(t)] :
+            &bamExtraTrackPtr[((t)-TRACKS_35)];
+    }
+    inline const bamTrackEntry* bamtrack(int t) const
     {
         return (t < TRACKS_35) ?
             &bamTrackPtr[(t)] :
             &bamExtraTrackPtr[((t)-TRACKS_35)];
     }
+    // the non const accessors are for sectors about to be changed
+    // a sector shared with a clone is copied first, read through the const ones
     inline sectorPtr getSectorPtr(uint8_t track, uint8_t sector)
     {
-        return reinterpret_cast<sectorPtr>(&data[calcOffset(track, sector)]);
+        return sectorAtForWrite<struct sector>(sectorIndex(track, sector));
+    }
+    inline const sector* getSectorPtr(uint8_t track, uint8_t sector) const
+    {
+        return sectorAt<struct sector>(sectorIndex(track, sector));
     }
     inline trackSector* getTrackSectorPtr(uint8_t track, uint8_t sector)
     {
-        return reinterpret_cast<trackSector*>(&data[calcOffset(track, sector)]);
+        return sectorAtForWrite<trackSector>(sectorIndex(track, sector));
+    }
+    inline const trackSector* getTrackSectorPtr(uint8_t track, uint8_t sector) const
+    {
+        return sectorAt<trackSector>(sectorIndex(track, sector));
     }
     inline sideSectorPtr getSideSectorPtr(uint8_t track, uint8_t sector)
     {
-        return reinterpret_cast<sideSectorPtr>(&data[calcOffset(track, sector)]);
+        return sectorAtForWrite<sideSector>(sectorIndex(track, sector));
+    }
+    inline const sideSector* getSideSectorPtr(uint8_t track, uint8_t sector) const
+    {
+        return sectorAt<sideSector>(sectorIndex(track, sector));
     }
     inline directorySectorPtr getDirectory_SectorPtr(const int& track, const int& sector)
     {
-        return reinterpret_cast<directorySectorPtr>(&data[calcOffset(track, sector)]);
+        return sectorAtForWrite<directorySector>(sectorIndex(track, sector));
+    }
+    inline const directorySector* getDirectory_SectorPtr(const int& track, const int& sector) const
+    {
+        return sectorAt<directorySector>(sectorIndex(track, sector));
     }
 
 private:
     static constexpr int INTERLEAVE = 10;
+
+    // a lock for a cache, a copied or moved disk has a lock of its own
+    struct cacheLock {
+        std::mutex lock;
+        cacheLock() = default;
+        cacheLock(const cacheLock&) {}
+        cacheLock& operator=(const cacheLock&) { return *this; }
+    };
+
+    // tracks nearest the directory first
+    static constexpr std::array<int, TRACKS_40> TRACK_40_SEARCH_ORDER = {
+        18, 17, 19, 16, 20, 15, 21, 14, 22, 13, 23, 12, 24, 11, 25, 10, 26, 9,
+        27, 8, 28, 7, 29, 6, 30, 5, 31, 4, 32, 3, 33, 2, 34, 1, 35, 36, 37, 38, 39, 40
+    };
+    static constexpr uint8_t PATCH_VERSION = 1;
     std::array<int, TRACKS_40> lastSectorUsed = { -1 };
+    allocationPolicy allocation;                    // used by the sector allocator
+    int allocationTrack = 0;                        // track of the file being allocated, 0 before its first sector
+    size_t allocationSectors = 0;                   // sectors of the file being allocated, 0 if not known
+    size_t allocationRemaining = 0;                 // of those, not allocated yet
     bamPtr diskBamPtr;
     bamTrackEntry* bamTrackPtr;
     bamTrackEntry* bamExtraTrackPtr;
     diskType disktype = diskType::thirty_five_track;
 
-    bool validateD64();
     void initBAM(std::string_view name);
     void initializeBAMFields(std::string_view name);
-    bool writeData(int track, int sector, std::vector<uint8_t> bytes, int byteoffset);
+    bool writeData(int track, int sector, std::span<const uint8_t> bytes, int byteoffset);
     std::vector<trackSector> parseSideSectors(int sideTrack, int sideSector);
-    void init_disk();
+
+    // where the records of a .REL file are
+    struct relFile {
+        directorySlot slot;
+        uint8_t recordLength = 0;
+        std::array<trackSector, SIDE_SECTOR_ENTRY_SIZE> sides;
+        int sideCount = 0;
+        size_t sectors = 0;                             // data sectors
+        size_t bytes = 0;                               // data bytes
+        size_t records() const { return bytes / recordLength; }
+    };
+    static constexpr size_t DATA_BYTES = SECTOR_SIZE - sizeof(trackSector);
+    relFile openRelFile(std::string_view filename);
+    trackSector relDataSector(const relFile& rel, size_t index) const;
+    void copyRecord(const relFile& rel, size_t record, std::span<uint8_t> bytes, bool toDisk);
+    void init_disk(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     bool findAndAllocateFreeOnTrack(int t, int& sector);
-    std::optional<directoryEntryPtr> findEmptyDirectorySlot();
+    std::optional<directoryEntryPtr> findEmptyDirectorySlot(directorySlot& slot);
+    std::optional<directorySlot> findSlot(std::string_view filename) const;
+    const directoryEntry& requireFile(std::string_view filename) const;
+    bool hostFileMatches(const std::string& path, const directoryEntry& entry, size_t length) const;
+
+    // walk the chain of a file, a bad link or a loop throws
+    template <typename Visit>
+    void walkFileChain(const directoryEntry& entry, Visit&& visit) const
+    {
+        auto chain = walkChain(entry.start, std::forward<Visit>(visit));
+        if (!chain) {
+            throw std::runtime_error(std::string(readErrorText(chain.error().code)));
+        }
+    }
+
+    static void checkAllocationPolicy(const allocationPolicy& policy);
+    int chooseAllocationTrack() const;
+    void beginFileAllocation(size_t sectors);
+
+    // run an action with another allocation policy, the disk's own is back afterwards even if it throws
+    template <typename Action>
+    auto withAllocation(const allocationPolicy& policy, Action&& action)
+    {
+        checkAllocationPolicy(policy);
+        struct restore {
+            allocationPolicy& current;
+            allocationPolicy saved;
+            ~restore() { current = saved; }
+        } guard{ allocation, std::exchange(allocation, policy) };
+        return action();
+    }
     bool allocateSideSector(int& track, int& sector, sideSectorPtr& side);
     bool allocateDataSector(int& track, int& sector, sectorPtr& sectorPtr);
-    void writeDataToSector(sectorPtr sectorPtr, const std::vector<uint8_t>& fileData, int& offset, int& bytesLeft);
-    std::vector<trackSector> writeFileDataToSectors(int start_track, int start_sector, const std::vector<uint8_t>& fileData);
+    void writeDataToSector(sectorPtr sectorPtr, std::span<const uint8_t> fileData, int& offset, int& bytesLeft);
+    std::vector<trackSector> writeFileDataToSectors(int start_track, int start_sector, std::span<const uint8_t> fileData);
+    void writeFileDataToSectors(const std::vector<trackSector>& chain, std::span<const uint8_t> fileData);
     std::optional<std::vector<sideSectorPtr>> createSideSectors(const std::vector<trackSector>& allocatedSectors, uint8_t record_size);
+    std::vector<sideSectorPtr> writeSideSectors(const std::vector<trackSector>& allocatedSectors, const std::vector<trackSector>& sides, uint8_t record_size);
     bool createDirectoryEntry(std::string_view filename, c64FileType type, int start_track, int start_sector, const std::vector<trackSector>& allocatedSectors, uint8_t record_size);
+    void writeDirectoryEntry(directoryEntry& fileEntry, const directorySlot& slot, std::string_view filename, c64FileType type, int start_track, int start_sector, const std::vector<trackSector>& allocatedSectors, uint8_t record_size);
+    int availableSectors() const;
+    int freeDirectorySlots() const;
     bool findAndAllocateFirstSector(int& start_track, int& start_sector);
     bool allocateNewDirectorySector(int& dir_track, int& dir_sector, directorySectorPtr& dirSectorPtr);
 
+    std::vector<trackSector> directoryChain() const;
+    bool endAtLoop(std::vector<trackSector>& chain) const;
+    std::vector<trackSector> entrySectors(const directoryEntry& entry) const;
+    std::ostream* openVerifyLog(const std::string& logFile, std::ofstream& logStream);
+    void rebuildVerifyCache();
+    void reconcileSlot(const directorySlot& slot, uint64_t& touched);
+    void dropSlot(int id, uint64_t& touched);
+    void useSector(const trackSector& ts, int16_t owner, uint64_t& touched);
+    void releaseSector(const trackSector& ts, int16_t owner, uint64_t& touched);
+    bool verifyTrack(int track, bool fix, std::ostream& log);
+    using sectorBits = std::array<uint64_t, (D64_DISK40_SZ / SECTOR_SIZE + 63) / 64>;
+    std::optional<diskError> markEntrySectors(const directoryEntry& entry, sectorBits& used, sectorBits& crossed) const;
+    inline int slotId(const directorySlot& slot) const
+    {
+        return sectorIndex(slot.location.track, slot.location.sector) * FILES_PER_SECTOR + slot.entry;
+    }
+
+    void rebuildFreeMap();
+    inline void refreshFreeMap(int track)
+    {
+        // a track with a zero free count is treated as full whatever its bitmap says
+        auto bam = std::as_const(*this).bamtrack(track - 1);
+        auto all = (1u << SECTORS_PER_TRACK[track - 1]) - 1;
+        freeMap[track - 1] = bam->free > 0 ? bam->mask() & all : 0;
+        freeTracks = freeMap[track - 1] ? freeTracks | uint64_t(1) << (track - 1) : freeTracks & ~(uint64_t(1) << (track - 1));
+    }
+
+    // the BAM pointers must be set again whenever the BAM sector may have moved
+    // a paged image gets its own copy of the BAM sector here
     inline void initBAMPtr()
     {
-        auto index = calcOffset(DIRECTORY_TRACK, BAM_SECTOR);
-        diskBamPtr = reinterpret_cast<bamPtr>(&data[index]);
+        auto bam = ownSector(sectorIndex(DIRECTORY_TRACK, BAM_SECTOR));
+        diskBamPtr = reinterpret_cast<bamPtr>(bam);
         bamTrackPtr = &(diskBamPtr->bamTrack[0]);
-        bamExtraTrackPtr = reinterpret_cast<bamTrackEntry*>(&data[index + 0xAC]);
+        bamExtraTrackPtr = reinterpret_cast<bamTrackEntry*>(bam + 0xAC);
+    }
+    inline int sectorIndex(int track, int sector) const
+    {
+        return calcOffset(track, sector) / SECTOR_SIZE;
+    }
+    // track and sector must already be valid
+    inline int uncheckedIndex(int track, int sector) const noexcept
+    {
+        assert(isValidTrackSector(track, sector));
+        return geometry40::SECTOR_LOOKUP[track * geometry40::LOOKUP_SECTORS + sector];
+    }
+    // sector number of a link, -1 if it is off the disk
+    inline int linkIndex(int track, int sector) const noexcept
+    {
+        return track <= TRACKS ? geometry40::lookup(track, sector) : -1;
+    }
+    // typed views of a sector without checks, index must come from a checked link
+    template <typename T>
+    inline const T* sectorAt(int index) const
+    {
+        assert(index >= 0 && static_cast<size_t>(index) < storage->size() / SECTOR_SIZE);
+        return reinterpret_cast<const T*>(sectorForRead(index));
+    }
+    template <typename T>
+    inline T* sectorAtForWrite(int index)
+    {
+        assert(index >= 0 && static_cast<size_t>(index) < storage->size() / SECTOR_SIZE);
+        return reinterpret_cast<T*>(sectorForWrite(index));
+    }
+    // the data bytes held by a chain sector, the last one holds next.sector - 1
+    static inline size_t chainBytes(const struct sector& current)
+    {
+        return current.next.track != 0 ? sizeof(current.data) : static_cast<size_t>(std::max(current.next.sector - 1, 0));
+    }
+
+    /// <summary>
+    /// Walk a sector chain checking each link once
+    /// a sector seen twice ends the walk, found with a bitmap of the visited sectors
+    /// visit is called with the location and bytes of each sector in chain order
+    /// </summary>
+    /// <param name="start">first sector of the chain</param>
+    /// <param name="visit">called for each sector</param>
+    /// <returns>number of sectors or the error with the sector holding the bad link</returns>
+    template <typename Visit>
+    diskResult<size_t> walkChain(trackSector start, Visit&& visit) const
+    {
+        auto index = linkIndex(start.track, start.sector);
+        if (index < 0) {
+            return diskError{ readError::read_chain_broken, start.track, start.sector };
+        }
+
+        std::array<uint64_t, D64_DISK40_SZ / SECTOR_SIZE / 64> visited = {};
+        size_t count = 0;
+        auto position = start;
+        while (true) {
+            visited[index >> 6] |= uint64_t(1) << (index & 63);
+            auto current = sectorAt<struct sector>(index);
+            ++count;
+            visit(position, *current);
+
+            auto next = current->next;
+            if (next.track == 0) return count;
+            index = linkIndex(next.track, next.sector);
+            if (index < 0) {
+                return diskError{ readError::read_chain_broken, position.track, position.sector };
+            }
+            if ((visited[index >> 6] >> (index & 63)) & 1) {
+                return diskError{ readError::read_chain_loop, position.track, position.sector };
+            }
+            position = next;
+        }
     }
-    bool isValidTrackSector(int track, int sector) const;
+    inline uint8_t* ownSector(int index)
+    {
+        return imageBytes != nullptr ? imageBytes + index * SECTOR_SIZE : storage->writableSector(index);
+    }
+    inline uint8_t* sectorForWrite(int index)
+    {
+        D64_COUNT(sectorsWritten, 1);
+        dirtySectors[index >> 6] |= uint64_t(1) << (index & 63);
+        markWritten(index);
+        return ownSector(index);
+    }
+    inline void markWritten(int index)
+    {
+        unsavedBits[index >> 6] |= uint64_t(1) << (index & 63);
+        hashedSectors[index >> 6] &= ~(uint64_t(1) << (index & 63));
+    }
+    std::vector<sectorRun> unsavedRuns() const;
+    static bool parsePatch(std::span<const uint8_t> patch, size_t sectors, std::vector<std::pair<sectorRun, size_t>>& runs);
+    static uint64_t journalChecksum(std::span<const uint8_t> bytes);
+    static uint64_t hash64(std::span<const uint8_t> bytes, uint64_t seed = 0);
+    uint64_t dataHash(int index) const;
+    uint64_t sectorHash(int index) const;
+    static inline uint64_t combineHash(uint64_t hash, uint64_t value)
+    {
+        hash ^= std::rotl(value * 0xC2B2AE3D27D4EB4Full, 31) * 0x9E3779B185EBCA87ull;
+        return std::rotl(hash, 27) * 0x9E3779B185EBCA87ull + 0x85EBCA77C2B2AE63ull;
+    }
+    static std::string journalName(const std::string& filename) { return filename + ".journal"; }
+    bool writeImage(std::ostream& out) const;
+    void writeJournal(const std::string& filename);
+    bool recoverJournal(const std::string& filename);
+    inline bool isDirty(int index) const
+    {
+        return (dirtySectors[index >> 6] >> (index & 63)) & 1;
+    }
+    inline const uint8_t* sectorForRead(int index) const
+    {
+        D64_COUNT(sectorsRead, 1);
+        return imageBytes != nullptr ? imageBytes + index * SECTOR_SIZE : storage->sector(index);
+    }
+    inline bool isValidTrackSector(int track, int sector) const noexcept
+    {
+        return linkIndex(track, sector) >= 0;
+    }
+    void attachStorage(std::unique_ptr<diskStorage> image);
+    static const diskFormat& openedFormat(size_t size, bool* errorInfo = nullptr);
+    void copyState(const d64& other);
+    void checkWritable() const;
+
+    static std::optional<fileNameKey> makeNameKey(std::string_view filename);
+    static fileNameKey makeNameKey(const directoryEntry& entry);
+    void buildNameIndex() const;
+    inline void requireNameIndex() const
+    {
+        if (!std::atomic_ref<bool>(nameIndexValid).load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> guard(indexLock.lock);
+            if (!nameIndexValid) {
+                buildNameIndex();
+            }
+        }
+    }
+    void indexName(const directoryEntry& entry, const directorySlot& slot);
+    void unindexName(const directoryEntry& entry);
+    inline void invalidateNameIndex()
+    {
+        nameIndexValid = false;
+        nameIndex.clear();
+    }
+    inline directoryEntryPtr getDirectoryEntryPtr(const directorySlot& slot)
+    {
+        return &getDirectory_SectorPtr(slot.location.track, slot.location.sector)->fileEntry[slot.entry];
+    }
+    inline const directoryEntry* getDirectoryEntryPtr(const directorySlot& slot) const
+    {
+        return &getDirectory_SectorPtr(slot.location.track, slot.location.sector)->fileEntry[slot.entry];
+    }
+
+    // only DIR_ENTRY_SZ bytes of an entry are its own
+    // padd is the start of the next entry and lies past the sector for the last one
+    static inline directoryEntry readEntry(const directoryEntry& entry)
+    {
+        directoryEntry copy{};
+        writeEntry(copy, entry);
+        return copy;
+    }
+    static inline void writeEntry(directoryEntry& to, const directoryEntry& from)
+    {
+        std::copy_n(reinterpret_cast<const uint8_t*>(&from), DIR_ENTRY_SZ, reinterpret_cast<uint8_t*>(&to));
+    }
+    static inline bool sameEntry(const directoryEntry& a, const directoryEntry& b)
+    {
+        auto bytes = reinterpret_cast<const uint8_t*>(&a);
+        return std::equal(bytes, bytes + DIR_ENTRY_SZ, reinterpret_cast<const uint8_t*>(&b));
+    }
+    bool permuteDirectory(const std::vector<directorySlot>& slots, const std::vector<size_t>& order);
+    void placeEntry(const directorySlot& slot, const directoryEntry& entry);
+
+    std::unique_ptr<diskStorage> storage;
+
+    // the storage bytes when they are in one block, nullptr for a paged image
+    uint8_t* imageBytes = nullptr;
+
+    // where diagnostics go, nullptr discards them
+    std::ostream* errorStream = &std::cerr;
+
+    // error code of each sector from the image file, empty if it had none
+    std::vector<uint8_t> errorInfo;
+
+    // free sectors of each track, bit n set if sector n is free
+    std::array<uint64_t, TRACKS_40> freeMap = {};
+    uint64_t freeTracks = 0;                        // bit per track with a free sector in freeMap
+    mutable d64Stats stats;
+    traceHook traceCallback;
+    bool freeMapValid = false;
+
+    // sector usage found by the last verifyBAMIntegrity
+    // verifyBAMIncremental brings it up to date from the sectors written since
+    struct fileUse {
+        directorySlot slot;
+        std::vector<trackSector> sectors;               // each sector once
+    };
+    struct verifyCache {
+        bool valid = false;
+        bool crossLinked = false;                       // a sector had more than one user
+        std::vector<trackSector> directoryChain;
+        std::unordered_map<int, fileUse> files;         // by slot id
+        std::vector<uint16_t> users;                    // number of users of each sector
+        std::vector<int16_t> owner;                     // slot id of the file using each sector
+        uint64_t badTracks = 0;                         // bit t - 1 set if the BAM of track t was wrong
+    };
+    static constexpr int16_t NO_OWNER = -1;
+    static constexpr int16_t DIRECTORY_OWNER = -2;
+    verifyCache verifyState;
+
+    // sectors written and BAM tracks changed since the last verify
+    std::array<uint64_t, (D64_DISK40_SZ / SECTOR_SIZE + 63) / 64> dirtySectors = {};
+    uint64_t dirtyBamTracks = 0;
+
+    // sectors changed since the image was loaded or saved
+    std::array<uint64_t, (D64_DISK40_SZ / SECTOR_SIZE + 63) / 64> unsavedBits = {};
+
+    // hash of the data bytes of each sector, kept until the sector is written
+    mutable std::array<uint64_t, D64_DISK40_SZ / SECTOR_SIZE> dataHashes = {};
+    mutable std::array<uint64_t, (D64_DISK40_SZ / SECTOR_SIZE + 63) / 64> hashedSectors = {};
 
-    std::vector<uint8_t> data;
+    // directory entries by name, built on first lookup
+    // readers sharing the disk build it once under indexLock, writers change it only while they have the disk to themselves
+    mutable std::unordered_map<fileNameKey, directorySlot, fileNameKeyHash> nameIndex;
+    mutable bool nameIndexValid = false;
+    mutable bool nameIndexDuplicates = false;
+    mutable cacheLock indexLock;
 };
 
-#pragma pack(pop)
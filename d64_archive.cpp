@@ -0,0 +1,391 @@
+// Written by Paul Baxter
+
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <algorithm>
+
+#include "d64_archive.h"
+
+// the header and index are used in place in the mapping
+static_assert(std::endian::native == std::endian::little, "archives are read in place and are little endian");
+
+/// <summary>
+/// write the whole image to a stream, one sector at a time from the archive
+/// </summary>
+/// <param name="out">stream to write to</param>
+/// <returns>true on success</returns>
+bool archiveStorage::write(std::ostream& out) const
+{
+    if (table == nullptr) {
+        return diskStorage::write(out);
+    }
+    for (size_t i = 0; i < length / SECTOR_BYTES && out.good(); ++i) {
+        out.write(reinterpret_cast<const char*>(sector(i)), SECTOR_BYTES);
+    }
+    return out.good();
+}
+
+/// <summary>
+/// open an archive
+/// only the header is checked here, each image is checked when it is opened
+/// </summary>
+/// <param name="filename">archive file</param>
+d64archive::d64archive(const std::string& filename)
+{
+    auto file = mappedStorage::open(filename, mapMode::map_read_only);
+    if (!file) {
+        throw std::runtime_error("Error: Could not map archive " + filename);
+    }
+    mapping = std::move(file);
+
+    header = at<archiveHeader>(0, 1);
+    if (std::memcmp(header->magic, archiveHeader::MAGIC, sizeof(header->magic)) != 0 || header->version != archiveHeader::VERSION ||
+        header->layout > archiveLayout::archive_deduplicated) {
+        throw std::runtime_error("Error: " + filename + " is not a disk archive");
+    }
+    index = at<archiveIndexEntry>(header->indexOffset, header->images);
+    byName = at<uint32_t>(header->byNameOffset, header->images);
+    byFingerprint = at<uint32_t>(header->byFingerprintOffset, header->images);
+    names = at<char>(header->namesOffset, header->namesSize);
+    if (layout() == archiveLayout::archive_deduplicated) {
+        data = at<uint8_t>(sizeof(archiveHeader), static_cast<uint64_t>(header->sectors) * SECTOR_SIZE);
+    }
+}
+
+/// <summary>
+/// name of an image
+/// </summary>
+/// <param name="index">image number</param>
+std::string_view d64archive::name(size_t index) const
+{
+    auto& image = entry(index);
+    if (static_cast<uint64_t>(image.nameOffset) + image.nameLength > header->namesSize) {
+        throw std::runtime_error("Error: Archive is damaged");
+    }
+    return std::string_view(names + image.nameOffset, image.nameLength);
+}
+
+/// <summary>
+/// find an image by name
+/// </summary>
+/// <param name="name">name it was added with</param>
+/// <returns>image number or nullopt if there is none</returns>
+std::optional<size_t> d64archive::find(std::string_view name) const
+{
+    auto first = byName, last = byName + size();
+    auto found = std::lower_bound(first, last, name, [&](uint32_t image, std::string_view key) { return this->name(image) < key; });
+    if (found == last || this->name(*found) != name) {
+        return std::nullopt;
+    }
+    return *found;
+}
+
+/// <summary>
+/// find an image by its contents
+/// </summary>
+/// <param name="fingerprint">imageFingerprint of the image</param>
+/// <returns>number of the first image added with it or nullopt if there is none</returns>
+std::optional<size_t> d64archive::findFingerprint(uint64_t fingerprint) const
+{
+    auto first = byFingerprint, last = byFingerprint + size();
+    auto found = std::lower_bound(first, last, fingerprint, [&](uint32_t image, uint64_t key) { return entry(image).fingerprint < key; });
+    if (found == last || entry(*found).fingerprint != fingerprint) {
+        return std::nullopt;
+    }
+    return *found;
+}
+
+/// <summary>
+/// open an image without copying it out of the archive
+/// </summary>
+/// <param name="index">image number</param>
+/// <param name="mode">map_read_only, or map_copy_on_write to copy only the sectors that change</param>
+/// <returns>the disk, throws std::runtime_error if the image is damaged</returns>
+d64 d64archive::disk(size_t index, mapMode mode) const
+{
+    if (mode == mapMode::map_write_through) {
+        throw std::invalid_argument("Error: An archive can not be written through");
+    }
+
+    auto& image = entry(index);
+    auto format = diskFormat::fromFileSize(image.size);
+    if (format == nullptr || image.size != format->imageSize || (image.errorSize != 0 && image.errorSize != format->errorSize())) {
+        throw std::runtime_error("Error: Archive is damaged");
+    }
+
+    // error bytes follow the image in whole sectors
+    std::vector<uint8_t> errors(image.errorSize);
+    auto errorSectors = (errors.size() + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    std::unique_ptr<diskStorage> storage;
+    if (layout() == archiveLayout::archive_concatenated) {
+        auto bytes = at<uint8_t>(image.location, image.size + errorSectors * SECTOR_SIZE);
+        std::copy_n(bytes + image.size, errors.size(), errors.begin());
+        storage = std::make_unique<archiveStorage>(mapping, bytes, image.size);
+    }
+    else {
+        // every sector number is checked once here so reads need no check
+        auto count = image.size / SECTOR_SIZE + errorSectors;
+        if (image.location > std::numeric_limits<uint64_t>::max() - count) {
+            throw std::runtime_error("Error: Archive is damaged");
+        }
+        auto table = at<uint32_t>(header->tableOffset, image.location + count) + image.location;
+        if (std::any_of(table, table + count, [&](uint32_t sector) { return sector >= header->sectors; })) {
+            throw std::runtime_error("Error: Archive is damaged");
+        }
+        for (size_t offset = 0; offset < errors.size(); offset += SECTOR_SIZE) {
+            auto sector = data + static_cast<size_t>(table[image.size / SECTOR_SIZE + offset / SECTOR_SIZE]) * SECTOR_SIZE;
+            std::copy_n(sector, std::min<size_t>(SECTOR_SIZE, errors.size() - offset), errors.begin() + offset);
+        }
+        storage = std::make_unique<archiveStorage>(mapping, table, data, image.size);
+    }
+    if (mode == mapMode::map_copy_on_write) {
+        storage = std::make_unique<pagedStorage>(std::shared_ptr<const diskStorage>(std::move(storage)), true);
+    }
+
+    d64 disk(std::move(storage));
+    disk.validateD64();
+    disk.setErrorInfo(errors);
+    return disk;
+}
+
+/// <summary>
+/// open an image by name
+/// </summary>
+/// <param name="name">name it was added with</param>
+/// <param name="mode">map_read_only or map_copy_on_write</param>
+/// <returns>the disk or nullopt if there is no image of that name</returns>
+std::optional<d64> d64archive::open(std::string_view name, mapMode mode) const
+{
+    auto found = find(name);
+    if (!found.has_value()) {
+        return std::nullopt;
+    }
+    return disk(found.value(), mode);
+}
+
+/// <summary>
+/// index entry of an image
+/// </summary>
+/// <param name="index">image number</param>
+const archiveIndexEntry& d64archive::entry(size_t index) const
+{
+    if (index >= size()) {
+        throw std::out_of_range("Error: No image " + std::to_string(index) + " in archive");
+    }
+    return this->index[index];
+}
+
+/// <summary>
+/// bytes of the mapping as an array, checked to lie inside it
+/// </summary>
+/// <param name="offset">byte offset in the file</param>
+/// <param name="count">number of T from there</param>
+/// <returns>the array, throws std::runtime_error if the file is too short for it</returns>
+template <typename T>
+const T* d64archive::at(uint64_t offset, uint64_t count) const
+{
+    auto length = mapping->size();
+    if (offset > length || count > (length - offset) / sizeof(T) || offset % alignof(T) != 0) {
+        throw std::runtime_error("Error: Archive is damaged");
+    }
+    return reinterpret_cast<const T*>(mapping->data() + offset);
+}
+
+/// <summary>
+/// start an archive
+/// </summary>
+/// <param name="filename">archive file, it is replaced</param>
+/// <param name="layout">how the images are stored</param>
+d64archiveWriter::d64archiveWriter(const std::string& filename, archiveLayout layout) : layout(layout)
+{
+    out.open(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Error: Could not open file for writing");
+    }
+
+    // the header is written by finish, a file left without one is never taken for an archive
+    archiveHeader blank = {};
+    writeBytes(&blank, sizeof(blank));
+}
+
+/// <summary>
+/// add the image read from a stream, such as the output of d64::save
+/// </summary>
+/// <param name="name">name to find it by, unique in the archive</param>
+/// <param name="image">stream holding one image, read to its end</param>
+void d64archiveWriter::add(std::string_view name, std::istream& image)
+{
+    std::vector<uint8_t> bytes(D64_DISK40_ERRORS_SZ + 1);
+    image.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    bytes.resize(static_cast<size_t>(image.gcount()));
+    addImage(name, bytes);
+}
+
+/// <summary>
+/// add a disk as it is now
+/// </summary>
+/// <param name="name">name to find it by, unique in the archive</param>
+/// <param name="disk">disk to add</param>
+void d64archiveWriter::add(std::string_view name, const d64& disk)
+{
+    std::stringstream image;
+    if (!disk.save(image)) {
+        throw std::runtime_error("Error: Could not write disk image");
+    }
+    add(name, image);
+}
+
+/// <summary>
+/// write the index and the header
+/// </summary>
+/// <returns>true if the archive was written</returns>
+bool d64archiveWriter::finish()
+{
+    if (finished) return true;
+    finished = true;
+
+    try {
+        archiveHeader header = {};
+        std::memcpy(header.magic, archiveHeader::MAGIC, sizeof(header.magic));
+        header.version = archiveHeader::VERSION;
+        header.layout = layout;
+        header.images = static_cast<uint32_t>(entries.size());
+        header.sectors = static_cast<uint32_t>(stored);
+
+        // the images and the sectors are whole sectors so the tables start aligned
+        header.tableOffset = written;
+        writeBytes(tables.data(), tables.size() * sizeof(uint32_t));
+        uint64_t padding = 0;
+        writeBytes(&padding, (sizeof(uint64_t) - written % sizeof(uint64_t)) % sizeof(uint64_t));
+
+        header.indexOffset = written;
+        for (auto& image : entries) {
+            archiveIndexEntry entry = { image.fingerprint, image.location, image.size,
+                static_cast<uint32_t>(image.nameOffset), static_cast<uint32_t>(image.nameLength), image.errorSize };
+            writeBytes(&entry, sizeof(entry));
+        }
+
+        auto nameOf = [&](uint32_t image) { return std::string_view(names).substr(entries[image].nameOffset, entries[image].nameLength); };
+        std::vector<uint32_t> order(entries.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return nameOf(a) < nameOf(b); });
+        header.byNameOffset = written;
+        writeBytes(order.data(), order.size() * sizeof(uint32_t));
+
+        // images with the same contents stay in the order they were added
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+            {
+                return entries[a].fingerprint != entries[b].fingerprint ? entries[a].fingerprint < entries[b].fingerprint : a < b;
+            });
+        header.byFingerprintOffset = written;
+        writeBytes(order.data(), order.size() * sizeof(uint32_t));
+
+        header.namesOffset = written;
+        header.namesSize = names.size();
+        writeBytes(names.data(), names.size());
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        return !out.fail();
+    }
+    catch (const std::runtime_error&) {
+        return false;
+    }
+}
+
+/// <summary>
+/// check an image and write it
+/// </summary>
+/// <param name="name">name to find it by</param>
+/// <param name="bytes">the image, throws std::invalid_argument if it is not a valid disk</param>
+void d64archiveWriter::addImage(std::string_view name, std::vector<uint8_t>& bytes)
+{
+    if (finished) {
+        throw std::runtime_error("Error: Archive is already finished");
+    }
+    if (name.empty() || usedNames.contains(std::string(name))) {
+        throw std::invalid_argument("Error: Duplicate image name " + std::string(name));
+    }
+
+    // a disk over the bytes checks them and hashes the sectors without a copy
+    d64 disk{ std::span<uint8_t>(bytes) };
+    try {
+        disk.validateD64();
+    }
+    catch (const std::runtime_error& e) {
+        throw std::invalid_argument(e.what());
+    }
+
+    // error bytes are stored after the image in whole sectors
+    auto errors = disk.errorCodes();
+    auto size = bytes.size() - errors.size();
+    std::vector<uint8_t> errorSectors((errors.size() + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE);
+    std::copy(errors.begin(), errors.end(), errorSectors.begin());
+
+    pendingImage image = { names.size(), name.size(), disk.imageFingerprint(), 0, static_cast<uint32_t>(size), static_cast<uint32_t>(errors.size()) };
+    if (layout == archiveLayout::archive_concatenated) {
+        image.location = written;
+        writeBytes(bytes.data(), size);
+        writeBytes(errorSectors.data(), errorSectors.size());
+    }
+    else {
+        image.location = tables.size();
+        size_t index = 0;
+        for (auto track = 1; track <= disk.TRACKS; ++track) {
+            for (auto sector = 0; sector < geometry40::SECTORS_PER_TRACK[track - 1]; ++sector, ++index) {
+                tables.push_back(storeSector(disk.sectorFingerprint(track, sector), bytes.data() + index * SECTOR_SIZE));
+            }
+        }
+        for (size_t offset = 0; offset < errorSectors.size(); offset += SECTOR_SIZE) {
+            auto chunk = std::span<const uint8_t>(errorSectors).subspan(offset, SECTOR_SIZE);
+            tables.push_back(storeSector(d64::dataFingerprint(chunk), chunk.data()));
+        }
+    }
+
+    usedNames.emplace(name);
+    names.append(name);
+    entries.push_back(image);
+}
+
+/// <summary>
+/// find a sector among those written or write it
+/// </summary>
+/// <param name="hash">fingerprint of the sector</param>
+/// <param name="bytes">the sector</param>
+/// <returns>its sector number in the archive</returns>
+uint32_t d64archiveWriter::storeSector(uint64_t hash, const uint8_t* bytes)
+{
+    auto [first, last] = sectorsByHash.equal_range(hash);
+    for (auto match = first; match != last; ++match) {
+        if (std::memcmp(sectors.data() + static_cast<size_t>(match->second) * SECTOR_SIZE, bytes, SECTOR_SIZE) == 0) {
+            return match->second;
+        }
+    }
+    if (stored == std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Error: Archive is full");
+    }
+
+    auto number = static_cast<uint32_t>(stored++);
+    sectors.insert(sectors.end(), bytes, bytes + SECTOR_SIZE);
+    sectorsByHash.emplace(hash, number);
+    writeBytes(bytes, SECTOR_SIZE);
+    return number;
+}
+
+/// <summary>
+/// append to the archive file
+/// </summary>
+/// <param name="bytes">bytes to write</param>
+/// <param name="size">number of bytes</param>
+void d64archiveWriter::writeBytes(const void* bytes, size_t size)
+{
+    out.write(static_cast<const char*>(bytes), size);
+    if (!out) {
+        throw std::runtime_error("Error: Could not write archive");
+    }
+    written += size;
+}
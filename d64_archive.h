@@ -0,0 +1,171 @@
+// Written by Paul Baxter
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <fstream>
+#include <istream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "d64.h"
+
+/// <summary>
+/// How the images of an archive are stored
+/// </summary>
+enum archiveLayout : uint8_t {
+    archive_concatenated,   // each image whole, one after another
+    archive_deduplicated    // each different sector once, images are tables of sector numbers
+};
+
+/// <summary>
+/// Layout of an archive file, little endian
+/// the header is followed by the images or the sectors, the sector tables, the index,
+/// the index sorted by name, the index sorted by fingerprint and the names
+/// </summary>
+struct archiveHeader {
+    static constexpr char MAGIC[8] = { 'D', '6', '4', 'A', 'R', 'C', 'H', 0 };
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;            // archiveLayout
+    uint32_t images;
+    uint32_t sectors;           // archive_deduplicated, sectors stored
+    uint64_t tableOffset;       // archive_deduplicated, a uint32_t sector number for every sector of every image
+    uint64_t indexOffset;       // an archiveIndexEntry for every image
+    uint64_t byNameOffset;      // uint32_t entry numbers sorted by name
+    uint64_t byFingerprintOffset;   // uint32_t entry numbers sorted by fingerprint
+    uint64_t namesOffset;
+    uint64_t namesSize;
+    uint8_t reserved[SECTOR_SIZE - 72];
+};
+static_assert(sizeof(archiveHeader) == SECTOR_SIZE);
+
+/// <summary>
+/// One image in the index of an archive
+/// </summary>
+struct archiveIndexEntry {
+    uint64_t fingerprint;       // imageFingerprint of the image
+    uint64_t location;          // byte offset of the image, or of its first sector number in the tables
+    uint32_t size;              // D64_DISK35_SZ or D64_DISK40_SZ
+    uint32_t nameOffset;        // in the names
+    uint32_t nameLength;
+    uint32_t errorSize;         // error bytes stored after the image in whole sectors, 0 if it has none
+};
+static_assert(sizeof(archiveIndexEntry) == 32);
+
+/// <summary>
+/// Disk image read in place from the mapping of an archive
+/// </summary>
+class archiveStorage : public diskStorage {
+public:
+    // a whole image of archive_concatenated
+    archiveStorage(std::shared_ptr<const mappedStorage> archive, const uint8_t* image, size_t size)
+        : archive(std::move(archive)), image(image), table(nullptr), length(size) {}
+    // the sector numbers of an image of archive_deduplicated
+    archiveStorage(std::shared_ptr<const mappedStorage> archive, const uint32_t* table, const uint8_t* sectors, size_t size)
+        : archive(std::move(archive)), image(sectors), table(table), length(size) {}
+
+    // the mapping is read only, writable keeps the disk from changing it
+    uint8_t* data() override { return table ? nullptr : const_cast<uint8_t*>(image); }
+    const uint8_t* data() const override { return table ? nullptr : image; }
+    size_t size() const override { return length; }
+    bool writable() const override { return false; }
+    bool mappedFrom(const std::string& filename) const override { return archive->mappedFrom(filename); }
+
+    const uint8_t* sector(size_t index) const override
+    {
+        return table ? image + static_cast<size_t>(table[index]) * SECTOR_BYTES : image + index * SECTOR_BYTES;
+    }
+    uint8_t* writableSector(size_t index) override { return const_cast<uint8_t*>(sector(index)); }
+    bool write(std::ostream& out) const override;
+
+private:
+    std::shared_ptr<const mappedStorage> archive;
+    const uint8_t* image;
+    const uint32_t* table;
+    size_t length;
+};
+
+/// <summary>
+/// Many disk images in one file, read straight from its mapping
+/// the disks it opens hold the mapping and may outlive the archive
+/// </summary>
+class d64archive {
+public:
+    explicit d64archive(const std::string& filename);
+
+    size_t size() const { return header->images; }
+    archiveLayout layout() const { return static_cast<archiveLayout>(header->layout); }
+    std::string_view name(size_t index) const;
+    uint64_t fingerprint(size_t index) const { return entry(index).fingerprint; }
+
+    std::optional<size_t> find(std::string_view name) const;
+    std::optional<size_t> findFingerprint(uint64_t fingerprint) const;
+    d64 disk(size_t index, mapMode mode = mapMode::map_read_only) const;
+    std::optional<d64> open(std::string_view name, mapMode mode = mapMode::map_read_only) const;
+
+private:
+    const archiveIndexEntry& entry(size_t index) const;
+    template <typename T>
+    const T* at(uint64_t offset, uint64_t count) const;
+
+    std::shared_ptr<const mappedStorage> mapping;
+    const archiveHeader* header = nullptr;
+    const archiveIndexEntry* index = nullptr;
+    const uint32_t* byName = nullptr;
+    const uint32_t* byFingerprint = nullptr;
+    const uint8_t* data = nullptr;
+    const char* names = nullptr;
+};
+
+/// <summary>
+/// Packs disk images into an archive file
+/// images are written as they are added, the index when the archive is finished
+/// until then the file is not a valid archive
+/// </summary>
+class d64archiveWriter {
+public:
+    explicit d64archiveWriter(const std::string& filename, archiveLayout layout = archiveLayout::archive_deduplicated);
+
+    d64archiveWriter(const d64archiveWriter&) = delete;
+    d64archiveWriter& operator=(const d64archiveWriter&) = delete;
+
+    void add(std::string_view name, std::istream& image);
+    void add(std::string_view name, const d64& disk);
+    bool finish();
+
+    size_t images() const { return entries.size(); }
+    size_t storedSectors() const { return stored; }
+
+private:
+    struct pendingImage {
+        size_t nameOffset;
+        size_t nameLength;
+        uint64_t fingerprint;
+        uint64_t location;
+        uint32_t size;
+        uint32_t errorSize;
+    };
+
+    void addImage(std::string_view name, std::vector<uint8_t>& bytes);
+    uint32_t storeSector(uint64_t hash, const uint8_t* bytes);
+    void writeBytes(const void* bytes, size_t size);
+
+    std::ofstream out;
+    archiveLayout layout;
+    uint64_t written = 0;
+    size_t stored = 0;
+    bool finished = false;
+    std::vector<pendingImage> entries;
+    std::string names;
+    std::unordered_set<std::string> usedNames;
+
+    // archive_deduplicated
+    std::vector<uint32_t> tables;
+    std::vector<uint8_t> sectors;                       // every sector written, to tell a hash collision from a match
+    std::unordered_multimap<uint64_t, uint32_t> sectorsByHash;
+};
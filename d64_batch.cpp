@@ -0,0 +1,238 @@
+// Written by Paul Baxter
+
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <iterator>
+
+#include "d64_batch.h"
+
+/// <summary>
+/// start the worker threads
+/// </summary>
+/// <param name="threads">number of workers, 0 for one per hardware thread</param>
+workStealingPool::workStealingPool(unsigned threads)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (auto i = 0u; i < threads; ++i) {
+        queues.push_back(std::make_unique<workQueue>());
+    }
+    for (auto i = 0u; i < threads; ++i) {
+        this->threads.emplace_back(&workStealingPool::worker, this, i);
+    }
+}
+
+/// <summary>
+/// stop and join the worker threads
+/// </summary>
+workStealingPool::~workStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+/// <summary>
+/// run task for every item from 0 to count - 1
+/// returns when every item is done
+/// </summary>
+/// <param name="count">number of items</param>
+/// <param name="task">work for one item</param>
+void workStealingPool::run(size_t count, const std::function<void(size_t)>& task)
+{
+    if (count == 0) return;
+    std::lock_guard<std::mutex> running(runLock);
+
+    std::unique_lock<std::mutex> guard(lock);
+
+    // give each worker a contiguous run of items
+    auto workers = queues.size();
+    for (size_t w = 0; w < workers; ++w) {
+        std::lock_guard<std::mutex> queueGuard(queues[w]->lock);
+        for (auto item = count * w / workers; item < count * (w + 1) / workers; ++item) {
+            queues[w]->items.push_back(item);
+        }
+    }
+
+    this->task = &task;
+    remaining = count;
+    ++generation;
+    wake.notify_all();
+
+    // wait for the work and for every worker to be idle again
+    finished.wait(guard, [&] { return remaining == 0 && active == 0; });
+    this->task = nullptr;
+}
+
+/// <summary>
+/// worker thread
+/// </summary>
+/// <param name="id">worker number</param>
+void workStealingPool::worker(unsigned id)
+{
+    size_t seen = 0;
+    while (true) {
+        const std::function<void(size_t)>* work;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            work = task;
+
+            // woke after the run it was called for had already finished
+            if (work == nullptr) continue;
+            ++active;
+        }
+
+        size_t item;
+        size_t done = 0;
+        while (next(id, item)) {
+            try {
+                (*work)(item);
+            }
+            catch (...) {
+                // a task must report its own errors
+            }
+            ++done;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            remaining -= done;
+            --active;
+        }
+        finished.notify_all();
+    }
+}
+
+/// <summary>
+/// get the next item for a worker
+/// its own queue is used newest first, others are robbed oldest first
+/// </summary>
+/// <param name="id">worker number</param>
+/// <param name="item">out next item</param>
+/// <returns>true if an item was found</returns>
+bool workStealingPool::next(unsigned id, size_t& item)
+{
+    {
+        auto& own = *queues[id];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.items.empty()) {
+            item = own.items.back();
+            own.items.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); ++i) {
+        auto& victim = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.items.empty()) {
+            item = victim.items.front();
+            victim.items.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// run the standard jobs on every image
+/// </summary>
+/// <param name="paths">image files</param>
+/// <param name="jobs">batchJob flags</param>
+/// <param name="outputDir">directory for batch_extract, one sub directory per image</param>
+/// <returns>one result per image in the order of paths</returns>
+std::vector<batchResult> d64batch::run(const std::vector<std::string>& paths, unsigned jobs, const std::string& outputDir)
+{
+    return run(paths, [&](d64& disk, batchResult& result)
+        {
+            auto ok = true;
+            if (jobs & batchJob::batch_directory) {
+                result.directory = disk.directory();
+            }
+            if (jobs & batchJob::batch_verify) {
+                result.report = disk.verify();
+                result.bamValid = result.report.valid();
+                if (!result.bamValid) {
+                    disk.errorLog() << "ERROR: " << result.report.mismatches.size() << " BAM mismatches, "
+                        << result.report.freeCounts.size() << " wrong free counts, "
+                        << result.report.crossLinks.size() << " cross linked sectors, "
+                        << result.report.chainFaults.size() << " bad chains\n";
+                }
+                ok = ok && result.bamValid;
+            }
+            if (jobs & batchJob::batch_fingerprint) {
+                result.fingerprint = disk.imageFingerprint();
+                for (auto& entry : disk.entries()) {
+                    result.fileFingerprints.emplace_back(d64::Trim(entry.fileName), disk.fileFingerprint(entry));
+                }
+            }
+            if (jobs & batchJob::batch_extract) {
+                auto stem = std::filesystem::path(result.path).stem();
+                ok = extractAll(disk, (std::filesystem::path(outputDir) / stem).string(), result) && ok;
+            }
+            return ok;
+        });
+}
+
+/// <summary>
+/// run a job on every image
+/// images are mapped read only, the job gets its own disk and result
+/// </summary>
+/// <param name="paths">image files</param>
+/// <param name="job">job to run, returns true on success</param>
+/// <returns>one result per image in the order of paths</returns>
+std::vector<batchResult> d64batch::run(const std::vector<std::string>& paths, const jobFunction& job)
+{
+    std::vector<batchResult> results(paths.size());
+
+    pool.run(paths.size(), [&](size_t index)
+        {
+            auto& result = results[index];
+            result.path = paths[index];
+
+            // everything the disk would have written to std::cerr goes to the result
+            std::ostringstream log;
+            try {
+                d64 disk(result.path, mapMode::map_read_only, &log);
+                result.loaded = true;
+                result.diskName = disk.diskname();
+                result.success = job(disk, result);
+            }
+            catch (const std::exception& e) {
+                log << "Error: " << e.what() << "\n";
+                result.success = false;
+            }
+            result.errors = log.str();
+        });
+
+    return results;
+}
+
+/// <summary>
+/// extract every file of a disk into a directory
+/// files already there with the same data are left as they are
+/// </summary>
+/// <param name="disk">disk to extract from</param>
+/// <param name="outputDir">directory to write to, created if needed</param>
+/// <param name="result">extracted file names are added here, errors go to the disk's log</param>
+/// <returns>true if every file was extracted</returns>
+bool d64batch::extractAll(d64& disk, const std::string& outputDir, batchResult& result)
+{
+    // the pool already runs one image per thread, so each disk writes its files on its own thread
+    auto report = disk.extractAll(outputDir);
+    result.upToDate += report.upToDate.size();
+    result.extracted.insert(result.extracted.end(), std::make_move_iterator(report.written.begin()), std::make_move_iterator(report.written.end()));
+    result.extracted.insert(result.extracted.end(), std::make_move_iterator(report.upToDate.begin()), std::make_move_iterator(report.upToDate.end()));
+    return report.ok();
+}
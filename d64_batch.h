@@ -0,0 +1,96 @@
+// Written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "d64.h"
+
+/// <summary>
+/// Jobs run on each image of a batch
+/// </summary>
+enum batchJob : unsigned {
+    batch_directory = 1 << 0,   // list the directory
+    batch_verify = 1 << 1,      // verify the BAM
+    batch_extract = 1 << 2,     // extract every file
+    batch_fingerprint = 1 << 3  // fingerprint the image and every file
+};
+
+/// <summary>
+/// Result of the jobs run on one image
+/// </summary>
+struct batchResult {
+    std::string path;                       // image file
+    bool loaded = false;                    // image was opened
+    bool success = false;                   // every job succeeded
+    std::string diskName;                   // name of the disk
+    std::vector<directoryEntry> directory;  // batch_directory
+    bool bamValid = false;                  // batch_verify, nothing in the report
+    verifyReport report;                    // batch_verify
+    std::vector<std::string> extracted;     // batch_extract, files written or already up to date
+    size_t upToDate = 0;                    // batch_extract, of those the ones left as they were
+    uint64_t fingerprint = 0;               // batch_fingerprint, whole image
+    std::vector<std::pair<std::string, uint64_t>> fileFingerprints;   // batch_fingerprint, name and data fingerprint of each file
+    std::string errors;                     // diagnostics from the disk and the jobs
+};
+
+/// <summary>
+/// Thread pool where idle workers steal queued work from busy ones
+/// </summary>
+class workStealingPool {
+public:
+    explicit workStealingPool(unsigned threads = 0);
+    ~workStealingPool();
+
+    workStealingPool(const workStealingPool&) = delete;
+    workStealingPool& operator=(const workStealingPool&) = delete;
+
+    void run(size_t count, const std::function<void(size_t)>& task);
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+private:
+    struct workQueue {
+        std::mutex lock;
+        std::deque<size_t> items;
+    };
+
+    void worker(unsigned id);
+    bool next(unsigned id, size_t& item);
+
+    std::vector<std::unique_ptr<workQueue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex runLock;                     // one run at a time
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(size_t)>* task = nullptr;
+    size_t generation = 0;
+    size_t remaining = 0;
+    unsigned active = 0;
+    bool stopping = false;
+};
+
+/// <summary>
+/// Run jobs over many disk images in parallel
+/// </summary>
+class d64batch {
+public:
+    using jobFunction = std::function<bool(d64& disk, batchResult& result)>;
+
+    explicit d64batch(unsigned threads = 0) : pool(threads) {}
+
+    std::vector<batchResult> run(const std::vector<std::string>& paths, unsigned jobs, const std::string& outputDir = "");
+    std::vector<batchResult> run(const std::vector<std::string>& paths, const jobFunction& job);
+    unsigned threads() const { return pool.size(); }
+
+    static bool extractAll(d64& disk, const std::string& outputDir, batchResult& result);
+
+private:
+    workStealingPool pool;
+};
@@ -0,0 +1,230 @@
+// Written by Paul Baxter
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+
+#include "d64_types.h"
+
+/// <summary>
+/// Sectors on each track of the 1541 speed zones, tracks past 35 are like 31-35
+/// </summary>
+struct zones1541 {
+    static constexpr int sectors(int track)
+    {
+        return track <= 17 ? 21 : track <= 24 ? 19 : track <= 30 ? 18 : 17;
+    }
+};
+
+/// <summary>
+/// Sectors on each track of a 1571, tracks 36-70 are the second side laid out like 1-35
+/// </summary>
+struct zones1571 {
+    static constexpr int sectors(int track)
+    {
+        return zones1541::sectors(track > TRACKS_35 ? track - TRACKS_35 : track);
+    }
+};
+
+/// <summary>
+/// Sectors on each track of a 1581, every track holds forty
+/// </summary>
+struct zones1581 {
+    static constexpr int sectors(int)
+    {
+        return 40;
+    }
+};
+
+/// <summary>
+/// Track layout of a Commodore disk image, all of it known at compile time
+/// offsets and sector numbers fold to constants when track and sector are
+/// </summary>
+template <int Tracks, typename Zones = zones1541>
+struct diskGeometry {
+    static constexpr int TRACKS = Tracks;
+
+    /// <summary>
+    /// sectors on a track
+    /// </summary>
+    /// <param name="track">track number starting at 1</param>
+    static constexpr int zoneSectors(int track)
+    {
+        return Zones::sectors(track);
+    }
+
+    static constexpr std::array<int, Tracks> SECTORS_PER_TRACK = []
+        {
+            std::array<int, Tracks> sectors = {};
+            for (auto t = 0; t < Tracks; ++t) {
+                sectors[t] = zoneSectors(t + 1);
+            }
+            return sectors;
+        }();
+
+    // byte offset of sector 0 of each track
+    static constexpr std::array<int, Tracks> TRACK_OFFSETS = []
+        {
+            std::array<int, Tracks> offsets = {};
+            auto offset = 0;
+            for (auto t = 0; t < Tracks; ++t) {
+                offsets[t] = offset;
+                offset += SECTORS_PER_TRACK[t] * SECTOR_SIZE;
+            }
+            return offsets;
+        }();
+
+    static constexpr int SECTORS = TRACK_OFFSETS[Tracks - 1] / SECTOR_SIZE + SECTORS_PER_TRACK[Tracks - 1];
+    static constexpr size_t IMAGE_SIZE = static_cast<size_t>(SECTORS) * SECTOR_SIZE;
+
+    // sector number of every track and sector, -1 where there is none
+    // indexed by track * LOOKUP_SECTORS + sector so a link is checked and found with one load
+    // the row is the power of two that holds the longest track, 32 for a 1541 and 64 for a 1581
+    static constexpr int LOOKUP_SECTORS = []
+        {
+            auto longest = 0;
+            for (auto t = 1; t <= Tracks; ++t) {
+                longest = longest > zoneSectors(t) ? longest : zoneSectors(t);
+            }
+            auto row = 1;
+            while (row < longest) row <<= 1;
+            return row;
+        }();
+    static constexpr std::array<int16_t, (Tracks + 1) * LOOKUP_SECTORS> SECTOR_LOOKUP = []
+        {
+            std::array<int16_t, (Tracks + 1) * LOOKUP_SECTORS> lookup = {};
+            lookup.fill(-1);
+            for (auto t = 1; t <= Tracks; ++t) {
+                for (auto s = 0; s < SECTORS_PER_TRACK[t - 1]; ++s) {
+                    lookup[t * LOOKUP_SECTORS + s] = static_cast<int16_t>(TRACK_OFFSETS[t - 1] / SECTOR_SIZE + s);
+                }
+            }
+            return lookup;
+        }();
+
+    /// <summary>
+    /// sector number of a track and sector
+    /// </summary>
+    /// <param name="track">track number starting at 1</param>
+    /// <param name="sector">sector number</param>
+    /// <returns>sector number counted from the start of the image or -1 if there is no such sector</returns>
+    static constexpr int lookup(int track, int sector) noexcept
+    {
+        return static_cast<unsigned>(track) <= Tracks && static_cast<unsigned>(sector) < LOOKUP_SECTORS ?
+            SECTOR_LOOKUP[track * LOOKUP_SECTORS + sector] : -1;
+    }
+
+    static constexpr bool isValid(int track, int sector) noexcept
+    {
+        return lookup(track, sector) >= 0;
+    }
+
+    // track and sector must already be valid
+    static constexpr int sectorIndex(int track, int sector) noexcept
+    {
+        return TRACK_OFFSETS[track - 1] / SECTOR_SIZE + sector;
+    }
+
+    static constexpr int offset(int track, int sector) noexcept
+    {
+        return TRACK_OFFSETS[track - 1] + sector * SECTOR_SIZE;
+    }
+};
+
+using geometry35 = diskGeometry<TRACKS_35>;
+using geometry40 = diskGeometry<TRACKS_40>;
+using geometry71 = diskGeometry<2 * TRACKS_35, zones1571>;
+using geometry81 = diskGeometry<80, zones1581>;
+
+static_assert(geometry35::IMAGE_SIZE == D64_DISK35_SZ);
+static_assert(geometry40::IMAGE_SIZE == D64_DISK40_SZ);
+static_assert(geometry71::IMAGE_SIZE == D71_DISK_SZ);
+static_assert(geometry81::IMAGE_SIZE == D81_DISK_SZ);
+static_assert(geometry35::offset(DIRECTORY_TRACK, BAM_SECTOR) == 0x16500);
+static_assert(geometry40::lookup(TRACKS_40, 16) == geometry40::SECTORS - 1 && geometry40::lookup(0, 0) == -1);
+static_assert(geometry40::LOOKUP_SECTORS == 32 && geometry81::LOOKUP_SECTORS == 64);
+static_assert(geometry71::offset(53, 0) == 0x41000 && geometry81::offset(40, 0) == 0x61800);
+
+/// <summary>
+/// An image file format, the geometry of its disk and where its directory is
+/// a file may hold the image alone or the image followed by one error byte per sector
+/// D71 and D81 images are only told apart by their size, they have no disk type and do not open
+/// </summary>
+struct diskFormat {
+    std::optional<diskType> type;   // empty for a format d64 does not open
+    const char* name;           // file extension without the dot
+    int tracks;
+    int sectors;
+    size_t imageSize;
+    int directoryTrack;         // the BAM of a 1581 is in sectors 1 and 2 of the header track
+    int bamSector;
+
+    constexpr size_t errorSize() const { return static_cast<size_t>(sectors); }
+    constexpr size_t fileSize(bool errorInfo) const { return imageSize + (errorInfo ? errorSize() : 0); }
+
+    /// <summary>
+    /// sector number of a track and sector
+    /// </summary>
+    /// <param name="track">track number starting at 1</param>
+    /// <param name="sector">sector number</param>
+    /// <returns>sector number counted from the start of the image or -1 if there is no such sector</returns>
+    constexpr int lookup(int track, int sector) const noexcept
+    {
+        switch (tracks) {
+            case geometry35::TRACKS:
+                return geometry35::lookup(track, sector);
+            case geometry40::TRACKS:
+                return geometry40::lookup(track, sector);
+            case geometry71::TRACKS:
+                return geometry71::lookup(track, sector);
+            default:
+                return geometry81::lookup(track, sector);
+        }
+    }
+
+    static const diskFormat& of(diskType type);
+    static const diskFormat* fromFileSize(size_t size, bool* errorInfo = nullptr);
+};
+
+inline constexpr std::array<diskFormat, 4> DISK_FORMATS = { {
+    { diskType::thirty_five_track, "d64", TRACKS_35, geometry35::SECTORS, geometry35::IMAGE_SIZE, DIRECTORY_TRACK, BAM_SECTOR },
+    { diskType::forty_track, "d64", TRACKS_40, geometry40::SECTORS, geometry40::IMAGE_SIZE, DIRECTORY_TRACK, BAM_SECTOR },
+    { std::nullopt, "d71", geometry71::TRACKS, geometry71::SECTORS, geometry71::IMAGE_SIZE, DIRECTORY_TRACK, BAM_SECTOR },
+    { std::nullopt, "d81", geometry81::TRACKS, geometry81::SECTORS, geometry81::IMAGE_SIZE, 40, 1 }
+} };
+
+static_assert(DISK_FORMATS[0].fileSize(true) == D64_DISK35_ERRORS_SZ && DISK_FORMATS[1].fileSize(true) == D64_DISK40_ERRORS_SZ);
+
+/// <summary>
+/// format of a disk type
+/// </summary>
+/// <param name="type">disk type</param>
+/// <returns>the format, throws std::runtime_error if there is no such disk type</returns>
+inline const diskFormat& diskFormat::of(diskType type)
+{
+    if (static_cast<size_t>(type) >= DISK_FORMATS.size() || DISK_FORMATS[type].type != type) {
+        throw std::runtime_error("Invalid Disk type");
+    }
+    return DISK_FORMATS[type];
+}
+
+/// <summary>
+/// find the format of an image file from its size
+/// </summary>
+/// <param name="size">bytes in the file</param>
+/// <param name="errorInfo">out true if the image is followed by error bytes, may be nullptr</param>
+/// <returns>the format or nullptr if no format has that size</returns>
+inline const diskFormat* diskFormat::fromFileSize(size_t size, bool* errorInfo)
+{
+    for (auto& format : DISK_FORMATS) {
+        if (size == format.imageSize || size == format.fileSize(true)) {
+            if (errorInfo != nullptr) {
+                *errorInfo = size != format.imageSize;
+            }
+            return &format;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,124 @@
+// Written by Paul Baxter
+
+#include <fstream>
+#include <mutex>
+
+#include "d64_loader.h"
+
+/// <summary>
+/// constructor
+/// io_uring falls back to the thread pool where the kernel does not have it
+/// </summary>
+/// <param name="depth">reads kept in flight by io_uring</param>
+/// <param name="backend">load_io_uring or load_thread_pool</param>
+/// <param name="threads">workers of the thread pool, 0 for one per hardware thread</param>
+d64loader::d64loader(unsigned depth, loadBackend backend, unsigned threads)
+{
+    if (backend == loadBackend::load_io_uring) {
+        reader = batchFileReader::open(depth);
+    }
+    if (!reader) {
+        pool = std::make_unique<workStealingPool>(threads);
+    }
+}
+
+d64loader::~d64loader() = default;
+
+/// <summary>
+/// number of images read at once
+/// </summary>
+unsigned d64loader::depth() const
+{
+    return reader ? reader->depth() : pool->size();
+}
+
+/// <summary>
+/// load every image
+/// returns when ready has been called for every image
+/// </summary>
+/// <param name="paths">image files</param>
+/// <param name="ready">called as each image is loaded or fails</param>
+void d64loader::load(const std::vector<std::string>& paths, const readyFunction& ready)
+{
+    if (reader) {
+        reader->readAll(paths, D64_DISK40_ERRORS_SZ, [&](size_t index, std::unique_ptr<vectorStorage> image, const std::string& error)
+            {
+                auto loaded = makeImage(index, paths[index], std::move(image), error);
+                ready(loaded);
+            });
+        return;
+    }
+
+    std::mutex readyLock;
+    pool->run(paths.size(), [&](size_t index)
+        {
+            std::unique_ptr<vectorStorage> image;
+            std::string error;
+            std::ifstream inFile(paths[index], std::ios::binary | std::ios::ate);
+            if (!inFile) {
+                error = "Could not open " + paths[index];
+            }
+            else {
+                auto size = static_cast<size_t>(inFile.tellg());
+                if (size == 0 || size > D64_DISK40_ERRORS_SZ) {
+                    error = "Invalid disk size";
+                }
+                else {
+                    image = std::make_unique<vectorStorage>(size);
+                    inFile.seekg(0);
+                    if (!inFile.read(reinterpret_cast<char*>(image->data()), image->size())) {
+                        error = "Could not read " + paths[index];
+                        image.reset();
+                    }
+                }
+            }
+
+            auto loaded = makeImage(index, paths[index], std::move(image), error);
+            std::lock_guard<std::mutex> guard(readyLock);
+            ready(loaded);
+        });
+}
+
+/// <summary>
+/// load every image
+/// </summary>
+/// <param name="paths">image files</param>
+/// <returns>one image per path in the order of paths</returns>
+std::vector<loadedImage> d64loader::load(const std::vector<std::string>& paths)
+{
+    std::vector<loadedImage> images(paths.size());
+    load(paths, [&](loadedImage& image)
+        {
+            images[image.index] = std::move(image);
+        });
+    return images;
+}
+
+/// <summary>
+/// make a disk from the bytes of a file and validate it
+/// </summary>
+/// <param name="index">position in paths</param>
+/// <param name="path">image file</param>
+/// <param name="image">bytes of the file or nullptr if it could not be read</param>
+/// <param name="error">why it could not be read</param>
+/// <returns>the loaded image</returns>
+loadedImage d64loader::makeImage(size_t index, const std::string& path, std::unique_ptr<diskStorage> image, const std::string& error)
+{
+    loadedImage loaded;
+    loaded.index = index;
+    loaded.path = path;
+    loaded.error = error;
+    if (!image) {
+        return loaded;
+    }
+
+    try {
+        d64 disk(std::move(image));
+        disk.validateD64();
+        loaded.disk.emplace(std::move(disk));
+    }
+    catch (const std::exception& e) {
+        loaded.error = e.what();
+    }
+    return loaded;
+}
@@ -0,0 +1,59 @@
+// Written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <functional>
+
+#include "d64.h"
+#include "d64_batch.h"
+
+/// <summary>
+/// How a loader reads the image files
+/// </summary>
+enum loadBackend : uint8_t {
+    load_io_uring,      // every read in one io_uring, Linux only
+    load_thread_pool    // each read on a worker thread
+};
+
+/// <summary>
+/// One image of a load, passed to the ready function
+/// </summary>
+struct loadedImage {
+    size_t index = 0;           // position in the paths that were loaded
+    std::string path;
+    std::optional<d64> disk;    // empty if the image could not be read or is not a valid disk
+    std::string error;          // why there is no disk
+
+    bool ok() const { return disk.has_value(); }
+};
+
+/// <summary>
+/// Loads many disk images with their reads in flight together
+/// each image is validated as its read finishes and handed over while the others are still being read
+/// </summary>
+class d64loader {
+public:
+    // called once for every image in the order they finish, never on two threads at once
+    // like a pool task it must report its own errors
+    // the disk may be moved out of the image
+    using readyFunction = std::function<void(loadedImage& image)>;
+
+    explicit d64loader(unsigned depth = 16, loadBackend backend = loadBackend::load_io_uring, unsigned threads = 0);
+    ~d64loader();
+
+    d64loader(const d64loader&) = delete;
+    d64loader& operator=(const d64loader&) = delete;
+
+    void load(const std::vector<std::string>& paths, const readyFunction& ready);
+    std::vector<loadedImage> load(const std::vector<std::string>& paths);
+    loadBackend backend() const { return reader ? loadBackend::load_io_uring : loadBackend::load_thread_pool; }
+    unsigned depth() const;
+
+private:
+    static loadedImage makeImage(size_t index, const std::string& path, std::unique_ptr<diskStorage> image, const std::string& error);
+
+    std::unique_ptr<batchFileReader> reader;
+    std::unique_ptr<workStealingPool> pool;
+};
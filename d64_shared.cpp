@@ -0,0 +1,85 @@
+// Written by Paul Baxter
+
+#include "d64_shared.h"
+
+/// <summary>
+/// share a disk
+/// </summary>
+/// <param name="disk">disk to share, it belongs to the shared disk from now on</param>
+sharedDisk::sharedDisk(d64 disk) : disk(std::move(disk))
+{
+}
+
+/// <summary>
+/// list the directory
+/// </summary>
+/// <returns>directory entries</returns>
+std::vector<directoryEntry> sharedDisk::directory() const
+{
+    return read([](const d64& disk) { return disk.directory(); });
+}
+
+/// <summary>
+/// read a file
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <returns>data of the file</returns>
+std::optional<std::vector<uint8_t>> sharedDisk::readFile(std::string_view filename) const
+{
+    return read([&](const d64& disk) { return disk.readFile(std::string(filename)); });
+}
+
+/// <summary>
+/// read a sector
+/// </summary>
+/// <param name="track">track number</param>
+/// <param name="sector">sector number</param>
+/// <returns>optional vector of data read</returns>
+std::optional<std::vector<uint8_t>> sharedDisk::readSector(int track, int sector) const
+{
+    return read([&](const d64& disk) { return disk.readSector(track, sector); });
+}
+
+/// <summary>
+/// get the number of bytes in a file
+/// </summary>
+/// <param name="filename">file to measure</param>
+/// <returns>number of data bytes in the file</returns>
+size_t sharedDisk::fileLength(std::string_view filename) const
+{
+    return read([&](const d64& disk) { return disk.fileLength(filename); });
+}
+
+/// <summary>
+/// add a file
+/// </summary>
+/// <param name="filename">name of the file</param>
+/// <param name="type">file type</param>
+/// <param name="fileData">bytes of the file</param>
+/// <param name="recordSize">record size of a .REL file</param>
+/// <returns>true if successful</returns>
+bool sharedDisk::addFile(std::string_view filename, c64FileType type, std::span<const uint8_t> fileData, int recordSize)
+{
+    return write([&](d64& disk) { return disk.addFile(filename, type, fileData, recordSize); });
+}
+
+/// <summary>
+/// remove a file
+/// </summary>
+/// <param name="filename">file to remove</param>
+/// <returns>true if successful</returns>
+bool sharedDisk::removeFile(std::string_view filename)
+{
+    return write([&](d64& disk) { return disk.removeFile(filename); });
+}
+
+/// <summary>
+/// save the image, readers wait until it is written
+/// </summary>
+/// <param name="filename">name of file</param>
+/// <param name="mode">how to write the file</param>
+/// <returns>true if successful</returns>
+bool sharedDisk::save(std::string filename, saveMode mode)
+{
+    return write([&](d64& disk) { return disk.save(filename, mode); });
+}
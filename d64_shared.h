@@ -0,0 +1,55 @@
+// Written by Paul Baxter
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <span>
+#include <utility>
+#include <shared_mutex>
+
+#include "d64.h"
+
+/// <summary>
+/// One disk image served to many threads without a copy per thread
+/// any number of readers run at once, a writer waits for them and has the disk to itself
+/// a reader gets the disk as const, the const members of d64 are the ones safe to call while other readers run
+/// </summary>
+class sharedDisk {
+public:
+    explicit sharedDisk(d64 disk);
+
+    sharedDisk(const sharedDisk&) = delete;
+    sharedDisk& operator=(const sharedDisk&) = delete;
+
+    // run an action on the disk alongside other readers
+    template <typename Action>
+    auto read(Action&& action) const
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return action(std::as_const(disk));
+    }
+
+    // run an action on the disk with no reader or other writer running
+    template <typename Action>
+    auto write(Action&& action)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        return action(disk);
+    }
+
+    // readers
+    std::vector<directoryEntry> directory() const;
+    std::optional<std::vector<uint8_t>> readFile(std::string_view filename) const;
+    std::optional<std::vector<uint8_t>> readSector(int track, int sector) const;
+    size_t fileLength(std::string_view filename) const;
+
+    // writers
+    bool addFile(std::string_view filename, c64FileType type, std::span<const uint8_t> fileData, int recordSize = 0);
+    bool removeFile(std::string_view filename);
+    bool save(std::string filename, saveMode mode = saveMode::save_in_place);
+
+private:
+    mutable std::shared_mutex lock;
+    d64 disk;
+};
@@ -0,0 +1,700 @@
+// Written by Paul Baxter
+
+#include <filesystem>
+#include <system_error>
+#include <ostream>
+#include <cstring>
+#include <algorithm>
+
+#include "d64_storage.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <atomic>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/// <summary>
+/// copy the storage into a new heap buffer
+/// </summary>
+/// <returns>independent copy of the image</returns>
+std::unique_ptr<diskStorage> diskStorage::clone() const
+{
+    if (data() != nullptr) {
+        return std::make_unique<vectorStorage>(data(), size());
+    }
+    auto copy = std::make_unique<vectorStorage>(size());
+    for (size_t i = 0; i < size() / SECTOR_BYTES; ++i) {
+        std::memcpy(copy->data() + i * SECTOR_BYTES, sector(i), SECTOR_BYTES);
+    }
+    return copy;
+}
+
+/// <summary>
+/// write the whole image to a stream
+/// </summary>
+/// <param name="out">stream to write to</param>
+/// <returns>true on success</returns>
+bool diskStorage::write(std::ostream& out) const
+{
+    out.write(reinterpret_cast<const char*>(data()), size());
+    return out.good();
+}
+
+/// <summary>
+/// write runs of sectors in place into an existing image file
+/// the rest of the file is left as it is
+/// </summary>
+/// <param name="filename">file to update, it must be the size of the image and trailer</param>
+/// <param name="runs">sectors to write</param>
+/// <param name="flush">true to wait until the sectors are on the disk</param>
+/// <param name="trailer">bytes the file holds after the image, such as its error bytes</param>
+/// <returns>true on success</returns>
+bool diskStorage::writeSectors(const std::string& filename, const std::vector<sectorRun>& runs, bool flush, size_t trailer) const
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER sz;
+    auto ok = GetFileSizeEx(file, &sz) && static_cast<size_t>(sz.QuadPart) == size() + trailer;
+
+    auto writeAt = [&](const uint8_t* bytes, size_t len, size_t offset)
+        {
+            OVERLAPPED at = {};
+            at.Offset = static_cast<DWORD>(offset);
+            at.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(offset) >> 32);
+            DWORD written = 0;
+            return WriteFile(file, bytes, static_cast<DWORD>(len), &written, &at) && written == len;
+        };
+#else
+    int fd = ::open(filename.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    auto ok = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size() + trailer;
+
+    auto writeAt = [&](const uint8_t* bytes, size_t len, size_t offset)
+        {
+            while (len > 0) {
+                auto written = ::pwrite(fd, bytes, len, static_cast<off_t>(offset));
+                if (written < 0 && errno == EINTR) continue;
+                if (written <= 0) return false;
+                bytes += written;
+                len -= static_cast<size_t>(written);
+                offset += static_cast<size_t>(written);
+            }
+            return true;
+        };
+#endif
+
+    for (auto& run : runs) {
+        if (!ok) break;
+        if (data() != nullptr) {
+            // the run is one block of the image
+            ok = writeAt(data() + run.first * SECTOR_BYTES, run.count * SECTOR_BYTES, run.first * SECTOR_BYTES);
+            continue;
+        }
+        for (auto i = run.first; i < run.first + run.count && ok; ++i) {
+            ok = writeAt(sector(i), SECTOR_BYTES, i * SECTOR_BYTES);
+        }
+    }
+
+#ifdef _WIN32
+    ok = ok && (!flush || FlushFileBuffers(file));
+    CloseHandle(file);
+#else
+    ok = ok && (!flush || ::fsync(fd) == 0);
+    ok = ::close(fd) == 0 && ok;
+#endif
+    return ok;
+}
+
+/// <summary>
+/// create or replace a file from pieces of memory, gathered into as few writes as the system allows
+/// </summary>
+/// <param name="filename">file to write</param>
+/// <param name="parts">bytes of the file in order, such as the sectors of a chain</param>
+/// <param name="flush">true to wait until the file is on the disk</param>
+/// <returns>true on success</returns>
+bool diskStorage::writeFile(const std::string& filename, std::span<const std::span<const uint8_t>> parts, bool flush)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    auto ok = true;
+    for (auto& part : parts) {
+        DWORD written = 0;
+        ok = ok && WriteFile(file, part.data(), static_cast<DWORD>(part.size()), &written, nullptr) && written == part.size();
+    }
+    ok = ok && (!flush || FlushFileBuffers(file));
+    ok = CloseHandle(file) && ok;
+    return ok;
+#else
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<iovec> pieces;
+    pieces.reserve(parts.size());
+    for (auto& part : parts) {
+        if (!part.empty()) {
+            pieces.push_back({ const_cast<uint8_t*>(part.data()), part.size() });
+        }
+    }
+
+    auto ok = true;
+    size_t first = 0;
+    while (ok && first < pieces.size()) {
+        auto written = ::writev(fd, pieces.data() + first, static_cast<int>(std::min<size_t>(pieces.size() - first, IOV_MAX)));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            ok = false;
+            break;
+        }
+        // a short write can stop inside a piece
+        auto left = static_cast<size_t>(written);
+        while (first < pieces.size() && left >= pieces[first].iov_len) {
+            left -= pieces[first++].iov_len;
+        }
+        if (left > 0) {
+            pieces[first].iov_base = static_cast<uint8_t*>(pieces[first].iov_base) + left;
+            pieces[first].iov_len -= left;
+        }
+    }
+    ok = ok && (!flush || ::fsync(fd) == 0);
+    ok = ::close(fd) == 0 && ok;
+    return ok;
+#endif
+}
+
+/// <summary>
+/// wait until a file that has been written and closed is on the disk
+/// </summary>
+/// <param name="filename">file to flush</param>
+/// <returns>true on success</returns>
+bool diskStorage::syncFile(const std::string& filename)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    auto ok = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return ok;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    auto ok = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+#endif
+}
+
+/// <summary>
+/// wait until the directory entry of a file that was created, renamed or removed is on the disk
+/// </summary>
+/// <param name="filename">file in the directory to flush</param>
+/// <returns>true on success</returns>
+bool diskStorage::syncDirectory(const std::string& filename)
+{
+#ifdef _WIN32
+    // a directory can not be opened to flush it here
+    return true;
+#else
+    auto dir = std::filesystem::path(filename).parent_path();
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+    auto ok = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+#endif
+}
+
+/// <summary>
+/// share every sector of a base image
+/// </summary>
+/// <param name="base">image to share, it must not change afterwards</param>
+/// <param name="canWrite">true if the sectors may be modified</param>
+pagedStorage::pagedStorage(std::shared_ptr<const diskStorage> base, bool canWrite) :
+    base(std::move(base)),
+    canWrite(canWrite)
+{
+    pages.resize(this->base->size() / SECTOR_BYTES);
+}
+
+/// <summary>
+/// get a sector to change
+/// a sector still shared with the base or another fork is copied first
+/// </summary>
+/// <param name="index">sector number counted from the start of the image</param>
+/// <returns>bytes of the sector owned by this storage</returns>
+uint8_t* pagedStorage::writableSector(size_t index)
+{
+    auto& page = pages[index];
+    if (!page) {
+        page = std::make_shared<sectorPage>();
+        std::memcpy(page->data(), base->sector(index), SECTOR_BYTES);
+    }
+    else if (page.use_count() > 1) {
+        page = std::make_shared<sectorPage>(*page);
+    }
+    return page->data();
+}
+
+/// <summary>
+/// count the sectors that would be copied before they could change
+/// </summary>
+/// <returns>number of shared sectors</returns>
+size_t pagedStorage::sharedSectors() const
+{
+    return std::count_if(pages.begin(), pages.end(), [](auto& page) { return !page || page.use_count() > 1; });
+}
+
+/// <summary>
+/// write the whole image to a stream one sector at a time
+/// </summary>
+/// <param name="out">stream to write to</param>
+/// <returns>true on success</returns>
+bool pagedStorage::write(std::ostream& out) const
+{
+    for (size_t i = 0; i < pages.size() && out.good(); ++i) {
+        out.write(reinterpret_cast<const char*>(sector(i)), SECTOR_BYTES);
+    }
+    return out.good();
+}
+
+/// <summary>
+/// make a writable storage sharing every sector with this one
+/// </summary>
+/// <returns>new storage, O(sectors) reference counts and no sector copies</returns>
+std::unique_ptr<pagedStorage> pagedStorage::fork() const
+{
+    auto copy = std::make_unique<pagedStorage>(*this);
+    copy->canWrite = true;
+    return copy;
+}
+
+/// <summary>
+/// map a disk image file into memory
+/// </summary>
+/// <param name="filename">file to map</param>
+/// <param name="mode">how to map the file</param>
+/// <returns>mapped storage or nullptr on failure</returns>
+std::unique_ptr<mappedStorage> mappedStorage::open(const std::string& filename, mapMode mode)
+{
+    std::unique_ptr<mappedStorage> storage(new mappedStorage());
+    storage->mode = mode;
+    storage->path = filename;
+
+#ifdef _WIN32
+    DWORD access = mode == mapMode::map_write_through ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+    HANDLE file = CreateFileA(filename.c_str(), access, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    storage->fileHandle = file;
+
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(file, &sz) || sz.QuadPart == 0) {
+        return nullptr;
+    }
+    storage->length = static_cast<size_t>(sz.QuadPart);
+    storage->imageLength = storage->length;
+
+    DWORD protect = PAGE_READONLY;
+    DWORD view = FILE_MAP_READ;
+    if (mode == mapMode::map_copy_on_write) {
+        protect = PAGE_WRITECOPY;
+        view = FILE_MAP_COPY;
+    }
+    else if (mode == mapMode::map_write_through) {
+        protect = PAGE_READWRITE;
+        view = FILE_MAP_WRITE;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, protect, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+    storage->mappingHandle = mapping;
+
+    storage->base = static_cast<uint8_t*>(MapViewOfFile(mapping, view, 0, 0, 0));
+    if (storage->base == nullptr) {
+        return nullptr;
+    }
+#else
+    int flags = mode == mapMode::map_write_through ? O_RDWR : O_RDONLY;
+    storage->fd = ::open(filename.c_str(), flags);
+    if (storage->fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(storage->fd, &st) != 0 || st.st_size == 0) {
+        return nullptr;
+    }
+    storage->length = static_cast<size_t>(st.st_size);
+    storage->imageLength = storage->length;
+
+    int prot = PROT_READ;
+    int share = MAP_PRIVATE;
+    if (mode == mapMode::map_copy_on_write) {
+        prot |= PROT_WRITE;
+    }
+    else if (mode == mapMode::map_write_through) {
+        prot |= PROT_WRITE;
+        share = MAP_SHARED;
+    }
+
+    void* addr = mmap(nullptr, storage->length, prot, share, storage->fd, 0);
+    if (addr == MAP_FAILED) {
+        return nullptr;
+    }
+    storage->base = static_cast<uint8_t*>(addr);
+#endif
+    return storage;
+}
+
+/// <summary>
+/// unmap the view and close the file
+/// </summary>
+mappedStorage::~mappedStorage()
+{
+#ifdef _WIN32
+    if (base != nullptr) UnmapViewOfFile(base);
+    if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+    if (fileHandle != nullptr) CloseHandle(fileHandle);
+#else
+    if (base != nullptr) munmap(base, length);
+    if (fd >= 0) ::close(fd);
+#endif
+}
+
+/// <summary>
+/// flush a write through mapping to the file
+/// </summary>
+/// <returns>true on success</returns>
+bool mappedStorage::sync()
+{
+    if (mode != mapMode::map_write_through) return true;
+#ifdef _WIN32
+    return FlushViewOfFile(base, length) && FlushFileBuffers(fileHandle);
+#else
+    return msync(base, length, MS_SYNC) == 0;
+#endif
+}
+
+/// <summary>
+/// true if the mapping writes through to filename
+/// </summary>
+/// <param name="filename">file to test</param>
+bool mappedStorage::writesThrough(const std::string& filename) const
+{
+    return mode == mapMode::map_write_through && mappedFrom(filename);
+}
+
+/// <summary>
+/// true if the mapping was created from filename
+/// </summary>
+/// <param name="filename">file to test</param>
+bool mappedStorage::mappedFrom(const std::string& filename) const
+{
+    std::error_code ec;
+    return std::filesystem::equivalent(path, filename, ec);
+}
+
+#ifdef __linux__
+
+/// <summary>
+/// The rings shared with the kernel, set up without liburing
+/// </summary>
+struct batchFileReader::ringState {
+    int fd = -1;
+    unsigned entries = 0;
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    ~ringState()
+    {
+        if (sqes != nullptr) munmap(sqes, sqesSize);
+        if (cqRing != nullptr && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != nullptr) munmap(sqRing, sqRingSize);
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+/// <summary>
+/// set up io_uring
+/// </summary>
+/// <param name="depth">reads to keep in flight</param>
+/// <returns>reader or nullptr if the kernel does not allow io_uring or can not read with it</returns>
+std::unique_ptr<batchFileReader> batchFileReader::open(unsigned depth)
+{
+    std::unique_ptr<batchFileReader> reader(new batchFileReader());
+    reader->ring = std::make_unique<ringState>();
+    auto& ring = *reader->ring;
+
+    io_uring_params params = {};
+    ring.fd = static_cast<int>(syscall(__NR_io_uring_setup, std::max(1u, depth), &params));
+    if (ring.fd < 0) {
+        return nullptr;
+    }
+    // kernels before 5.6 set up a ring but have neither the probe nor IORING_OP_READ
+    constexpr unsigned PROBE_OPS = 256;
+    std::vector<uint8_t> probeBytes(sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(probeBytes.data());
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0 ||
+        probe->ops_len <= IORING_OP_READ || (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) == 0) {
+        return nullptr;
+    }
+    ring.entries = params.sq_entries;
+
+    // one mapping holds both rings where the kernel allows it
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    auto single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        ring.sqRingSize = ring.cqRingSize = std::max(ring.sqRingSize, ring.cqRingSize);
+    }
+    auto sq = mmap(nullptr, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        return nullptr;
+    }
+    ring.sqRing = sq;
+    ring.cqRing = sq;
+    if (!single) {
+        auto cq = mmap(nullptr, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            ring.cqRing = nullptr;
+            return nullptr;
+        }
+        ring.cqRing = cq;
+    }
+    ring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    ring.sqes = static_cast<io_uring_sqe*>(sqes);
+
+    auto sqBase = static_cast<uint8_t*>(ring.sqRing);
+    auto cqBase = static_cast<uint8_t*>(ring.cqRing);
+    ring.sqTail = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+    ring.sqMask = *reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+    ring.sqArray = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+    ring.cqHead = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+    ring.cqTail = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+    ring.cqMask = *reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(cqBase + params.cq_off.cqes);
+    return reader;
+}
+
+/// <summary>
+/// read every file whole with up to depth reads in flight
+/// files are opened as reads are started and closed as they finish
+/// done is called on this thread as each file finishes, in the order they finish
+/// </summary>
+/// <param name="paths">files to read</param>
+/// <param name="maxSize">larger files are not read and fail</param>
+/// <param name="done">called once for every file</param>
+/// <param name="resource">where the buffers of the images come from</param>
+void batchFileReader::readAll(const std::vector<std::string>& paths, size_t maxSize, const doneFunction& done, std::pmr::memory_resource* resource)
+{
+    struct pending {
+        size_t index;
+        int fd;
+        size_t done;
+        std::unique_ptr<vectorStorage> image;
+    };
+    auto& r = *ring;
+    std::vector<pending> slots(r.entries);
+    std::vector<unsigned> idle(r.entries);
+    for (unsigned i = 0; i < r.entries; ++i) {
+        idle[i] = r.entries - 1 - i;
+    }
+
+    unsigned queued = 0;
+    auto queueRead = [&](unsigned slot)
+        {
+            auto& read = slots[slot];
+            auto tail = *r.sqTail;
+            auto& sqe = r.sqes[tail & r.sqMask];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = read.fd;
+            sqe.addr = reinterpret_cast<uint64_t>(read.image->data() + read.done);
+            sqe.len = static_cast<unsigned>(read.image->size() - read.done);
+            sqe.off = read.done;
+            sqe.user_data = slot;
+            r.sqArray[tail & r.sqMask] = tail & r.sqMask;
+            std::atomic_ref<unsigned>(*r.sqTail).store(tail + 1, std::memory_order_release);
+            ++queued;
+        };
+    auto finish = [&](unsigned slot, const std::string& error)
+        {
+            auto& read = slots[slot];
+            ::close(read.fd);
+            done(read.index, error.empty() ? std::move(read.image) : nullptr, error);
+            read.image.reset();
+            idle.push_back(slot);
+        };
+
+    size_t next = 0;
+    unsigned inFlight = 0;
+
+    // the kernel writes into the buffers until a read completes
+    // so when done throws every read in flight is waited for before the buffers go
+    struct drainGuard {
+        ringState& r;
+        std::vector<pending>& slots;
+        unsigned& queued;
+        unsigned& inFlight;
+        ~drainGuard()
+        {
+            while (inFlight > 0) {
+                auto entered = syscall(__NR_io_uring_enter, r.fd, queued, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (entered < 0 && errno != EINTR) break;
+                if (entered >= 0) {
+                    queued -= std::min<unsigned>(queued, static_cast<unsigned>(entered));
+                }
+                auto head = *r.cqHead;
+                auto tail = std::atomic_ref<unsigned>(*r.cqTail).load(std::memory_order_acquire);
+                for (; head != tail; ++head) {
+                    ::close(slots[static_cast<unsigned>(r.cqes[head & r.cqMask].user_data)].fd);
+                    --inFlight;
+                }
+                std::atomic_ref<unsigned>(*r.cqHead).store(head, std::memory_order_release);
+            }
+        }
+    } drain{ r, slots, queued, inFlight };
+
+    while (next < paths.size() || inFlight > 0) {
+        // start reads while there are free slots
+        while (next < paths.size() && !idle.empty()) {
+            auto index = next++;
+            auto fd = ::open(paths[index].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                done(index, nullptr, "Could not open " + paths[index] + ": " + std::strerror(errno));
+                continue;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0 || static_cast<size_t>(st.st_size) > maxSize) {
+                ::close(fd);
+                done(index, nullptr, "Invalid disk size");
+                continue;
+            }
+            auto slot = idle.back();
+            idle.pop_back();
+            slots[slot] = pending{ index, fd, 0, std::make_unique<vectorStorage>(static_cast<size_t>(st.st_size), resource) };
+            queueRead(slot);
+            ++inFlight;
+        }
+        if (inFlight == 0) break;
+
+        // hand the new reads to the kernel and wait for at least one to finish
+        auto entered = syscall(__NR_io_uring_enter, r.fd, queued, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (entered < 0 && errno != EINTR) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+        }
+        if (entered >= 0) {
+            queued -= std::min<unsigned>(queued, static_cast<unsigned>(entered));
+        }
+
+        auto head = *r.cqHead;
+        auto tail = std::atomic_ref<unsigned>(*r.cqTail).load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            // the entry is given back before done runs so a throw cannot see it twice
+            auto cqe = r.cqes[head & r.cqMask];
+            std::atomic_ref<unsigned>(*r.cqHead).store(head + 1, std::memory_order_release);
+            auto slot = static_cast<unsigned>(cqe.user_data);
+            auto& read = slots[slot];
+            if (cqe.res < 0) {
+                --inFlight;
+                finish(slot, "Could not read " + paths[read.index] + ": " + std::strerror(-cqe.res));
+            }
+            else if (cqe.res == 0) {
+                --inFlight;
+                finish(slot, "Could not read " + paths[read.index] + ": file is shorter than it was");
+            }
+            else {
+                // a short read goes on from where it stopped
+                read.done += static_cast<size_t>(cqe.res);
+                if (read.done < read.image->size()) {
+                    queueRead(slot);
+                }
+                else {
+                    --inFlight;
+                    finish(slot, "");
+                }
+            }
+        }
+    }
+}
+
+#else
+
+struct batchFileReader::ringState {
+};
+
+/// <summary>
+/// io_uring is only on Linux
+/// </summary>
+/// <param name="depth">reads to keep in flight</param>
+/// <returns>nullptr</returns>
+std::unique_ptr<batchFileReader> batchFileReader::open(unsigned depth)
+{
+    return nullptr;
+}
+
+void batchFileReader::readAll(const std::vector<std::string>& paths, size_t maxSize, const doneFunction& done, std::pmr::memory_resource* resource)
+{
+}
+
+#endif
+
+batchFileReader::~batchFileReader() = default;
+
+/// <summary>
+/// number of reads kept in flight
+/// </summary>
+unsigned batchFileReader::depth() const
+{
+#ifdef __linux__
+    return ring->entries;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,242 @@
+// Written by Paul Baxter
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <array>
+#include <span>
+#include <memory_resource>
+#include <iosfwd>
+#include <functional>
+
+/// <summary>
+/// How a disk image file is mapped into memory
+/// </summary>
+enum mapMode {
+    map_read_only,          // image can only be read
+    map_copy_on_write,      // changes stay in memory until save
+    map_write_through       // changes go straight to the file
+};
+
+/// <summary>
+/// How a disk image is written to its file
+/// </summary>
+enum saveMode {
+    save_in_place,          // write over the file
+    save_journaled          // a crash leaves the old image or the new one, never a mix
+};
+
+/// <summary>
+/// Consecutive sectors of an image
+/// </summary>
+struct sectorRun {
+    size_t first;           // sector number counted from the start of the image
+    size_t count;           // number of sectors
+};
+
+/// <summary>
+/// Backing store for the bytes of a disk image
+/// </summary>
+class diskStorage {
+public:
+    static constexpr size_t SECTOR_BYTES = 256;
+
+    virtual ~diskStorage() = default;
+
+    // the whole image in one block, nullptr if the sectors are held apart
+    virtual uint8_t* data() = 0;
+    virtual const uint8_t* data() const = 0;
+    virtual size_t size() const = 0;
+
+    /// <summary>
+    /// bytes of a sector to read
+    /// </summary>
+    /// <param name="index">sector number counted from the start of the image</param>
+    virtual const uint8_t* sector(size_t index) const { return data() + index * SECTOR_BYTES; }
+
+    /// <summary>
+    /// bytes of a sector that are about to be changed
+    /// </summary>
+    /// <param name="index">sector number counted from the start of the image</param>
+    virtual uint8_t* writableSector(size_t index) { return data() + index * SECTOR_BYTES; }
+
+    /// <summary>
+    /// number of sectors still shared with other disks
+    /// </summary>
+    virtual size_t sharedSectors() const { return 0; }
+
+    /// <summary>
+    /// true if the bytes of the image may be modified
+    /// </summary>
+    virtual bool writable() const { return true; }
+
+    /// <summary>
+    /// flush changes to the backing file if there is one
+    /// </summary>
+    /// <returns>true on success</returns>
+    virtual bool sync() { return true; }
+
+    /// <summary>
+    /// true if every change is already written to filename
+    /// save can then be replaced with sync
+    /// </summary>
+    /// <param name="filename">file to test</param>
+    virtual bool writesThrough(const std::string& /*filename*/) const { return false; }
+
+    /// <summary>
+    /// true if the storage is mapped from filename
+    /// </summary>
+    /// <param name="filename">file to test</param>
+    virtual bool mappedFrom(const std::string& /*filename*/) const { return false; }
+
+    /// <summary>
+    /// drop the bytes past length from the image, such as the error bytes that follow it
+    /// </summary>
+    /// <param name="length">new size, no larger than the old</param>
+    /// <returns>false if the storage can not be shortened</returns>
+    virtual bool truncate(size_t /*length*/) { return false; }
+
+    virtual bool write(std::ostream& out) const;
+    bool writeSectors(const std::string& filename, const std::vector<sectorRun>& runs, bool flush = false, size_t trailer = 0) const;
+    std::unique_ptr<diskStorage> clone() const;
+
+    static bool writeFile(const std::string& filename, std::span<const std::span<const uint8_t>> parts, bool flush = false);
+    static bool syncFile(const std::string& filename);
+    static bool syncDirectory(const std::string& filename);
+};
+
+/// <summary>
+/// Disk image held in a heap buffer
+/// the buffer comes from resource, which must outlive the storage
+/// </summary>
+class vectorStorage : public diskStorage {
+public:
+    explicit vectorStorage(size_t sz, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : bytes(sz, resource) {}
+    vectorStorage(const uint8_t* src, size_t sz) : bytes(src, src + sz) {}
+
+    uint8_t* data() override { return bytes.data(); }
+    const uint8_t* data() const override { return bytes.data(); }
+    size_t size() const override { return bytes.size(); }
+    bool truncate(size_t length) override { bytes.resize(length); return true; }
+
+private:
+    std::pmr::vector<uint8_t> bytes;
+};
+
+/// <summary>
+/// Disk image in a buffer owned by the caller, such as a slice of an arena
+/// the buffer must outlive the storage
+/// </summary>
+class spanStorage : public diskStorage {
+public:
+    explicit spanStorage(std::span<uint8_t> image) : bytes(image) {}
+
+    uint8_t* data() override { return bytes.data(); }
+    const uint8_t* data() const override { return bytes.data(); }
+    size_t size() const override { return bytes.size(); }
+    bool truncate(size_t length) override { bytes = bytes.first(length); return true; }
+
+private:
+    std::span<uint8_t> bytes;
+};
+
+/// <summary>
+/// Disk image memory mapped from a file
+/// </summary>
+class mappedStorage : public diskStorage {
+public:
+    static std::unique_ptr<mappedStorage> open(const std::string& filename, mapMode mode);
+    ~mappedStorage() override;
+
+    mappedStorage(const mappedStorage&) = delete;
+    mappedStorage& operator=(const mappedStorage&) = delete;
+
+    uint8_t* data() override { return base; }
+    const uint8_t* data() const override { return base; }
+    size_t size() const override { return imageLength; }
+    bool writable() const override { return mode != mapMode::map_read_only; }
+    bool truncate(size_t length) override { imageLength = length; return true; }
+    bool sync() override;
+    bool writesThrough(const std::string& filename) const override;
+    bool mappedFrom(const std::string& filename) const override;
+    mapMode mapping() const { return mode; }
+
+private:
+    mappedStorage() = default;
+
+    uint8_t* base = nullptr;
+    size_t length = 0;                  // of the mapping
+    size_t imageLength = 0;             // of it, the image
+    mapMode mode = mapMode::map_read_only;
+    std::string path;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+/// <summary>
+/// Disk image held as separate refcounted sectors over a shared base image
+/// sectors are copied out of the base or another fork the first time they change
+/// </summary>
+class pagedStorage : public diskStorage {
+public:
+    pagedStorage(std::shared_ptr<const diskStorage> base, bool canWrite);
+
+    uint8_t* data() override { return nullptr; }
+    const uint8_t* data() const override { return nullptr; }
+    size_t size() const override { return base->size(); }
+    bool writable() const override { return canWrite; }
+    bool mappedFrom(const std::string& filename) const override { return base->mappedFrom(filename); }
+
+    const uint8_t* sector(size_t index) const override
+    {
+        auto& page = pages[index];
+        return page ? page->data() : base->sector(index);
+    }
+    uint8_t* writableSector(size_t index) override;
+    size_t sharedSectors() const override;
+    bool write(std::ostream& out) const override;
+
+    std::unique_ptr<pagedStorage> fork() const;
+
+private:
+    using sectorPage = std::array<uint8_t, SECTOR_BYTES>;
+
+    // never written once it is shared
+    std::shared_ptr<const diskStorage> base;
+
+    // nullptr while the sector is still the one in base
+    std::vector<std::shared_ptr<sectorPage>> pages;
+    bool canWrite;
+};
+
+/// <summary>
+/// Reads many whole files with their reads in flight together
+/// it uses io_uring, open returns nullptr where that or its read operation is not available
+/// </summary>
+class batchFileReader {
+public:
+    // index of the file in paths, its bytes or nullptr and why it could not be read
+    using doneFunction = std::function<void(size_t index, std::unique_ptr<vectorStorage> image, const std::string& error)>;
+
+    static std::unique_ptr<batchFileReader> open(unsigned depth);
+    ~batchFileReader();
+
+    batchFileReader(const batchFileReader&) = delete;
+    batchFileReader& operator=(const batchFileReader&) = delete;
+
+    void readAll(const std::vector<std::string>& paths, size_t maxSize, const doneFunction& done, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    unsigned depth() const;
+
+private:
+    struct ringState;
+
+    batchFileReader() = default;
+
+    std::unique_ptr<ringState> ring;
+};
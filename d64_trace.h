@@ -0,0 +1,121 @@
+// Written by Paul Baxter
+#pragma once
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+
+// counters and timing hooks of d64, build with D64_INSTRUMENTATION=0 to compile them out
+// the stats are then always zero and the trace hook is never called
+#ifndef D64_INSTRUMENTATION
+#define D64_INSTRUMENTATION 1
+#endif
+
+/// <summary>
+/// Operations timed by the trace hook
+/// </summary>
+enum traceOperation : uint8_t {
+    trace_load,                 // load, both overloads
+    trace_save,                 // save and saveIncremental
+    trace_add_file,
+    trace_verify_bam,           // verifyBAMIntegrity
+    trace_compact_directory,
+    trace_operation_count
+};
+
+/// <summary>
+/// A traced operation that has finished, passed to the trace hook
+/// </summary>
+struct traceEvent {
+    traceOperation operation;
+    std::chrono::nanoseconds elapsed;
+    bool threw;                 // left by an exception
+};
+
+// called on the thread that ran the operation, it must not throw
+using traceHook = std::function<void(const traceEvent&)>;
+
+/// <summary>
+/// Totals of one traced operation
+/// </summary>
+struct operationStats {
+    uint64_t calls = 0;
+    uint64_t exceptions = 0;
+    std::chrono::nanoseconds elapsed{ 0 };
+};
+
+/// <summary>
+/// What a disk has done since it was made or its stats were reset
+/// </summary>
+struct d64Stats {
+    uint64_t sectorsRead = 0;               // sector reads from the image, a chain walk reads each sector once
+    uint64_t sectorsWritten = 0;            // sector writes to the image, the same sector may be counted many times
+    uint64_t calcOffsetCalls = 0;
+    uint64_t fileLookups = 0;               // findFile and everything else that finds a file by name
+    uint64_t directoryEntriesScanned = 0;   // building the name index and findEmptyDirectorySlot
+    uint64_t bamProbes = 0;                 // tracks tried by findAndAllocateFreeOnTrack
+    uint64_t bamProbeMisses = 0;            // of those, tracks that had no free sector
+    std::array<operationStats, trace_operation_count> operations = {};
+
+    const operationStats& operator[](traceOperation operation) const { return operations[operation]; }
+};
+
+#if D64_INSTRUMENTATION
+
+/// <summary>
+/// Times an operation from construction to destruction
+/// adds it to the stats and passes it to the hook
+/// </summary>
+class traceScope {
+public:
+    traceScope(d64Stats& stats, const traceHook& hook, traceOperation operation)
+        : stats(stats), hook(hook), operation(operation), exceptions(std::uncaught_exceptions()), start(std::chrono::steady_clock::now())
+    {
+    }
+    ~traceScope()
+    {
+        traceEvent event{ operation, std::chrono::steady_clock::now() - start, std::uncaught_exceptions() > exceptions };
+        auto& totals = stats.operations[operation];
+        ++totals.calls;
+        totals.exceptions += event.threw;
+        totals.elapsed += event.elapsed;
+        if (hook) {
+            try {
+                hook(event);
+            }
+            catch (...) {
+                // a hook must not stop the disk
+            }
+        }
+    }
+    traceScope(const traceScope&) = delete;
+    traceScope& operator=(const traceScope&) = delete;
+
+private:
+    d64Stats& stats;
+    const traceHook& hook;
+    traceOperation operation;
+    int exceptions;
+    std::chrono::steady_clock::time_point start;
+};
+
+// readers sharing a disk bump its counters at once, an atomic load and store keeps that defined
+// without the cost of a locked add on every sector, a count from readers at the same moment can be lost
+inline void traceAdd(uint64_t& counter, uint64_t count)
+{
+    std::atomic_ref<uint64_t> value(counter);
+    value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+// used inside d64, which holds the stats and the hook
+#define D64_COUNT(counter, count) (traceAdd(stats.counter, (count)))
+#define D64_TRACE(operation) traceScope trace_scope(stats, traceCallback, operation)
+
+#else
+
+#define D64_COUNT(counter, count) ((void)0)
+#define D64_TRACE(operation) ((void)0)
+
+#endif
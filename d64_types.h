@@ -18,6 +18,10 @@ const int BAM_SECTOR = 0;
 const int FILES_PER_SECTOR = 8;
 const int D64_DISK35_SZ = 174848;
 const int D64_DISK40_SZ = 196608;
+const int D64_DISK35_ERRORS_SZ = D64_DISK35_SZ + D64_DISK35_SZ / SECTOR_SIZE;     // one error byte per sector follows the image
+const int D64_DISK40_ERRORS_SZ = D64_DISK40_SZ + D64_DISK40_SZ / SECTOR_SIZE;
+const int D71_DISK_SZ = 349696;
+const int D81_DISK_SZ = 819200;
 
 const int SIDE_SECTOR_ENTRY_SIZE = 6;
 const int SIDE_SECTOR_CHAIN_SZ = ((SECTOR_SIZE - 15) / (2));
@@ -50,6 +54,7 @@ public:
         return track == other.track && sector == other.sector;
     }
 
+    trackSector() : track(0), sector(0) {};
     trackSector(int track, int sector) : track(track), sector(sector) {};
     trackSector(uint8_t track, uint8_t sector) : track(track), sector(sector) {};
 };
@@ -107,13 +112,9 @@ public:
     /// test if a sector is used in bam  
     /// </summary>
     /// <param name="sector">sector to test</param>
-    bool test(int sector)
+    inline bool test(int sector) const
     {
-        auto byte = sector / 8;
-        auto bit = sector % 8;
-
-        std::bitset<8> bits(bytes[byte]);
-        return bits.test(bit);
+        return (bytes[sector >> 3] >> (sector & 7)) & 1;
     }
 
     /// <summary>
@@ -122,12 +123,7 @@ public:
     /// <param name="sector">sector to mark</param>
     inline void set(int sector)
     {
-        auto byte = sector / 8;
-        auto bit = sector % 8;
-
-        std::bitset<8> bits(bytes[byte]);
-        bits.set(bit);
-        bytes[byte] = static_cast<uint8_t>(bits.to_ulong());
+        bytes[sector >> 3] |= static_cast<uint8_t>(1 << (sector & 7));
     }
 
     /// <summary>
@@ -136,12 +132,27 @@ public:
     /// <param name="sector">sector to mark</param>
     inline void reset(int sector)
     {
-        auto byte = sector / 8;
-        auto bit = sector % 8;
+        bytes[sector >> 3] &= static_cast<uint8_t>(~(1 << (sector & 7)));
+    }
 
-        std::bitset<8> bits(bytes[byte]);
-        bits.reset(bit);
-        bytes[byte] = static_cast<uint8_t>(bits.to_ulong());
+    /// <summary>
+    /// get the bam bitmap as a 24 bit mask
+    /// bit n is set if sector n is free
+    /// </summary>
+    inline uint32_t mask() const
+    {
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+    }
+
+    /// <summary>
+    /// set the bam bitmap from a 24 bit mask
+    /// </summary>
+    /// <param name="bits">bit n is set if sector n is free</param>
+    inline void setMask(uint32_t bits)
+    {
+        bytes[0] = static_cast<uint8_t>(bits);
+        bytes[1] = static_cast<uint8_t>(bits >> 8);
+        bytes[2] = static_cast<uint8_t>(bits >> 16);
     }
 
     /// <summary>
@@ -210,4 +221,37 @@ struct directorySector {
 };
 typedef struct directorySector* directorySectorPtr;
 
+// file name as stored in a directory entry
+// everything from the first A0 on is A0 padding
+struct fileNameKey {
+    std::array<char, FILE_NAME_SZ> name;
+
+    bool operator==(const fileNameKey& other) const = default;
+};
+
+struct fileNameKeyHash {
+    size_t operator()(const fileNameKey& key) const
+    {
+        uint64_t lo, hi;
+        std::memcpy(&lo, key.name.data(), sizeof(lo));
+        std::memcpy(&hi, key.name.data() + sizeof(lo), sizeof(hi));
+        uint64_t h = lo ^ (hi * 0x9E3779B97F4A7C15ull);
+        h ^= h >> 32;
+        h *= 0xD6E8FEB86659FD93ull;
+        h ^= h >> 32;
+        return static_cast<size_t>(h);
+    }
+};
+
+// location of a directory entry
+struct directorySlot {
+    trackSector location;   // directory sector
+    uint8_t entry;          // entry in directory sector
+
+    directorySlot() : location(0, 0), entry(0) {}
+    directorySlot(int track, int sector, int entry) : location(track, sector), entry(static_cast<uint8_t>(entry)) {}
+
+    bool operator==(const directorySlot& other) const = default;
+};
+
 #pragma pack(pop)
@@ -0,0 +1,599 @@
+// Written by Paul Baxter
+// random operation sequences and damaged images for d64
+// built with D64_LIBFUZZER=ON it is a libFuzzer target, otherwise it makes its own random inputs
+//     d64fuzz [--runs N] [--seed S] [--budget-ms M] [--max-len L] [input files...]
+// input files are run once each, as saved from a failure
+// every input is checked against a model of the files the disk should hold, a broken invariant aborts
+// an operation slower than the budget is reported with its input and fails the run, one ten times over it is a hang
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+
+#include "d64.h"
+
+namespace d64lib_fuzz
+{
+    using clock = std::chrono::steady_clock;
+
+    /// <summary>
+    /// Fuzz input read as a stream of choices, zeros once it runs out
+    /// </summary>
+    class fuzzInput {
+    public:
+        explicit fuzzInput(std::span<const uint8_t> bytes) : bytes(bytes) {}
+
+        bool empty() const { return position >= bytes.size(); }
+        uint8_t byte() { return empty() ? 0 : bytes[position++]; }
+        uint16_t word() { return static_cast<uint16_t>(byte() | (byte() << 8)); }
+        size_t pick(size_t count) { return count == 0 ? 0 : word() % count; }
+
+    private:
+        std::span<const uint8_t> bytes;
+        size_t position = 0;
+    };
+
+    /// <summary>
+    /// Calls and time of one operation over the whole run
+    /// </summary>
+    struct operationTotals {
+        uint64_t calls = 0;
+        clock::duration elapsed{ 0 };
+        clock::duration slowest{ 0 };
+    };
+
+    static std::chrono::milliseconds budget{ 250 };
+    static bool libFuzzer = false;
+    static std::span<const uint8_t> currentInput;
+    static std::map<std::string, operationTotals> totals;
+    static size_t slowOperations = 0;
+    static std::string currentRun;              // printed with a failure
+    static std::atomic<const char*> running{ nullptr };    // the operation being timed, for the watchdog
+    static std::atomic<clock::rep> runningSince{ 0 };
+
+    // keep the input that broke something so it can be run again
+    static std::string saveInput(const char* kind)
+    {
+        static size_t saved = 0;
+        auto name = std::string("d64fuzz-") + kind + "-" + std::to_string(saved++) + ".bin";
+        std::ofstream(name, std::ios::binary).write(reinterpret_cast<const char*>(currentInput.data()), currentInput.size());
+        return name;
+    }
+
+    [[noreturn]] static void fail(const std::string& what)
+    {
+        std::fprintf(stderr, "invariant broken in %s: %s\n", currentRun.c_str(), what.c_str());
+        if (!libFuzzer) {
+            std::fprintf(stderr, "input saved to %s\n", saveInput("crash").c_str());
+        }
+        std::abort();
+    }
+
+#define FUZZ_CHECK(condition, what) do { if (!(condition)) fail(what); } while (false)
+
+    // run an operation against the budget, its time is counted even when it throws
+    template <typename Action>
+    static auto timed(const char* operation, Action&& action)
+    {
+        struct measure {
+            const char* operation;
+            clock::time_point start = clock::now();
+            const char* outer = running.exchange(operation);
+            clock::rep outerSince = runningSince.exchange(start.time_since_epoch().count());
+            ~measure()
+            {
+                running = outer;
+                runningSince = outerSince;
+                auto elapsed = clock::now() - start;
+                auto& total = totals[operation];
+                ++total.calls;
+                total.elapsed += elapsed;
+                total.slowest = std::max(total.slowest, elapsed);
+                if (elapsed > budget) {
+                    auto ms = std::chrono::duration<double, std::milli>(elapsed).count();
+                    if (libFuzzer) {
+                        std::fprintf(stderr, "over budget: %s took %.1f ms\n", operation, ms);
+                        std::abort();
+                    }
+                    ++slowOperations;
+                    std::fprintf(stderr, "over budget: %s took %.1f ms, input saved to %s\n", operation, ms, saveInput("slow").c_str());
+                }
+            }
+        } guard{ operation };
+        return action();
+    }
+
+    // an operation that never returns can not be timed, ten budgets without one finishing is taken as a hang
+    static void watchdog()
+    {
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            auto since = runningSince.load();
+            if (since != 0 && clock::now() - clock::time_point(clock::duration(since)) > budget * 10) {
+                std::fprintf(stderr, "hung: %s in %s, input saved to %s\n", running.load(), currentRun.c_str(), saveInput("hang").c_str());
+                std::abort();
+            }
+        }
+    }
+
+    // file data that tells one file from another
+    static std::vector<uint8_t> fileData(size_t size, uint8_t seed)
+    {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<uint8_t>(seed + i * 31 + (i >> 8));
+        }
+        return data;
+    }
+
+    // the disk holds the files of the model and its BAM matches them
+    static void checkDisk(const d64& disk, const std::map<std::string, std::vector<uint8_t>>& files, bool readAll, const std::string& after)
+    {
+        auto report = timed("verify", [&] { return disk.verify(); });
+        FUZZ_CHECK(report.valid(), "after " + after + " the BAM does not match the files, " + std::to_string(report.mismatches.size()) + " mismatches, "
+            + std::to_string(report.freeCounts.size()) + " wrong free counts, " + std::to_string(report.crossLinks.size()) + " cross links, "
+            + std::to_string(report.chainFaults.size()) + " bad chains");
+        FUZZ_CHECK(report.files == files.size(), "after " + after + " the directory has " + std::to_string(report.files) + " files, the model " + std::to_string(files.size()));
+
+        std::multiset<std::string> names;
+        for (auto& entry : disk.entries()) {
+            names.insert(d64::Trim(entry.fileName));
+        }
+        std::multiset<std::string> expected;
+        for (auto& [name, data] : files) {
+            expected.insert(name);
+        }
+        FUZZ_CHECK(names == expected, "after " + after + " the directory does not hold the files of the model");
+
+        if (readAll) {
+            for (auto& [name, data] : files) {
+                auto read = timed("readFile", [&] { return disk.readFile(name); });
+                FUZZ_CHECK(read.has_value() && read.value() == data, "after " + after + " file " + name + " does not read back");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Random operations on a good disk, checked after each one
+    /// </summary>
+    /// <param name="in">choices</param>
+    static void runOperations(fuzzInput& in)
+    {
+        d64 disk(in.byte() & 1 ? diskType::forty_track : diskType::thirty_five_track);
+        disk.setErrorLog(nullptr);
+        std::map<std::string, std::vector<uint8_t>> files;
+
+        for (auto step = 0; step < 256 && !in.empty(); ++step) {
+            std::string done;
+            switch (in.byte() % 8) {
+                case 0:
+                case 1:
+                case 2: {
+                    // more names than the directory has room for
+                    auto name = "F" + std::to_string(in.pick(160));
+                    if (files.contains(name)) break;
+                    static constexpr size_t maxBlocks[] = { 2, 40, 400 };
+                    auto type = static_cast<d64FileTypes>(1 + in.pick(4));
+                    auto recordSize = type == d64FileTypes::REL ? static_cast<int>(1 + in.pick(254)) : 0;
+                    auto size = 1 + in.pick(maxBlocks[in.pick(3)] * 254);
+                    auto data = fileData(size, in.byte());
+                    done = "addFile " + name + " type " + std::to_string(type) + " of " + std::to_string(size) + " bytes";
+                    auto free = disk.getFreeSectorCount();
+                    bool added = false;
+                    try {
+                        added = timed("addFile", [&] { return disk.addFile(name, type, data, recordSize); });
+                    }
+                    catch (const std::runtime_error&) {
+                        // the file does not fit
+                    }
+                    if (added) {
+                        files.emplace(name, std::move(data));
+                    }
+                    else {
+                        FUZZ_CHECK(disk.getFreeSectorCount() == free, "addFile of " + name + " failed but kept sectors");
+                    }
+                    break;
+                }
+                case 3: {
+                    auto it = files.begin();
+                    std::advance(it, in.pick(files.size() + 1) % (files.size() + 1));
+                    auto name = it == files.end() ? std::string("MISSING") : it->first;
+                    done = "removeFile " + name;
+                    auto removed = timed("removeFile", [&] { return disk.removeFile(name); });
+                    FUZZ_CHECK(removed == (it != files.end()), "removeFile of " + name + " returned " + std::to_string(removed));
+                    if (removed) {
+                        files.erase(it);
+                    }
+                    break;
+                }
+                case 4:
+                    done = "compactDirectory";
+                    timed("compactDirectory", [&] { return disk.compactDirectory(); });
+                    break;
+                case 5: {
+                    auto descending = in.byte() & 1;
+                    done = "reorderDirectory by name";
+                    timed("reorderDirectory", [&]
+                        {
+                            return disk.reorderDirectory([descending](const directoryEntry& a, const directoryEntry& b)
+                                {
+                                    auto less = std::memcmp(a.fileName, b.fileName, FILE_NAME_SZ) < 0;
+                                    return descending ? !less && std::memcmp(a.fileName, b.fileName, FILE_NAME_SZ) != 0 : less;
+                                });
+                        });
+                    break;
+                }
+                case 6: {
+                    std::vector<std::string> order;
+                    for (auto& [name, data] : files) {
+                        order.push_back(name);
+                    }
+                    done = "reorderDirectory by list";
+                    for (size_t i = order.size(); i > 1; --i) {
+                        std::swap(order[i - 1], order[in.pick(i)]);
+                    }
+                    try {
+                        timed("reorderDirectory", [&] { return disk.reorderDirectory(order); });
+                    }
+                    catch (const std::exception& e) {
+                        fail(std::string("reorderDirectory threw ") + e.what());
+                    }
+                    break;
+                }
+                default: {
+                    auto fix = (in.byte() & 1) != 0;
+                    done = "verifyBAMIntegrity";
+                    auto valid = timed("verifyBAMIntegrity", [&] { return disk.verifyBAMIntegrity(fix, ""); });
+                    FUZZ_CHECK(valid, "verifyBAMIntegrity failed on a good disk");
+                    break;
+                }
+            }
+            checkDisk(disk, files, step % 16 == 0, done.empty() ? "nothing" : done);
+        }
+        checkDisk(disk, files, true, "the last step");
+    }
+
+    // good images the damage starts from, saved once
+    static const std::vector<std::vector<uint8_t>>& baseImages()
+    {
+        static std::vector<std::vector<uint8_t>> images = []
+            {
+                auto saved = [](const d64& disk)
+                    {
+                        std::ostringstream out;
+                        disk.save(out);
+                        auto text = out.str();
+                        return std::vector<uint8_t>(text.begin(), text.end());
+                    };
+                std::vector<std::vector<uint8_t>> images;
+                d64 disk;
+                images.push_back(saved(disk));
+                for (auto file = 0; file < 20; ++file) {
+                    disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, fileData(254 * (1 + file % 7), static_cast<uint8_t>(file)));
+                }
+                disk.addFile("RECORDS", d64FileTypes::REL, fileData(64 * 100, 9), 64);
+                images.push_back(saved(disk));
+                d64 wide(diskType::forty_track);
+                for (auto file = 0; file < 144; ++file) {
+                    wide.addFile("F" + std::to_string(file), d64FileTypes::SEQ, fileData(300, static_cast<uint8_t>(file)));
+                }
+                images.push_back(saved(wide));
+                return images;
+            }();
+        return images;
+    }
+
+    /// <summary>
+    /// Load a damaged image, anything it holds must be read safely in time
+    /// </summary>
+    /// <param name="in">choices</param>
+    static void runImage(fuzzInput& in)
+    {
+        auto& bases = baseImages();
+        auto bytes = bases[in.pick(bases.size())];
+
+        // an image of another size, with or without error bytes
+        if (in.byte() % 8 == 0) {
+            static constexpr size_t sizes[] = { 0, 256, D64_DISK35_SZ - 1, D64_DISK35_SZ, D64_DISK35_ERRORS_SZ, D64_DISK40_SZ, D64_DISK40_ERRORS_SZ, D64_DISK40_SZ + 1, D71_DISK_SZ };
+            bytes.resize(sizes[in.pick(std::size(sizes))], 1);
+        }
+
+        auto sectors = bytes.size() / SECTOR_SIZE;
+        auto directory = D64_DISK35_SZ <= bytes.size() ? static_cast<size_t>(357) : 0;    // 18/0
+        for (auto change = in.byte() % 24; change > 0 && !bytes.empty(); --change) {
+            auto kind = in.byte() % 4;
+            if (kind == 0) {
+                // anywhere
+                bytes[in.pick(bytes.size() / 2) * 2 + (in.byte() & 1)] = in.byte();
+            }
+            else if (kind == 1 && directory != 0) {
+                // the BAM and the directory, track 18
+                bytes[(directory + in.pick(19)) * SECTOR_SIZE + in.byte()] = in.byte();
+            }
+            else if (sectors > 0) {
+                // a link, to the sector itself, another good sector or off the disk
+                auto sector = in.pick(sectors) * SECTOR_SIZE;
+                bytes[sector] = static_cast<uint8_t>(kind == 2 ? in.pick(44) : 18);
+                bytes[sector + 1] = static_cast<uint8_t>(in.pick(kind == 2 ? 24 : 19));
+            }
+        }
+
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        try {
+            if (in.byte() & 1) {
+                static const std::string filename = "d64fuzz_image.d64";
+                std::ofstream(filename, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+                if (!timed("load", [&] { return disk.load(filename); })) return;
+            }
+            else {
+                disk = timed("load", [&] { return d64(std::span<uint8_t>(bytes)); });
+                disk.setErrorLog(nullptr);
+                if (!timed("load", [&] { return disk.validateD64(); })) return;
+            }
+        }
+        catch (const std::exception&) {
+            return;
+        }
+
+        // readers must not crash or take long however bad the image is
+        auto report = timed("verify", [&] { return disk.verify(); });
+        timed("directory", [&] { return disk.directory(); });
+        timed("imageFingerprint", [&] { return disk.imageFingerprint(); });
+        timed("getFreeSectorCount", [&] { return disk.getFreeSectorCount(); });
+        for (auto& entry : disk.directory()) {
+            auto name = d64::Trim(entry.fileName);
+            try {
+                timed("readFile", [&] { return disk.readFile(name); });
+                timed("fileFingerprint", [&] { return disk.fileFingerprint(entry); });
+            }
+            catch (const std::exception&) {
+                // a broken chain
+            }
+
+            // extractFile writes name and extension where it runs, only a plain name stays in this directory
+            auto plain = !name.empty() && name[0] != '.' && std::none_of(name.begin(), name.end(), [](char c)
+                {
+                    return static_cast<unsigned char>(c) < 0x20 || std::string_view("/\\:*?\"<>|").find(c) != std::string_view::npos;
+                });
+            if (plain && !d64::extension(entry.file_type.type).empty()) {
+                try {
+                    timed("extractFile", [&] { return disk.extractFile(name); });
+                }
+                catch (const std::exception&) {
+                }
+                std::error_code ec;
+                std::filesystem::remove(name + std::string(d64::extension(entry.file_type.type)), ec);
+            }
+        }
+
+        // a chain that loops must end the file it is written to
+        static const std::string extractDir = "d64fuzz_extract";
+        extractOptions options;
+        options.threads = 1 + in.byte() % 3;
+        timed("extractAll", [&] { return disk.extractAll(extractDir, options); });
+        std::error_code ec;
+        std::filesystem::remove_all(extractDir, ec);
+
+        // fixing the BAM leaves nothing for it to fix
+        try {
+            timed("verifyBAMIntegrity", [&] { return disk.verifyBAMIntegrity(true, ""); });
+            auto fixed = timed("verify", [&] { return disk.verify(); });
+            FUZZ_CHECK(!report.valid() || fixed.valid(), "verifyBAMIntegrity broke a good image");
+            FUZZ_CHECK(fixed.crossLinks.size() > 0 || fixed.chainFaults.size() > 0 || (fixed.mismatches.empty() && fixed.freeCounts.empty()),
+                "verifyBAMIntegrity left the BAM wrong");
+        }
+        catch (const std::exception&) {
+        }
+
+        // and the disk can still be changed
+        try {
+            timed("addFile", [&] { return disk.addFile("FUZZ", d64FileTypes::PRG, fileData(600, 1)); });
+            timed("removeFile", [&] { return disk.removeFile("FUZZ"); });
+            timed("compactDirectory", [&] { return disk.compactDirectory(); });
+        }
+        catch (const std::exception&) {
+        }
+    }
+
+    static void runOne(std::span<const uint8_t> input)
+    {
+        currentInput = input;
+        fuzzInput in(input);
+        if (in.byte() & 1) {
+            runImage(in);
+        }
+        else {
+            runOperations(in);
+        }
+    }
+
+    /// <summary>
+    /// Images that have been slow or wrong before, run before the random inputs
+    /// </summary>
+    static void runPathological()
+    {
+        currentInput = {};
+
+        // a full 1541 directory of 144 files, then one more that takes the directory off track 18
+        currentRun = "a long directory";
+        {
+            d64 disk(diskType::forty_track);
+            disk.setErrorLog(nullptr);
+            std::map<std::string, std::vector<uint8_t>> files;
+            for (auto file = 0; file < 145; ++file) {
+                auto name = "DIR" + std::to_string(file);
+                auto data = fileData(200, static_cast<uint8_t>(file));
+                FUZZ_CHECK(timed("addFile", [&] { return disk.addFile(name, d64FileTypes::PRG, data); }), "file " + name + " is refused");
+                files.emplace(name, std::move(data));
+            }
+            std::vector<std::string> order;
+            for (auto& [name, data] : files) {
+                order.insert(order.begin(), name);
+            }
+            timed("reorderDirectory", [&] { return disk.reorderDirectory(order); });
+            timed("compactDirectory", [&] { return disk.compactDirectory(); });
+            FUZZ_CHECK(timed("verifyBAMIntegrity", [&] { return disk.verifyBAMIntegrity(false, ""); }), "the long directory does not verify");
+            checkDisk(disk, files, true, currentRun);
+        }
+
+        // every other sector free, one file through all of them
+        currentRun = "a fragmented disk";
+        {
+            d64 disk;
+            disk.setErrorLog(nullptr);
+            std::map<std::string, std::vector<uint8_t>> files;
+            for (auto file = 0; disk.getFreeSectorCount() > 0 && file < 144; ++file) {
+                disk.addFile("B" + std::to_string(file), d64FileTypes::PRG, fileData(254 * 4, 0));
+            }
+            for (auto file = 0; file < 144; file += 2) {
+                disk.removeFile("B" + std::to_string(file));
+            }
+            for (auto file = 1; file < 144; file += 2) {
+                auto name = "B" + std::to_string(file);
+                if (auto data = disk.readFile(name)) {
+                    files.emplace(name, std::move(data.value()));
+                }
+            }
+            auto data = fileData(254 * static_cast<size_t>(disk.getFreeSectorCount()), 7);
+            FUZZ_CHECK(timed("addFile", [&] { return disk.addFile("SPREAD", d64FileTypes::PRG, data); }), "a file of every free sector is refused");
+            files.emplace("SPREAD", std::move(data));
+            checkDisk(disk, files, true, currentRun);
+        }
+
+        // a chain that comes back to its first sector
+        currentRun = "a looping chain";
+        {
+            d64 disk;
+            disk.setErrorLog(nullptr);
+            disk.addFile("LOOP", d64FileTypes::PRG, fileData(254 * 50, 3));
+            auto start = disk.findFile("LOOP").value()->start;
+            std::vector<trackSector> chain;
+            for (auto at = start; at.track != 0;) {
+                chain.push_back(at);
+                auto link = disk.readSector(at.track, at.sector).value();
+                at = trackSector(link[0], link[1]);
+            }
+            disk.writeByte(chain.back().track, chain.back().sector, 0, start.track);
+            disk.writeByte(chain.back().track, chain.back().sector, 1, start.sector);
+            auto threw = false;
+            try {
+                timed("readFile", [&] { return disk.readFile("LOOP"); });
+            }
+            catch (const std::runtime_error&) {
+                threw = true;
+            }
+            FUZZ_CHECK(threw, "a looping chain reads");
+            auto report = timed("verify", [&] { return disk.verify(); });
+            FUZZ_CHECK(report.chainFaults.size() == 1, "the loop is not found");
+            timed("verifyBAMIntegrity", [&] { return disk.verifyBAMIntegrity(false, ""); });
+        }
+
+        // the largest REL file a 40 track disk takes, read back record by record
+        currentRun = "a huge REL file";
+        {
+            d64 disk(diskType::forty_track);
+            disk.setErrorLog(nullptr);
+            constexpr int RECORD_SIZE = 254;
+            auto data = fileData(RECORD_SIZE * 700, 5);
+            FUZZ_CHECK(timed("addFile", [&] { return disk.addFile("HUGE", d64FileTypes::REL, data, RECORD_SIZE); }), "a huge REL file is refused");
+            auto records = timed("recordCount", [&] { return disk.recordCount("HUGE"); });
+            FUZZ_CHECK(records == 700, "the huge REL file has " + std::to_string(records) + " records");
+            timed("readRecord", [&]
+                {
+                    for (size_t record = 0; record < records; ++record) {
+                        auto bytes = disk.readRecord("HUGE", record);
+                        FUZZ_CHECK(bytes.has_value() && std::equal(bytes->begin(), bytes->end(), data.begin() + record * RECORD_SIZE), "record " + std::to_string(record) + " does not read back");
+                    }
+                    return records;
+                });
+            checkDisk(disk, { { "HUGE", data } }, true, currentRun);
+        }
+    }
+
+    static void printTotals()
+    {
+        std::printf("%-20s %10s %12s %12s %12s\n", "operation", "calls", "calls/s", "mean us", "slowest us");
+        for (auto& [operation, total] : totals) {
+            auto seconds = std::chrono::duration<double>(total.elapsed).count();
+            std::printf("%-20s %10llu %12.0f %12.1f %12.1f\n", operation.c_str(), static_cast<unsigned long long>(total.calls),
+                seconds > 0 ? total.calls / seconds : 0.0, seconds * 1e6 / std::max<uint64_t>(total.calls, 1),
+                std::chrono::duration<double, std::micro>(total.slowest).count());
+        }
+    }
+}
+
+#if D64_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    d64lib_fuzz::libFuzzer = true;
+    d64lib_fuzz::runOne(std::span<const uint8_t>(data, size));
+    return 0;
+}
+
+#else
+
+int main(int argc, char* argv[])
+{
+    using namespace d64lib_fuzz;
+    size_t runs = 1000;
+    uint64_t seed = std::random_device{}();
+    size_t maxLength = 1024;
+    std::vector<std::string> inputs;
+    for (auto i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        auto value = [&]() { return i + 1 < argc ? std::strtoull(argv[++i], nullptr, 10) : 0ull; };
+        if (arg == "--runs") runs = value();
+        else if (arg == "--seed") seed = value();
+        else if (arg == "--budget-ms") budget = std::chrono::milliseconds(value());
+        else if (arg == "--max-len") maxLength = std::max<size_t>(value(), 1);
+        else inputs.emplace_back(arg);
+    }
+
+    if (!inputs.empty()) {
+        for (auto& name : inputs) {
+            currentRun = name;
+            std::ifstream in(name, std::ios::binary);
+            std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            runOne(bytes);
+        }
+    }
+    else {
+        std::printf("seed %llu, %zu runs, budget %lld ms\n", static_cast<unsigned long long>(seed), runs, static_cast<long long>(budget.count()));
+        std::thread(watchdog).detach();
+        runPathological();
+        std::mt19937_64 random(seed);
+        std::vector<uint8_t> bytes;
+        for (size_t run = 0; run < runs; ++run) {
+            bytes.resize(1 + random() % maxLength);
+            for (auto& byte : bytes) {
+                byte = static_cast<uint8_t>(random());
+            }
+            currentRun = "run " + std::to_string(run);
+            runOne(bytes);
+        }
+    }
+    std::remove("d64fuzz_image.d64");
+    printTotals();
+    if (slowOperations > 0) {
+        std::printf("%zu operations over budget\n", slowOperations);
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -1,8 +1,20 @@
 // Written by Paul Baxter
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <string>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory_resource>
+#include <thread>
 
 #include "d64.h"
+#include "d64_batch.h"
+#include "d64_shared.h"
+#include "d64_loader.h"
+#include "d64_archive.h"
 
 #pragma warning(disable:4996)
 
@@ -229,6 +241,11 @@ namespace d64lib_unit_test
                 EXPECT_TRUE(readfile.value() == prog);
             }
         }
+        // the directory has grown past track 18 and the image still loads
+        disk.save("add_file_unit_test_full.d64");
+        d64 loaded;
+        EXPECT_TRUE(loaded.load("add_file_unit_test_full.d64"));
+        EXPECT_EQ(loaded.directory().size(), disk.directory().size());
         d64lib_unit_test_method_cleanup(disk);
     }
 
@@ -267,6 +284,2157 @@ namespace d64lib_unit_test
     }
 
 
+    TEST(d64lib_unit_test, map_read_only_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        {
+            d64 disk;
+            disk.addFile("PROG", d64FileTypes::PRG, prog);
+            disk.save("map_read_only_test.d64");
+        }
+
+        d64 disk("map_read_only_test.d64", mapMode::map_read_only);
+        EXPECT_FALSE(disk.writable());
+        EXPECT_STREQ(disk.diskname().c_str(), "NEW DISK");
+        auto readfile = disk.readFile("PROG");
+        EXPECT_TRUE(readfile.has_value());
+        if (readfile.has_value()) {
+            EXPECT_EQ(readfile.value(), prog);
+        }
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+        EXPECT_FALSE(disk.writeByte(1, 0, 0, 0xAA));
+        EXPECT_ANY_THROW(disk.addFile("MORE", d64FileTypes::PRG, prog));
+
+        // a writable copy can be changed
+        d64 copy(disk);
+        EXPECT_TRUE(copy.writable());
+        EXPECT_TRUE(copy.addFile("MORE", d64FileTypes::PRG, prog));
+        EXPECT_EQ(copy.directory().size(), 2);
+        EXPECT_EQ(disk.directory().size(), 1);
+    }
+
+    TEST(d64lib_unit_test, map_copy_on_write_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        {
+            d64 disk;
+            disk.save("map_copy_on_write_test.d64");
+        }
+
+        {
+            d64 disk("map_copy_on_write_test.d64", mapMode::map_copy_on_write);
+            EXPECT_TRUE(disk.addFile("PROG", d64FileTypes::PRG, prog));
+
+            // the file on disk is not changed until it is saved
+            d64 unchanged("map_copy_on_write_test.d64");
+            EXPECT_EQ(unchanged.directory().size(), 0);
+
+            EXPECT_TRUE(disk.save("map_copy_on_write_test.d64"));
+        }
+
+        d64 saved("map_copy_on_write_test.d64");
+        EXPECT_EQ(saved.directory().size(), 1);
+        EXPECT_TRUE(saved.verifyBAMIntegrity(false, ""));
+    }
+
+    TEST(d64lib_unit_test, map_write_through_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        {
+            d64 disk(diskType::forty_track);
+            disk.save("map_write_through_test.d64");
+        }
+
+        {
+            d64 disk("map_write_through_test.d64", mapMode::map_write_through);
+            EXPECT_EQ(disk.TRACKS, TRACKS_40);
+            EXPECT_TRUE(disk.addFile("PROG", d64FileTypes::PRG, prog));
+            EXPECT_TRUE(disk.save("map_write_through_test.d64"));
+        }
+
+        d64 saved("map_write_through_test.d64");
+        EXPECT_EQ(saved.TRACKS, TRACKS_40);
+        auto readfile = saved.readFile("PROG");
+        EXPECT_TRUE(readfile.has_value());
+        if (readfile.has_value()) {
+            EXPECT_EQ(readfile.value(), prog);
+        }
+    }
+
+    TEST(d64lib_unit_test, copy_constructor_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        d64 disk;
+        disk.addFile("PROG", d64FileTypes::PRG, prog);
+
+        d64 copy(disk);
+        copy.rename_disk("COPY");
+        copy.removeFile("PROG");
+
+        // the BAM of the copy is its own
+        EXPECT_STREQ(disk.diskname().c_str(), "NEW DISK");
+        EXPECT_STREQ(copy.diskname().c_str(), "COPY");
+        EXPECT_EQ(disk.directory().size(), 1);
+        EXPECT_EQ(copy.directory().size(), 0);
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+        EXPECT_TRUE(copy.verifyBAMIntegrity(false, ""));
+
+        d64 assigned(diskType::forty_track);
+        assigned = disk;
+        EXPECT_EQ(assigned.TRACKS, TRACKS_35);
+        EXPECT_EQ(assigned.getFreeSectorCount(), disk.getFreeSectorCount());
+
+        d64lib_unit_test_method_cleanup(copy);
+    }
+
+    TEST(d64lib_unit_test, clone_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        std::vector<uint8_t> big(5000, 0x55);
+        d64 disk;
+        disk.addFile("PROG", d64FileTypes::PRG, prog);
+
+        // only the BAM sector of each disk is its own
+        auto fork = disk.clone();
+        auto sectors = static_cast<size_t>(D64_DISK35_SZ / SECTOR_SIZE);
+        EXPECT_EQ(fork.sharedSectors(), sectors - 1);
+        EXPECT_EQ(disk.sharedSectors(), sectors - 1);
+
+        // reading shares everything still
+        EXPECT_EQ(fork.readFile("PROG").value(), prog);
+        EXPECT_EQ(fork.directory().size(), 1);
+        EXPECT_TRUE(fork.verifyBAMIntegrity(false, ""));
+        EXPECT_EQ(fork.sharedSectors(), sectors - 1);
+
+        // a change copies only the sectors it writes
+        fork.addFile("BIG", d64FileTypes::PRG, big);
+        fork.rename_disk("FORK");
+        auto written = (big.size() + 253) / 254 + 1;
+        EXPECT_EQ(fork.sharedSectors(), sectors - 1 - written);
+
+        EXPECT_STREQ(disk.diskname().c_str(), "NEW DISK");
+        EXPECT_STREQ(fork.diskname().c_str(), "FORK");
+        EXPECT_EQ(disk.directory().size(), 1);
+        EXPECT_EQ(fork.directory().size(), 2);
+        EXPECT_FALSE(disk.findFile("BIG").has_value());
+        EXPECT_EQ(fork.readFile("BIG").value(), big);
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+        EXPECT_TRUE(fork.verifyBAMIntegrity(false, ""));
+
+        // the source can change without touching the fork
+        disk.removeFile("PROG");
+        EXPECT_EQ(fork.readFile("PROG").value(), prog);
+
+        // forks of forks, copies and saves see their own sectors
+        auto second = fork.clone();
+        second.removeFile("BIG");
+        EXPECT_EQ(fork.readFile("BIG").value(), big);
+        d64 copy(fork);
+        EXPECT_EQ(copy.sharedSectors(), 0);
+        EXPECT_EQ(copy.readFile("BIG").value(), big);
+
+        EXPECT_TRUE(fork.save("clone_test.d64"));
+        d64 loaded("clone_test.d64");
+        EXPECT_STREQ(loaded.diskname().c_str(), "FORK");
+        EXPECT_EQ(loaded.readFile("BIG").value(), big);
+
+        // a read only mapped disk gives writable clones
+        d64 mapped("clone_test.d64", mapMode::map_read_only);
+        auto writableFork = mapped.clone();
+        EXPECT_FALSE(mapped.writable());
+        EXPECT_TRUE(writableFork.writable());
+        EXPECT_TRUE(writableFork.removeFile("BIG"));
+        EXPECT_EQ(mapped.readFile("BIG").value(), big);
+
+        d64lib_unit_test_method_cleanup(second);
+    }
+
+    TEST(d64lib_unit_test, verify_incremental_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        std::vector<uint8_t> big(3000, 0x33);
+        std::vector<uint8_t> rel(64 * 20, 0x44);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto file = 1; file <= 12; ++file) {
+            disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, file % 3 ? prog : big);
+        }
+        disk.addFile("RELFILE", d64FileTypes::REL, rel, 64);
+
+        // the first verify has nothing to start from and scans everything
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+
+        // mutations through the API keep the BAM right
+        disk.addFile("MORE", d64FileTypes::PRG, big);
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+        disk.removeFile("FILE2");
+        disk.renameFile("FILE3", "RENAMED");
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+        disk.compactDirectory();
+        EXPECT_EQ(disk.directory().size(), 13);
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+        disk.reorderDirectory([](const directoryEntry& a, const directoryEntry& b) { return d64::Trim(a.fileName) < d64::Trim(b.fileName); });
+        EXPECT_EQ(disk.directory().size(), 13);
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+
+        // a sector freed under a file
+        auto start = disk.findFile("MORE").value()->start;
+        disk.freeSector(start.track, start.sector);
+        EXPECT_FALSE(disk.verifyBAMIncremental(false, ""));
+        EXPECT_FALSE(disk.verifyBAMIncremental(false, ""));
+        EXPECT_FALSE(disk.verifyBAMIntegrity(false, ""));
+        EXPECT_FALSE(disk.verifyBAMIncremental(true, ""));
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+
+        // a raw write that links a file onto free sectors
+        auto last = disk.findFile("FILE1").value()->start;
+        EXPECT_TRUE(disk.writeByte(last.track, last.sector, 0, 1));
+        EXPECT_TRUE(disk.writeByte(last.track, last.sector, 1, 0));
+        EXPECT_FALSE(disk.verifyBAMIncremental(false, ""));
+        EXPECT_FALSE(disk.verifyBAMIntegrity(false, ""));
+        EXPECT_TRUE(disk.writeByte(last.track, last.sector, 0, 0));
+        EXPECT_TRUE(disk.writeByte(last.track, last.sector, 1, static_cast<uint8_t>(prog.size() + 1)));
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+
+        // a raw write that deletes a directory entry leaves its sectors used
+        d64 copy(disk);
+        auto entries = copy.directory();
+        EXPECT_TRUE(copy.writeByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 2, 0));
+        EXPECT_EQ(copy.directory().size(), entries.size() - 1);
+        EXPECT_FALSE(copy.verifyBAMIncremental(false, ""));
+        EXPECT_FALSE(copy.verifyBAMIntegrity(false, ""));
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+
+        // clones carry the state and verify on their own
+        auto fork = disk.clone();
+        fork.removeFile("RELFILE");
+        EXPECT_TRUE(fork.verifyBAMIncremental(false, ""));
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+
+        // a new format starts over
+        disk.formatDisk("EMPTY");
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+
+        d64lib_unit_test_method_cleanup(fork);
+    }
+
+    TEST(d64lib_unit_test, try_read_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> big(1000, 0x77);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.addFile("BIG", d64FileTypes::PRG, big);
+        disk.addFile("LOOP", d64FileTypes::PRG, big);
+        disk.addFile("BROKEN", d64FileTypes::PRG, big);
+
+        // good reads match the throwing api
+        auto file = disk.tryReadFile("BIG");
+        ASSERT_TRUE(file.has_value());
+        EXPECT_EQ(file.value(), big);
+        std::vector<uint8_t> buffer(big.size());
+        EXPECT_EQ(disk.tryReadFileInto("BIG", buffer).value(), big.size());
+        EXPECT_EQ(buffer, big);
+        EXPECT_EQ(disk.tryReadFileInto("BIG", std::span<uint8_t>(buffer).first(10)).error().code, readError::read_buffer_too_small);
+        auto sector = disk.tryReadSector(DIRECTORY_TRACK, BAM_SECTOR);
+        ASSERT_TRUE(sector.has_value());
+        EXPECT_TRUE(std::equal(sector->begin(), sector->end(), disk.readSector(DIRECTORY_TRACK, BAM_SECTOR).value().begin()));
+        EXPECT_EQ(disk.tryReadByte(DIRECTORY_TRACK, BAM_SECTOR, 2).value(), DOS_VERSION);
+        EXPECT_EQ(disk.tryDirectory().value().size(), 3);
+        auto chain = disk.tryFileChain("BIG");
+        ASSERT_TRUE(chain.has_value());
+        EXPECT_EQ(std::distance(chain->begin(), chain->end()), 4);
+
+        // bad arguments
+        EXPECT_EQ(disk.tryReadSector(0, 0).error().code, readError::read_bad_track_sector);
+        EXPECT_EQ(disk.tryReadSector(1, 21).error().code, readError::read_bad_track_sector);
+        EXPECT_EQ(disk.tryReadSector(36, 0).error().code, readError::read_bad_track_sector);
+        EXPECT_EQ(disk.tryReadByte(1, 0, SECTOR_SIZE).error().code, readError::read_bad_offset);
+        EXPECT_EQ(disk.tryFindFile("NOT THERE").error().code, readError::read_file_not_found);
+        EXPECT_EQ(disk.tryFindFile("A NAME LONGER THAN SIXTEEN").error().code, readError::read_bad_name);
+
+        // the second sector of LOOP links back to the first
+        auto loop = disk.fileChain("LOOP").begin();
+        auto first = loop.location();
+        auto second = (++loop).location();
+        disk.writeByte(second.track, second.sector, 0, first.track);
+        disk.writeByte(second.track, second.sector, 1, first.sector);
+        auto looped = disk.tryReadFile("LOOP");
+        ASSERT_FALSE(looped.has_value());
+        EXPECT_EQ(looped.error().code, readError::read_chain_loop);
+        EXPECT_EQ(looped.error().track, second.track);
+        EXPECT_EQ(looped.error().sector, second.sector);
+
+        // the throwing reads stop at the loop too and a looped file is left alone
+        std::vector<uint8_t> loopBuffer(10000);
+        EXPECT_THROW(disk.readFile("LOOP"), std::runtime_error);
+        EXPECT_THROW(disk.readFileInto("LOOP", loopBuffer), std::runtime_error);
+        EXPECT_THROW(disk.fileLength("LOOP"), std::runtime_error);
+        EXPECT_THROW(disk.fileFingerprint("LOOP"), std::runtime_error);
+        auto freeBefore = disk.getFreeSectorCount();
+        EXPECT_FALSE(disk.removeFile("LOOP"));
+        EXPECT_EQ(disk.getFreeSectorCount(), freeBefore);
+
+        // the first sector of BROKEN links off the disk
+        auto broken = disk.fileChain("BROKEN").begin().location();
+        disk.writeByte(broken.track, broken.sector, 0, 50);
+        auto brokenChain = disk.tryFileChain("BROKEN");
+        ASSERT_FALSE(brokenChain.has_value());
+        EXPECT_EQ(brokenChain.error().code, readError::read_chain_broken);
+        EXPECT_EQ(brokenChain.error().track, broken.track);
+        EXPECT_EQ(brokenChain.error().sector, broken.sector);
+        EXPECT_EQ(disk.tryReadFile("BIG").value(), big);
+
+        // a directory that links off the disk still lists what it can reach
+        disk.writeByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0, 99);
+        EXPECT_EQ(disk.tryDirectory().error().code, readError::read_chain_broken);
+        EXPECT_TRUE(disk.tryFindFile("BIG").has_value());
+        EXPECT_STREQ(std::string(readErrorText(readError::read_chain_broken)).c_str(), "Sector chain links off the disk");
+    }
+
+    TEST(d64lib_unit_test, directory_view_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(300, 0x11);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+
+        // more files than fit in one directory sector
+        for (auto i = 0; i < 10; ++i) {
+            disk.addFile("FILE" + std::to_string(i), i % 2 ? d64FileTypes::SEQ : d64FileTypes::PRG, data);
+        }
+        disk.removeFile("FILE4");
+
+        // same entries as the copied directory
+        auto view = disk.entries();
+        auto files = disk.directory();
+        EXPECT_EQ(std::distance(view.begin(), view.end()), 9);
+        EXPECT_TRUE(std::equal(view.begin(), view.end(), files.begin(), files.end()));
+
+        // entries are read in place and know their slot
+        for (auto it = view.begin(); it != view.end(); ++it) {
+            auto slot = it.slot();
+            EXPECT_EQ(&*it, &disk.getDirectory_SectorPtr(slot.location.track, slot.location.sector)->fileEntry[slot.entry]);
+        }
+
+        // filter by type
+        auto seq = disk.entries(d64FileTypes::SEQ);
+        EXPECT_EQ(std::distance(seq.begin(), seq.end()), 5);
+        EXPECT_TRUE(std::all_of(seq.begin(), seq.end(), [](const directoryEntry& entry) { return entry.file_type.type == d64FileTypes::SEQ; }));
+        auto rel = disk.entries(d64FileTypes::REL);
+        EXPECT_TRUE(rel.begin() == rel.end());
+
+        // ordered directories are left alone
+        EXPECT_FALSE(disk.reorderDirectory(files));
+        EXPECT_FALSE(disk.movefileFirst("FILE0"));
+        EXPECT_TRUE(disk.movefileFirst("FILE9"));
+        EXPECT_EQ(d64::Trim(disk.entries().begin()->fileName), "FILE9");
+
+        // a directory that links back to itself ends the walk
+        auto dir = disk.getDirectory_SectorPtr(DIRECTORY_TRACK, DIRECTORY_SECTOR);
+        auto second = dir->next;
+        disk.getDirectory_SectorPtr(second.track, second.sector)->next = trackSector(DIRECTORY_TRACK, DIRECTORY_SECTOR);
+        auto looped = disk.entries();
+        EXPECT_LE(std::distance(looped.begin(), looped.end()), static_cast<std::ptrdiff_t>(D64_DISK35_SZ / SECTOR_SIZE * FILES_PER_SECTOR));
+    }
+
+    TEST(d64lib_unit_test, reorder_permutation_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(10, 0x22);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+
+        // three directory sectors
+        for (auto i = 0; i < 20; ++i) {
+            disk.addFile("FILE" + std::to_string(i), d64FileTypes::PRG, data);
+        }
+        auto names = [](const d64& image)
+            {
+                std::vector<std::string> result;
+                for (auto& entry : image.entries()) {
+                    result.push_back(d64::Trim(entry.fileName));
+                }
+                return result;
+            };
+
+        // a swap across two sectors writes just those two
+        auto copy = disk.clone();
+        auto shared = copy.sharedSectors();
+        EXPECT_TRUE(copy.movefileFirst("FILE10"));
+        EXPECT_EQ(copy.sharedSectors(), shared - 2);
+        EXPECT_EQ(d64::Trim(copy.entries().begin()->fileName), "FILE10");
+        ASSERT_TRUE(copy.findFile("FILE0").has_value());
+        EXPECT_EQ(d64::Trim(copy.findFile("FILE0").value()->fileName), "FILE0");
+
+        // moving entries inside the last sector leaves the others alone
+        copy = disk.clone();
+        shared = copy.sharedSectors();
+        std::vector<std::string> order;
+        for (auto i = 0; i < 16; ++i) {
+            order.push_back("FILE" + std::to_string(i));
+        }
+        order.push_back("FILE19");
+        EXPECT_TRUE(copy.reorderDirectory(order));
+        EXPECT_EQ(copy.sharedSectors(), shared - 1);
+        EXPECT_EQ(names(copy).size(), 20);
+        EXPECT_EQ(d64::Trim(copy.directory()[16].fileName), "FILE19");
+        EXPECT_EQ(d64::Trim(copy.directory()[19].fileName), "FILE18");
+        EXPECT_FALSE(copy.reorderDirectory(order));
+
+        // sorting keeps the slots the files are in
+        disk.removeFile("FILE3");
+        EXPECT_TRUE(disk.reorderDirectory([](const directoryEntry& a, const directoryEntry& b) { return d64::Trim(a.fileName) > d64::Trim(b.fileName); }));
+        auto sorted = names(disk);
+        EXPECT_EQ(sorted.size(), 19);
+        EXPECT_TRUE(std::is_sorted(sorted.rbegin(), sorted.rend()));
+        EXPECT_FALSE(disk.getDirectory_SectorPtr(DIRECTORY_TRACK, DIRECTORY_SECTOR)->fileEntry[3].file_type.closed);
+        for (auto& name : sorted) {
+            ASSERT_TRUE(disk.findFile(name).has_value());
+            EXPECT_EQ(d64::Trim(disk.findFile(name).value()->fileName), name);
+        }
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+
+        // writing a shorter list empties the slots past it
+        auto all = disk.directory();
+        std::vector<directoryEntry> files(all.rbegin(), all.rbegin() + 8);
+        EXPECT_TRUE(disk.reorderDirectory(files));
+        EXPECT_EQ(names(disk).size(), 8);
+    }
+
+    TEST(d64lib_unit_test, save_incremental_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        auto fileBytes = [](const std::string& name)
+            {
+                std::ifstream in(name, std::ios::binary);
+                return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            };
+
+        std::vector<uint8_t> data(600, 0x33);
+        {
+            d64 disk;
+            EXPECT_GT(disk.unsavedSectors(), 0);
+            disk.addFile("FIRST", d64FileTypes::PRG, data);
+            disk.save("save_incremental_test.d64");
+            EXPECT_EQ(disk.unsavedSectors(), 0);
+        }
+
+        d64 disk("save_incremental_test.d64");
+        d64 original(disk);
+
+        // reading changes nothing
+        disk.directory();
+        disk.readFile("FIRST");
+        disk.getFreeSectorCount();
+        disk.verifyBAMIntegrity(false, "");
+        EXPECT_EQ(disk.unsavedSectors(), 0);
+        EXPECT_TRUE(disk.saveIncremental("save_incremental_test.d64"));
+
+        // three data sectors, a directory sector and the BAM
+        disk.addFile("SECOND", d64FileTypes::PRG, data);
+        EXPECT_EQ(disk.unsavedSectors(), 5);
+        auto patch = disk.exportPatch();
+        EXPECT_LT(patch.size(), 6 * SECTOR_SIZE);
+
+        // only the changed sectors are written and the file matches a full save
+        EXPECT_TRUE(disk.saveIncremental("save_incremental_test.d64"));
+        EXPECT_EQ(disk.unsavedSectors(), 0);
+        disk.save("save_incremental_test_full.d64");
+        EXPECT_EQ(fileBytes("save_incremental_test.d64"), fileBytes("save_incremental_test_full.d64"));
+
+        // the patch brings the old image up to date
+        EXPECT_TRUE(original.applyPatch(patch));
+        ASSERT_TRUE(original.findFile("SECOND").has_value());
+        EXPECT_EQ(original.readFile("SECOND").value(), data);
+        EXPECT_TRUE(original.verifyBAMIntegrity(false, ""));
+        original.save("save_incremental_test_patched.d64");
+        EXPECT_EQ(fileBytes("save_incremental_test_patched.d64"), fileBytes("save_incremental_test_full.d64"));
+
+        // a damaged patch changes nothing
+        original.setErrorLog(nullptr);
+        auto before = original.unsavedSectors();
+        patch.pop_back();
+        EXPECT_FALSE(original.applyPatch(patch));
+        patch = { 'D', '6', '4', 'P', 1, 0x00, 0x03, 0, 0 };
+        EXPECT_FALSE(original.applyPatch(patch));
+        EXPECT_EQ(original.unsavedSectors(), before);
+
+        // a file of another size is not patched
+        d64 forty(diskType::forty_track);
+        forty.save("save_incremental_test_40.d64");
+        disk.writeByte(1, 0, 2, 0x55);
+        EXPECT_THROW(disk.saveIncremental("save_incremental_test_40.d64"), std::runtime_error);
+    }
+
+    TEST(d64lib_unit_test, journaled_save_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(600, 0x44);
+        const std::string name = "journaled_save_test.d64";
+        const std::string journal = name + ".journal";
+        std::filesystem::remove(journal);
+
+        // a whole save goes through a temporary file
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.addFile("FIRST", d64FileTypes::PRG, data);
+        EXPECT_TRUE(disk.save(name, saveMode::save_journaled));
+        EXPECT_FALSE(std::filesystem::exists(name + ".tmp"));
+        EXPECT_EQ(d64(name).directory().size(), 1);
+
+        // the journal is gone once the sectors are written
+        disk.addFile("SECOND", d64FileTypes::PRG, data);
+        EXPECT_TRUE(disk.saveIncremental(name, saveMode::save_journaled));
+        EXPECT_FALSE(std::filesystem::exists(journal));
+        EXPECT_EQ(d64(name).directory().size(), 2);
+
+        // a save cut short after its journal was written is finished by load
+        disk.addFile("THIRD", d64FileTypes::PRG, data);
+        auto patch = disk.exportPatch();
+        uint64_t checksum = 0xcbf29ce484222325ull;
+        for (auto byte : patch) {
+            checksum = (checksum ^ byte) * 0x100000001b3ull;
+        }
+        for (auto i = 0; i < 8; ++i) {
+            patch.push_back(static_cast<uint8_t>(checksum >> (i * 8)));
+        }
+        {
+            std::ofstream out(journal, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(patch.data()), patch.size());
+        }
+        d64 recovered(name);
+        EXPECT_FALSE(std::filesystem::exists(journal));
+        ASSERT_TRUE(recovered.findFile("THIRD").has_value());
+        EXPECT_EQ(recovered.readFile("THIRD").value(), data);
+        EXPECT_TRUE(recovered.verifyBAMIntegrity(false, ""));
+
+        // a journal cut short is dropped and the image is left as it was
+        {
+            std::ofstream out(journal, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(patch.data()), patch.size() / 2);
+        }
+        std::ostringstream log;
+        d64 unchanged;
+        unchanged.setErrorLog(&log);
+        EXPECT_TRUE(unchanged.load(name));
+        EXPECT_FALSE(std::filesystem::exists(journal));
+        EXPECT_NE(log.str().find("incomplete journal"), std::string::npos);
+        EXPECT_EQ(unchanged.directory().size(), 3);
+    }
+
+    TEST(d64lib_unit_test, rel_record_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        constexpr int RECORD_SIZE = 64;
+        auto makeRecord = [](int n, size_t size)
+            {
+                std::vector<uint8_t> rec(size);
+                for (size_t i = 0; i < size; ++i) {
+                    rec[i] = static_cast<uint8_t>(n * 3 + i);
+                }
+                return rec;
+            };
+
+        std::vector<uint8_t> rel;
+        for (auto n = 0; n < 20; ++n) {
+            auto rec = makeRecord(n, RECORD_SIZE);
+            rel.insert(rel.end(), rec.begin(), rec.end());
+        }
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        ASSERT_TRUE(disk.addFile("RELFILE", d64FileTypes::REL, rel, RECORD_SIZE));
+        disk.addFile("PRGFILE", d64FileTypes::PRG, rel);
+
+        // records are found through the side sectors, record 3 spans two sectors
+        EXPECT_EQ(disk.recordCount("RELFILE"), 20);
+        EXPECT_EQ(disk.readRecord("RELFILE", 0).value(), makeRecord(0, RECORD_SIZE));
+        EXPECT_EQ(disk.readRecord("RELFILE", 3).value(), makeRecord(3, RECORD_SIZE));
+        EXPECT_EQ(disk.readRecord("RELFILE", 19).value(), makeRecord(19, RECORD_SIZE));
+        EXPECT_FALSE(disk.readRecord("RELFILE", 20).has_value());
+        EXPECT_THROW(disk.readRecord("PRGFILE", 0), std::runtime_error);
+        EXPECT_THROW(disk.readRecord("MISSING", 0), std::runtime_error);
+
+        // a record write changes at most two sectors
+        auto copy = disk.clone();
+        auto shared = copy.sharedSectors();
+        auto replacement = makeRecord(100, 10);
+        EXPECT_TRUE(copy.writeRecord("RELFILE", 3, replacement));
+        EXPECT_EQ(copy.sharedSectors(), shared - 2);
+        replacement.resize(RECORD_SIZE, 0);
+        EXPECT_EQ(copy.readRecord("RELFILE", 3).value(), replacement);
+        EXPECT_FALSE(copy.writeRecord("RELFILE", 20, replacement));
+        EXPECT_FALSE(copy.writeRecord("RELFILE", 0, makeRecord(0, RECORD_SIZE + 1)));
+
+        // appended records fill the last sector then extend the file
+        for (auto n = 20; n < 30; ++n) {
+            ASSERT_TRUE(disk.appendRecord("RELFILE", makeRecord(n, RECORD_SIZE)));
+            auto rec = makeRecord(n, RECORD_SIZE);
+            rel.insert(rel.end(), rec.begin(), rec.end());
+        }
+        EXPECT_EQ(disk.recordCount("RELFILE"), 30);
+        EXPECT_EQ(disk.readFile("RELFILE").value(), rel);
+        EXPECT_EQ(disk.findFile("RELFILE").value()->fileSize[0], (30 * RECORD_SIZE + 253) / 254);
+        EXPECT_TRUE(disk.verifyBAMIncremental(false, ""));
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+
+        // one record per sector reaches a second side sector
+        std::vector<uint8_t> big;
+        for (auto n = 0; n < SIDE_SECTOR_CHAIN_SZ; ++n) {
+            auto rec = makeRecord(n, 254);
+            big.insert(big.end(), rec.begin(), rec.end());
+        }
+        ASSERT_TRUE(disk.addFile("BIGREL", d64FileTypes::REL, big, 254));
+        auto free = disk.getFreeSectorCount();
+        for (auto n = SIDE_SECTOR_CHAIN_SZ; n < SIDE_SECTOR_CHAIN_SZ + 3; ++n) {
+            ASSERT_TRUE(disk.appendRecord("BIGREL", makeRecord(n, 254)));
+        }
+        EXPECT_EQ(disk.getFreeSectorCount(), free - 4);
+        EXPECT_EQ(disk.recordCount("BIGREL"), SIDE_SECTOR_CHAIN_SZ + 3);
+        EXPECT_EQ(disk.readRecord("BIGREL", SIDE_SECTOR_CHAIN_SZ + 1).value(), makeRecord(SIDE_SECTOR_CHAIN_SZ + 1, 254));
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+
+        // every sector is given back when the file is removed
+        EXPECT_TRUE(disk.removeFile("BIGREL"));
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+    }
+
+    TEST(d64lib_unit_test, fingerprint_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog(1000);
+        for (size_t i = 0; i < prog.size(); ++i) {
+            prog[i] = static_cast<uint8_t>(i * 7);
+        }
+
+        // the same file stored in different places has the same fingerprint
+        d64 first;
+        first.addFile("PROG", d64FileTypes::PRG, prog);
+        d64 second;
+        second.addFile("OTHER", d64FileTypes::PRG, std::vector<uint8_t>(3000, 0x55));
+        second.addFile("COPY", d64FileTypes::PRG, prog);
+        EXPECT_NE(first.findFile("PROG").value()->start.sector, second.findFile("COPY").value()->start.sector);
+        EXPECT_EQ(first.fileFingerprint("PROG"), second.fileFingerprint("COPY"));
+        EXPECT_EQ(first.fileFingerprint("PROG"), d64::dataFingerprint(prog));
+        EXPECT_NE(second.fileFingerprint("OTHER"), second.fileFingerprint("COPY"));
+        EXPECT_FALSE(first.fileFingerprint("MISSING").has_value());
+
+        auto shorter = prog;
+        shorter.pop_back();
+        EXPECT_NE(d64::dataFingerprint(shorter), d64::dataFingerprint(prog));
+
+        // a write changes the cached fingerprints, undoing it restores them
+        auto start = first.findFile("PROG").value()->start;
+        auto sectorBefore = first.sectorFingerprint(start.track, start.sector);
+        auto imageBefore = first.imageFingerprint();
+        auto old = first.readByte(start.track, start.sector, 100).value();
+        first.writeByte(start.track, start.sector, 100, old ^ 0xff);
+        EXPECT_NE(first.sectorFingerprint(start.track, start.sector), sectorBefore);
+        EXPECT_NE(first.imageFingerprint(), imageBefore);
+        EXPECT_NE(first.fileFingerprint("PROG"), d64::dataFingerprint(prog));
+        first.writeByte(start.track, start.sector, 100, old);
+        EXPECT_EQ(first.sectorFingerprint(start.track, start.sector), sectorBefore);
+        EXPECT_EQ(first.imageFingerprint(), imageBefore);
+
+        // BAM changes are seen too, a copy fingerprints the same
+        first.rename_disk("RENAMED");
+        EXPECT_NE(first.imageFingerprint(), imageBefore);
+        d64 copy(first);
+        EXPECT_EQ(copy.imageFingerprint(), first.imageFingerprint());
+
+        // the batch job finds which images hold the program
+        first.save("fingerprint_test_1.d64");
+        second.save("fingerprint_test_2.d64");
+        d64batch batch(2);
+        auto results = batch.run({ "fingerprint_test_1.d64", "fingerprint_test_2.d64" }, batchJob::batch_fingerprint);
+        ASSERT_EQ(results.size(), 2);
+        EXPECT_EQ(results[0].fingerprint, first.imageFingerprint());
+        EXPECT_EQ(results[1].fingerprint, second.imageFingerprint());
+        ASSERT_EQ(results[1].fileFingerprints.size(), 2);
+        EXPECT_EQ(results[1].fileFingerprints[1].first, "COPY");
+        EXPECT_EQ(results[1].fileFingerprints[1].second, d64::dataFingerprint(prog));
+    }
+
+    TEST(d64lib_unit_test, caller_storage_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::array<uint8_t, 300> prog;
+        for (size_t i = 0; i < prog.size(); ++i) {
+            prog[i] = static_cast<uint8_t>(i * 5);
+        }
+
+        // a disk over the caller's buffer works in that buffer
+        std::vector<uint8_t> buffer(D64_DISK35_SZ, 0xee);
+        {
+            d64 disk{ std::span<uint8_t>(buffer) };
+            disk.formatDisk("SPAN");
+            ASSERT_TRUE(disk.addFile("PROG", d64FileTypes::PRG, prog));
+            EXPECT_EQ(disk.diskname(), "SPAN");
+            auto start = disk.findFile("PROG").value()->start;
+            EXPECT_EQ(buffer[disk.calcOffset(start.track, start.sector) + 2], prog[0]);
+
+            // a copy gets its own image
+            d64 copy(disk);
+            copy.rename_disk("COPY");
+            EXPECT_EQ(disk.diskname(), "SPAN");
+        }
+        d64 reopened{ std::span<uint8_t>(buffer) };
+        auto file = reopened.readFile("PROG").value();
+        EXPECT_TRUE(std::equal(file.begin(), file.end(), prog.begin(), prog.end()));
+        std::vector<uint8_t> wrongSize(1000);
+        EXPECT_THROW(d64{ std::span<uint8_t>(wrongSize) }, std::invalid_argument);
+
+        // images come out of the arena and nowhere else
+        std::vector<uint8_t> arenaBytes(2 * D64_DISK40_SZ + 1024);
+        std::pmr::monotonic_buffer_resource arena(arenaBytes.data(), arenaBytes.size(), std::pmr::null_memory_resource());
+        d64 first(diskType::thirty_five_track, &arena);
+        d64 second(diskType::forty_track, &arena);
+        EXPECT_THROW(d64(diskType::forty_track, &arena), std::bad_alloc);
+        EXPECT_EQ(second.getFreeSectorCount(), 749);
+
+        // sector reads and writes through caller buffers
+        std::array<uint8_t, SECTOR_SIZE> sector;
+        sector.fill(0x42);
+        EXPECT_TRUE(first.writeSector(1, 0, sector));
+        sector.fill(0);
+        EXPECT_TRUE(first.readSectorInto(1, 0, sector));
+        EXPECT_EQ(sector[0], 0x42);
+        EXPECT_EQ(sector[SECTOR_SIZE - 1], 0x42);
+        EXPECT_FALSE(first.readSectorInto(1, 0, std::span<uint8_t>(sector).first(10)));
+        EXPECT_FALSE(first.readSectorInto(36, 0, sector));
+    }
+
+    TEST(d64lib_unit_test, geometry_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        static_assert(geometry35::SECTORS == D64_DISK35_SZ / SECTOR_SIZE);
+        static_assert(geometry40::sectorIndex(DIRECTORY_TRACK, DIRECTORY_SECTOR) == 358);
+        static_assert(!geometry35::isValid(36, 0) && geometry40::isValid(40, 16) && !geometry40::isValid(40, 17));
+        static_assert(geometry40::lookup(DIRECTORY_TRACK, 19) == -1 && geometry40::lookup(DIRECTORY_TRACK + 1, 0) == geometry40::sectorIndex(DIRECTORY_TRACK, 18) + 1);
+
+        // the runtime disk agrees with the compile time tables
+        for (auto type : { diskType::thirty_five_track, diskType::forty_track }) {
+            d64 disk(type);
+            for (auto track = 0; track <= TRACKS_40 + 1; ++track) {
+                for (auto sector = -1; sector <= 21; ++sector) {
+                    auto valid = type == diskType::thirty_five_track ?
+                        geometry35::isValid(track, sector) : geometry40::isValid(track, sector);
+                    EXPECT_EQ(disk.readByte(track, sector, 0).has_value(), valid);
+                    if (valid) {
+                        EXPECT_EQ(disk.calcOffset(track, sector), geometry40::offset(track, sector));
+                    }
+                }
+            }
+        }
+
+        // the tables are shared rather than held by every disk
+        d64 first;
+        d64 second(diskType::forty_track);
+        EXPECT_EQ(&first.SECTORS_PER_TRACK, &second.SECTORS_PER_TRACK);
+        EXPECT_EQ(first.TRACK_OFFSETS[DIRECTORY_TRACK - 1], 0x16500);
+    }
+
+    TEST(d64lib_unit_test, verify_report_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(600, 0x21);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto file = 0; file < 20; ++file) {
+            disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, data);
+        }
+        disk.addFile("RELFILE", d64FileTypes::REL, std::vector<uint8_t>(64 * 100, 0x33), 64);
+
+        // a good image is valid however many threads walk it
+        for (auto threads : { 1u, 4u, 0u }) {
+            auto report = disk.verify(threads);
+            EXPECT_TRUE(report.valid());
+            EXPECT_EQ(report.files, 21);
+        }
+
+        // a used sector marked free
+        auto start = disk.findFile("FILE3").value()->start;
+        disk.freeSector(start.track, start.sector);
+        auto freed = disk.verify(2);
+        ASSERT_EQ(freed.mismatches.size(), 1);
+        EXPECT_EQ(freed.mismatches[0].location, start);
+        EXPECT_TRUE(freed.mismatches[0].used);
+        ASSERT_EQ(freed.freeCounts.size(), 1);
+        EXPECT_EQ(freed.freeCounts[0].track, start.track);
+        EXPECT_EQ(freed.freeCounts[0].bamFree, freed.freeCounts[0].expected + 1);
+        disk.allocateSector(start.track, start.sector);
+        EXPECT_TRUE(disk.verify().valid());
+
+        // FILE15 starts where FILE2 does, its own sectors are left allocated but unused
+        directorySlot first, second;
+        for (auto it = disk.entries().begin(); it != disk.entries().end(); ++it) {
+            if (d64::Trim(it->fileName) == "FILE2") first = it.slot();
+            if (d64::Trim(it->fileName) == "FILE15") second = it.slot();
+        }
+        auto shared = disk.findFile("FILE2").value()->start;
+        auto lost = disk.findFile("FILE15").value()->start;
+        disk.writeByte(second.location.track, second.location.sector, second.entry * 32 + 3, shared.track);
+        disk.writeByte(second.location.track, second.location.sector, second.entry * 32 + 4, shared.sector);
+        for (auto threads : { 1u, 3u }) {
+            auto crossed = disk.verify(threads);
+            EXPECT_FALSE(crossed.valid());
+            ASSERT_EQ(crossed.crossLinks.size(), 3);
+            EXPECT_EQ(crossed.crossLinks[0].location, shared);
+            EXPECT_EQ(crossed.crossLinks[0].first, first);
+            EXPECT_EQ(crossed.crossLinks[0].second, second);
+            ASSERT_EQ(crossed.mismatches.size(), 3);
+            EXPECT_TRUE(std::any_of(crossed.mismatches.begin(), crossed.mismatches.end(), [&](auto& m) { return m.location == lost && !m.used; }));
+        }
+        disk.writeByte(second.location.track, second.location.sector, second.entry * 32 + 3, lost.track);
+        disk.writeByte(second.location.track, second.location.sector, second.entry * 32 + 4, lost.sector);
+        EXPECT_TRUE(disk.verify().valid());
+
+        // a looping chain is reported and the walk ends
+        auto loop = disk.fileChain("FILE7").begin();
+        auto loopStart = loop.location();
+        auto loopEnd = (++loop).location();
+        disk.writeByte(loopEnd.track, loopEnd.sector, 0, loopStart.track);
+        disk.writeByte(loopEnd.track, loopEnd.sector, 1, loopStart.sector);
+        auto looped = disk.verify(2);
+        ASSERT_EQ(looped.chainFaults.size(), 1);
+        EXPECT_EQ(looped.chainFaults[0].error.code, readError::read_chain_loop);
+        EXPECT_EQ(looped.chainFaults[0].error.track, loopEnd.track);
+        EXPECT_EQ(looped.mismatches.size(), 1);
+
+        // a directory linking off the disk belongs to the default slot
+        disk.writeByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0, 99);
+        auto broken = disk.verify();
+        ASSERT_FALSE(broken.chainFaults.empty());
+        EXPECT_EQ(broken.chainFaults[0].slot.location.track, 0);
+        EXPECT_EQ(broken.chainFaults[0].error.code, readError::read_chain_broken);
+        EXPECT_EQ(broken.files, 8);
+    }
+
+    TEST(d64lib_unit_test, relayout_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        auto makeData = [](int n, size_t size)
+            {
+                std::vector<uint8_t> data(size);
+                for (size_t i = 0; i < size; ++i) {
+                    data[i] = static_cast<uint8_t>(n + i * 13);
+                }
+                return data;
+            };
+
+        // fragment the disk by removing every other file and filling the gaps with bigger ones
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto file = 0; file < 30; ++file) {
+            disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, makeData(file, 1500));
+        }
+        for (auto file = 0; file < 30; file += 2) {
+            disk.removeFile("FILE" + std::to_string(file));
+        }
+        for (auto file = 0; file < 6; ++file) {
+            disk.addFile("BIG" + std::to_string(file), d64FileTypes::PRG, makeData(file + 100, 9000));
+        }
+        disk.addFile("RELFILE", d64FileTypes::REL, makeData(7, 64 * 200), 64);
+
+        std::vector<std::pair<std::string, std::vector<uint8_t>>> before;
+        for (auto& entry : disk.entries()) {
+            auto name = d64::Trim(entry.fileName);
+            before.emplace_back(name, disk.readFile(name).value());
+        }
+        auto freeBefore = disk.getFreeSectorCount();
+
+        auto report = disk.relayout();
+        EXPECT_EQ(report.files, before.size());
+        EXPECT_LT(report.loadMsAfter, report.loadMsBefore);
+        EXPECT_TRUE(disk.verify().valid());
+        EXPECT_EQ(disk.getFreeSectorCount(), freeBefore);
+        EXPECT_EQ(disk.recordCount("RELFILE"), 200);
+        auto rel = makeData(7, 64 * 200);
+        EXPECT_EQ(disk.readRecord("RELFILE", 150).value(), std::vector<uint8_t>(rel.begin() + 150 * 64, rel.begin() + 151 * 64));
+
+        // same files in the same slots, each chain leaves a track only once
+        auto index = 0;
+        for (auto& entry : disk.entries()) {
+            EXPECT_EQ(d64::Trim(entry.fileName), before[index].first);
+            EXPECT_EQ(disk.readFile(before[index].first).value(), before[index].second);
+            ++index;
+
+            std::vector<int> tracks;
+            for (auto it = disk.fileChain(entry).begin(); it != disk.fileChain(entry).end(); ++it) {
+                if (tracks.empty() || tracks.back() != it.location().track) {
+                    tracks.push_back(it.location().track);
+                }
+            }
+            std::sort(tracks.begin(), tracks.end());
+            EXPECT_EQ(std::unique(tracks.begin(), tracks.end()), tracks.end());
+        }
+
+        // the first file starts the directory track and steps by the interleave
+        auto chain = disk.fileChain(*disk.entries().begin());
+        auto it = chain.begin();
+        auto first = it.location();
+        auto second = (++it).location();
+        EXPECT_EQ(first.track, DIRECTORY_TRACK);
+        EXPECT_EQ(second.track, DIRECTORY_TRACK);
+
+        // a layout tuned for another loader loads faster with it
+        auto fast = loadModel::fastloader();
+        auto tuned = disk.relayout(d64::fastestInterleave(fast), fast);
+        EXPECT_LT(tuned.loadMsAfter, tuned.loadMsBefore);
+        EXPECT_THROW(disk.relayout(0), std::invalid_argument);
+
+        // a bad chain leaves the disk as it was
+        auto loop = disk.fileChain("BIG2").begin();
+        auto loopStart = loop.location();
+        auto loopEnd = (++loop).location();
+        disk.writeByte(loopEnd.track, loopEnd.sector, 0, loopStart.track);
+        disk.writeByte(loopEnd.track, loopEnd.sector, 1, loopStart.sector);
+        auto fingerprint = disk.imageFingerprint();
+        EXPECT_THROW(disk.relayout(), std::runtime_error);
+        EXPECT_EQ(disk.imageFingerprint(), fingerprint);
+    }
+
+    TEST(d64lib_unit_test, relayout_cross_link_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        auto lastSector = [](const d64& disk, const std::string& name)
+            {
+                trackSector last{ 0, 0 };
+                for (auto it = disk.fileChain(name).begin(); it != disk.fileChain(name).end(); ++it) {
+                    last = it.location();
+                }
+                return last;
+            };
+
+        // a file whose chain runs on into a file that fills the disk needs more room than there is
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.addFile("SMALL", d64FileTypes::PRG, std::vector<uint8_t>(500, 0x53));
+        disk.addFile("FILL", d64FileTypes::PRG, std::vector<uint8_t>(500 * 254, 0x46));
+        auto fill = disk.fileChain("FILL").begin().location();
+        auto tail = lastSector(disk, "SMALL");
+        EXPECT_TRUE(disk.writeByte(tail.track, tail.sector, 0, fill.track));
+        EXPECT_TRUE(disk.writeByte(tail.track, tail.sector, 1, fill.sector));
+        auto fingerprint = disk.imageFingerprint();
+        EXPECT_THROW(disk.relayout(), std::runtime_error);
+        EXPECT_EQ(disk.imageFingerprint(), fingerprint);
+
+        // a chain that runs into the directory moves without taking the directory sector with it
+        d64 dirDisk;
+        dirDisk.setErrorLog(nullptr);
+        for (auto file = 0; file < 10; ++file) {
+            dirDisk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, std::vector<uint8_t>(1000, static_cast<uint8_t>(file)));
+        }
+        trackSector second(dirDisk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0).value(), dirDisk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 1).value());
+        tail = lastSector(dirDisk, "FILE0");
+        EXPECT_TRUE(dirDisk.writeByte(tail.track, tail.sector, 0, second.track));
+        EXPECT_TRUE(dirDisk.writeByte(tail.track, tail.sector, 1, second.sector));
+        auto file0 = dirDisk.readFile("FILE0").value();
+
+        dirDisk.relayout();
+        EXPECT_EQ(dirDisk.readFile("FILE0").value(), file0);
+        for (auto file = 1; file < 10; ++file) {
+            EXPECT_EQ(dirDisk.readFile("FILE" + std::to_string(file)), std::make_optional(std::vector<uint8_t>(1000, static_cast<uint8_t>(file))));
+        }
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, load_model_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        // the most common step between sectors of a chain on one track
+        // sectors already in use push a few steps further
+        auto interleaveOf = [](d64& disk, std::string_view name)
+            {
+                std::map<int, int> steps;
+                auto chain = disk.fileChain(name);
+                auto it = chain.begin();
+                auto previous = it.location();
+                for (++it; it != chain.end(); ++it) {
+                    if (it.location().track == previous.track) {
+                        auto count = d64::SECTORS_PER_TRACK[previous.track - 1];
+                        ++steps[(it.location().sector - previous.sector + count) % count];
+                    }
+                    previous = it.location();
+                }
+                return std::max_element(steps.begin(), steps.end(), [](auto& a, auto& b) { return a.second < b.second; })->first;
+            };
+
+        EXPECT_EQ(d64::fastestInterleave(loadModel::kernal()), 10);
+        EXPECT_EQ(d64::fastestInterleave(loadModel::jiffyDos()), 6);
+        EXPECT_EQ(d64::fastestInterleave(loadModel::fastloader()), 4);
+        EXPECT_LT(d64::fastestInterleave(loadModel::kernal(), 31), 10);
+        EXPECT_THROW(d64::fastestInterleave(loadModel::kernal(), 41), std::invalid_argument);
+
+        std::vector<uint8_t> data(254 * 15, 0x42);
+        d64 disk;
+        auto fast = loadModel::fastloader();
+        ASSERT_TRUE(disk.addFile("TUNED", d64FileTypes::PRG, data, allocationPolicy{ d64::fastestInterleave(fast) }));
+        ASSERT_TRUE(disk.addFile("STOCK", d64FileTypes::PRG, data));
+        EXPECT_EQ(interleaveOf(disk, "TUNED"), 4);
+        EXPECT_EQ(interleaveOf(disk, "STOCK"), 10);
+
+        // the tuned file loads faster with its loader and every sector is accounted for
+        auto tuned = disk.profileLoad(*disk.findFile("TUNED").value(), fast);
+        auto stock = disk.profileLoad(*disk.findFile("STOCK").value(), fast);
+        EXPECT_LT(tuned.totalMs, stock.totalMs);
+        EXPECT_LT(tuned.missedSectors, stock.missedSectors);
+        EXPECT_EQ(tuned.sectors, 15);
+        EXPECT_NEAR(tuned.totalMs, tuned.stepMs + tuned.rotationMs + tuned.readMs + tuned.handleMs, 1e-6);
+        EXPECT_DOUBLE_EQ(disk.estimateLoadTime(*disk.findFile("STOCK").value(), fast), stock.totalMs);
+
+        // a faster loader is faster on the same layout
+        auto kernal = disk.profileLoad(*disk.findFile("STOCK").value(), loadModel::kernal());
+        EXPECT_LT(stock.totalMs, kernal.totalMs);
+
+        // a chain from anywhere can be timed, stepping from the directory track
+        std::vector<trackSector> chain = { trackSector(1, 0), trackSector(1, 1) };
+        auto far = d64::profileLoad(chain, fast);
+        EXPECT_EQ(far.trackChanges, 1);
+        EXPECT_DOUBLE_EQ(far.stepMs, (DIRECTORY_TRACK - 1) * fast.trackStepMs);
+        chain.emplace_back(1, 21);
+        EXPECT_THROW(d64::profileLoad(chain, fast), std::invalid_argument);
+
+        // a bad policy changes nothing and files added together share one
+        auto freeBefore = disk.getFreeSectorCount();
+        EXPECT_THROW(disk.addFile("BAD", d64FileTypes::PRG, data, allocationPolicy{ 0 }), std::invalid_argument);
+        EXPECT_EQ(disk.getFreeSectorCount(), freeBefore);
+        std::vector<fileSpec> files = { { "ONE", d64FileTypes::PRG, data }, { "TWO", d64FileTypes::PRG, data } };
+        ASSERT_TRUE(disk.addFiles(files, allocationPolicy{ 6 }));
+        EXPECT_EQ(interleaveOf(disk, "TWO"), 6);
+        ASSERT_TRUE(disk.addFile("AFTER", d64FileTypes::PRG, std::vector<uint8_t>(254 * 60, 0x42)));
+        EXPECT_EQ(interleaveOf(disk, "AFTER"), 10);
+    }
+
+    TEST(d64lib_unit_test, allocation_strategy_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        auto tracksOf = [](d64& disk, std::string_view name)
+            {
+                std::vector<int> tracks;
+                auto chain = disk.fileChain(name);
+                for (auto it = chain.begin(); it != chain.end(); ++it) {
+                    if (tracks.empty() || tracks.back() != it.location().track) {
+                        tracks.push_back(it.location().track);
+                    }
+                }
+                return tracks;
+            };
+        auto blocks = [](size_t count) { return std::vector<uint8_t>(count * 254, 0x5a); };
+
+        d64 disk;
+        EXPECT_EQ(disk.getAllocationPolicy().strategy, allocationStrategy::allocate_near_directory);
+        EXPECT_EQ(disk.getAllocationPolicy().interleave, 10);
+
+        // first fit leaves 5 free sectors on track 1, best fit then fills exactly those
+        allocationPolicy firstFit{ 10, allocationStrategy::allocate_first_fit };
+        ASSERT_TRUE(disk.addFile("FIRST", d64FileTypes::PRG, blocks(16), firstFit));
+        EXPECT_EQ(tracksOf(disk, "FIRST"), std::vector<int>({ 1 }));
+        disk.setAllocationPolicy(allocationPolicy{ 10, allocationStrategy::allocate_best_fit });
+        ASSERT_TRUE(disk.addFile("FIT", d64FileTypes::PRG, blocks(5)));
+        EXPECT_EQ(tracksOf(disk, "FIT"), std::vector<int>({ 1 }));
+
+        // a file that fits nowhere starts on the emptiest track and its rest goes where it fits best
+        ASSERT_TRUE(disk.addFile("LARGE", d64FileTypes::PRG, blocks(30)));
+        EXPECT_EQ(tracksOf(disk, "LARGE"), std::vector<int>({ 17, 18 }));
+
+        // the disk keeps its policy across a file added with another
+        ASSERT_TRUE(disk.addFile("NEAR", d64FileTypes::PRG, blocks(2), allocationPolicy()));
+        EXPECT_EQ(tracksOf(disk, "NEAR"), std::vector<int>({ 18 }));
+        EXPECT_EQ(disk.getAllocationPolicy().strategy, allocationStrategy::allocate_best_fit);
+
+        // banding keeps small files near the directory and big ones on the outer tracks
+        disk.setAllocationPolicy(allocationPolicy{ 10, allocationStrategy::allocate_banded, 10 });
+        ASSERT_TRUE(disk.addFile("SMALL", d64FileTypes::PRG, blocks(3)));
+        EXPECT_EQ(tracksOf(disk, "SMALL"), std::vector<int>({ 18 }));
+        ASSERT_TRUE(disk.addFile("BIG", d64FileTypes::PRG, blocks(20)));
+        EXPECT_EQ(tracksOf(disk, "BIG"), std::vector<int>({ 35, 34 }));
+        auto big = blocks(12), small = blocks(2);
+        std::vector<fileSpec> files = { { "BIG2", d64FileTypes::PRG, big }, { "SMALL2", d64FileTypes::PRG, small } };
+        ASSERT_TRUE(disk.addFiles(files));
+        EXPECT_EQ(tracksOf(disk, "BIG2").front(), 34);
+        EXPECT_EQ(tracksOf(disk, "SMALL2"), std::vector<int>({ 18 }));
+        EXPECT_TRUE(disk.verify().valid());
+
+        // the extended tracks first, only where there are some
+        allocationPolicy extended{ 10, allocationStrategy::allocate_extended_first };
+        d64 forty(diskType::forty_track);
+        ASSERT_TRUE(forty.addFile("EXT", d64FileTypes::PRG, blocks(20), extended));
+        EXPECT_EQ(tracksOf(forty, "EXT"), std::vector<int>({ 36, 37 }));
+        d64 thirtyFive;
+        ASSERT_TRUE(thirtyFive.addFile("EXT", d64FileTypes::PRG, blocks(2), extended));
+        EXPECT_EQ(tracksOf(thirtyFive, "EXT"), std::vector<int>({ 18 }));
+
+        EXPECT_THROW(disk.setAllocationPolicy(allocationPolicy{ 0 }), std::invalid_argument);
+        EXPECT_THROW(disk.setAllocationPolicy(allocationPolicy{ 10, static_cast<allocationStrategy>(9) }), std::invalid_argument);
+        EXPECT_EQ(disk.getAllocationPolicy().strategy, allocationStrategy::allocate_banded);
+    }
+
+    TEST(d64lib_unit_test, instrumentation_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<traceEvent> events;
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.setTraceHook([&](const traceEvent& event) { events.push_back(event); });
+        disk.resetStats();
+
+        std::vector<uint8_t> data(254 * 5, 0x11);
+        ASSERT_TRUE(disk.addFile("TRACED", d64FileTypes::PRG, data));
+        auto& stats = disk.getStats();
+#if D64_INSTRUMENTATION
+        EXPECT_EQ(stats[traceOperation::trace_add_file].calls, 1);
+        EXPECT_GE(stats.bamProbes, 5);
+        EXPECT_GE(stats.sectorsWritten, 5);
+        EXPECT_GT(stats.directoryEntriesScanned, 0);
+        ASSERT_EQ(events.size(), 1);
+        EXPECT_EQ(events[0].operation, traceOperation::trace_add_file);
+        EXPECT_FALSE(events[0].threw);
+        EXPECT_EQ(events[0].elapsed, stats[traceOperation::trace_add_file].elapsed);
+
+        // a chain walk reads every sector of the file once
+        auto before = stats.sectorsRead;
+        disk.readFile("TRACED");
+        EXPECT_GE(stats.sectorsRead - before, 5);
+        EXPECT_GE(stats.fileLookups, 1);
+        EXPECT_GT(stats.calcOffsetCalls, 0);
+
+        // an operation left by an exception is marked
+        EXPECT_THROW(disk.addFile("", d64FileTypes::PRG, data), std::runtime_error);
+        EXPECT_EQ(stats[traceOperation::trace_add_file].calls, 2);
+        EXPECT_EQ(stats[traceOperation::trace_add_file].exceptions, 1);
+        EXPECT_TRUE(events.back().threw);
+
+        // a hook that throws does not stop the disk
+        disk.verifyBAMIntegrity(false, "");
+        disk.compactDirectory();
+        disk.setTraceHook([](const traceEvent&) { throw std::runtime_error("hook"); });
+        EXPECT_NO_THROW(disk.compactDirectory());
+        EXPECT_EQ(stats[traceOperation::trace_verify_bam].calls, 1);
+        EXPECT_EQ(stats[traceOperation::trace_compact_directory].calls, 2);
+
+        // load and save are traced, and the free map keeps the allocator off full tracks
+        auto path = (std::filesystem::temp_directory_path() / "instrumentation_test.d64").string();
+        disk.setTraceHook(nullptr);
+        ASSERT_TRUE(disk.save(path));
+        ASSERT_TRUE(disk.load(path));
+        EXPECT_EQ(stats[traceOperation::trace_save].calls, 1);
+        EXPECT_EQ(stats[traceOperation::trace_load].calls, 1);
+        std::filesystem::remove(path);
+        for (auto sector = 0; sector < d64::SECTORS_PER_TRACK[0]; ++sector) {
+            disk.allocateSector(1, sector);
+        }
+        auto misses = stats.bamProbeMisses;
+        disk.setAllocationPolicy(allocationPolicy{ 10, allocationStrategy::allocate_first_fit });
+        ASSERT_TRUE(disk.addFile("MORE", d64FileTypes::PRG, data));
+        EXPECT_EQ(stats.bamProbeMisses, misses);
+
+        disk.resetStats();
+        EXPECT_EQ(stats.sectorsRead, 0);
+        EXPECT_EQ(stats[traceOperation::trace_add_file].calls, 0);
+#else
+        EXPECT_EQ(stats.sectorsRead, 0);
+        EXPECT_EQ(stats[traceOperation::trace_add_file].calls, 0);
+        EXPECT_TRUE(events.empty());
+#endif
+    }
+
+    TEST(d64lib_unit_test, shared_disk_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        // every byte of a file says which file it is
+        auto fileData = [](int file) { return std::vector<uint8_t>(254 * (1 + file % 7), static_cast<uint8_t>(file)); };
+
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto file = 0; file < 40; ++file) {
+            disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, fileData(file));
+        }
+        auto expected = disk.imageFingerprint();
+        sharedDisk shared(std::move(disk));
+
+        // readers race to build the name index and the fingerprint cache of the same disk
+        std::atomic<int> bad = 0;
+        std::vector<std::thread> readers;
+        for (auto t = 0; t < 8; ++t) {
+            readers.emplace_back([&, t]
+                {
+                    for (auto i = 0; i < 200; ++i) {
+                        auto file = (t * 7 + i) % 40;
+                        auto data = shared.readFile("FILE" + std::to_string(file));
+                        if (!data || *data != fileData(file)) ++bad;
+                        if (shared.read([](const d64& disk) { return disk.imageFingerprint(); }) != expected) ++bad;
+                    }
+                });
+        }
+        for (auto& reader : readers) reader.join();
+        EXPECT_EQ(bad, 0);
+
+        // a writer churns files while readers list and read, a reader only ever sees whole files
+        std::atomic<bool> done = false;
+        readers.clear();
+        for (auto t = 0; t < 4; ++t) {
+            readers.emplace_back([&]
+                {
+                    while (!done) {
+                        for (auto& entry : shared.directory()) {
+                            auto name = d64::Trim(entry.fileName);
+                            auto file = std::stoi(name.substr(4));
+                            try {
+                                auto data = shared.readFile(name);
+                                if (!data || *data != fileData(file)) ++bad;
+                            }
+                            catch (const std::runtime_error&) {
+                                // removed since the listing, that is fine
+                            }
+                        }
+                        if (!shared.readSector(DIRECTORY_TRACK, BAM_SECTOR)) ++bad;
+                    }
+                });
+        }
+        for (auto round = 0; round < 50; ++round) {
+            auto file = 40 + round;
+            EXPECT_TRUE(shared.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, fileData(file)));
+            EXPECT_TRUE(shared.removeFile("FILE" + std::to_string(round)));
+        }
+        done = true;
+        for (auto& reader : readers) reader.join();
+        EXPECT_EQ(bad, 0);
+
+        EXPECT_EQ(shared.directory().size(), 40);
+        EXPECT_EQ(shared.fileLength("FILE89"), fileData(89).size());
+        EXPECT_TRUE(shared.write([](d64& disk) { return disk.verify().valid(); }));
+    }
+
+    TEST(d64lib_unit_test, loader_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        std::vector<std::string> paths;
+        std::vector<uint64_t> fingerprints;
+        for (auto image = 0; image < 10; ++image) {
+            d64 disk(image % 2 ? diskType::forty_track : diskType::thirty_five_track);
+            disk.rename_disk("LOADER" + std::to_string(image));
+            for (auto file = 0; file <= image; ++file) {
+                disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, prog);
+            }
+            paths.push_back("loader_test_" + std::to_string(image) + ".d64");
+            disk.save(paths.back());
+            fingerprints.push_back(disk.imageFingerprint());
+        }
+
+        // a file of the wrong size, a directory that does not start at 18/1 and a missing file
+        {
+            std::ofstream(paths.emplace_back("loader_test_size.d64"), std::ios::binary) << "not a disk";
+            d64 disk;
+            disk.writeByte(DIRECTORY_TRACK, BAM_SECTOR, 0, 17);
+            paths.push_back("loader_test_bam.d64");
+            disk.save(paths.back());
+            paths.push_back("loader_test_missing.d64");
+        }
+
+        for (auto backend : { loadBackend::load_io_uring, loadBackend::load_thread_pool }) {
+            // fewer reads in flight than images
+            d64loader loader(3, backend, 2);
+            if (backend == loadBackend::load_thread_pool) {
+                EXPECT_EQ(loader.backend(), loadBackend::load_thread_pool);
+                EXPECT_EQ(loader.depth(), 2);
+            }
+
+            std::vector<int> seen(paths.size());
+            std::atomic<int> callers = 0;
+            auto overlapped = false;
+            loader.load(paths, [&](loadedImage& image)
+                {
+                    overlapped = overlapped || ++callers > 1;
+                    ++seen[image.index];
+                    EXPECT_EQ(image.path, paths[image.index]);
+                    if (image.index < 10) {
+                        EXPECT_TRUE(image.ok()) << image.error;
+                        EXPECT_TRUE(image.error.empty());
+                        EXPECT_EQ(image.disk->imageFingerprint(), fingerprints[image.index]);
+                        EXPECT_EQ(image.disk->diskname(), "LOADER" + std::to_string(image.index));
+                        EXPECT_EQ(image.disk->directory().size(), image.index + 1);
+                    }
+                    else {
+                        EXPECT_FALSE(image.ok());
+                        EXPECT_FALSE(image.error.empty());
+                    }
+                    --callers;
+                });
+            EXPECT_FALSE(overlapped);
+            EXPECT_EQ(seen, std::vector<int>(paths.size(), 1));
+
+            // images in the order of paths, a disk can be moved out and used
+            auto images = loader.load(paths);
+            ASSERT_EQ(images.size(), paths.size());
+            EXPECT_EQ(images[10].error, "Invalid disk size");
+            EXPECT_NE(images[11].error.find("directory"), std::string::npos);
+            EXPECT_FALSE(images[12].ok());
+            auto disk = std::move(*images[3].disk);
+            EXPECT_TRUE(disk.addFile("MORE", d64FileTypes::PRG, prog));
+            EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+        }
+    }
+
+    TEST(d64lib_unit_test, archive_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        // disks that share most of their sectors, one of them twice under another name
+        std::vector<uint8_t> prog(3000);
+        for (size_t i = 0; i < prog.size(); ++i) {
+            prog[i] = static_cast<uint8_t>(i * 7);
+        }
+        std::vector<d64> disks;
+        std::vector<std::string> names;
+        for (auto image = 0; image < 6; ++image) {
+            d64 disk(image == 5 ? diskType::forty_track : diskType::thirty_five_track);
+            disk.rename_disk("ARCHIVE" + std::to_string(image));
+            disk.addFile("SHARED", d64FileTypes::PRG, prog);
+            disk.addFile("OWN" + std::to_string(image), d64FileTypes::PRG, std::vector<uint8_t>(100, static_cast<uint8_t>(image)));
+            disks.push_back(disk);
+            names.push_back("image" + std::to_string(5 - image));
+        }
+        disks.push_back(disks[2]);
+        names.push_back("copy of image3");
+
+        size_t stored[2] = {};
+        for (auto layout : { archiveLayout::archive_concatenated, archiveLayout::archive_deduplicated }) {
+            auto filename = std::string("archive_test_") + std::to_string(layout) + ".d64a";
+            {
+                d64archiveWriter writer(filename, layout);
+                for (size_t image = 0; image < disks.size(); ++image) {
+                    if (image % 2 == 0) {
+                        writer.add(names[image], disks[image]);
+                    }
+                    else {
+                        // the output of save read back from a stream
+                        std::stringstream saved;
+                        EXPECT_TRUE(disks[image].save(saved));
+                        writer.add(names[image], saved);
+                    }
+                }
+                EXPECT_THROW(writer.add(names[0], disks[0]), std::invalid_argument);
+                std::stringstream bad("not a disk");
+                EXPECT_THROW(writer.add("bad", bad), std::invalid_argument);
+                EXPECT_EQ(writer.images(), disks.size());
+                EXPECT_TRUE(writer.finish());
+                stored[layout] = writer.storedSectors();
+            }
+
+            std::optional<d64> kept;
+            {
+                d64archive archive(filename);
+                EXPECT_EQ(archive.size(), disks.size());
+                EXPECT_EQ(archive.layout(), layout);
+                for (size_t image = 0; image < disks.size(); ++image) {
+                    EXPECT_EQ(archive.name(image), names[image]);
+                    EXPECT_EQ(archive.find(names[image]), image);
+                    EXPECT_EQ(archive.fingerprint(image), disks[image].imageFingerprint());
+
+                    auto disk = archive.disk(image);
+                    EXPECT_FALSE(disk.writable());
+                    EXPECT_EQ(disk.imageFingerprint(), disks[image].imageFingerprint());
+                    EXPECT_EQ(disk.diskname(), disks[image].diskname());
+                    EXPECT_EQ(disk.readFile("SHARED"), prog);
+                    EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+                }
+                EXPECT_FALSE(archive.find("image9").has_value());
+                EXPECT_EQ(archive.findFingerprint(disks[2].imageFingerprint()), 2);
+                EXPECT_FALSE(archive.findFingerprint(disks[0].imageFingerprint() + 1).has_value());
+                EXPECT_THROW(archive.disk(disks.size()), std::out_of_range);
+                EXPECT_THROW(archive.disk(0, mapMode::map_write_through), std::invalid_argument);
+
+                // a copy on write disk changes without touching the archive
+                auto changed = archive.open("image3", mapMode::map_copy_on_write);
+                ASSERT_TRUE(changed.has_value());
+                EXPECT_TRUE(changed->addFile("MORE", d64FileTypes::PRG, prog));
+                EXPECT_NE(changed->imageFingerprint(), disks[2].imageFingerprint());
+                EXPECT_EQ(archive.open("image3")->imageFingerprint(), disks[2].imageFingerprint());
+
+                // an image saved from the archive is the image that went in
+                std::stringstream saved, original;
+                archive.disk(5).save(saved);
+                disks[5].save(original);
+                EXPECT_EQ(saved.str(), original.str());
+
+                kept = archive.open("image0");
+            }
+            // the disk holds the mapping after the archive is gone
+            ASSERT_TRUE(kept.has_value());
+            EXPECT_EQ(kept->imageFingerprint(), disks[5].imageFingerprint());
+            EXPECT_EQ(kept->readFile("OWN5"), std::vector<uint8_t>(100, 5));
+        }
+
+        // every image whole against each different sector once
+        EXPECT_EQ(stored[archiveLayout::archive_concatenated], 0);
+        EXPECT_GT(stored[archiveLayout::archive_deduplicated], 0);
+        EXPECT_LT(std::filesystem::file_size("archive_test_1.d64a") * 4, std::filesystem::file_size("archive_test_0.d64a"));
+
+        // damaged or unfinished archives are refused
+        {
+            std::ifstream in("archive_test_1.d64a", std::ios::binary);
+            std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            std::ofstream(std::string("archive_test_cut.d64a"), std::ios::binary).write(bytes.data(), bytes.size() / 2);
+            EXPECT_THROW(d64archive("archive_test_cut.d64a"), std::runtime_error);
+            auto unfinished = std::make_unique<d64archiveWriter>("archive_test_open.d64a");
+            unfinished->add("image", disks[0]);
+            unfinished.reset();
+            EXPECT_THROW(d64archive("archive_test_open.d64a"), std::runtime_error);
+            EXPECT_THROW(d64archive("archive_test_missing.d64a"), std::runtime_error);
+        }
+    }
+
+    TEST(d64lib_unit_test, error_info_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        // an image with a byte for every sector after it, 5 for 18/1 and 1 (no error) for the rest
+        std::vector<uint8_t> prog(2000, 0x42);
+        d64 original;
+        original.addFile("PROG", d64FileTypes::PRG, prog);
+        std::stringstream image;
+        EXPECT_TRUE(original.save(image));
+        std::vector<uint8_t> codes(D64_DISK35_ERRORS_SZ - D64_DISK35_SZ, 1);
+        codes[original.calcOffset(18, 1) / SECTOR_SIZE] = 5;
+        auto bytes = image.str();
+        bytes.append(codes.begin(), codes.end());
+        std::ofstream(std::string("error_info_test.d64"), std::ios::binary).write(bytes.data(), bytes.size());
+        EXPECT_EQ(std::filesystem::file_size("error_info_test.d64"), D64_DISK35_ERRORS_SZ);
+
+        bool errorInfo = false;
+        auto format = diskFormat::fromFileSize(D64_DISK35_ERRORS_SZ, &errorInfo);
+        ASSERT_NE(format, nullptr);
+        EXPECT_EQ(format->type, diskType::thirty_five_track);
+        EXPECT_TRUE(errorInfo);
+        ASSERT_NE(diskFormat::fromFileSize(D71_DISK_SZ), nullptr);
+        EXPECT_FALSE(diskFormat::fromFileSize(D71_DISK_SZ)->type.has_value());
+        EXPECT_STREQ(diskFormat::fromFileSize(D81_DISK_SZ)->name, "d81");
+        EXPECT_EQ(diskFormat::fromFileSize(D64_DISK35_SZ + 1), nullptr);
+
+        auto check = [&](const d64& disk) {
+            EXPECT_TRUE(disk.hasErrorInfo());
+            EXPECT_EQ(disk.sectorError(18, 1), 5);
+            EXPECT_EQ(disk.sectorError(1, 0), 1);
+            EXPECT_TRUE(std::ranges::equal(disk.errorCodes(), codes));
+            EXPECT_EQ(disk.readFile("PROG"), prog);
+            EXPECT_EQ(disk.imageFingerprint(), original.imageFingerprint());
+        };
+
+        d64 disk;
+        ASSERT_TRUE(disk.load("error_info_test.d64"));
+        check(disk);
+        for (auto mode : { mapMode::map_read_only, mapMode::map_copy_on_write }) {
+            d64 mapped;
+            ASSERT_TRUE(mapped.load("error_info_test.d64", mode));
+            check(mapped);
+        }
+        EXPECT_FALSE(original.hasErrorInfo());
+        EXPECT_EQ(original.sectorError(18, 1), 1);
+
+        // saved back whole, then changed in place and through the journal
+        std::stringstream saved;
+        EXPECT_TRUE(disk.save(saved));
+        EXPECT_EQ(saved.str(), bytes);
+        EXPECT_TRUE(disk.save("error_info_test_copy.d64"));
+        EXPECT_EQ(std::filesystem::file_size("error_info_test_copy.d64"), D64_DISK35_ERRORS_SZ);
+        for (auto mode : { saveMode::save_in_place, saveMode::save_journaled }) {
+            EXPECT_TRUE(disk.addFile("MORE" + std::to_string(mode), d64FileTypes::PRG, prog));
+            EXPECT_TRUE(disk.saveIncremental("error_info_test_copy.d64", mode));
+            d64 reloaded;
+            ASSERT_TRUE(reloaded.load("error_info_test_copy.d64"));
+            EXPECT_TRUE(std::ranges::equal(reloaded.errorCodes(), codes));
+            EXPECT_EQ(reloaded.imageFingerprint(), disk.imageFingerprint());
+        }
+
+        // the loader and both archive layouts keep the codes
+        d64loader loader(4, loadBackend::load_thread_pool);
+        auto loaded = loader.load({ "error_info_test.d64" });
+        ASSERT_TRUE(loaded[0].ok());
+        check(*loaded[0].disk);
+        for (auto layout : { archiveLayout::archive_concatenated, archiveLayout::archive_deduplicated }) {
+            auto filename = std::string("error_info_test_") + std::to_string(layout) + ".d64a";
+            {
+                d64archiveWriter writer(filename, layout);
+                writer.add("errors", disk);
+                std::ifstream in("error_info_test.d64", std::ios::binary);
+                writer.add("file", in);
+                writer.add("plain", original);
+                EXPECT_TRUE(writer.finish());
+            }
+            d64archive archive(filename);
+            check(archive.disk(1));
+            EXPECT_TRUE(std::ranges::equal(archive.disk(0).errorCodes(), codes));
+            EXPECT_FALSE(archive.disk(2).hasErrorInfo());
+        }
+
+        // codes set by hand must cover every sector
+        EXPECT_THROW(original.setErrorInfo(std::span<const uint8_t>(codes).first(10)), std::invalid_argument);
+        original.setErrorInfo(codes);
+        EXPECT_EQ(original.sectorError(18, 1), 5);
+        original.setErrorInfo({});
+        EXPECT_FALSE(original.hasErrorInfo());
+
+        // d71 images are identified but not opened
+        std::ofstream(std::string("error_info_test_d71.d64"), std::ios::binary).write(std::string(D71_DISK_SZ, '\0').data(), D71_DISK_SZ);
+        d64 unsupported;
+        std::ostringstream log;
+        unsupported.setErrorLog(&log);
+        EXPECT_FALSE(unsupported.load("error_info_test_d71.d64"));
+        EXPECT_NE(log.str().find("Unsupported format, d71 images are not supported"), std::string::npos);
+        EXPECT_THROW(d64(static_cast<diskType>(2)), std::runtime_error);
+    }
+
+    TEST(d64lib_unit_test, extract_all_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog(3000);
+        for (size_t i = 0; i < prog.size(); ++i) {
+            prog[i] = static_cast<uint8_t>(i * 13);
+        }
+        d64 disk;
+        disk.addFile("BIG", d64FileTypes::PRG, prog);
+        disk.addFile("SMALL", d64FileTypes::SEQ, std::vector<uint8_t>(10, 0x55));
+        disk.addFile("ONE BLOCK", d64FileTypes::USR, std::vector<uint8_t>(254, 0x66));
+        // both names become A_B on the host
+        disk.addFile("A/B", d64FileTypes::PRG, std::vector<uint8_t>(300, 1));
+        disk.addFile("A:B", d64FileTypes::PRG, std::vector<uint8_t>(400, 2));
+
+        auto dir = std::filesystem::path("extract_all_test_out");
+        std::filesystem::remove_all(dir);
+        auto read = [](const std::filesystem::path& path)
+            {
+                std::ifstream in(path, std::ios::binary);
+                return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            };
+
+        extractOptions options;
+        options.threads = 4;
+        auto report = disk.extractAll(dir.string(), options);
+        EXPECT_TRUE(report.ok());
+        ASSERT_EQ(report.written.size(), 5);
+        EXPECT_TRUE(report.upToDate.empty());
+        EXPECT_EQ(report.written[0], (dir / "BIG.prg").string());
+        EXPECT_EQ(report.written[3], (dir / "A_B.prg").string());
+        EXPECT_EQ(report.written[4], (dir / "A_B~2.prg").string());
+        EXPECT_EQ(read(dir / "BIG.prg"), prog);
+        EXPECT_EQ(read(dir / "SMALL.seq"), std::vector<uint8_t>(10, 0x55));
+        EXPECT_EQ(read(dir / "ONE BLOCK.usr"), std::vector<uint8_t>(254, 0x66));
+        EXPECT_EQ(read(dir / "A_B~2.prg"), std::vector<uint8_t>(400, 2));
+
+        // a second run leaves everything alone, then only rewrites what changed on the host
+        auto stamp = std::filesystem::last_write_time(dir / "BIG.prg");
+        report = disk.extractAll(dir.string(), options);
+        EXPECT_TRUE(report.written.empty());
+        EXPECT_EQ(report.upToDate.size(), 5);
+        EXPECT_EQ(std::filesystem::last_write_time(dir / "BIG.prg"), stamp);
+
+        auto changed = prog;
+        changed[1000] ^= 0xff;
+        std::ofstream(dir / "BIG.prg", std::ios::binary).write(reinterpret_cast<const char*>(changed.data()), changed.size());
+        std::ofstream(dir / "SMALL.seq", std::ios::binary).write("short", 5);
+        report = disk.extractAll(dir.string());
+        EXPECT_EQ(report.written, std::vector<std::string>({ (dir / "BIG.prg").string(), (dir / "SMALL.seq").string() }));
+        EXPECT_EQ(report.upToDate.size(), 3);
+        EXPECT_EQ(read(dir / "BIG.prg"), prog);
+        EXPECT_EQ(read(dir / "SMALL.seq"), std::vector<uint8_t>(10, 0x55));
+
+        options.skipUpToDate = false;
+        EXPECT_EQ(disk.extractAll(dir.string(), options).written.size(), 5);
+
+        // a broken chain fails that file only
+        std::ostringstream log;
+        disk.setErrorLog(&log);
+        auto start = disk.findFile("SMALL").value()->start;
+        EXPECT_TRUE(disk.writeByte(start.track, start.sector, 0, 99));
+        report = disk.extractAll(dir.string(), options);
+        EXPECT_FALSE(report.ok());
+        EXPECT_EQ(report.failed, 1);
+        EXPECT_EQ(report.written.size(), 4);
+        EXPECT_NE(log.str().find("Error extracting file"), std::string::npos);
+
+        // a chain that loops fails that file too, however many workers meet it
+        auto loop = disk.fileChain("BIG").begin();
+        auto loopStart = loop.location();
+        auto loopEnd = (++loop).location();
+        EXPECT_TRUE(disk.writeByte(loopEnd.track, loopEnd.sector, 0, loopStart.track));
+        EXPECT_TRUE(disk.writeByte(loopEnd.track, loopEnd.sector, 1, loopStart.sector));
+        log.str("");
+        report = disk.extractAll(dir.string(), options);
+        EXPECT_EQ(report.failed, 2);
+        EXPECT_EQ(report.written.size(), 3);
+        EXPECT_EQ(std::filesystem::file_size(dir / "BIG.prg"), prog.size());
+        EXPECT_NE(log.str().find("Error extracting file: Sector chain loops"), std::string::npos);
+
+        // nowhere to write
+        report = disk.extractAll((dir / "BIG.prg" / "sub").string());
+        EXPECT_FALSE(report.ok());
+        EXPECT_TRUE(report.written.empty());
+
+        // a directory that loops gives each file once
+        std::filesystem::remove_all(dir);
+        d64 looped;
+        looped.addFile("ONE", d64FileTypes::PRG, std::vector<uint8_t>(10, 1));
+        looped.addFile("ONE", d64FileTypes::PRG, std::vector<uint8_t>(20, 2));
+        EXPECT_TRUE(looped.writeByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0, DIRECTORY_TRACK));
+        EXPECT_TRUE(looped.writeByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 1, DIRECTORY_SECTOR));
+        report = looped.extractAll(dir.string());
+        EXPECT_TRUE(report.ok());
+        EXPECT_EQ(report.written, std::vector<std::string>({ (dir / "ONE.prg").string(), (dir / "ONE~2.prg").string() }));
+        EXPECT_EQ(read(dir / "ONE~2.prg"), std::vector<uint8_t>(20, 2));
+        std::filesystem::remove_all(dir);
+    }
+
+    TEST(d64lib_unit_test, compact_directory_chain_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(300, 0x44);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto i = 0; i < 20; ++i) {
+            disk.addFile("FILE" + std::to_string(i), d64FileTypes::PRG, data);
+        }
+        trackSector second(disk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0).value(), disk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 1).value());
+        trackSector third(disk.readByte(second.track, second.sector, 0).value(), disk.readByte(second.track, second.sector, 1).value());
+
+        // filling the last slot of 18/1 leaves the link of the sector after it alone
+        ASSERT_NE(second, trackSector(DIRECTORY_TRACK, DIRECTORY_SECTOR + 1));
+        auto after = disk.readSector(DIRECTORY_TRACK, DIRECTORY_SECTOR + 1).value();
+        ASSERT_TRUE(after[0] != 0 || after[1] != 0);
+        EXPECT_TRUE(disk.removeFile("FILE0"));
+        EXPECT_TRUE(disk.compactDirectory());
+        EXPECT_EQ(disk.readSector(DIRECTORY_TRACK, DIRECTORY_SECTOR + 1).value(), after);
+        EXPECT_EQ(disk.directory().size(), 19);
+        EXPECT_EQ(d64::Trim(disk.directory()[7].fileName), "FILE8");
+        EXPECT_TRUE(disk.verify().valid());
+
+        // a directory linking back into itself ends where it loops
+        disk.writeByte(third.track, third.sector, 0, DIRECTORY_TRACK);
+        disk.writeByte(third.track, third.sector, 1, DIRECTORY_SECTOR);
+        EXPECT_TRUE(disk.compactDirectory());
+        EXPECT_EQ(disk.readByte(third.track, third.sector, 0), 0);
+        EXPECT_EQ(disk.directory().size(), 19);
+        EXPECT_TRUE(disk.verify().valid());
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, directory_slot_loop_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(300, 0x45);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto i = 0; i < 16; ++i) {
+            disk.addFile("FILE" + std::to_string(i), d64FileTypes::PRG, data);
+        }
+
+        // a full directory grows after its last sector
+        EXPECT_TRUE(disk.addFile("GROWN", d64FileTypes::PRG, data));
+        EXPECT_EQ(disk.directory().size(), 17);
+        EXPECT_TRUE(disk.verify().valid());
+        EXPECT_TRUE(disk.removeFile("GROWN"));
+        EXPECT_TRUE(disk.compactDirectory());
+
+        // a full directory linking back into itself has no last sector to grow from
+        trackSector second(disk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0).value(), disk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 1).value());
+        auto end = disk.readSector(second.track, second.sector).value();
+        disk.writeByte(second.track, second.sector, 0, DIRECTORY_TRACK);
+        disk.writeByte(second.track, second.sector, 1, DIRECTORY_SECTOR);
+        try {
+            disk.addFile("LOOPED", d64FileTypes::PRG, data);
+            FAIL() << "a looping directory took a file";
+        }
+        catch (const std::runtime_error& e) {
+            EXPECT_STREQ(e.what(), "Error: Directory chain loops");
+        }
+        disk.writeByte(second.track, second.sector, 0, end[0]);
+        disk.writeByte(second.track, second.sector, 1, end[1]);
+        EXPECT_EQ(disk.directory().size(), 16);
+        EXPECT_FALSE(disk.findFile("LOOPED").has_value());
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, add_file_disk_full_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        auto block = [](int sectors) { return std::vector<uint8_t>(sectors * 254, 0x46); };
+        // files also go on the directory track, which getFreeSectorCount leaves out
+        auto usable = [&] { return disk.getFreeSectorCount() + disk.readByte(DIRECTORY_TRACK, BAM_SECTOR, DIRECTORY_TRACK * 4).value(); };
+
+        // a full directory sector with ten sectors left
+        int fill = usable() - (FILES_PER_SECTOR - 1) - 10;
+        EXPECT_TRUE(disk.addFile("FILL", d64FileTypes::PRG, block(fill)));
+        for (auto i = 1; i < FILES_PER_SECTOR; ++i) {
+            EXPECT_TRUE(disk.addFile("FILE" + std::to_string(i), d64FileTypes::PRG, block(1)));
+        }
+        ASSERT_EQ(usable(), 10);
+
+        // ten data sectors and a new directory sector do not fit, and nothing is left allocated
+        EXPECT_THROW(disk.addFile("TOO BIG", d64FileTypes::PRG, block(10)), std::runtime_error);
+        EXPECT_EQ(usable(), 10);
+        EXPECT_FALSE(disk.findFile("TOO BIG").has_value());
+        EXPECT_TRUE(disk.verify().valid());
+
+        // nine do
+        EXPECT_TRUE(disk.addFile("EXACT", d64FileTypes::PRG, block(9)));
+        EXPECT_EQ(usable(), 0);
+        EXPECT_THROW(disk.addFile("ONE MORE", d64FileTypes::SEQ, block(1)), std::runtime_error);
+        EXPECT_TRUE(disk.verify().valid());
+        EXPECT_EQ(disk.readFile("EXACT").value(), block(9));
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, rel_side_list_bam_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> records(64 * 40);
+        for (size_t i = 0; i < records.size(); ++i) {
+            records[i] = static_cast<uint8_t>(i);
+        }
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        disk.addFile("FIRST", d64FileTypes::PRG, std::vector<uint8_t>(600, 0x48));
+        disk.addFile("RELFILE", d64FileTypes::REL, records, 64);
+        auto side = disk.findFile("RELFILE").value()->side;
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+
+        // the side sector lists a free sector in place of the first data sector
+        int track = DIRECTORY_TRACK + 12;
+        EXPECT_TRUE(disk.writeByte(side.track, side.sector, 16, track));
+        EXPECT_TRUE(disk.writeByte(side.track, side.sector, 17, 5));
+
+        // the data chain is what the file uses, fixing the BAM keeps it
+        disk.verifyBAMIntegrity(true, "");
+        auto bam = disk.verify();
+        EXPECT_TRUE(bam.mismatches.empty());
+        EXPECT_TRUE(bam.freeCounts.empty());
+        EXPECT_EQ(disk.readFile("RELFILE").value(), records);
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, extract_file_loop_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        d64 disk;
+        std::ostringstream log;
+        disk.setErrorLog(&log);
+        disk.addFile("LOOP", d64FileTypes::SEQ, std::vector<uint8_t>(2000, 0x49));
+
+        // a chain that loops is refused before anything is written
+        std::filesystem::remove("LOOP.seq");
+        auto loop = disk.fileChain("LOOP").begin();
+        auto loopStart = loop.location();
+        auto loopEnd = (++loop).location();
+        EXPECT_TRUE(disk.writeByte(loopEnd.track, loopEnd.sector, 0, loopStart.track));
+        EXPECT_TRUE(disk.writeByte(loopEnd.track, loopEnd.sector, 1, loopStart.sector));
+        EXPECT_FALSE(disk.extractFile("LOOP"));
+        EXPECT_NE(log.str().find("Error extracting file: Sector chain loops"), std::string::npos);
+        EXPECT_FALSE(std::filesystem::exists("LOOP.seq"));
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, add_files_directory_loop_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> data(300, 0x4a);
+        d64 disk;
+        disk.setErrorLog(nullptr);
+        for (auto i = 0; i < 2 * FILES_PER_SECTOR; ++i) {
+            disk.addFile("FILE" + std::to_string(i), d64FileTypes::PRG, data);
+        }
+        trackSector second(disk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 0).value(), disk.readByte(DIRECTORY_TRACK, DIRECTORY_SECTOR, 1).value());
+        disk.writeByte(second.track, second.sector, 0, DIRECTORY_TRACK);
+        disk.writeByte(second.track, second.sector, 1, DIRECTORY_SECTOR);
+
+        // a full directory that loops can not grow, and nothing is allocated first
+        auto free = disk.getFreeSectorCount();
+        std::vector<fileSpec> one = { { "ONE", c64FileType(d64FileTypes::PRG), data } };
+        EXPECT_THROW(disk.addFiles(one), std::runtime_error);
+        EXPECT_EQ(disk.getFreeSectorCount(), free);
+
+        // its free slots are each counted once and still used
+        EXPECT_TRUE(disk.removeFile("FILE3"));
+        std::vector<fileSpec> two = { { "ONE", c64FileType(d64FileTypes::PRG), data }, { "TWO", c64FileType(d64FileTypes::PRG), data } };
+        EXPECT_THROW(disk.addFiles(two), std::runtime_error);
+        EXPECT_FALSE(disk.findFile("TWO").has_value());
+        EXPECT_TRUE(disk.addFiles(one));
+        EXPECT_EQ(disk.readFile("ONE").value(), data);
+        EXPECT_EQ(disk.readByte(second.track, second.sector, 0), DIRECTORY_TRACK);
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, save_short_write_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        // every write to /dev/full fails with the disk full
+        if (!std::filesystem::exists("/dev/full")) {
+            GTEST_SKIP() << "no /dev/full";
+        }
+        d64 disk;
+        disk.addFile("FIRST", d64FileTypes::PRG, std::vector<uint8_t>(600, 0x4b));
+        auto unsaved = disk.unsavedSectors();
+        EXPECT_THROW(disk.save("/dev/full"), std::runtime_error);
+        EXPECT_EQ(disk.unsavedSectors(), unsaved);
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, file_chain_loop_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        d64 disk;
+        disk.addFile("LOOP", d64FileTypes::PRG, std::vector<uint8_t>(1000, 0x4c));
+        auto loop = disk.fileChain("LOOP").begin();
+        auto loopStart = loop.location();
+        auto loopEnd = (++loop).location();
+        EXPECT_TRUE(disk.writeByte(loopEnd.track, loopEnd.sector, 0, loopStart.track));
+        EXPECT_TRUE(disk.writeByte(loopEnd.track, loopEnd.sector, 1, loopStart.sector));
+
+        // the range comes round the loop until it has taken as many steps as the disk has sectors
+        size_t sectors = 0;
+        try {
+            for (auto bytes : disk.fileChain("LOOP")) {
+                EXPECT_EQ(bytes.size(), 254);
+                ++sectors;
+            }
+            FAIL() << "a looping chain ended";
+        }
+        catch (const std::runtime_error& e) {
+            EXPECT_STREQ(e.what(), "Sector chain loops");
+        }
+        EXPECT_EQ(sectors, D64_DISK35_SZ / SECTOR_SIZE);
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+    TEST(d64lib_unit_test, find_file_index_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        d64 disk;
+        for (auto file = 1; file <= 20; ++file) {
+            disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, prog);
+        }
+        EXPECT_TRUE(disk.findFile("FILE1").has_value());
+        EXPECT_TRUE(disk.findFile("FILE20").has_value());
+        EXPECT_FALSE(disk.findFile("FILE21").has_value());
+        EXPECT_FALSE(disk.findFile("FILE1234567890123").has_value());
+
+        // index follows removes and renames
+        EXPECT_TRUE(disk.removeFile("FILE3"));
+        EXPECT_FALSE(disk.findFile("FILE3").has_value());
+        EXPECT_TRUE(disk.renameFile("FILE4", "RENAMED"));
+        EXPECT_FALSE(disk.findFile("FILE4").has_value());
+        auto renamed = disk.findFile("RENAMED");
+        EXPECT_TRUE(renamed.has_value());
+
+        // a new file takes the slot of the removed one
+        disk.addFile("NEWFILE", d64FileTypes::SEQ, prog);
+        auto newfile = disk.findFile("NEWFILE");
+        EXPECT_TRUE(newfile.has_value());
+        if (newfile.has_value()) {
+            EXPECT_EQ(newfile.value()->file_type.type, d64FileTypes::SEQ);
+        }
+
+        // entries move when the directory is reordered
+        disk.removeFile("FILE1");
+        disk.compactDirectory();
+        disk.movefileFirst("FILE20");
+        disk.reorderDirectory([](const directoryEntry& a, const directoryEntry& b)
+            {
+                return d64::Trim(a.fileName) > d64::Trim(b.fileName);
+            });
+        for (auto& entry : disk.directory()) {
+            auto found = disk.findFile(d64::Trim(entry.fileName));
+            EXPECT_TRUE(found.has_value());
+            if (found.has_value()) {
+                EXPECT_TRUE(*found.value() == entry);
+            }
+        }
+
+        // a raw write into the directory is seen by the next lookup
+        auto dirSector = disk.readSector(DIRECTORY_TRACK, DIRECTORY_SECTOR).value();
+        dirSector[2 + 3] = 'X';
+        disk.writeSector(DIRECTORY_TRACK, DIRECTORY_SECTOR, dirSector);
+        auto first = disk.directory().front();
+        EXPECT_TRUE(disk.findFile(d64::Trim(first.fileName)).has_value());
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+
+    TEST(d64lib_unit_test, file_chain_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        const auto bigSize = 5000;
+        std::vector<uint8_t> big_file(bigSize);
+        for (auto i = 0; i < bigSize; ++i) {
+            big_file[i] = i % 251;
+        }
+
+        d64 disk;
+        disk.addFile("BIG", d64FileTypes::SEQ, big_file);
+        EXPECT_EQ(disk.fileLength("BIG"), bigSize);
+
+        // the chain views the image directly
+        std::vector<uint8_t> chained;
+        size_t sectors = 0;
+        for (auto bytes : disk.fileChain("BIG")) {
+            chained.insert(chained.end(), bytes.begin(), bytes.end());
+            ++sectors;
+        }
+        EXPECT_EQ(chained, big_file);
+        EXPECT_EQ(sectors, (bigSize + 253) / 254);
+
+        auto entry = disk.findFile("BIG");
+        EXPECT_TRUE(entry.has_value());
+        if (entry.has_value()) {
+            auto first = disk.fileChain(*entry.value()).begin();
+            EXPECT_TRUE(first.location() == entry.value()->start);
+        }
+
+        // read into a caller buffer
+        std::vector<uint8_t> buffer(bigSize);
+        auto read = disk.readFileInto("BIG", buffer);
+        EXPECT_TRUE(read.has_value());
+        EXPECT_EQ(read.value_or(0), bigSize);
+        EXPECT_EQ(buffer, big_file);
+
+        std::vector<uint8_t> small(bigSize - 1, 0xee);
+        EXPECT_FALSE(disk.readFileInto("BIG", small).has_value());
+        EXPECT_EQ(small, std::vector<uint8_t>(bigSize - 1, 0xee));
+        EXPECT_ANY_THROW(disk.readFileInto("MISSING", buffer));
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+
+    TEST(d64lib_unit_test, bam_mask_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        bamTrackEntry entry{};
+        entry.setMask(0x1FFFFF);
+        EXPECT_EQ(entry.bytes[0], 0xFF);
+        EXPECT_EQ(entry.bytes[1], 0xFF);
+        EXPECT_EQ(entry.bytes[2], 0x1F);
+        entry.reset(0);
+        entry.reset(9);
+        entry.reset(20);
+        EXPECT_FALSE(entry.test(0));
+        EXPECT_FALSE(entry.test(9));
+        EXPECT_FALSE(entry.test(20));
+        EXPECT_TRUE(entry.test(19));
+        EXPECT_EQ(entry.mask(), 0x1FFFFFu & ~((1u << 0) | (1u << 9) | (1u << 20)));
+        entry.set(9);
+        EXPECT_TRUE(entry.test(9));
+
+        // allocation starts on the directory track and steps by the interleave
+        d64 disk;
+        std::vector<trackSector> expected = { { 18, 11 }, { 18, 2 }, { 18, 12 }, { 18, 3 }, { 18, 13 } };
+        for (auto& ts : expected) {
+            int track, sector;
+            EXPECT_TRUE(disk.findAndAllocateFreeSector(track, sector));
+            EXPECT_EQ(track, ts.track);
+            EXPECT_EQ(sector, ts.sector);
+        }
+
+        // once the directory track is full allocation moves to the next track in the search order
+        while (disk.bamtrack(DIRECTORY_TRACK - 1)->free > 0) {
+            int track, sector;
+            EXPECT_TRUE(disk.findAndAllocateFreeSector(track, sector));
+            EXPECT_EQ(track, DIRECTORY_TRACK);
+        }
+        int track, sector;
+        EXPECT_TRUE(disk.findAndAllocateFreeSector(track, sector));
+        EXPECT_EQ(track, 17);
+
+        // a sector freed by a raw BAM write is found again
+        auto bam = disk.readSector(DIRECTORY_TRACK, BAM_SECTOR).value();
+        bam[4 + (DIRECTORY_TRACK - 1) * 4] = 1;
+        bam[4 + (DIRECTORY_TRACK - 1) * 4 + 1] |= 1 << 5;
+        disk.writeSector(DIRECTORY_TRACK, BAM_SECTOR, bam);
+        EXPECT_TRUE(disk.findAndAllocateFreeSector(track, sector));
+        EXPECT_EQ(track, DIRECTORY_TRACK);
+        EXPECT_EQ(sector, 5);
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+
+    TEST(d64lib_unit_test, add_files_test)
+    {
+        d64lib_unit_test_method_initialize();
+        constexpr int RECORD_SIZE = 32;
+
+        std::vector<std::vector<uint8_t>> contents;
+        std::vector<std::string> names;
+        for (auto file = 0; file < 40; ++file) {
+            contents.emplace_back(100 + file * 100, static_cast<uint8_t>(file));
+            names.push_back("BATCH" + std::to_string(file));
+        }
+        std::vector<uint8_t> rel(RECORD_SIZE * 100, 'R');
+
+        std::vector<fileSpec> specs;
+        for (size_t file = 0; file < names.size(); ++file) {
+            specs.push_back({ names[file], c64FileType(d64FileTypes::PRG), contents[file] });
+        }
+        specs.push_back({ "RELFILE", c64FileType(d64FileTypes::REL), rel, RECORD_SIZE });
+
+        d64 disk;
+        EXPECT_TRUE(disk.addFiles(specs));
+        EXPECT_EQ(disk.directory().size(), specs.size());
+        EXPECT_TRUE(disk.verifyBAMIntegrity(false, ""));
+        for (size_t file = 0; file < names.size(); ++file) {
+            auto readfile = disk.readFile(names[file]);
+            EXPECT_TRUE(readfile.has_value());
+            if (readfile.has_value()) {
+                EXPECT_EQ(readfile.value(), contents[file]);
+            }
+        }
+        auto readrel = disk.readFile("RELFILE");
+        EXPECT_TRUE(readrel.has_value());
+        if (readrel.has_value()) {
+            EXPECT_EQ(readrel.value(), rel);
+        }
+
+        // a batch that does not fit leaves the disk unchanged
+        auto free = disk.getFreeSectorCount();
+        std::vector<uint8_t> big(free * 254, 0xEE);
+        std::vector<fileSpec> tooBig = { { "SMALL", c64FileType(d64FileTypes::PRG), contents[0] },
+                                         { "BIG", c64FileType(d64FileTypes::SEQ), big } };
+        EXPECT_FALSE(disk.addFiles(tooBig));
+        EXPECT_EQ(disk.getFreeSectorCount(), free);
+        EXPECT_EQ(disk.directory().size(), specs.size());
+        EXPECT_FALSE(disk.findFile("SMALL").has_value());
+
+        d64lib_unit_test_method_cleanup(disk);
+    }
+
+
+    TEST(d64lib_unit_test, batch_test)
+    {
+        d64lib_unit_test_method_initialize();
+
+        std::vector<uint8_t> prog = { 0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        std::vector<std::string> paths;
+        for (auto image = 0; image < 12; ++image) {
+            d64 disk;
+            disk.rename_disk("BATCH" + std::to_string(image));
+            for (auto file = 0; file <= image; ++file) {
+                disk.addFile("FILE" + std::to_string(file), d64FileTypes::PRG, prog);
+            }
+            paths.push_back("batch_test_" + std::to_string(image) + ".d64");
+            disk.save(paths.back());
+        }
+
+        // a broken BAM and a missing image
+        {
+            d64 disk;
+            disk.addFile("FILE", d64FileTypes::PRG, prog);
+            disk.freeSector(disk.findFile("FILE").value()->start.track, disk.findFile("FILE").value()->start.sector);
+            paths.push_back("batch_test_bad.d64");
+            disk.save(paths.back());
+        }
+        paths.push_back("batch_test_missing.d64");
+
+        d64batch batch(4);
+        EXPECT_EQ(batch.threads(), 4);
+        auto results = batch.run(paths, batchJob::batch_directory | batchJob::batch_verify | batchJob::batch_extract, "batch_test_out");
+        EXPECT_EQ(results.size(), paths.size());
+
+        for (auto image = 0; image < 12; ++image) {
+            auto& result = results[image];
+            EXPECT_EQ(result.path, paths[image]);
+            EXPECT_TRUE(result.loaded);
+            EXPECT_TRUE(result.success);
+            EXPECT_TRUE(result.bamValid);
+            EXPECT_EQ(result.diskName, "BATCH" + std::to_string(image));
+            EXPECT_EQ(result.directory.size(), image + 1);
+            EXPECT_EQ(result.extracted.size(), image + 1);
+            EXPECT_TRUE(result.errors.empty());
+            for (auto& file : result.extracted) {
+                EXPECT_EQ(std::filesystem::file_size(file), prog.size());
+            }
+        }
+
+        auto& bad = results[12];
+        EXPECT_TRUE(bad.loaded);
+        EXPECT_FALSE(bad.success);
+        EXPECT_FALSE(bad.bamValid);
+        EXPECT_EQ(bad.report.mismatches.size(), 1);
+        EXPECT_FALSE(bad.errors.empty());
+
+        auto& missing = results[13];
+        EXPECT_FALSE(missing.loaded);
+        EXPECT_FALSE(missing.success);
+        EXPECT_FALSE(missing.errors.empty());
+
+        // the pool is reused for the next run
+        std::atomic<size_t> files = 0;
+        results = batch.run(paths, [&](d64& disk, batchResult&)
+            {
+                files += disk.directory().size();
+                return true;
+            });
+        EXPECT_EQ(files, 12 * 13 / 2 + 1);
+
+        std::filesystem::remove_all("batch_test_out");
+    }
+
+
     // Stub test functions for all public methods in the d64 class
 
     TEST(d64lib_unit_test, constructor_default_test)